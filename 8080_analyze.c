@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "8080_disasm.c"
+#include "8080_profile.c"
+#include "8080_emu.c"
+#include "8080_cfg.c"
+#include "8080_core.c"
+#include "8080_invaders.c"
+
+/* Data bytes per line of the listing */
+#define LISTING_DATA_BYTES (8)
+
+void usage(char *prog) {
+    fprintf(stderr,
+            "usage: %s [-R <rom dir>] [-f <binary>] [-b <block map>] "
+            "[-d <dot file>] [-l 1]\n",
+            prog);
+    exit(1);
+}
+
+/*
+ * print_listing: Prints the analyzed memory, code as disassembly with labels
+ *                for functions and blocks, and everything else as bytes.
+ *
+ * Arguments:
+ *   cfg    - analysis
+ *
+ * Returns:
+ *   None.
+ */
+void print_listing(cfg_t *cfg) {
+    char name[32];
+
+    for (uint32_t addr = 0; addr < cfg->size;) {
+        if (cfg->mark[addr] == CFG_CODE) {
+            if (cfg->flags[addr] & CFG_FUNCTION) {
+                cfg_function_name(name, sizeof(name), addr);
+                printf("\n%s:\n", name);
+            } else if (cfg->flags[addr] & CFG_LEADER) {
+                printf("  ; block %04x\n", addr);
+            }
+            disasm_info_t info;
+            const char *text = disasm_line(&cfg->mem[addr], addr, &info);
+            printf("%04x:      %s\n", addr, text);
+            addr += info.size;
+            continue;
+        }
+
+        /* Jump tables as words, other bytes that aren't code in runs */
+        for (int t = 0; t < cfg->num_jump_tables; t++) {
+            cfg_jump_table_t *table = &cfg->jump_tables[t];
+            if (table->base != addr) continue;
+            for (int i = 0; i < table->len; i++, addr += 2) {
+                if (i % (LISTING_DATA_BYTES / 2) == 0) {
+                    printf("%s%04x:      %-8s", i ? "\n" : "", addr, "dw");
+                } else {
+                    printf(", ");
+                }
+                printf("0x%04x", cfg->mem[addr] | cfg->mem[addr + 1] << 8);
+            }
+            printf("  ; jump table of %04x\n", table->pchl);
+        }
+        if (addr >= cfg->size || cfg->mark[addr] == CFG_CODE) continue;
+
+        uint8_t mark = cfg->mark[addr];
+        printf("%04x:      %-8s", addr, "db");
+        for (int i = 0; i < LISTING_DATA_BYTES && addr < cfg->size; i++) {
+            printf("%s0x%02x", i ? ", " : "", cfg->mem[addr++]);
+            if (addr >= cfg->size || cfg->mark[addr] != mark ||
+                (cfg->flags[addr] & CFG_JUMP_TABLE)) {
+                break;
+            }
+        }
+        printf("%s\n", (mark == CFG_DATA) ? "" : "  ; unreached");
+    }
+}
+
+int main(int argc, char **argv) {
+    char *rom_dir = "ROM";
+    char *binary = NULL;
+    char *map_file = NULL;
+    char *dot_file = NULL;
+    int listing = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-') usage(argv[0]);
+        char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+            case 'R':
+                rom_dir = arg;
+                break;
+            case 'f':
+                binary = arg;
+                break;
+            case 'b':
+                map_file = arg;
+                break;
+            case 'd':
+                dot_file = arg;
+                break;
+            case 'l':
+                listing = atoi(arg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    static uint8_t mem[MEM_SIZE];
+    int size = binary ? read_file_to_buf(binary, mem, 0, MEM_SIZE)
+                      : invaders_load_rom(rom_dir, mem);
+    if (size <= 0) {
+        if (binary) {
+            fprintf(stderr, "error: Couldn't read %s, or it is over %d bytes\n",
+                    binary, MEM_SIZE);
+        }
+        exit(1);
+    }
+
+    static cfg_t cfg;
+    if (cfg_analyze(&cfg, mem, size) < 0) {
+        fprintf(stderr, "error: Out of memory\n");
+        exit(1);
+    }
+
+    int counts[4] = {0};
+    int functions = 0;
+    for (int addr = 0; addr < size; addr++) counts[cfg.mark[addr]]++;
+    for (int b = 0; b < cfg.num_blocks; b++) {
+        functions += !!(cfg.blocks[b].flags & CFG_FUNCTION);
+    }
+    printf(
+        "%d bytes: %d code, %d operands, %d data, %d unreached\n"
+        "%d basic blocks, %d functions, %d jump tables\n"
+        "%d unresolved PCHL, %d conflicting paths\n",
+        size, counts[CFG_CODE], counts[CFG_OPERAND], counts[CFG_DATA],
+        counts[CFG_UNKNOWN], cfg.num_blocks, functions, cfg.num_jump_tables,
+        cfg.num_unresolved, cfg.num_conflicts);
+
+    if (map_file && cfg_write_block_map(&cfg, map_file) < 0) {
+        fprintf(stderr, "error: Couldn't write %s\n", map_file);
+    }
+    if (dot_file) {
+        FILE *fp = fopen(dot_file, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "error: Couldn't write %s\n", dot_file);
+        } else {
+            cfg_write_dot(&cfg, fp);
+            fclose(fp);
+        }
+    }
+    if (listing) print_listing(&cfg);
+
+    cfg_free(&cfg);
+    return 0;
+}
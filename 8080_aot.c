@@ -0,0 +1,319 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Runtime of the ahead-of-time recompiled ROM (see 8080_recomp.c). The
+ * generated code (8080_aot_rom.c) has one function per basic block, which
+ * keeps the registers and flags in locals and only computes the flags that
+ * are read before being overwritten within the block. Code that wasn't found
+ * by the static analysis, code in RAM and blocks that would run past the
+ * cycle budget are emulated by the interpreter, so the machine state always
+ * matches the table core.
+ *
+ * The pages of the ROM are flagged in emu_state_t.code_pages. A write to a
+ * recompiled byte ends the running block right after the writing
+ * instruction, and the machine is interpreted until its ROM hashes to the
+ * recompiled one again.
+ */
+
+/*
+ * aot_next_t: Block to run next, returned by a block function to aot_run so
+ *             that chained blocks don't grow the stack. A struct as a function
+ *             type can't return itself.
+ *
+ *   fn     - block function, NULL to go back to the dispatcher
+ */
+typedef struct aot_next {
+    struct aot_next (*fn)(emu_state_t *state, uint64_t until);
+} aot_next_t;
+
+typedef aot_next_t (*aot_block_fn_t)(emu_state_t *state, uint64_t until);
+
+/* Return value of a block going back to the dispatcher */
+#define AOT_DISPATCH ((aot_next_t){NULL})
+
+/*
+ * aot_entry_t: Recompiled block starting at an address.
+ *
+ *   fn     - block function
+ *   prefix - cycles of the block without its last instruction, the block
+ *            only runs when state->cycles + prefix < until so that it stops
+ *            exactly where the interpreter would
+ *   end    - address past the last instruction
+ */
+typedef struct {
+    aot_block_fn_t fn;
+    uint16_t prefix;
+    uint16_t end;
+} aot_entry_t;
+
+/* Parity flag of each value, as computed by parity() */
+uint8_t aot_parity[0x100];
+
+/* Machine whose memory was last checked against the recompiled ROM */
+uint8_t *aot_checked_mem;
+uint64_t aot_checked_cycles;
+int aot_rom_matches;
+int aot_rom_written;  // Recompiled code was written since the last check
+
+/* Locals of a block function */
+#define AOT_LOCALS                              \
+    uint8_t *mem = state->mem;                  \
+    uint8_t a, b, c, d, e, h, l;                \
+    uint16_t sp;                                \
+    uint8_t fz, fs, fp, fcy, fac;               \
+    uint64_t cycles = state->cycles;            \
+    uint64_t instructions = state->instructions
+
+#define AOT_LOAD()                             \
+    do {                                       \
+        a = state->a;                          \
+        b = state->b;                          \
+        c = state->c;                          \
+        d = state->d;                          \
+        e = state->e;                          \
+        h = state->h;                          \
+        l = state->l;                          \
+        sp = state->sp;                        \
+        fz = state->cf.z;                      \
+        fs = state->cf.s;                      \
+        fp = state->cf.p;                      \
+        fcy = state->cf.cy;                    \
+        fac = state->cf.ac;                    \
+        (void)mem;                             \
+    } while (0)
+
+#define AOT_STORE()                         \
+    do {                                    \
+        state->a = a;                       \
+        state->b = b;                       \
+        state->c = c;                       \
+        state->d = d;                       \
+        state->e = e;                       \
+        state->h = h;                       \
+        state->l = l;                       \
+        state->sp = sp;                     \
+        state->cf.z = fz;                   \
+        state->cf.s = fs;                   \
+        state->cf.p = fp;                   \
+        state->cf.cy = fcy;                 \
+        state->cf.ac = fac;                 \
+        state->cycles = cycles;             \
+        state->instructions = instructions; \
+    } while (0)
+
+/* Continues with the recompiled block at addr if it fits in the budget and
+ * the recompiled code wasn't written */
+#define AOT_CHAIN(addr, fn, prefix)                                   \
+    do {                                                              \
+        state->pc = (addr);                                           \
+        if (cycles + (prefix) < until && !state->code_written) {      \
+            return (aot_next_t){fn};                                  \
+        }                                                             \
+        return AOT_DISPATCH;                                          \
+    } while (0)
+
+/* Leaves the block, the dispatcher continues at addr */
+#define AOT_EXIT(addr)          \
+    do {                        \
+        state->pc = (addr);     \
+        return AOT_DISPATCH;    \
+    } while (0)
+
+/* Leaves the block at addr if the instruction before wrote to recompiled
+ * code, adding the cycles and instructions run since the last update */
+#define AOT_CHECK_CODE(addr, pending_cycles, pending_instructions) \
+    do {                                                           \
+        if (state->code_written) {                                 \
+            cycles += (pending_cycles);                            \
+            instructions += (pending_instructions);                \
+            AOT_STORE();                                           \
+            AOT_EXIT(addr);                                        \
+        }                                                          \
+    } while (0)
+
+/* Emulates one instruction with its interpreter handler */
+#define AOT_INTERPRET(addr)                                \
+    do {                                                   \
+        AOT_STORE();                                       \
+        state->pc = (addr);                                \
+        state->pc += (*emu_handlers[mem[addr]])(state);    \
+        cycles = state->cycles;                            \
+        instructions = state->instructions;                \
+        AOT_LOAD();                                        \
+    } while (0)
+
+/* Flag updates, matching the helpers of 8080_emu.c */
+#define AOT_ZSP(r, need)                              \
+    do {                                              \
+        if ((need)&OF_Z) fz = ((r) == 0);             \
+        if ((need)&OF_S) fs = (r) >> 7;               \
+        if ((need)&OF_P) fp = aot_parity[(r)];        \
+    } while (0)
+
+#define AOT_ADD(val, cin, need)                                   \
+    do {                                                          \
+        uint8_t v_ = (val);                                       \
+        uint16_t r_ = a + v_ + (cin);                             \
+        if ((need)&OF_CY) fcy = r_ >> 8;                          \
+        if ((need)&OF_AC) fac = ((a ^ v_ ^ r_) >> 4) & 1;         \
+        a = r_;                                                   \
+        AOT_ZSP(a, need);                                         \
+    } while (0)
+
+#define AOT_SUB(val, cin, need)                        \
+    do {                                               \
+        AOT_ADD((uint8_t)~(val), !(cin), need);        \
+        if ((need)&OF_CY) fcy = !fcy;                  \
+    } while (0)
+
+#define AOT_CMP(val, need)                                \
+    do {                                                  \
+        uint8_t v_ = (val);                               \
+        uint8_t r_ = a - v_;                              \
+        AOT_ZSP(r_, need);                                \
+        if ((need)&OF_CY) fcy = (a < v_);                 \
+        if ((need)&OF_AC) fac = 0;                        \
+    } while (0)
+
+#define AOT_LOGIC(expr, clear_ac, need)                   \
+    do {                                                  \
+        a = (expr);                                       \
+        AOT_ZSP(a, need);                                 \
+        if ((need)&OF_CY) fcy = 0;                        \
+        if ((clear_ac) && ((need)&OF_AC)) fac = 0;        \
+    } while (0)
+
+#define AOT_INR(lval, need)                               \
+    do {                                                  \
+        uint8_t r_ = ++(lval);                            \
+        AOT_ZSP(r_, need);                                \
+        if ((need)&OF_AC) fac = (r_ == 0x0);              \
+    } while (0)
+
+#define AOT_DCR(lval, need)                               \
+    do {                                                  \
+        uint8_t r_ = --(lval);                            \
+        AOT_ZSP(r_, need);                                \
+        if ((need)&OF_AC) fac = (r_ == 0xf);              \
+    } while (0)
+
+#define AOT_DAD(rp, need)                                 \
+    do {                                                  \
+        uint32_t r_ = ((h << 8) | l) + (uint32_t)(rp);    \
+        if ((need)&OF_CY) fcy = r_ >> 16;                 \
+        h = r_ >> 8;                                      \
+        l = r_ & 0xff;                                    \
+    } while (0)
+
+/* Memory is written with MEM_WRITE, which keeps the memory hash */
+#define AOT_PUSH(hi, lo)            \
+    do {                            \
+        MEM_WRITE(sp - 1, (hi));    \
+        MEM_WRITE(sp - 2, (lo));    \
+        sp -= 2;                    \
+    } while (0)
+
+#define AOT_POP(hi, lo)                  \
+    do {                                 \
+        (lo) = mem[sp];                  \
+        (hi) = mem[(uint16_t)(sp + 1)];  \
+        sp += 2;                         \
+    } while (0)
+
+#ifdef AOT
+#include "8080_aot_rom.c"
+
+/* Recompiled bytes of the ROM */
+uint8_t aot_code[AOT_ROM_SIZE];
+
+/*
+ * aot_check_rom: Checks that the memory of a machine holds the ROM that was
+ *                recompiled. The check is repeated when the memory changes,
+ *                a machine restarts (e.g. a new machine reusing freed memory)
+ *                or recompiled code was written.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *
+ * Returns:
+ *   1 if the recompiled blocks can be used, 0 otherwise.
+ */
+int aot_check_rom(emu_state_t *state) {
+    if (state->mem != aot_checked_mem || state->cycles < aot_checked_cycles ||
+        aot_rom_written) {
+        for (int i = 0; i < 0x100; i++) aot_parity[i] = parity(i);
+        for (uint32_t addr = 0; addr < AOT_ROM_SIZE; addr++) {
+            const aot_entry_t *entry = &aot_entries[addr];
+            if (entry->fn) memset(&aot_code[addr], 1, entry->end - addr);
+        }
+        aot_rom_matches =
+            cfg_hash(state->mem, AOT_ROM_SIZE) == AOT_ROM_HASH;
+        aot_rom_written = 0;
+        aot_checked_mem = state->mem;
+    }
+    aot_checked_cycles = state->cycles;
+    return aot_rom_matches;
+}
+
+/*
+ * aot_code_write: Stops using the recompiled blocks when one of their bytes
+ *                 is written, the emu_state_t.code_write function of the aot
+ *                 core.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   addr   - address written
+ *
+ * Returns:
+ *   None.
+ */
+void aot_code_write(emu_state_t *state, uint16_t addr) {
+    if (state->mem == aot_checked_mem && addr < AOT_ROM_SIZE &&
+        aot_code[addr]) {
+        aot_rom_matches = 0;
+        aot_rom_written = 1;
+        state->code_written = 1;
+    }
+}
+
+/*
+ * aot_run: Emulates instructions until the given cycle count is reached,
+ *          running recompiled blocks where possible.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   until  - value of state->cycles at which to stop
+ *
+ * Returns:
+ *   None.
+ */
+void aot_run(emu_state_t *state, uint64_t until) {
+    /* The profilers hook into the interpreter */
+    if (PROFILE_PER_INSTR || !aot_check_rom(state)) {
+        emu_run(state, until);
+        return;
+    }
+    memset(state->code_pages, 1, (AOT_ROM_SIZE - 1) / EMU_CODE_PAGE_SIZE + 1);
+    state->code_write = aot_code_write;
+
+    while (state->cycles < until) {
+        uint16_t pc = state->pc;
+        if (aot_rom_matches && pc < AOT_ROM_SIZE && aot_entries[pc].fn &&
+            !state->halted &&
+            state->cycles + aot_entries[pc].prefix < until) {
+            aot_next_t next = {aot_entries[pc].fn};
+            state->code_written = 0;
+            while (next.fn != NULL) {
+                next = next.fn(state, until);
+            }
+        } else if (state->halted && state->stopped) {
+            break;
+        } else {
+            emu_step(state);
+        }
+    }
+    aot_checked_cycles = state->cycles;
+}
+#endif
@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "8080_disasm.c"
+#include "8080_profile.c"
+#include "8080_emu.c"
+#include "8080_cfg.c"
+#include "8080_core.c"
+#include "8080_invaders.c"
+
+#define DEFAULT_REPS (5)
+#define DEFAULT_FRAMES (600)
+#define MAX_RECORDED_FRAMES (1000000)
+
+/*
+ * Synthetic workloads, small 8080 programs looping forever from address 0.
+ * They don't use interrupts or I/O, so they run on a bare machine.
+ */
+
+/* ALU heavy: arithmetic, logic, rotates and DAA on registers */
+uint8_t prog_alu[] = {
+    0x31, 0x00, 0x24,  // 0000: LXI  SP, 0x2400
+    0x3e, 0x01,        // 0003: MVI  A, 0x01
+    0x06, 0x03,        // 0005: MVI  B, 0x03
+    0x0e, 0x05,        // 0007: MVI  C, 0x05
+    0x80,              // 0009: ADD  B
+    0x89,              // 000a: ADC  C
+    0x90,              // 000b: SUB  B
+    0x99,              // 000c: SBB  C
+    0xa1,              // 000d: ANA  C
+    0xa8,              // 000e: XRA  B
+    0xb1,              // 000f: ORA  C
+    0xb8,              // 0010: CMP  B
+    0x27,              // 0011: DAA
+    0x07,              // 0012: RLC
+    0x1f,              // 0013: RAR
+    0x2f,              // 0014: CMA
+    0x04,              // 0015: INR  B
+    0x0d,              // 0016: DCR  C
+    0xc6, 0x11,        // 0017: ADI  0x11
+    0xfe, 0x42,        // 0019: CPI  0x42
+    0xc3, 0x09, 0x00,  // 001b: JMP  0x0009
+};
+
+/* Memory heavy: copies a 256 byte block back and forth */
+uint8_t prog_memory[] = {
+    0x31, 0x00, 0x24,  // 0000: LXI  SP, 0x2400
+    0x21, 0x00, 0x20,  // 0003: LXI  H, 0x2000
+    0x11, 0x00, 0x30,  // 0006: LXI  D, 0x3000
+    0x06, 0x00,        // 0009: MVI  B, 0x00
+    0x7e,              // 000b: MOV  A, M
+    0x12,              // 000c: STAX D
+    0x23,              // 000d: INX  H
+    0x13,              // 000e: INX  D
+    0x34,              // 000f: INR  M
+    0x1a,              // 0010: LDAX D
+    0x77,              // 0011: MOV  M, A
+    0x05,              // 0012: DCR  B
+    0xc2, 0x0b, 0x00,  // 0013: JNZ  0x000b
+    0x2a, 0x00, 0x20,  // 0016: LHLD 0x2000
+    0x22, 0x02, 0x20,  // 0019: SHLD 0x2002
+    0xc3, 0x03, 0x00,  // 001c: JMP  0x0003
+};
+
+/* Branch heavy: conditional jumps, calls and returns */
+uint8_t prog_branch[] = {
+    0x31, 0x00, 0x24,  // 0000: LXI  SP, 0x2400
+    0x0e, 0x00,        // 0003: MVI  C, 0x00
+    0x0c,              // 0005: INR  C
+    0x79,              // 0006: MOV  A, C
+    0xe6, 0x01,        // 0007: ANI  0x01
+    0xca, 0x12, 0x00,  // 0009: JZ   0x0012
+    0xcd, 0x20, 0x00,  // 000c: CALL 0x0020
+    0xc3, 0x05, 0x00,  // 000f: JMP  0x0005
+    0xd4, 0x20, 0x00,  // 0012: CNC  0x0020
+    0xf5,              // 0015: PUSH PSW
+    0xf1,              // 0016: POP  PSW
+    0xc3, 0x05, 0x00,  // 0017: JMP  0x0005
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x79,              // 0020: MOV  A, C
+    0xfe, 0x80,        // 0021: CPI  0x80
+    0xd8,              // 0023: RC
+    0xc8,              // 0024: RZ
+    0xc9,              // 0025: RET
+};
+
+/*
+ * Default gameplay input script, as (frame, port 1 bits) pairs: insert a coin,
+ * start a 1P game, then move left and right while shooting.
+ */
+int gameplay_script[][2] = {
+    {60, 0x01},   {64, 0x00},   {120, 0x04},  {124, 0x00},  {240, 0x30},
+    {300, 0x50},  {360, 0x30},  {420, 0x50},  {480, 0x10},  {540, 0x00},
+};
+
+typedef struct {
+    const char *name;
+    int needs_rom;  // Runs the Space Invaders ROM rather than a program
+    int inputs;     // Feeds recorded inputs to the ROM
+    uint8_t *prog;
+    size_t prog_size;
+} workload_t;
+
+workload_t workloads[] = {
+    {"boot", 1, 0, NULL, 0},
+    {"gameplay", 1, 1, NULL, 0},
+    {"alu", 0, 0, prog_alu, sizeof(prog_alu)},
+    {"memory", 0, 0, prog_memory, sizeof(prog_memory)},
+    {"branch", 0, 0, prog_branch, sizeof(prog_branch)},
+};
+
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+/* Recorded inputs, 2 bytes per frame (port 1 bits, port 2 bits) */
+uint8_t *recorded_inputs;
+long recorded_frames;
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * percentile: Nearest-rank percentile of sorted samples.
+ *
+ * Arguments:
+ *   sorted - samples in ascending order
+ *   n      - number of samples
+ *   p      - percentile, between 0 and 100
+ *
+ * Returns:
+ *   value of the percentile.
+ */
+double percentile(double *sorted, size_t n, double p) {
+    size_t rank = (size_t)(p / 100.0 * n + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+    return sorted[rank - 1];
+}
+
+void print_stats(FILE *out, const char *name, double *samples, size_t n) {
+    qsort(samples, n, sizeof(double), cmp_double);
+    fprintf(out,
+            "\"%s\": {\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, "
+            "\"p99\": %.1f, \"max\": %.1f}",
+            name, samples[0], percentile(samples, n, 50),
+            percentile(samples, n, 90), percentile(samples, n, 99),
+            samples[n - 1]);
+}
+
+/*
+ * set_inputs: Applies the inputs of the given frame for the gameplay workload.
+ *
+ * Arguments:
+ *   m      - machine to update
+ *   frame  - frame about to be emulated
+ *
+ * Returns:
+ *   None.
+ */
+void set_inputs(invaders_t *m, long frame) {
+    if (recorded_inputs) {
+        long f = frame % recorded_frames;
+        m->port1_inputs = recorded_inputs[2 * f];
+        m->port2_inputs = recorded_inputs[2 * f + 1];
+        return;
+    }
+
+    int n = sizeof(gameplay_script) / sizeof(gameplay_script[0]);
+    for (int i = 0; i < n; i++) {
+        if (gameplay_script[i][0] == frame % 600) {
+            m->port1_inputs = gameplay_script[i][1];
+        }
+    }
+}
+
+/*
+ * print_tier_stats: Writes the statistics of the tiered core, summed over the
+ *                   repetitions, as a JSON field.
+ *
+ * Arguments:
+ *   out    - stream to write to
+ *
+ * Returns:
+ *   None.
+ */
+void print_tier_stats(FILE *out) {
+    fprintf(out,
+            "\"tiers\": {\"invalidations\": %llu, \"loaded\": %llu, "
+            "\"mapped\": %llu, \"flushes\": %llu, \"failures\": %llu",
+            (unsigned long long)tier_stats.invalidations,
+            (unsigned long long)tier_stats.loaded,
+            (unsigned long long)tier_stats.mapped,
+            (unsigned long long)tier_stats.flushes,
+            (unsigned long long)tier_stats.failures);
+    for (int t = 0; t < TIER_COUNT; t++) {
+        fprintf(out,
+                ", \"%s\": {\"promotions\": %llu, \"instructions\": %llu, "
+                "\"switches\": %llu}",
+                tier_names[t], (unsigned long long)tier_stats.promotions[t],
+                (unsigned long long)tier_stats.instructions[t],
+                (unsigned long long)tier_stats.switches[t]);
+    }
+    fprintf(out, "}");
+}
+
+/*
+ * bench: Runs a workload on a core and reports the results as a JSON object.
+ *
+ * Arguments:
+ *   out    - stream to write the JSON object to
+ *   w      - workload to run
+ *   core   - execution core to run it on
+ *   rom    - Space Invaders ROM, or NULL if not available
+ *   reps   - number of repetitions
+ *   frames - frames emulated per repetition
+ *
+ * Returns:
+ *   None.
+ */
+void bench(FILE *out, workload_t *w, emu_core_t *core, uint8_t *rom, int reps,
+           int frames) {
+    fprintf(out, "    {\"workload\": \"%s\", \"core\": \"%s\"", w->name,
+            core->name);
+    if (core->run == block_run) {
+        fprintf(out, ", \"patterns\": \"");
+        for (unsigned int p = 0, n = 0; p < BLOCK_NUM_PATTERNS; p++) {
+            if (!(block_patterns & (1 << p))) continue;
+            fprintf(out, "%s%s", n++ ? "," : "", block_pattern_names[p]);
+        }
+        fprintf(out, "\", \"dead_flags\": %d", block_dead_flags);
+    }
+    if (w->needs_rom && rom == NULL) {
+        fprintf(out, ", \"skipped\": \"ROM not found\"}");
+        return;
+    }
+    memset(&tier_stats, 0, sizeof(tier_stats));
+
+    double *ips = malloc(reps * sizeof(double));
+    double *cps = malloc(reps * sizeof(double));
+    double *frame_ns = malloc((size_t)reps * frames * sizeof(double));
+    uint64_t instructions = 0, cycles = 0, code_writes = emu_code_writes;
+    uint64_t fingerprint = 0;
+    uint8_t image[ROM_SIZE] = {0};
+
+    if (!w->needs_rom) memcpy(image, w->prog, w->prog_size);
+
+    for (int r = 0; r < reps; r++) {
+        invaders_t m;
+        invaders_init(&m, w->needs_rom ? rom : image);
+        if (!w->needs_rom) m.cpu.interrupts_enabled = 0;
+
+        /* The fingerprints of the frames are folded into one, the same for
+         * every core and repetition */
+        fingerprint = 0;
+        uint64_t start = now_ns();
+        for (int f = 0; f < frames; f++) {
+            uint64_t t = now_ns();
+            if (w->inputs) set_inputs(&m, f);
+            invaders_run_frame(&m, core);
+            fingerprint = emu_hash_mix(fingerprint ^ emu_fingerprint(&m.cpu));
+            frame_ns[(size_t)r * frames + f] = now_ns() - t;
+        }
+        double secs = (now_ns() - start) / 1e9;
+
+        ips[r] = m.cpu.instructions / secs;
+        cps[r] = m.cpu.cycles / secs;
+        instructions = m.cpu.instructions;
+        cycles = m.cpu.cycles;
+        if (core->run == tier_run && tcache_file != NULL && r == reps - 1 &&
+            tcache_save(tcache_file, m.cpu.mem) < 0) {
+            fprintf(stderr, "warning: Couldn't write %s\n", tcache_file);
+        }
+        invaders_free(&m);
+    }
+
+    fprintf(out,
+            ", \"reps\": %d, \"frames\": %d, \"instructions\": %llu, "
+            "\"cycles\": %llu, \"fingerprint\": \"%016llx\",\n     ",
+            reps, frames, (unsigned long long)instructions,
+            (unsigned long long)cycles, (unsigned long long)fingerprint);
+    print_stats(out, "instructions_per_sec", ips, reps);
+    fprintf(out, ",\n     ");
+    print_stats(out, "cycles_per_sec", cps, reps);
+    fprintf(out, ",\n     ");
+    print_stats(out, "ns_per_frame", frame_ns, (size_t)reps * frames);
+    code_writes = emu_code_writes - code_writes;
+    if (core->run == block_run || core->run == tier_run) {
+        fprintf(out, ",\n     \"code_writes\": %llu",
+                (unsigned long long)code_writes);
+        if (code_writes > 0) emu_print_code_log(stderr);
+    }
+    if (core->run == tier_run) {
+        fprintf(out, ",\n     ");
+        print_tier_stats(out);
+    }
+    fprintf(out, "}");
+
+    free(ips);
+    free(cps);
+    free(frame_ns);
+}
+
+void usage(char *prog) {
+    fprintf(stderr,
+            "usage: %s [-r <reps>] [-f <frames>] [-w <workload>,...] "
+            "[-c <core>,...] [-p <pattern>,...] [-d <0|1>] [-T <cache file>] "
+            "[-b <block map>] [-R <rom dir>] [-i <inputs>] [-o <file>]\n"
+            "  workloads: boot, gameplay, alu, memory, branch\n"
+            "  cores:    ",
+            prog);
+    for (unsigned int i = 0; i < EMU_NUM_CORES; i++) {
+        fprintf(stderr, " %s", emu_cores[i].name);
+    }
+    fprintf(stderr, "\n  patterns:  none");
+    for (unsigned int i = 0; i < BLOCK_NUM_PATTERNS; i++) {
+        fprintf(stderr, " %s", block_pattern_names[i]);
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/*
+ * in_list: Checks if a name appears in a comma separated list.
+ *
+ * Arguments:
+ *   list   - comma separated list, NULL matches every name
+ *   name   - name to look for
+ *
+ * Returns:
+ *   1 if the name is in the list, 0 otherwise.
+ */
+int in_list(const char *list, const char *name) {
+    if (list == NULL) return 1;
+
+    size_t len = strlen(name);
+    for (const char *p = list; p; p = strchr(p, ',')) {
+        if (*p == ',') p++;
+        if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int reps = DEFAULT_REPS;
+    int frames = DEFAULT_FRAMES;
+    char *workload_list = NULL;
+    char *core_list = NULL;
+    char *rom_dir = "ROM";
+    char *inputs_file = NULL;
+    char *block_map_file = NULL;
+    FILE *out = stdout;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-') usage(argv[0]);
+        char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+            case 'r':
+                reps = atoi(arg);
+                break;
+            case 'f':
+                frames = atoi(arg);
+                break;
+            case 'w':
+                workload_list = arg;
+                break;
+            case 'c':
+                core_list = arg;
+                break;
+            case 'p':
+                block_patterns = 0;
+                for (unsigned int p = 0; p < BLOCK_NUM_PATTERNS; p++) {
+                    if (in_list(arg, block_pattern_names[p])) {
+                        block_patterns |= 1 << p;
+                    }
+                }
+                break;
+            case 'd':
+                block_dead_flags = atoi(arg);
+                break;
+            case 'T':
+                tcache_file = arg;
+                break;
+            case 'b':
+                block_map_file = arg;
+                break;
+            case 'R':
+                rom_dir = arg;
+                break;
+            case 'i':
+                inputs_file = arg;
+                break;
+            case 'o':
+                out = fopen(arg, "w");
+                if (out == NULL) {
+                    fprintf(stderr, "error: Couldn't open %s\n", arg);
+                    exit(1);
+                }
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (reps < 1 || frames < 1) usage(argv[0]);
+
+    uint8_t rom_buf[ROM_SIZE] = {0};
+    int rom_size = invaders_load_rom(rom_dir, rom_buf);
+    uint8_t *rom = (rom_size < 0) ? NULL : rom_buf;
+    if (block_map_file &&
+        (rom == NULL || block_load_map(block_map_file, rom, rom_size) < 0)) {
+        fprintf(stderr, "error: Couldn't load %s for this ROM\n",
+                block_map_file);
+        exit(1);
+    }
+
+    if (inputs_file) {
+        static uint8_t inputs[2 * MAX_RECORDED_FRAMES];
+        FILE *fp = fopen(inputs_file, "rb");
+        size_t rc = fp ? fread(inputs, 1, sizeof(inputs), fp) : 0;
+        if (fp) fclose(fp);
+        if (rc < 2) {
+            fprintf(stderr, "error: Couldn't read inputs from %s\n",
+                    inputs_file);
+            exit(1);
+        }
+        recorded_inputs = inputs;
+        recorded_frames = rc / 2;
+    }
+
+    fprintf(out, "{\n  \"results\": [\n");
+    int first = 1;
+    for (unsigned int w = 0; w < NUM_WORKLOADS; w++) {
+        if (!in_list(workload_list, workloads[w].name)) continue;
+        for (unsigned int c = 0; c < EMU_NUM_CORES; c++) {
+            if (!in_list(core_list, emu_cores[c].name)) continue;
+            if (!first) fprintf(out, ",\n");
+            first = 0;
+            fprintf(stderr, "bench: %s on %s core\n", workloads[w].name,
+                    emu_cores[c].name);
+            bench(out, &workloads[w], &emu_cores[c], rom, reps, frames);
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout) fclose(out);
+    return 0;
+}
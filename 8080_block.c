@@ -0,0 +1,845 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Block cache execution core. Straight-line runs of code are decoded
+ * once into blocks of handler pointers, so executing them skips fetching and
+ * looking up each opcode. Frequent instruction pairs and triples are fused
+ * into superinstructions, which run as a single handler. Arithmetic and
+ * logic instructions whose flags are overwritten later in the block without
+ * being read run a variant that skips computing them. A block whose
+ * cycles fit in the budget accounts for its cycles at once and runs its
+ * handlers back to back; otherwise its instructions run one at a time, so
+ * execution stops at the same instruction as with the table core.
+ *
+ * The pages holding cached blocks are flagged in emu_state_t.code_pages, so a
+ * write to code (self-modifying code, or code loaded into RAM) invalidates
+ * the blocks holding the written byte, and ends the block being run right
+ * after the writing instruction, even in the middle of a superinstruction.
+ * The blocks holding each byte are counted, so writes to data sharing a page
+ * with code cost a single lookup.
+ *
+ * With a block map loaded (block_load_map), the ROM's basic blocks are
+ * decoded up front each time the cache is flushed.
+ */
+
+/* End of the code that is cached */
+#define BLOCK_CODE_END (0x10000)
+
+/* Instructions per block */
+#define BLOCK_MAX_OPS (32)
+
+/* Bytes of the longest block */
+#define BLOCK_MAX_BYTES (BLOCK_MAX_OPS * 3)
+
+/* Classes of the instructions that end a block */
+#define BLOCK_END_CLASSES (OC_JUMP | OC_CALL | OC_RET | OC_CONTROL | OC_UNDEF)
+
+/* Fused patterns, as bits of block_patterns */
+#define BLOCK_FUSE_DCR_JNZ (1 << 0)   // DCR r; JNZ a
+#define BLOCK_FUSE_MOV_INX (1 << 1)   // MOV r, M or MOV M, r; INX H
+#define BLOCK_FUSE_LDAX_MOV (1 << 2)  // LDAX D; MOV M, A; INX H or INX D
+#define BLOCK_FUSE_ALL (0x7)
+
+typedef int (*block_handler_t)(emu_state_t *state);
+
+/*
+ * block_t: Decoded block.
+ *
+ *   start, end   - addresses of the first byte and past the last byte
+ *   addrs        - address of each instruction
+ *   handlers     - handler of each instruction
+ *   fast         - handlers with the fused groups replaced by their
+ *                  superinstruction, and flag-free variants where the
+ *                  flags are dead
+ *   fast_ops     - number of instructions run by each fast handler
+ *   dead_flags   - OF_* flags written by each instruction that are
+ *                  overwritten before being read
+ *   rest_cycles  - cycles of the instructions after each fast handler
+ *   rest_ops     - instructions after each fast handler
+ *   retired      - next block to free, once invalidated
+ *   num_ops      - number of instructions
+ *   num_fast     - number of fast handlers
+ *   cycles       - cycles of the block, without taken branch extras
+ *   prefix       - cycles of the block without its last instruction
+ */
+typedef struct block_s {
+    uint16_t start;
+    uint32_t end;  // Up to BLOCK_CODE_END
+    uint16_t addrs[BLOCK_MAX_OPS];
+    block_handler_t handlers[BLOCK_MAX_OPS];
+    block_handler_t fast[BLOCK_MAX_OPS];
+    uint8_t fast_ops[BLOCK_MAX_OPS];
+    uint8_t op_cycles[BLOCK_MAX_OPS];
+    uint8_t dead_flags[BLOCK_MAX_OPS];
+    uint16_t rest_cycles[BLOCK_MAX_OPS];
+    uint8_t rest_ops[BLOCK_MAX_OPS];
+    struct block_s *retired;
+    int num_ops;
+    int num_fast;
+    int cycles;
+    int prefix;
+} block_t;
+
+/* Names of the fused patterns, in bit order */
+const char *block_pattern_names[] = {"dcr_jnz", "mov_inx", "ldax_mov"};
+
+#define BLOCK_NUM_PATTERNS \
+    (sizeof(block_pattern_names) / sizeof(block_pattern_names[0]))
+
+/* Fused patterns in use */
+unsigned int block_patterns = BLOCK_FUSE_ALL;
+
+/* Whether flag-free variants are used for instructions with dead flags */
+int block_dead_flags = 1;
+
+/* Blocks by start address, and the machine and patterns they were built for */
+block_t *block_cache[BLOCK_CODE_END];
+block_t *block_retired;  // Invalidated blocks, freed by block_reclaim
+
+/* Cached blocks holding each byte and each page of memory (at most
+ * BLOCK_MAX_BYTES per byte) */
+uint8_t block_code_bytes[BLOCK_CODE_END];
+uint32_t block_code_pages[EMU_CODE_PAGES];
+uint8_t *block_cache_mem;
+uint64_t block_cache_cycles;
+unsigned int block_cache_patterns;
+int block_cache_dead_flags;
+
+/* Block map (see cfg_load_block_map) decoded into the cache whenever it is
+ * flushed, if the memory holds the ROM it was made for */
+cfg_block_t *block_map;
+int block_map_blocks;
+uint32_t block_map_size;
+uint32_t block_map_hash;
+
+/* --- Superinstructions --- */
+
+/* Runs a handler of a superinstruction. If the instruction is a store that
+ * wrote to code, the instructions after it are stale: the superinstruction
+ * stops, and takes back the cycles and instructions of the skipped ones, as
+ * block_stop does for the rest of the block. */
+#define BLOCK_FUSE_STEP(handler, op, skipped_cycles, skipped_ops)   \
+    do {                                                           \
+        state->pc += handler(state);                               \
+        if ((opcode_info[op].op_class & OC_STORE) &&               \
+            state->code_written) {                                 \
+            state->cycles -= (skipped_cycles);                     \
+            state->instructions -= (skipped_ops);                  \
+            return 0;                                              \
+        }                                                          \
+    } while (0)
+
+/* Runs two or three instructions in a row, given by their emulator handler
+ * and opcode, the result is the new PC */
+#define BLOCK_FUSE2(name, first, op1, second, op2)                \
+    int block_##name(emu_state_t *state) {                       \
+        BLOCK_FUSE_STEP(first, op1, opcode_info[op2].cycles, 1); \
+        state->pc += second(state);                              \
+        return 0;                                                \
+    }
+#define BLOCK_FUSE3(name, first, op1, second, op2, third, op3)          \
+    int block_##name(emu_state_t *state) {                             \
+        BLOCK_FUSE_STEP(first, op1,                                    \
+                        opcode_info[op2].cycles +                      \
+                            opcode_info[op3].cycles,                   \
+                        2);                                            \
+        BLOCK_FUSE_STEP(second, op2, opcode_info[op3].cycles, 1);      \
+        state->pc += third(state);                                     \
+        return 0;                                                      \
+    }
+
+BLOCK_FUSE2(DCR_B_JNZ, emu_DCR_B, 0x05, emu_JNZ, 0xc2)
+BLOCK_FUSE2(DCR_C_JNZ, emu_DCR_C, 0x0d, emu_JNZ, 0xc2)
+BLOCK_FUSE2(DCR_D_JNZ, emu_DCR_D, 0x15, emu_JNZ, 0xc2)
+BLOCK_FUSE2(DCR_E_JNZ, emu_DCR_E, 0x1d, emu_JNZ, 0xc2)
+BLOCK_FUSE2(DCR_H_JNZ, emu_DCR_H, 0x25, emu_JNZ, 0xc2)
+BLOCK_FUSE2(DCR_L_JNZ, emu_DCR_L, 0x2d, emu_JNZ, 0xc2)
+BLOCK_FUSE2(DCR_A_JNZ, emu_DCR_A, 0x3d, emu_JNZ, 0xc2)
+
+BLOCK_FUSE2(MOV_B_M_INX_H, emu_MOV_B_M, 0x46, emu_INX_H, 0x23)
+BLOCK_FUSE2(MOV_C_M_INX_H, emu_MOV_C_M, 0x4e, emu_INX_H, 0x23)
+BLOCK_FUSE2(MOV_D_M_INX_H, emu_MOV_D_M, 0x56, emu_INX_H, 0x23)
+BLOCK_FUSE2(MOV_E_M_INX_H, emu_MOV_E_M, 0x5e, emu_INX_H, 0x23)
+BLOCK_FUSE2(MOV_A_M_INX_H, emu_MOV_A_M, 0x7e, emu_INX_H, 0x23)
+BLOCK_FUSE2(MOV_M_B_INX_H, emu_MOV_M_B, 0x70, emu_INX_H, 0x23)
+BLOCK_FUSE2(MOV_M_C_INX_H, emu_MOV_M_C, 0x71, emu_INX_H, 0x23)
+BLOCK_FUSE2(MOV_M_D_INX_H, emu_MOV_M_D, 0x72, emu_INX_H, 0x23)
+BLOCK_FUSE2(MOV_M_E_INX_H, emu_MOV_M_E, 0x73, emu_INX_H, 0x23)
+BLOCK_FUSE2(MOV_M_A_INX_H, emu_MOV_M_A, 0x77, emu_INX_H, 0x23)
+
+BLOCK_FUSE3(LDAX_D_MOV_M_A_INX_H, emu_LDAX_D, 0x1a, emu_MOV_M_A, 0x77,
+            emu_INX_H, 0x23)
+BLOCK_FUSE3(LDAX_D_MOV_M_A_INX_D, emu_LDAX_D, 0x1a, emu_MOV_M_A, 0x77,
+            emu_INX_D, 0x13)
+
+/* DCR r; JNZ, indexed by the register field of DCR */
+block_handler_t block_dcr_jnz[8] = {
+    block_DCR_B_JNZ, block_DCR_C_JNZ, block_DCR_D_JNZ, block_DCR_E_JNZ,
+    block_DCR_H_JNZ, block_DCR_L_JNZ, NULL,            block_DCR_A_JNZ};
+
+/* MOV r, M; INX H and MOV M, r; INX H, indexed by the register field of r */
+block_handler_t block_mov_from_m_inx[8] = {
+    block_MOV_B_M_INX_H, block_MOV_C_M_INX_H, block_MOV_D_M_INX_H,
+    block_MOV_E_M_INX_H, NULL,                NULL,
+    NULL,                block_MOV_A_M_INX_H};
+block_handler_t block_mov_to_m_inx[8] = {
+    block_MOV_M_B_INX_H, block_MOV_M_C_INX_H, block_MOV_M_D_INX_H,
+    block_MOV_M_E_INX_H, NULL,                NULL,
+    NULL,                block_MOV_M_A_INX_H};
+
+/* --- Flag-free variants --- */
+
+/* Flags computed by the partial variants, the parity and the auxiliary
+ * carry are the expensive ones and rarely read */
+#define BLOCK_FLAGS_ZSC (OF_Z | OF_S | OF_CY)
+
+/*
+ * block_zsp: Updates the selected Zero, Sign and Parity flags.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   result - result of the operation
+ *   mask   - OF_* flags to update
+ *
+ * Returns:
+ *   None.
+ */
+void block_zsp(emu_state_t *state, uint8_t result, int mask) {
+    if (mask & OF_Z) state->cf.z = (result == 0);
+    if (mask & OF_S) state->cf.s = (result >> 7 == 1);
+    if (mask & OF_P) state->cf.p = parity(result);
+}
+
+/*
+ * block_add: emu_add updating only the selected flags.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   reg    - pointer to register on which to perform addition
+ *   val    - value to add to register
+ *   cy     - carry-in
+ *   mask   - OF_* flags to update
+ *
+ * Returns:
+ *   None.
+ */
+void block_add(emu_state_t *state, uint8_t *reg, uint8_t val, uint8_t cy,
+               int mask) {
+    uint8_t result = *reg + val + cy;
+    block_zsp(state, result, mask);
+    if (mask & OF_CY) state->cf.cy = carry(*reg, val, 8, cy);
+    if (mask & OF_AC) state->cf.ac = carry(*reg, val, 4, cy);
+    *reg = result;
+}
+
+/*
+ * block_sub: emu_sub updating only the selected flags.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   reg    - pointer to register on which to perform subtraction
+ *   val    - value to sub from register
+ *   cy     - carry-in
+ *   mask   - OF_* flags to update
+ *
+ * Returns:
+ *   None.
+ */
+void block_sub(emu_state_t *state, uint8_t *reg, uint8_t val, uint8_t cy,
+               int mask) {
+    block_add(state, reg, ~val, !cy, mask);
+    if (mask & OF_CY) state->cf.cy = !state->cf.cy;
+}
+
+/*
+ * block_logic: Stores the result of a logical operation in the accumulator,
+ *              updating only the selected flags. The carry is cleared, and
+ *              the auxiliary carry too except for ANA.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   result - result of the operation
+ *   ac     - whether the auxiliary carry is cleared
+ *   mask   - OF_* flags to update
+ *
+ * Returns:
+ *   None.
+ */
+void block_logic(emu_state_t *state, uint8_t result, int ac, int mask) {
+    state->a = result;
+    block_zsp(state, result, mask);
+    if (mask & OF_CY) state->cf.cy = 0;
+    if ((mask & OF_AC) && ac) state->cf.ac = 0;
+}
+
+/*
+ * block_cmp: emu_cmp updating only the selected flags.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   val    - value to compare with accumulator
+ *   mask   - OF_* flags to update
+ *
+ * Returns:
+ *   None.
+ */
+void block_cmp(emu_state_t *state, uint8_t val, int mask) {
+    block_zsp(state, state->a - val, mask);
+    if (mask & OF_CY) state->cf.cy = (state->a < val);
+    if (mask & OF_AC) state->cf.ac = 0;
+}
+
+/*
+ * block_inr: emu_inr (or emu_dcr) updating only the selected flags.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   reg    - pointer to register to increment
+ *   delta  - 1 to increment, -1 to decrement
+ *   mask   - OF_* flags to update
+ *
+ * Returns:
+ *   None.
+ */
+void block_inr(emu_state_t *state, uint8_t *reg, int delta, int mask) {
+    *reg += delta;
+    block_zsp(state, *reg, mask);
+    if (mask & OF_AC) state->cf.ac = (*reg == (delta > 0 ? 0x0 : 0xF));
+}
+
+#define BLOCK_ALU_ADD(x, mask) block_add(state, &state->a, x, 0, mask)
+#define BLOCK_ALU_ADC(x, mask) \
+    block_add(state, &state->a, x, state->cf.cy, mask)
+#define BLOCK_ALU_SUB(x, mask) block_sub(state, &state->a, x, 0, mask)
+#define BLOCK_ALU_SBB(x, mask) \
+    block_sub(state, &state->a, x, state->cf.cy, mask)
+#define BLOCK_ALU_ANA(x, mask) block_logic(state, state->a & (x), 0, mask)
+#define BLOCK_ALU_XRA(x, mask) block_logic(state, state->a ^ (x), 1, mask)
+#define BLOCK_ALU_ORA(x, mask) block_logic(state, state->a | (x), 1, mask)
+#define BLOCK_ALU_CMP(x, mask) block_cmp(state, x, mask)
+#define BLOCK_ALU_INR(x, mask) block_inr(state, &(x), 1, mask)
+#define BLOCK_ALU_DCR(x, mask) block_inr(state, &(x), -1, mask)
+
+/* The instructions of an operation on each register, opcodes spaced by
+ * stride in register field order */
+#define BLOCK_ALU_REGS(X, op, base, stride)            \
+    X(op##_B, op, (base) + 0 * (stride), state->b, 1) \
+    X(op##_C, op, (base) + 1 * (stride), state->c, 1) \
+    X(op##_D, op, (base) + 2 * (stride), state->d, 1) \
+    X(op##_E, op, (base) + 3 * (stride), state->e, 1) \
+    X(op##_H, op, (base) + 4 * (stride), state->h, 1) \
+    X(op##_L, op, (base) + 5 * (stride), state->l, 1) \
+    X(op##_A, op, (base) + 7 * (stride), state->a, 1)
+
+/* The same with M, for the operations reading it */
+#define BLOCK_ALU_ROW(X, op, base, stride) \
+    BLOCK_ALU_REGS(X, op, base, stride)    \
+    X(op##_M, op, (base) + 6 * (stride), MEM(HL), 1)
+
+/* Instructions with flag-free variants: X(name, operation, opcode, operand,
+ * size). INR M and DCR M write memory, through MEM_WRITE in their emulator
+ * handlers. */
+#define BLOCK_ALU_OPS(X)                 \
+    BLOCK_ALU_REGS(X, INR, 0x04, 8)      \
+    BLOCK_ALU_REGS(X, DCR, 0x05, 8)      \
+    BLOCK_ALU_ROW(X, ADD, 0x80, 1)       \
+    BLOCK_ALU_ROW(X, ADC, 0x88, 1)       \
+    BLOCK_ALU_ROW(X, SUB, 0x90, 1)       \
+    BLOCK_ALU_ROW(X, SBB, 0x98, 1)       \
+    BLOCK_ALU_ROW(X, ANA, 0xa0, 1)       \
+    BLOCK_ALU_ROW(X, XRA, 0xa8, 1)       \
+    BLOCK_ALU_ROW(X, ORA, 0xb0, 1)       \
+    BLOCK_ALU_ROW(X, CMP, 0xb8, 1)       \
+    X(ADI, ADD, 0xc6, DATA, 2)           \
+    X(ACI, ADC, 0xce, DATA, 2)           \
+    X(SUI, SUB, 0xd6, DATA, 2)           \
+    X(SBI, SBB, 0xde, DATA, 2)           \
+    X(ANI, ANA, 0xe6, DATA, 2)           \
+    X(XRI, XRA, 0xee, DATA, 2)           \
+    X(ORI, ORA, 0xf6, DATA, 2)           \
+    X(CPI, CMP, 0xfe, DATA, 2)
+
+/* _NF computes no flag, _ZSC only the zero, sign and carry flags */
+#define BLOCK_ALU_HANDLERS(name, op, opcode, operand, size) \
+    int block_##name##_NF(emu_state_t *state) {             \
+        BLOCK_ALU_##op(operand, 0);                         \
+        return size;                                        \
+    }                                                       \
+    int block_##name##_ZSC(emu_state_t *state) {            \
+        BLOCK_ALU_##op(operand, BLOCK_FLAGS_ZSC);           \
+        return size;                                        \
+    }
+BLOCK_ALU_OPS(BLOCK_ALU_HANDLERS)
+
+#define BLOCK_ALU_NF(name, op, opcode, ...) [opcode] = block_##name##_NF,
+#define BLOCK_ALU_ZSC(name, op, opcode, ...) [opcode] = block_##name##_ZSC,
+
+/* Variants indexed by opcode, NULL for the other instructions */
+block_handler_t block_nf_handlers[0x100] = {BLOCK_ALU_OPS(BLOCK_ALU_NF)};
+block_handler_t block_zsc_handlers[0x100] = {BLOCK_ALU_OPS(BLOCK_ALU_ZSC)};
+
+/*
+ * block_liveness: Finds the flags written by each instruction of a block
+ *                 that are overwritten before being read. All the flags are
+ *                 live when leaving the block, and after memory writes,
+ *                 which stop the block if they hit its code.
+ *
+ * Arguments:
+ *   mem    - memory holding the code
+ *   addrs  - address of each instruction
+ *   n      - number of instructions
+ *   dead   - set to the dead OF_* flags of each instruction
+ *
+ * Returns:
+ *   None.
+ */
+void block_liveness(const uint8_t *mem, const uint16_t *addrs, int n,
+                    uint8_t *dead) {
+    int live = OF_ALL;
+    for (int i = n - 1; i >= 0; i--) {
+        const opcode_info_t *info = &opcode_info[mem[addrs[i]]];
+        if (info->op_class & OC_STORE) live = OF_ALL;
+        dead[i] = info->flags_written & ~live;
+        live = (live & ~info->flags_written) | info->flags_read;
+    }
+}
+
+/*
+ * block_variant: Selects the handler of an instruction given its dead
+ *                flags.
+ *
+ * Arguments:
+ *   op     - opcode
+ *   dead   - OF_* flags written by the instruction that are dead
+ *
+ * Returns:
+ *   the flag-free variant, or the emulator handler if there is none.
+ */
+block_handler_t block_variant(uint8_t op, int dead) {
+    int live = opcode_info[op].flags_written & ~dead;
+    if (block_dead_flags && block_nf_handlers[op] != NULL) {
+        if (live == 0) return block_nf_handlers[op];
+        if ((live & ~BLOCK_FLAGS_ZSC) == 0) return block_zsc_handlers[op];
+    }
+    return emu_handlers[op];
+}
+
+/*
+ * block_fuse: Finds the superinstruction starting at an instruction.
+ *
+ * Arguments:
+ *   code   - bytes of the instruction and the following ones
+ *   n      - number of instructions left in the block, from this one
+ *   count  - set to the number of instructions covered
+ *
+ * Returns:
+ *   handler of the superinstruction, or NULL if no enabled pattern matches.
+ */
+block_handler_t block_fuse(const uint8_t *code, int n, int *count) {
+    uint8_t op = code[0];
+    if ((block_patterns & BLOCK_FUSE_DCR_JNZ) && n >= 2 &&
+        (op & 0xc7) == 0x05 && code[1] == 0xc2) {
+        *count = 2;
+        return block_dcr_jnz[(op >> 3) & 7];
+    }
+    if ((block_patterns & BLOCK_FUSE_MOV_INX) && n >= 2 && code[1] == 0x23) {
+        *count = 2;
+        if ((op & 0xc7) == 0x46) return block_mov_from_m_inx[(op >> 3) & 7];
+        if ((op & 0xf8) == 0x70) return block_mov_to_m_inx[op & 7];
+    }
+    if ((block_patterns & BLOCK_FUSE_LDAX_MOV) && n >= 3 && op == 0x1a &&
+        code[1] == 0x77) {
+        *count = 3;
+        if (code[2] == 0x23) return block_LDAX_D_MOV_M_A_INX_H;
+        if (code[2] == 0x13) return block_LDAX_D_MOV_M_A_INX_D;
+    }
+    return NULL;
+}
+
+/*
+ * block_finish: Computes the cycles and instructions left after each fast
+ *               handler of a decoded block.
+ *
+ * Arguments:
+ *   b      - block
+ *
+ * Returns:
+ *   None.
+ */
+void block_finish(block_t *b) {
+    int cycles = 0, ops = 0;
+    for (int i = b->num_fast - 1, op = b->num_ops; i >= 0; i--) {
+        b->rest_cycles[i] = cycles;
+        b->rest_ops[i] = ops;
+        for (int n = 0; n < b->fast_ops[i]; n++) {
+            cycles += b->op_cycles[--op];
+            ops++;
+        }
+    }
+    b->retired = NULL;
+}
+
+/*
+ * block_build: Decodes the block starting at an address. A block ends after
+ *              an instruction that may change PC or stop the CPU, or at the
+ *              end of the cached code.
+ *
+ * Arguments:
+ *   mem    - memory holding the code
+ *   start  - address of the first instruction
+ *
+ * Returns:
+ *   the block, or NULL if it couldn't be allocated or no instruction fits
+ *   before the end of the cached code.
+ */
+block_t *block_build(const uint8_t *mem, uint16_t start) {
+    block_t *b = malloc(sizeof(block_t));
+    if (b == NULL) return NULL;
+
+    uint16_t *addrs = b->addrs;
+    uint32_t addr = start;
+    b->num_ops = b->cycles = b->prefix = 0;
+    while (b->num_ops < BLOCK_MAX_OPS && addr < BLOCK_CODE_END) {
+        const opcode_info_t *info = &opcode_info[mem[addr]];
+        if (addr + info->size > BLOCK_CODE_END) break;
+
+        b->handlers[b->num_ops] = emu_handlers[mem[addr]];
+        b->op_cycles[b->num_ops] = info->cycles;
+        b->prefix = b->cycles;
+        b->cycles += info->cycles;
+        addrs[b->num_ops++] = addr;
+        addr += info->size;
+        if (info->op_class & BLOCK_END_CLASSES) break;
+    }
+
+    if (b->num_ops == 0) {
+        free(b);
+        return NULL;
+    }
+    b->start = start;
+    b->end = addr;
+    block_liveness(mem, addrs, b->num_ops, b->dead_flags);
+
+    /* The patterns only end with a branch, so the bytes following an
+     * instruction are the next instructions of the block */
+    b->num_fast = 0;
+    for (int i = 0; i < b->num_ops;) {
+        int count = 1;
+        block_handler_t h = block_fuse(&mem[addrs[i]], b->num_ops - i, &count);
+        if (h == NULL) {
+            h = block_variant(mem[addrs[i]], b->dead_flags[i]);
+            count = 1;
+        }
+        b->fast[b->num_fast] = h;
+        b->fast_ops[b->num_fast++] = count;
+        i += count;
+    }
+    block_finish(b);
+    return b;
+}
+
+/*
+ * block_track: Counts a block in the bytes and pages of code, or takes it
+ *              back. A page is flagged in emu_state_t.code_pages while a
+ *              block holds a byte of it.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   b      - block
+ *   delta  - 1 when the block is cached, -1 when it is dropped
+ *
+ * Returns:
+ *   None.
+ */
+void block_track(emu_state_t *state, const block_t *b, int delta) {
+    for (uint32_t addr = b->start; addr < b->end; addr++) {
+        block_code_bytes[addr] += delta;
+    }
+    for (uint32_t page = b->start / EMU_CODE_PAGE_SIZE;
+         page <= (b->end - 1u) / EMU_CODE_PAGE_SIZE; page++) {
+        block_code_pages[page] += delta;
+        state->code_pages[page] = block_code_pages[page] > 0;
+    }
+}
+
+/*
+ * block_holds_code: Checks if cached blocks hold a byte of an address range.
+ *
+ * Arguments:
+ *   start  - first address of the range
+ *   end    - address past the last one
+ *
+ * Returns:
+ *   1 if a block holds a byte of the range, 0 otherwise.
+ */
+int block_holds_code(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr < end; addr++) {
+        if (block_code_bytes[addr] > 0) return 1;
+    }
+    return 0;
+}
+
+/*
+ * block_invalidate: Drops the cached blocks holding a byte of an address
+ *                   range, so they are decoded again from memory. They may be
+ *                   running, so they are only freed by block_reclaim, and
+ *                   code_written tells the core to stop running them.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   start  - first address of the range
+ *   end    - address past the last one
+ *
+ * Returns:
+ *   None.
+ */
+void block_invalidate(emu_state_t *state, uint32_t start, uint32_t end) {
+    /* Writes to data next to code leave the blocks as they are */
+    if (!block_holds_code(start, end)) return;
+
+    uint32_t first = (start > BLOCK_MAX_BYTES) ? start - BLOCK_MAX_BYTES : 0;
+    for (uint32_t addr = first; addr < end; addr++) {
+        block_t *b = block_cache[addr];
+        if (b != NULL && b->end > start) {
+            block_track(state, b, -1);
+            b->retired = block_retired;
+            block_retired = b;
+            block_cache[addr] = NULL;
+        }
+    }
+    state->code_written = 1;
+}
+
+/*
+ * block_reclaim: Frees the invalidated blocks, between blocks since none may
+ *                be running then.
+ *
+ * Returns:
+ *   None.
+ */
+void block_reclaim(void) {
+    while (block_retired != NULL) {
+        block_t *b = block_retired;
+        block_retired = b->retired;
+        free(b);
+    }
+}
+
+/*
+ * block_code_write: Invalidates the blocks holding a written byte, the
+ *                   emu_state_t.code_write function of the block core.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   addr   - address written
+ *
+ * Returns:
+ *   None.
+ */
+void block_code_write(emu_state_t *state, uint16_t addr) {
+    if (state->mem == block_cache_mem) block_invalidate(state, addr, addr + 1);
+}
+
+/*
+ * block_flush: Frees all the cached blocks, and clears the code pages.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *
+ * Returns:
+ *   None.
+ */
+void block_flush(emu_state_t *state) {
+    block_reclaim();
+    for (uint32_t addr = 0; addr < BLOCK_CODE_END; addr++) {
+        free(block_cache[addr]);
+        block_cache[addr] = NULL;
+    }
+    memset(block_code_bytes, 0, sizeof(block_code_bytes));
+    memset(block_code_pages, 0, sizeof(block_code_pages));
+    memset(state->code_pages, 0, sizeof(state->code_pages));
+}
+
+/*
+ * block_check_cache: Flushes the cache when it was built for another machine
+ *                    (different memory, or a machine that restarted) or
+ *                    other patterns or variants.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *
+ * Returns:
+ *   1 if the cache was flushed, 0 otherwise.
+ */
+int block_check_cache(emu_state_t *state) {
+    if (state->mem != block_cache_mem || state->cycles < block_cache_cycles ||
+        block_patterns != block_cache_patterns ||
+        block_dead_flags != block_cache_dead_flags) {
+        block_flush(state);
+        block_cache_mem = state->mem;
+        block_cache_patterns = block_patterns;
+        block_cache_dead_flags = block_dead_flags;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * block_load_map: Loads the block map of a ROM, replacing the previous one.
+ *
+ * Arguments:
+ *   filename   - name of the block map file, written by 8080_analyze -b
+ *   rom        - ROM contents
+ *   size       - ROM size
+ *
+ * Returns:
+ *   0 on success, -1 if the file can't be read or was made for another ROM.
+ */
+int block_load_map(const char *filename, const uint8_t *rom, uint32_t size) {
+    free(block_map);
+    block_map = cfg_load_block_map(filename, rom, size, &block_map_blocks);
+    if (block_map == NULL) return -1;
+    block_map_size = size;
+    block_map_hash = cfg_hash(rom, size);
+    return 0;
+}
+
+/*
+ * block_map_matches: Checks that the memory holds the ROM of the block map,
+ *                    it may have been patched since the map was loaded.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *
+ * Returns:
+ *   1 if the map can be used, 0 otherwise.
+ */
+int block_map_matches(const emu_state_t *state) {
+    return block_map != NULL &&
+           cfg_hash(state->mem, block_map_size) == block_map_hash;
+}
+
+/*
+ * block_preload: Decodes the blocks of the block map that aren't cached, so
+ *                the ROM code doesn't pay for decoding while it runs.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *
+ * Returns:
+ *   the number of blocks decoded.
+ */
+int block_preload(emu_state_t *state) {
+    if (!block_map_matches(state)) return 0;
+
+    int decoded = 0;
+    for (int i = 0; i < block_map_blocks; i++) {
+        uint16_t start = block_map[i].start;
+        if (block_map[i].kind == CFG_END_INVALID ||
+            block_cache[start] != NULL) {
+            continue;
+        }
+        block_t *b = block_cache[start] = block_build(state->mem, start);
+        if (b == NULL) continue;
+        block_track(state, b, 1);
+        decoded++;
+    }
+    return decoded;
+}
+
+/*
+ * block_stop: Ends a block after one of its fast handlers, taking back the
+ *             cycles and instructions that were accounted for the rest of
+ *             the block.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   b      - block
+ *   i      - index of the last fast handler run
+ *
+ * Returns:
+ *   None.
+ */
+void block_stop(emu_state_t *state, const block_t *b, int i) {
+    state->cycles -= b->rest_cycles[i];
+    state->instructions -= b->rest_ops[i];
+}
+
+/*
+ * block_exec: Runs a decoded block, or its instructions up to the given
+ *             cycle count if the whole block doesn't fit.
+ *
+ * Arguments:
+ *   state  - emulator state, with PC at the start of the block
+ *   b      - block
+ *   until  - value of state->cycles at which to stop
+ *
+ * Returns:
+ *   None.
+ */
+void block_exec(emu_state_t *state, const block_t *b, uint64_t until) {
+    state->code_written = 0;
+    if (state->cycles + b->prefix < until) {
+        state->cycles += b->cycles;
+        state->instructions += b->num_ops;
+        int n = b->num_fast;
+        for (int i = 0; i < n; i++) {
+            state->pc += (*b->fast[i])(state);
+            if (state->code_written) {
+                block_stop(state, b, i);
+                return;
+            }
+        }
+    } else {
+        /* The flags of every instruction are computed, since an
+         * interrupt can read them after any of them */
+        for (int i = 0; i < b->num_ops && state->cycles < until; i++) {
+            state->cycles += b->op_cycles[i];
+            state->instructions++;
+            state->pc += (*b->handlers[i])(state);
+            if (state->code_written) return;
+        }
+    }
+}
+
+/*
+ * block_run: Emulates instructions until the given cycle count is reached,
+ *            running cached blocks.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   until  - value of state->cycles at which to stop
+ *
+ * Returns:
+ *   None.
+ */
+void block_run(emu_state_t *state, uint64_t until) {
+    /* The profilers hook into the interpreter */
+    if (PROFILE_PER_INSTR) {
+        emu_run(state, until);
+        return;
+    }
+    if (block_check_cache(state)) block_preload(state);
+    block_reclaim();
+    state->code_write = block_code_write;
+
+    while (state->cycles < until) {
+        uint16_t pc = state->pc;
+        block_t *b = block_cache[pc];
+        if (b == NULL && !state->halted) {
+            b = block_cache[pc] = block_build(state->mem, pc);
+            if (b != NULL) block_track(state, b, 1);
+        }
+        if (b == NULL || state->halted) {
+            if (state->halted && state->stopped) break;
+            emu_step(state);
+            continue;
+        }
+
+        block_exec(state, b, until);
+        if (state->code_written) block_reclaim();
+    }
+    block_cache_cycles = state->cycles;
+}
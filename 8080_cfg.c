@@ -0,0 +1,607 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Static control flow analysis of a ROM. Code is found by recursive descent
+ * from the reset and RST vectors, following jumps, calls and restarts, so the
+ * data tables mixed with the code are never decoded as instructions. The
+ * result is a list of basic blocks, which can be saved as a block map for the
+ * execution cores to load at startup, and a call graph.
+ */
+
+#define CFG_MAGIC "8080BLK1"
+
+/* Contents of a byte (cfg_t.mark) */
+#define CFG_UNKNOWN (0)  // Not reached by the analysis
+#define CFG_CODE (1)     // Opcode of an instruction
+#define CFG_OPERAND (2)  // Operand of an instruction
+#define CFG_DATA (3)     // Data, e.g. a jump table
+
+/* Attributes of an address (cfg_t.flags) */
+#define CFG_LEADER (1 << 0)      // Starts a basic block
+#define CFG_FUNCTION (1 << 1)    // Entry of a subroutine or interrupt handler
+#define CFG_JUMP_TABLE (1 << 2)  // Start of a jump table
+
+/* Longest jump table accepted by the PCHL heuristic, in entries */
+#define CFG_MAX_JUMP_TABLE (64)
+
+/* How a basic block ends */
+typedef enum {
+    CFG_END_FALL,      // Falls through into the next block
+    CFG_END_JUMP,      // JMP to target
+    CFG_END_BRANCH,    // Jcc to target, or falls through
+    CFG_END_CALL,      // CALL, Ccc or RST to target, then falls through
+    CFG_END_RET,       // RET
+    CFG_END_COND_RET,  // Rcc, or falls through
+    CFG_END_PCHL,      // PCHL, through the jump table at target if found
+    CFG_END_HALT,      // HLT, resumes with the next block after an interrupt
+    CFG_END_INVALID    // Unimplemented opcode or code overlapping other bytes
+} cfg_end_t;
+
+/* Basic block, also the record format of block map files */
+typedef struct {
+    uint16_t start;
+    uint16_t end;     // Address past the last instruction
+    uint16_t target;  // Jump or call target, or jump table (see cfg_end_t)
+    uint8_t kind;     // cfg_end_t
+    uint8_t flags;    // CFG_* attributes of the start address
+} cfg_block_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t rom_size;
+    uint32_t rom_hash;  // cfg_hash() of the ROM the map was made from
+    uint32_t num_blocks;
+    uint32_t reserved;
+} cfg_map_header_t;
+
+typedef struct {
+    uint16_t pchl;  // Address of the PCHL using the table
+    uint16_t base;
+    uint8_t len;  // Entries
+} cfg_jump_table_t;
+
+typedef struct {
+    const uint8_t *mem;
+    uint32_t size;  // Bytes of mem to analyze, addresses past it aren't
+    uint8_t mark[0x10000];
+    uint8_t flags[0x10000];
+    cfg_block_t *blocks;  // Sorted by address
+    int num_blocks;
+    cfg_jump_table_t jump_tables[0x100];
+    int num_jump_tables;
+    int num_conflicts;  // Paths that ran into data or the middle of code
+    int num_unresolved;  // PCHL without a recognized jump table
+} cfg_t;
+
+/*
+ * cfg_hash: Hashes a ROM (32 bit FNV-1a), to check that a block map matches
+ *           the ROM it is loaded for.
+ *
+ * Arguments:
+ *   mem    - ROM contents
+ *   size   - ROM size
+ *
+ * Returns:
+ *   the hash.
+ */
+uint32_t cfg_hash(const uint8_t *mem, uint32_t size) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < size; i++) {
+        hash = (hash ^ mem[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * cfg_end_kind: Classifies how an instruction affects control flow.
+ *
+ * Arguments:
+ *   info   - disassembled instruction
+ *
+ * Returns:
+ *   the cfg_end_t of a block ending with the instruction, or CFG_END_FALL if
+ *   the instruction doesn't end a block.
+ */
+cfg_end_t cfg_end_kind(const disasm_info_t *info) {
+    switch (info->mnemonic) {
+        case DISASM_MN_JMP:
+            return CFG_END_JUMP;
+        case DISASM_MN_JNZ:
+        case DISASM_MN_JZ:
+        case DISASM_MN_JNC:
+        case DISASM_MN_JC:
+        case DISASM_MN_JPO:
+        case DISASM_MN_JPE:
+        case DISASM_MN_JP:
+        case DISASM_MN_JM:
+            return CFG_END_BRANCH;
+        case DISASM_MN_CALL:
+        case DISASM_MN_CNZ:
+        case DISASM_MN_CZ:
+        case DISASM_MN_CNC:
+        case DISASM_MN_CC:
+        case DISASM_MN_CPO:
+        case DISASM_MN_CPE:
+        case DISASM_MN_CP:
+        case DISASM_MN_CM:
+        case DISASM_MN_RST:
+            return CFG_END_CALL;
+        case DISASM_MN_RET:
+            return CFG_END_RET;
+        case DISASM_MN_RNZ:
+        case DISASM_MN_RZ:
+        case DISASM_MN_RNC:
+        case DISASM_MN_RC:
+        case DISASM_MN_RPO:
+        case DISASM_MN_RPE:
+        case DISASM_MN_RP:
+        case DISASM_MN_RM:
+            return CFG_END_COND_RET;
+        case DISASM_MN_PCHL:
+            return CFG_END_PCHL;
+        case DISASM_MN_HLT:
+            return CFG_END_HALT;
+        case DISASM_MN_unimplemented:
+            return CFG_END_INVALID;
+        default:
+            return CFG_END_FALL;
+    }
+}
+
+/*
+ * cfg_target: Returns the address an instruction jumps or calls to.
+ *
+ * Arguments:
+ *   info   - disassembled jump, call or restart instruction
+ *
+ * Returns:
+ *   the target address.
+ */
+uint16_t cfg_target(const disasm_info_t *info) {
+    if (info->operands[0].type == DISASM_OP_RST) {
+        return info->operands[0].value * 8;
+    }
+    return info->operands[0].value;
+}
+
+/*
+ * cfg_decode: Decodes the instruction at an address, if all of its bytes are
+ *             within the analyzed memory.
+ *
+ * Arguments:
+ *   cfg    - analysis
+ *   addr   - address of the instruction
+ *   info   - filled with the instruction
+ *
+ * Returns:
+ *   0 on success, -1 if the instruction runs past the analyzed memory.
+ */
+int cfg_decode(cfg_t *cfg, uint32_t addr, disasm_info_t *info) {
+    char text[DISASM_BUF_SIZE];
+    uint8_t code[3] = {0};
+
+    memcpy(code, &cfg->mem[addr],
+           (cfg->size - addr < 3) ? cfg->size - addr : 3);
+    disasm_str(text, sizeof(text), code, addr, info);
+    return (addr + info->size <= cfg->size) ? 0 : -1;
+}
+
+/*
+ * cfg_jump_table: Looks for the jump table used by a PCHL. Tables are assumed
+ *                 to be loaded with LXI H or LXI D (followed by XCHG) before
+ *                 the index is added, and to hold addresses of code in the
+ *                 analyzed memory; a reset address ends the table. The
+ *                 entries are marked as data.
+ *
+ * Arguments:
+ *   cfg    - analysis
+ *   pchl   - address of the PCHL
+ *   base   - address loaded by the last LXI H/D before the PCHL
+ *   stack  - work list, the entries are pushed onto it
+ *   top    - number of addresses on the work list
+ *
+ * Returns:
+ *   number of entries in the table, 0 if no table was found.
+ */
+int cfg_jump_table(cfg_t *cfg, uint16_t pchl, uint32_t base, uint16_t *stack,
+                   int *top) {
+    int n = 0;
+
+    for (; n < CFG_MAX_JUMP_TABLE; n++) {
+        uint32_t entry = base + 2 * n;
+        if (entry + 1 >= cfg->size || cfg->mark[entry] != CFG_UNKNOWN ||
+            cfg->mark[entry + 1] != CFG_UNKNOWN) {
+            break;
+        }
+        uint16_t target = cfg->mem[entry] | cfg->mem[entry + 1] << 8;
+        if (target == 0 || target >= cfg->size ||
+            (cfg->mark[target] != CFG_UNKNOWN &&
+             cfg->mark[target] != CFG_CODE) ||
+            (target >= base && target <= entry + 1)) {
+            break;
+        }
+    }
+    if (n == 0 || cfg->num_jump_tables == 0x100) return 0;
+
+    for (int i = 0; i < n; i++) {
+        uint32_t entry = base + 2 * i;
+        uint16_t target = cfg->mem[entry] | cfg->mem[entry + 1] << 8;
+        cfg->mark[entry] = cfg->mark[entry + 1] = CFG_DATA;
+        cfg->flags[target] |= CFG_LEADER;
+        stack[(*top)++] = target;
+    }
+    cfg->flags[base] |= CFG_JUMP_TABLE;
+    cfg->jump_tables[cfg->num_jump_tables].pchl = pchl;
+    cfg->jump_tables[cfg->num_jump_tables].base = base;
+    cfg->jump_tables[cfg->num_jump_tables].len = n;
+    cfg->num_jump_tables++;
+    return n;
+}
+
+/*
+ * cfg_trace: Marks the code reachable from an entry point.
+ *
+ * Arguments:
+ *   cfg    - analysis
+ *   entry  - address to start from
+ *
+ * Returns:
+ *   None.
+ */
+void cfg_trace(cfg_t *cfg, uint16_t entry) {
+    /* Each instruction is decoded once and pushes at most one address, except
+     * for the PCHL of a jump table */
+    static uint16_t stack[0x10000 + 0x100 * CFG_MAX_JUMP_TABLE];
+    int top = 0;
+
+    stack[top++] = entry;
+    while (top > 0) {
+        uint32_t addr = stack[--top];
+        int32_t table = -1;  // Last address loaded into HL or DE
+
+        while (addr < cfg->size && cfg->mark[addr] != CFG_CODE) {
+            disasm_info_t info;
+            int overlap = (cfg->mark[addr] != CFG_UNKNOWN);
+            if (cfg_decode(cfg, addr, &info) < 0) overlap = 1;
+            for (int i = 1; i < info.size && !overlap; i++) {
+                overlap = (cfg->mark[addr + i] != CFG_UNKNOWN);
+            }
+            if (overlap || info.mnemonic == DISASM_MN_unimplemented) {
+                cfg->num_conflicts++;
+                break;
+            }
+
+            cfg->mark[addr] = CFG_CODE;
+            for (int i = 1; i < info.size; i++) {
+                cfg->mark[addr + i] = CFG_OPERAND;
+            }
+
+            uint32_t next = addr + info.size;
+            cfg_end_t kind = cfg_end_kind(&info);
+            if (kind != CFG_END_FALL && next < 0x10000) {
+                cfg->flags[next] |= CFG_LEADER;
+            }
+
+            switch (kind) {
+                case CFG_END_CALL:
+                    cfg->flags[cfg_target(&info)] |= CFG_FUNCTION;
+                    /* Fall through */
+                case CFG_END_JUMP:
+                case CFG_END_BRANCH:
+                    cfg->flags[cfg_target(&info)] |= CFG_LEADER;
+                    stack[top++] = cfg_target(&info);
+                    break;
+                case CFG_END_PCHL:
+                    if (table < 0 ||
+                        cfg_jump_table(cfg, addr, table, stack, &top) == 0) {
+                        cfg->num_unresolved++;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            if (kind == CFG_END_JUMP || kind == CFG_END_RET ||
+                kind == CFG_END_PCHL) {
+                break;
+            }
+
+            if (info.mnemonic == DISASM_MN_LXI &&
+                (info.operands[0].value == DISASM_REG_H ||
+                 info.operands[0].value == DISASM_REG_D)) {
+                table = info.operands[1].value;
+            }
+            addr = next;
+        }
+    }
+}
+
+/*
+ * cfg_find_jump_table: Finds the jump table of a PCHL.
+ *
+ * Arguments:
+ *   cfg    - analysis
+ *   pchl   - address of the PCHL
+ *
+ * Returns:
+ *   the table, or NULL if none was found for the PCHL.
+ */
+cfg_jump_table_t *cfg_find_jump_table(cfg_t *cfg, uint16_t pchl) {
+    for (int i = 0; i < cfg->num_jump_tables; i++) {
+        if (cfg->jump_tables[i].pchl == pchl) return &cfg->jump_tables[i];
+    }
+    return NULL;
+}
+
+/*
+ * cfg_build_blocks: Splits the marked code into basic blocks.
+ *
+ * Arguments:
+ *   cfg    - analysis
+ *
+ * Returns:
+ *   0 on success, -1 if out of memory.
+ */
+int cfg_build_blocks(cfg_t *cfg) {
+    int max_blocks = 0;
+    for (uint32_t addr = 0; addr < cfg->size; addr++) {
+        max_blocks += (cfg->mark[addr] == CFG_CODE);
+    }
+    cfg->blocks = malloc((max_blocks + 1) * sizeof(cfg_block_t));
+    if (cfg->blocks == NULL) return -1;
+
+    cfg_block_t *block = NULL;
+    for (uint32_t addr = 0; addr < cfg->size;) {
+        if (cfg->mark[addr] != CFG_CODE) {
+            block = NULL;
+            addr++;
+            continue;
+        }
+        if (block == NULL || (cfg->flags[addr] & CFG_LEADER)) {
+            block = &cfg->blocks[cfg->num_blocks++];
+            block->start = addr;
+            block->target = 0;
+            block->kind = CFG_END_FALL;
+            block->flags = cfg->flags[addr];
+        }
+
+        disasm_info_t info;
+        cfg_decode(cfg, addr, &info);
+        addr += info.size;
+        block->end = addr;
+
+        cfg_end_t kind = cfg_end_kind(&info);
+        if (kind == CFG_END_FALL) continue;
+        block->kind = kind;
+        if (kind == CFG_END_JUMP || kind == CFG_END_BRANCH ||
+            kind == CFG_END_CALL) {
+            block->target = cfg_target(&info);
+        } else if (kind == CFG_END_PCHL) {
+            cfg_jump_table_t *t = cfg_find_jump_table(cfg, addr - 1);
+            if (t != NULL) block->target = t->base;
+        }
+        block = NULL;
+    }
+
+    return 0;
+}
+
+/*
+ * cfg_analyze: Finds the code and basic blocks of a ROM, starting from the
+ *              reset and RST vectors.
+ *
+ * Arguments:
+ *   cfg    - analysis to fill, release with cfg_free()
+ *   mem    - ROM contents
+ *   size   - ROM size
+ *
+ * Returns:
+ *   0 on success, -1 if out of memory.
+ */
+int cfg_analyze(cfg_t *cfg, const uint8_t *mem, uint32_t size) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->mem = mem;
+    cfg->size = (size > 0x10000) ? 0x10000 : size;
+
+    /* Reset first, then the RST vectors that aren't already part of the code
+     * found so far (e.g. handlers longer than 8 bytes) */
+    for (int rst = 0; rst < 8; rst++) {
+        if (cfg->mark[rst * 8] != CFG_UNKNOWN) continue;
+        cfg->flags[rst * 8] |= CFG_LEADER | CFG_FUNCTION;
+        cfg_trace(cfg, rst * 8);
+    }
+
+    return cfg_build_blocks(cfg);
+}
+
+void cfg_free(cfg_t *cfg) {
+    free(cfg->blocks);
+    cfg->blocks = NULL;
+    cfg->num_blocks = 0;
+}
+
+/*
+ * cfg_find_block: Finds the block starting at an address.
+ *
+ * Arguments:
+ *   blocks     - blocks sorted by address
+ *   num_blocks - number of blocks
+ *   addr       - start address
+ *
+ * Returns:
+ *   the block, or NULL if no block starts at the address.
+ */
+cfg_block_t *cfg_find_block(cfg_block_t *blocks, int num_blocks,
+                            uint16_t addr) {
+    int lo = 0, hi = num_blocks - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (blocks[mid].start == addr) return &blocks[mid];
+        if (blocks[mid].start < addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * cfg_function_name: Formats the name of a function, as in the call
+ *                    profiler.
+ *
+ * Arguments:
+ *   buf    - buffer to write the name to
+ *   len    - size of the buffer
+ *   addr   - entry of the function
+ *
+ * Returns:
+ *   None.
+ */
+void cfg_function_name(char *buf, size_t len, uint16_t addr) {
+    if (addr == 0) {
+        snprintf(buf, len, "reset");
+    } else if (addr % 8 == 0 && addr <= 0x38) {
+        snprintf(buf, len, "rst%d_%04x", addr / 8, addr);
+    } else {
+        snprintf(buf, len, "sub_%04x", addr);
+    }
+}
+
+/*
+ * cfg_write_dot: Writes the call graph in Graphviz DOT format. The blocks of
+ *                a function are the ones reachable from its entry without
+ *                following calls; the graph has an edge for each function
+ *                they call.
+ *
+ * Arguments:
+ *   cfg    - analysis
+ *   out    - file to write to
+ *
+ * Returns:
+ *   None.
+ */
+void cfg_write_dot(cfg_t *cfg, FILE *out) {
+    static uint32_t visited[0x10000];  // Function that last visited a block
+    static uint8_t called[0x10000];    // Callees of the current function
+    static uint16_t stack[0x10000];
+    char name[32];
+
+    memset(visited, 0xff, sizeof(visited));
+    fprintf(out, "digraph calls {\n  node [shape=box, fontname=monospace];\n");
+
+    for (int f = 0; f < cfg->num_blocks; f++) {
+        cfg_block_t *entry = &cfg->blocks[f];
+        if (!(entry->flags & CFG_FUNCTION)) continue;
+
+        int top = 0, num_blocks = 0, num_bytes = 0;
+        memset(called, 0, sizeof(called));
+        stack[top++] = entry->start;
+        while (top > 0) {
+            cfg_block_t *b =
+                cfg_find_block(cfg->blocks, cfg->num_blocks, stack[--top]);
+            if (b == NULL || visited[b->start] == entry->start) continue;
+            visited[b->start] = entry->start;
+            num_blocks++;
+            num_bytes += b->end - b->start;
+
+            /* Successors within the function */
+            uint16_t succ[CFG_MAX_JUMP_TABLE];
+            int n = 0;
+            if (b->kind == CFG_END_JUMP || b->kind == CFG_END_BRANCH) {
+                succ[n++] = b->target;
+            }
+            if (b->kind == CFG_END_FALL || b->kind == CFG_END_BRANCH ||
+                b->kind == CFG_END_CALL || b->kind == CFG_END_COND_RET ||
+                b->kind == CFG_END_HALT) {
+                succ[n++] = b->end;
+            }
+            if (b->kind == CFG_END_CALL) called[b->target] = 1;
+            cfg_jump_table_t *t = (b->kind == CFG_END_PCHL)
+                                      ? cfg_find_jump_table(cfg, b->end - 1)
+                                      : NULL;
+            for (int i = 0; t && i < t->len; i++) {
+                succ[n++] = cfg->mem[t->base + 2 * i] |
+                            cfg->mem[t->base + 2 * i + 1] << 8;
+            }
+            for (int i = 0; i < n; i++) {
+                if (top < 0x10000) stack[top++] = succ[i];
+            }
+        }
+
+        cfg_function_name(name, sizeof(name), entry->start);
+        fprintf(out, "  \"%s\" [label=\"%s\\n%d blocks, %d bytes\"];\n", name,
+                name, num_blocks, num_bytes);
+        for (uint32_t callee = 0; callee < 0x10000; callee++) {
+            if (!called[callee]) continue;
+            char callee_name[32];
+            cfg_function_name(callee_name, sizeof(callee_name), callee);
+            fprintf(out, "  \"%s\" -> \"%s\";\n", name, callee_name);
+        }
+    }
+
+    fprintf(out, "}\n");
+}
+
+/*
+ * cfg_write_block_map: Saves the blocks of an analysis.
+ *
+ * Arguments:
+ *   cfg        - analysis
+ *   filename   - name of the block map file
+ *
+ * Returns:
+ *   0 on success, -1 on failure.
+ */
+int cfg_write_block_map(cfg_t *cfg, const char *filename) {
+    cfg_map_header_t header = {CFG_MAGIC, cfg->size,
+                               cfg_hash(cfg->mem, cfg->size), cfg->num_blocks,
+                               0};
+
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL) return -1;
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             fwrite(cfg->blocks, sizeof(cfg_block_t), cfg->num_blocks, fp) ==
+                 (size_t)cfg->num_blocks;
+    if (fclose(fp) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+/*
+ * cfg_load_block_map: Loads a block map made for a given ROM.
+ *
+ * Arguments:
+ *   filename   - name of the block map file
+ *   mem        - ROM contents
+ *   size       - ROM size
+ *   num_blocks - set to the number of blocks
+ *
+ * Returns:
+ *   the blocks sorted by address (free() them), or NULL if the file can't be
+ *   read or was made for another ROM.
+ */
+cfg_block_t *cfg_load_block_map(const char *filename, const uint8_t *mem,
+                                uint32_t size, int *num_blocks) {
+    cfg_map_header_t header;
+    cfg_block_t *blocks = NULL;
+
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) return NULL;
+    if (fread(&header, sizeof(header), 1, fp) == 1 &&
+        memcmp(header.magic, CFG_MAGIC, sizeof(header.magic)) == 0 &&
+        header.rom_size == size && header.rom_hash == cfg_hash(mem, size) &&
+        header.num_blocks <= 0x10000) {
+        blocks = malloc((header.num_blocks + 1) * sizeof(cfg_block_t));
+        if (blocks && fread(blocks, sizeof(cfg_block_t), header.num_blocks,
+                            fp) != header.num_blocks) {
+            free(blocks);
+            blocks = NULL;
+        }
+    }
+    fclose(fp);
+
+    if (blocks) *num_blocks = header.num_blocks;
+    return blocks;
+}
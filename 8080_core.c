@@ -0,0 +1,52 @@
+#include <string.h>
+
+#include "8080_block.c"
+#include "8080_tier.c"
+
+#ifdef AOT
+#include "8080_aot.c"
+#endif
+
+/*
+ * emu_core_t: An execution core, i.e. one strategy for emulating instructions.
+ *             All cores must produce the same machine state, they only differ
+ *             in speed.
+ *
+ *   name   - name used to select the core
+ *   run    - emulates instructions until state->cycles reaches <until>, or
+ *            until the CPU halts once the machine set state->stopped
+ */
+typedef struct {
+    const char *name;
+    void (*run)(emu_state_t *state, uint64_t until);
+} emu_core_t;
+
+/*
+ * emu_cores: Available execution cores, the first one is the default.
+ */
+emu_core_t emu_cores[] = {
+    {"table", emu_run},  // Table dispatch through emu_handlers
+    {"block", block_run},  // Cached decoded blocks with superinstructions
+    {"tier", tier_run},    // Interpreter, blocks, then native code when hot
+#ifdef AOT
+    {"aot", aot_run},  // Recompiled ROM blocks (8080_recomp.c)
+#endif
+};
+
+#define EMU_NUM_CORES (sizeof(emu_cores) / sizeof(emu_cores[0]))
+
+/*
+ * emu_find_core: Looks up an execution core by name.
+ *
+ * Arguments:
+ *   name   - name of the core
+ *
+ * Returns:
+ *   pointer to the core, or NULL if there is no core with that name.
+ */
+emu_core_t *emu_find_core(const char *name) {
+    for (unsigned int i = 0; i < EMU_NUM_CORES; i++) {
+        if (strcmp(emu_cores[i].name, name) == 0) return &emu_cores[i];
+    }
+    return NULL;
+}
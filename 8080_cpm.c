@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * CP/M machine, to run CP/M .COM programs such as the CPU exercisers
+ * (8080PRE, TST8080, CPUTEST, 8080EXM): 64K of RAM, the program loaded at
+ * the start of the TPA, and a stub of the BDOS for console output.
+ *
+ * Page zero and the BDOS stub are 8080 code that traps to the host through
+ * OUT, so every execution core runs the program unmodified:
+ *
+ *   0000: OUT CPM_PORT_BOOT; HLT   warm boot, stops the CPU to end the run
+ *   0005: JMP CPM_BDOS             BDOS entry, 0006 is also the top of the TPA
+ *   CPM_BDOS: OUT CPM_PORT_BDOS; RET
+ */
+
+#define CPM_TPA (0x0100)    // Load address of .COM programs
+#define CPM_BDOS (0xfe00)   // BDOS stub, the stack starts right below it
+#define CPM_TPA_SIZE (CPM_BDOS - 2 - CPM_TPA)
+#define CPM_PORT_BOOT (0xfe)
+#define CPM_PORT_BDOS (0xff)
+
+/* Cycles emulated between checks of the instruction limit, a warm boot
+ * returns from the core right away */
+#define CPM_SLICE_CYCLES (1 << 22)
+
+/* BDOS functions */
+#define CPM_BDOS_BOOT (0)      // System reset
+#define CPM_BDOS_PUTCHAR (2)   // Console output of the character in E
+#define CPM_BDOS_PUTSTR (9)    // Console output of the string at DE, to '$'
+
+/*
+ * cpm_t: CP/M machine, the CPU and the console.
+ */
+typedef struct {
+    emu_state_t cpu;  // Must be first, port handlers cast back from it
+    FILE *out;        // Console output
+    int exited;       // Set by a warm boot
+    uint64_t bdos_calls;
+} cpm_t;
+
+/*
+ * cpm_bdos: Runs a BDOS call, with the function number in C.
+ *
+ * Arguments:
+ *   m      - machine
+ *
+ * Returns:
+ *   None.
+ */
+void cpm_bdos(cpm_t *m) {
+    emu_state_t *state = &m->cpu;
+    m->bdos_calls++;
+    switch (state->c) {
+        case CPM_BDOS_BOOT:
+            /* Return to the warm boot of page zero rather than the caller */
+            MEM_WRITE(SP, 0x00);
+            MEM_WRITE(SP + 1, 0x00);
+            break;
+        case CPM_BDOS_PUTCHAR:
+            fputc(state->e, m->out);
+            break;
+        case CPM_BDOS_PUTSTR: {
+            /* The string may wrap around, but not through all the memory */
+            int len = 0;
+            while (len < MEM_SIZE && MEM((uint16_t)(DE + len)) != '$') len++;
+            if (len == MEM_SIZE) {
+                fprintf(stderr, "::: No '$' ending the string at %04x\n", DE);
+                break;
+            }
+            for (int i = 0; i < len; i++) {
+                fputc(MEM((uint16_t)(DE + i)), m->out);
+            }
+            break;
+        }
+        default:
+            fprintf(stderr, "::: Unsupported BDOS function %d at %04x\n",
+                    state->c, state->pc);
+    }
+}
+
+/*
+ * cpm_write_port: Device handler for writing data to I/O ports, the traps of
+ *                 page zero and of the BDOS stub.
+ *
+ * Arguments:
+ *   state  - emulator state of the machine
+ *   port   - addr of port to write data to
+ *   data   - data to write to port
+ */
+void cpm_write_port(emu_state_t *state, uint8_t port, uint8_t data) {
+    cpm_t *m = (cpm_t *)state;
+    switch (port) {
+        case CPM_PORT_BOOT:
+            /* The core returns at the HLT that follows */
+            m->exited = 1;
+            state->stopped = 1;
+            break;
+        case CPM_PORT_BDOS:
+            cpm_bdos(m);
+            break;
+        default:
+            fprintf(stderr, "::: Wrote to port %d: 0x%02x\n", port, data);
+    }
+}
+
+/*
+ * cpm_read_port: Device handler for reading data from I/O ports, there are
+ *                none.
+ *
+ * Arguments:
+ *   state  - emulator state of the machine
+ *   port   - addr of port to read data from
+ *
+ * Returns:
+ *   0
+ */
+uint8_t cpm_read_port(emu_state_t *state, uint8_t port) {
+    (void)(state);
+    fprintf(stderr, "::: Read from port %d\n", port);
+    return 0;
+}
+
+/*
+ * cpm_free: Releases the memory of the machine.
+ *
+ * Arguments:
+ *   m      - machine to release
+ *
+ * Returns:
+ *   None.
+ */
+void cpm_free(cpm_t *m) {
+    free(m->cpu.mem);
+    m->cpu.mem = NULL;
+}
+
+/*
+ * cpm_init: Resets the machine, loads a .COM program and sets up page zero
+ *           and the BDOS stub.
+ *
+ * Arguments:
+ *   m        - machine to initialize
+ *   filename - .COM program
+ *   out      - stream the console output is written to
+ *
+ * Returns:
+ *   size of the program, or -1 if it couldn't be loaded.
+ */
+int cpm_init(cpm_t *m, char *filename, FILE *out) {
+    memset(m, 0, sizeof(*m));
+    m->out = out;
+    m->cpu.write_port = cpm_write_port;
+    m->cpu.read_port = cpm_read_port;
+    m->cpu.mem = calloc(MEM_SIZE, 1);
+    if (m->cpu.mem == NULL) return -1;
+
+    /* The program must fit below the stack, read one more byte to find out */
+    int size = -1;
+    FILE *fp = fopen(filename, "rb");
+    if (fp != NULL) {
+        size = fread(m->cpu.mem + CPM_TPA, 1, CPM_TPA_SIZE + 1, fp);
+        fclose(fp);
+    }
+    if (size < 0 || size > CPM_TPA_SIZE) {
+        fprintf(stderr, "error: Couldn't load %s\n", filename);
+        cpm_free(m);
+        return -1;
+    }
+
+    uint8_t *mem = m->cpu.mem;
+    const uint8_t page_zero[] = {0xd3, CPM_PORT_BOOT, 0x76, 0x00, 0x00,
+                                 0xc3, CPM_BDOS & 0xff, CPM_BDOS >> 8};
+    const uint8_t bdos[] = {0xd3, CPM_PORT_BDOS, 0xc9};
+    memcpy(mem, page_zero, sizeof(page_zero));
+    memcpy(mem + CPM_BDOS, bdos, sizeof(bdos));
+
+    /* Returning from the program warm boots, as with the CCP */
+    m->cpu.pc = CPM_TPA;
+    m->cpu.sp = CPM_BDOS - 2;
+    emu_hash_reset(&m->cpu);
+    return size;
+}
+
+/*
+ * cpm_run: Runs the program until it warm boots.
+ *
+ * Arguments:
+ *   m        - machine to run
+ *   core     - execution core to emulate instructions with
+ *   stop_at  - instructions after which to stop, 0 for no limit
+ *
+ * Returns:
+ *   None.
+ */
+void cpm_run(cpm_t *m, emu_core_t *core, uint64_t stop_at) {
+    while (!m->exited &&
+           (stop_at == 0 || m->cpu.instructions < stop_at)) {
+        (*core->run)(&m->cpu, m->cpu.cycles + CPM_SLICE_CYCLES);
+    }
+    fflush(m->out);
+}
@@ -1,47 +1,134 @@
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define ARG_INDENT 8
 
-#define INSTR_BASE(name, size, format...)                           \
-    int disasm_##name(unsigned char *codebuffer, unsigned int pc) { \
-        unsigned char *codebyte = &codebuffer[pc];                  \
-        printf("%04x:      ", pc);                                  \
-        printf(format);                                             \
-        printf("\n");                                               \
-        return size;                                                \
+/* Large enough for the text of any instruction, including unimplemented */
+#define DISASM_BUF_SIZE 48
+
+#define DISASM_MNEMONICS(X)                                                   \
+    X(unimplemented) X(ACI) X(ADC) X(ADD) X(ADI) X(ANA) X(ANI) X(CALL) X(CC) \
+    X(CM) X(CMA) X(CMC) X(CMP) X(CNC) X(CNZ) X(CP) X(CPE) X(CPI) X(CPO)      \
+    X(CZ) X(DAA) X(DAD) X(DCR) X(DCX) X(DI) X(EI) X(HLT) X(IN) X(INR) X(INX) \
+    X(JC) X(JM) X(JMP) X(JNC) X(JNZ) X(JP) X(JPE) X(JPO) X(JZ) X(LDA)        \
+    X(LDAX) X(LHLD) X(LXI) X(MOV) X(MVI) X(NOP) X(ORA) X(ORI) X(OUT) X(PCHL) \
+    X(POP) X(PUSH) X(RAL) X(RAR) X(RC) X(RET) X(RIM) X(RLC) X(RM) X(RNC)     \
+    X(RNZ) X(RP) X(RPE) X(RPO) X(RRC) X(RST) X(RZ) X(SBB) X(SBI) X(SHLD)     \
+    X(SIM) X(SPHL) X(STA) X(STAX) X(STC) X(SUB) X(SUI) X(XCHG) X(XRA) X(XRI) \
+    X(XTHL)
+
+#define DISASM_REGISTERS(X) \
+    X(A) X(B) X(C) X(D) X(E) X(H) X(L) X(M) X(SP) X(PSW)
+
+#define DISASM_ENUM_MNEMONIC(name) DISASM_MN_##name,
+#define DISASM_ENUM_REGISTER(name) DISASM_REG_##name,
+#define DISASM_NAME(name) #name,
+
+typedef enum {
+    DISASM_MNEMONICS(DISASM_ENUM_MNEMONIC) DISASM_NUM_MN
+} disasm_mn_t;
+typedef enum {
+    DISASM_REGISTERS(DISASM_ENUM_REGISTER) DISASM_NUM_REG
+} disasm_reg_t;
+
+const char *disasm_mnemonic_names[DISASM_NUM_MN] = {
+    DISASM_MNEMONICS(DISASM_NAME)};
+const char *disasm_register_names[DISASM_NUM_REG] = {
+    DISASM_REGISTERS(DISASM_NAME)};
+
+#include "8080_opcodes.c"
+
+typedef enum {
+    DISASM_OP_NONE,
+    DISASM_OP_REG,    // value is a disasm_reg_t
+    DISASM_OP_IMM8,   // 8 bit immediate data
+    DISASM_OP_IMM16,  // 16 bit immediate data
+    DISASM_OP_ADDR,   // 16 bit address
+    DISASM_OP_RST     // value is the restart number
+} disasm_op_type_t;
+
+typedef struct {
+    uint8_t type;  // disasm_op_type_t
+    uint16_t value;
+} disasm_operand_t;
+
+/* Structured form of a disassembled instruction */
+typedef struct {
+    uint8_t mnemonic;  // disasm_mn_t
+    uint8_t size;      // Bytes, including the opcode
+    disasm_operand_t operands[2];
+} disasm_info_t;
+
+#define OP_NONE ((disasm_operand_t){DISASM_OP_NONE, 0})
+#define OP_REG(r) ((disasm_operand_t){DISASM_OP_REG, DISASM_REG_##r})
+#define OP_IMM8 ((disasm_operand_t){DISASM_OP_IMM8, codebyte[1]})
+#define OP_IMM16 \
+    ((disasm_operand_t){DISASM_OP_IMM16, codebyte[1] | codebyte[2] << 8})
+#define OP_ADDR \
+    ((disasm_operand_t){DISASM_OP_ADDR, codebyte[1] | codebyte[2] << 8})
+#define OP_RST(num) ((disasm_operand_t){DISASM_OP_RST, num})
+
+/*
+ * Each instruction gets two handlers:
+ *   disasm_str_<name>  - formats the instruction at codebyte into a buffer,
+ *                        like snprintf, and fills its structured info
+ *   disasm_<name>      - prints the address and instruction to stdout
+ */
+#define INSTR_BASE(name, bytes, mn, op0, op1, format...)                   \
+    int disasm_str_##name(char *buf, size_t len,                           \
+                          const unsigned char *codebyte, unsigned int pc,  \
+                          disasm_info_t *info) {                           \
+        (void)(codebyte);                                                  \
+        (void)(pc);                                                        \
+        if (info != NULL) {                                                \
+            info->mnemonic = DISASM_MN_##mn;                               \
+            info->size = bytes;                                            \
+            info->operands[0] = op0;                                       \
+            info->operands[1] = op1;                                       \
+        }                                                                  \
+        return snprintf(buf, len, format);                                 \
+    }                                                                      \
+    int disasm_##name(unsigned char *codebuffer, unsigned int pc) {        \
+        char buf[DISASM_BUF_SIZE];                                         \
+        disasm_str_##name(buf, sizeof(buf), &codebuffer[pc], pc, NULL);    \
+        printf("%04x:      %s\n", pc, buf);                                \
+        return bytes;                                                      \
     }
-#define INSTR(name) INSTR_BASE(name, 1, #name)
-#define INSTR_RST(num)       \
-    INSTR_BASE(RST_##num, 1, \
-               "RST"         \
-               "%*s%s",      \
+#define INSTR(name) INSTR_BASE(name, 1, name, OP_NONE, OP_NONE, #name)
+#define INSTR_RST(num)                                        \
+    INSTR_BASE(RST_##num, 1, RST, OP_RST(num), OP_NONE,       \
+               "RST"                                          \
+               "%*s%s",                                       \
                ARG_INDENT - (int)strlen("RST"), "", #num)
-#define INSTR_R(name, r)                                                      \
-    INSTR_BASE(name##_##r, 1, #name "%*s%s", ARG_INDENT - (int)strlen(#name), \
-               "", #r)
-#define INSTR_R_R(name, r1, r2)                          \
-    INSTR_BASE(name##_##r1##_##r2, 1, #name "%*s%s, %s", \
-               ARG_INDENT - (int)strlen(#name), "", #r1, #r2)
-#define INSTR_R_D8(name, r)                          \
-    INSTR_BASE(name##_##r, 2, #name "%*s%s, 0x%02x", \
-               ARG_INDENT - (int)strlen(#name), "", #r, codebyte[1])
-#define INSTR_R_D16(name, r)                                         \
-    INSTR_BASE(name##_##r, 3, #name "%*s%s, 0x%02x%02x",             \
-               ARG_INDENT - (int)strlen(#name), "", #r, codebyte[2], \
-               codebyte[1])
-#define INSTR_D8(name)                                                      \
-    INSTR_BASE(name, 2, #name "%*s0x%02x", ARG_INDENT - (int)strlen(#name), \
-               "", codebyte[1])
-#define INSTR_D16(name)                        \
-    INSTR_BASE(name, 3, #name "%*s0x%02x%02x", \
+#define INSTR_R(name, r)                                               \
+    INSTR_BASE(name##_##r, 1, name, OP_REG(r), OP_NONE, #name "%*s%s", \
+               ARG_INDENT - (int)strlen(#name), "", #r)
+#define INSTR_R_R(name, r1, r2)                                     \
+    INSTR_BASE(name##_##r1##_##r2, 1, name, OP_REG(r1), OP_REG(r2), \
+               #name "%*s%s, %s", ARG_INDENT - (int)strlen(#name), "", #r1, \
+               #r2)
+#define INSTR_R_D8(name, r)                                        \
+    INSTR_BASE(name##_##r, 2, name, OP_REG(r), OP_IMM8,            \
+               #name "%*s%s, 0x%02x", ARG_INDENT - (int)strlen(#name), \
+               "", #r, codebyte[1])
+#define INSTR_R_D16(name, r)                                           \
+    INSTR_BASE(name##_##r, 3, name, OP_REG(r), OP_IMM16,               \
+               #name "%*s%s, 0x%02x%02x", ARG_INDENT - (int)strlen(#name), \
+               "", #r, codebyte[2], codebyte[1])
+#define INSTR_D8(name)                                                  \
+    INSTR_BASE(name, 2, name, OP_IMM8, OP_NONE, #name "%*s0x%02x",      \
+               ARG_INDENT - (int)strlen(#name), "", codebyte[1])
+#define INSTR_D16(name)                                                 \
+    INSTR_BASE(name, 3, name, OP_IMM16, OP_NONE, #name "%*s0x%02x%02x", \
                ARG_INDENT - (int)strlen(#name), "", codebyte[2], codebyte[1])
-#define INSTR_ADDR(name)                       \
-    INSTR_BASE(name, 3, #name "%*s0x%02x%02x", \
+#define INSTR_ADDR(name)                                               \
+    INSTR_BASE(name, 3, name, OP_ADDR, OP_NONE, #name "%*s0x%02x%02x", \
                ARG_INDENT - (int)strlen(#name), "", codebyte[2], codebyte[1])
 
-INSTR_BASE(unimplemented, 1, "Unimplemented opcode <%02x> at addr: %08x",
-           codebyte[0], pc)
+INSTR_BASE(unimplemented, 1, unimplemented, OP_NONE, OP_NONE,
+           "Unimplemented opcode <%02x> at addr: %08x", codebyte[0], pc)
 
 /* --- 8080 Instructions --- */
 
@@ -308,262 +395,145 @@ INSTR_RST(7)
  * Returns:
  *      Number of bytes to advance pc.
  */
+#define DISASM_HANDLER(name, ...) disasm_##name,
 int (*disasm_handlers[0x100])(unsigned char *codebuffer,
-                              unsigned int pc) = {
-    disasm_NOP,            // 0x00
-    disasm_LXI_B,          // 0x01
-    disasm_STAX_B,         // 0x02
-    disasm_INX_B,          // 0x03
-    disasm_INR_B,          // 0x04
-    disasm_DCR_B,          // 0x05
-    disasm_MVI_B,          // 0x06
-    disasm_RLC,            // 0x07
-    disasm_unimplemented,  // 0x08
-    disasm_DAD_B,          // 0x09
-    disasm_LDAX_B,         // 0x0a
-    disasm_DCX_B,          // 0x0b
-    disasm_INR_C,          // 0x0c
-    disasm_DCR_C,          // 0x0d
-    disasm_MVI_C,          // 0x0e
-    disasm_RRC,            // 0x0f
-    disasm_unimplemented,  // 0x10
-    disasm_LXI_D,          // 0x11
-    disasm_STAX_D,         // 0x12
-    disasm_INX_D,          // 0x13
-    disasm_INR_D,          // 0x14
-    disasm_DCR_D,          // 0x15
-    disasm_MVI_D,          // 0x16
-    disasm_RAL,            // 0x17
-    disasm_unimplemented,  // 0x18
-    disasm_DAD_D,          // 0x19
-    disasm_LDAX_D,         // 0x1a
-    disasm_DCX_D,          // 0x1b
-    disasm_INR_E,          // 0x1c
-    disasm_DCR_E,          // 0x1d
-    disasm_MVI_E,          // 0x1e
-    disasm_RAR,            // 0x1f
-    disasm_RIM,            // 0x20
-    disasm_LXI_H,          // 0x21
-    disasm_SHLD,           // 0x22
-    disasm_INX_H,          // 0x23
-    disasm_INR_H,          // 0x24
-    disasm_DCR_H,          // 0x25
-    disasm_MVI_H,          // 0x26
-    disasm_DAA,            // 0x27
-    disasm_unimplemented,  // 0x28
-    disasm_DAD_H,          // 0x29
-    disasm_LHLD,           // 0x2a
-    disasm_DCX_H,          // 0x2b
-    disasm_INR_L,          // 0x2c
-    disasm_DCR_L,          // 0x2d
-    disasm_MVI_L,          // 0x2e
-    disasm_CMA,            // 0x2f
-    disasm_SIM,            // 0x30
-    disasm_LXI_SP,         // 0x31
-    disasm_STA,            // 0x32
-    disasm_INX_SP,         // 0x33
-    disasm_INR_M,          // 0x34
-    disasm_DCR_M,          // 0x35
-    disasm_MVI_M,          // 0x36
-    disasm_STC,            // 0x37
-    disasm_unimplemented,  // 0x38
-    disasm_DAD_SP,         // 0x39
-    disasm_LDA,            // 0x3a
-    disasm_DCX_SP,         // 0x3b
-    disasm_INR_A,          // 0x3c
-    disasm_DCR_A,          // 0x3d
-    disasm_MVI_A,          // 0x3e
-    disasm_CMC,            // 0x3f
-    disasm_MOV_B_B,        // 0x40
-    disasm_MOV_B_C,        // 0x41
-    disasm_MOV_B_D,        // 0x42
-    disasm_MOV_B_E,        // 0x43
-    disasm_MOV_B_H,        // 0x44
-    disasm_MOV_B_L,        // 0x45
-    disasm_MOV_B_M,        // 0x46
-    disasm_MOV_B_A,        // 0x47
-    disasm_MOV_C_B,        // 0x48
-    disasm_MOV_C_C,        // 0x49
-    disasm_MOV_C_D,        // 0x4a
-    disasm_MOV_C_E,        // 0x4b
-    disasm_MOV_C_H,        // 0x4c
-    disasm_MOV_C_L,        // 0x4d
-    disasm_MOV_C_M,        // 0x4e
-    disasm_MOV_C_A,        // 0x4f
-    disasm_MOV_D_B,        // 0x50
-    disasm_MOV_D_C,        // 0x51
-    disasm_MOV_D_D,        // 0x52
-    disasm_MOV_D_E,        // 0x53
-    disasm_MOV_D_H,        // 0x54
-    disasm_MOV_D_L,        // 0x55
-    disasm_MOV_D_M,        // 0x56
-    disasm_MOV_D_A,        // 0x57
-    disasm_MOV_E_B,        // 0x58
-    disasm_MOV_E_C,        // 0x59
-    disasm_MOV_E_D,        // 0x5a
-    disasm_MOV_E_E,        // 0x5b
-    disasm_MOV_E_H,        // 0x5c
-    disasm_MOV_E_L,        // 0x5d
-    disasm_MOV_E_M,        // 0x5e
-    disasm_MOV_E_A,        // 0x5f
-    disasm_MOV_H_B,        // 0x60
-    disasm_MOV_H_C,        // 0x61
-    disasm_MOV_H_D,        // 0x62
-    disasm_MOV_H_E,        // 0x63
-    disasm_MOV_H_H,        // 0x64
-    disasm_MOV_H_L,        // 0x65
-    disasm_MOV_H_M,        // 0x66
-    disasm_MOV_H_A,        // 0x67
-    disasm_MOV_L_B,        // 0x68
-    disasm_MOV_L_C,        // 0x69
-    disasm_MOV_L_D,        // 0x6a
-    disasm_MOV_L_E,        // 0x6b
-    disasm_MOV_L_H,        // 0x6c
-    disasm_MOV_L_L,        // 0x6d
-    disasm_MOV_L_M,        // 0x6e
-    disasm_MOV_L_A,        // 0x6f
-    disasm_MOV_M_B,        // 0x70
-    disasm_MOV_M_C,        // 0x71
-    disasm_MOV_M_D,        // 0x72
-    disasm_MOV_M_E,        // 0x73
-    disasm_MOV_M_H,        // 0x74
-    disasm_MOV_M_L,        // 0x75
-    disasm_HLT,            // 0x76
-    disasm_MOV_M_A,        // 0x77
-    disasm_MOV_A_B,        // 0x78
-    disasm_MOV_A_C,        // 0x79
-    disasm_MOV_A_D,        // 0x7a
-    disasm_MOV_A_E,        // 0x7b
-    disasm_MOV_A_H,        // 0x7c
-    disasm_MOV_A_L,        // 0x7d
-    disasm_MOV_A_M,        // 0x7e
-    disasm_MOV_A_A,        // 0x7f
-    disasm_ADD_B,          // 0x80
-    disasm_ADD_C,          // 0x81
-    disasm_ADD_D,          // 0x82
-    disasm_ADD_E,          // 0x83
-    disasm_ADD_H,          // 0x84
-    disasm_ADD_L,          // 0x85
-    disasm_ADD_M,          // 0x86
-    disasm_ADD_A,          // 0x87
-    disasm_ADC_B,          // 0x88
-    disasm_ADC_C,          // 0x89
-    disasm_ADC_D,          // 0x8a
-    disasm_ADC_E,          // 0x8b
-    disasm_ADC_H,          // 0x8c
-    disasm_ADC_L,          // 0x8d
-    disasm_ADC_M,          // 0x8e
-    disasm_ADC_A,          // 0x8f
-    disasm_SUB_B,          // 0x90
-    disasm_SUB_C,          // 0x91
-    disasm_SUB_D,          // 0x92
-    disasm_SUB_E,          // 0x93
-    disasm_SUB_H,          // 0x94
-    disasm_SUB_L,          // 0x95
-    disasm_SUB_M,          // 0x96
-    disasm_SUB_A,          // 0x97
-    disasm_SBB_B,          // 0x98
-    disasm_SBB_C,          // 0x99
-    disasm_SBB_D,          // 0x9a
-    disasm_SBB_E,          // 0x9b
-    disasm_SBB_H,          // 0x9c
-    disasm_SBB_L,          // 0x9d
-    disasm_SBB_M,          // 0x9e
-    disasm_SBB_A,          // 0x9f
-    disasm_ANA_B,          // 0xa0
-    disasm_ANA_C,          // 0xa1
-    disasm_ANA_D,          // 0xa2
-    disasm_ANA_E,          // 0xa3
-    disasm_ANA_H,          // 0xa4
-    disasm_ANA_L,          // 0xa5
-    disasm_ANA_M,          // 0xa6
-    disasm_ANA_A,          // 0xa7
-    disasm_XRA_B,          // 0xa8
-    disasm_XRA_C,          // 0xa9
-    disasm_XRA_D,          // 0xaa
-    disasm_XRA_E,          // 0xab
-    disasm_XRA_H,          // 0xac
-    disasm_XRA_L,          // 0xad
-    disasm_XRA_M,          // 0xae
-    disasm_XRA_A,          // 0xaf
-    disasm_ORA_B,          // 0xb0
-    disasm_ORA_C,          // 0xb1
-    disasm_ORA_D,          // 0xb2
-    disasm_ORA_E,          // 0xb3
-    disasm_ORA_H,          // 0xb4
-    disasm_ORA_L,          // 0xb5
-    disasm_ORA_M,          // 0xb6
-    disasm_ORA_A,          // 0xb7
-    disasm_CMP_B,          // 0xb8
-    disasm_CMP_C,          // 0xb9
-    disasm_CMP_D,          // 0xba
-    disasm_CMP_E,          // 0xbb
-    disasm_CMP_H,          // 0xbc
-    disasm_CMP_L,          // 0xbd
-    disasm_CMP_M,          // 0xbe
-    disasm_CMP_A,          // 0xbf
-    disasm_RNZ,            // 0xc0
-    disasm_POP_B,          // 0xc1
-    disasm_JNZ,            // 0xc2
-    disasm_JMP,            // 0xc3
-    disasm_CNZ,            // 0xc4
-    disasm_PUSH_B,         // 0xc5
-    disasm_ADI,            // 0xc6
-    disasm_RST_0,          // 0xc7
-    disasm_RZ,             // 0xc8
-    disasm_RET,            // 0xc9
-    disasm_JZ,             // 0xca
-    disasm_unimplemented,  // 0xcb
-    disasm_CZ,             // 0xcc
-    disasm_CALL,           // 0xcd
-    disasm_ACI,            // 0xce
-    disasm_RST_1,          // 0xcf
-    disasm_RNC,            // 0xd0
-    disasm_POP_D,          // 0xd1
-    disasm_JNC,            // 0xd2
-    disasm_OUT,            // 0xd3
-    disasm_CNC,            // 0xd4
-    disasm_PUSH_D,         // 0xd5
-    disasm_SUI,            // 0xd6
-    disasm_RST_2,          // 0xd7
-    disasm_RC,             // 0xd8
-    disasm_unimplemented,  // 0xd9
-    disasm_JC,             // 0xda
-    disasm_IN,             // 0xdb
-    disasm_CC,             // 0xdc
-    disasm_unimplemented,  // 0xdd
-    disasm_SBI,            // 0xde
-    disasm_RST_3,          // 0xdf
-    disasm_RPO,            // 0xe0
-    disasm_POP_H,          // 0xe1
-    disasm_JPO,            // 0xe2
-    disasm_XTHL,           // 0xe3
-    disasm_CPO,            // 0xe4
-    disasm_PUSH_H,         // 0xe5
-    disasm_ANI,            // 0xe6
-    disasm_RST_4,          // 0xe7
-    disasm_RPE,            // 0xe8
-    disasm_PCHL,           // 0xe9
-    disasm_JPE,            // 0xea
-    disasm_XCHG,           // 0xeb
-    disasm_CPE,            // 0xec
-    disasm_unimplemented,  // 0xed
-    disasm_XRI,            // 0xee
-    disasm_RST_5,          // 0xef
-    disasm_RP,             // 0xf0
-    disasm_POP_PSW,        // 0xf1
-    disasm_JP,             // 0xf2
-    disasm_DI,             // 0xf3
-    disasm_CP,             // 0xf4
-    disasm_PUSH_PSW,       // 0xf5
-    disasm_ORI,            // 0xf6
-    disasm_RST_6,          // 0xf7
-    disasm_RM,             // 0xf8
-    disasm_SPHL,           // 0xf9
-    disasm_JM,             // 0xfa
-    disasm_EI,             // 0xfb
-    disasm_CM,             // 0xfc
-    disasm_unimplemented,  // 0xfd
-    disasm_CPI,            // 0xfe
-    disasm_RST_7           // 0xff
-};
+                              unsigned int pc) = {OPCODES(DISASM_HANDLER)};
+
+/*
+ * disasm_str_handlers: Handlers formatting an instruction into a buffer,
+ *                      indexed by opcode.
+ *
+ * Returns:
+ *      Length of the instruction text, as returned by snprintf.
+ */
+#define DISASM_STR_HANDLER(name, ...) disasm_str_##name,
+int (*disasm_str_handlers[0x100])(char *buf, size_t len,
+                                  const unsigned char *codebyte,
+                                  unsigned int pc, disasm_info_t *info) = {
+    OPCODES(DISASM_STR_HANDLER)};
+
+/*
+ * disasm_str: Formats an instruction into a buffer.
+ *
+ * Arguments:
+ *   buf        - buffer to write the text to
+ *   len        - size of the buffer
+ *   codebyte   - bytes of the instruction
+ *   pc         - address of the instruction
+ *   info       - filled with the structured form of the instruction, if not
+ *                NULL
+ *
+ * Returns:
+ *   length of the instruction text, as returned by snprintf.
+ */
+int disasm_str(char *buf, size_t len, const unsigned char *codebyte,
+               unsigned int pc, disasm_info_t *info) {
+    return (*disasm_str_handlers[codebyte[0]])(buf, len, codebyte, pc, info);
+}
+
+/*
+ * Listing cache: the formatted text of the instruction at each address, built
+ * the first time the address is disassembled. A line remembers the bytes it
+ * was formatted from, so code that changed (e.g. in RAM) is formatted again.
+ */
+typedef struct {
+    uint8_t bytes[3];
+    uint8_t valid;
+    disasm_info_t info;
+    char text[DISASM_BUF_SIZE];
+} disasm_line_t;
+
+disasm_line_t *disasm_listing;  // 0x10000 lines, allocated on first use
+
+/*
+ * disasm_line: Returns the cached text of the instruction at an address,
+ *              formatting it if needed.
+ *
+ * Arguments:
+ *   codebyte   - bytes of the instruction
+ *   pc         - address of the instruction
+ *   info       - filled with the structured form of the instruction, if not
+ *                NULL
+ *
+ * Returns:
+ *   the instruction text, valid until the address is disassembled again.
+ */
+const char *disasm_line(const unsigned char *codebyte, uint16_t pc,
+                        disasm_info_t *info) {
+    static disasm_line_t scratch;
+    if (disasm_listing == NULL) {
+        disasm_listing = calloc(0x10000, sizeof(disasm_line_t));
+    }
+    disasm_line_t *line = disasm_listing ? &disasm_listing[pc] : &scratch;
+
+    if (!line->valid || line->bytes[0] != codebyte[0] ||
+        memcmp(&line->bytes[1], &codebyte[1], line->info.size - 1) != 0) {
+        disasm_str(line->text, sizeof(line->text), codebyte, pc, &line->info);
+        memcpy(line->bytes, codebyte, line->info.size);
+        line->valid = 1;
+    }
+
+    if (info != NULL) *info = line->info;
+    return line->text;
+}
+
+/*
+ * disasm_opcode_name: Formats an opcode with placeholders for its immediate
+ *                     operands, e.g. "MVI     A, d8" or "JMP     a16".
+ *
+ * Arguments:
+ *   buf    - buffer to write the text to
+ *   len    - size of the buffer
+ *   opcode - opcode to format
+ *
+ * Returns:
+ *   length of the text, as returned by snprintf.
+ */
+int disasm_opcode_name(char *buf, size_t len, uint8_t opcode) {
+    const unsigned char codebyte[3] = {opcode, 0, 0};
+    char operands[2][8];
+    disasm_info_t info;
+
+    disasm_str(buf, len, codebyte, 0, &info);
+    if (info.mnemonic == DISASM_MN_unimplemented) {
+        return snprintf(buf, len, "-");
+    }
+
+    int num_operands = 0;
+    for (int i = 0; i < 2; i++) {
+        disasm_operand_t *op = &info.operands[i];
+        switch (op->type) {
+            case DISASM_OP_REG:
+                snprintf(operands[i], sizeof(operands[i]), "%s",
+                         disasm_register_names[op->value]);
+                break;
+            case DISASM_OP_IMM8:
+                snprintf(operands[i], sizeof(operands[i]), "d8");
+                break;
+            case DISASM_OP_IMM16:
+                snprintf(operands[i], sizeof(operands[i]), "d16");
+                break;
+            case DISASM_OP_ADDR:
+                snprintf(operands[i], sizeof(operands[i]), "a16");
+                break;
+            case DISASM_OP_RST:
+                snprintf(operands[i], sizeof(operands[i]), "%d", op->value);
+                break;
+            default:
+                continue;
+        }
+        num_operands = i + 1;
+    }
+
+    const char *mn = disasm_mnemonic_names[info.mnemonic];
+    int indent = ARG_INDENT - (int)strlen(mn);
+    switch (num_operands) {
+        case 0:
+            return snprintf(buf, len, "%s", mn);
+        case 1:
+            return snprintf(buf, len, "%s%*s%s", mn, indent, "", operands[0]);
+        default:
+            return snprintf(buf, len, "%s%*s%s, %s", mn, indent, "",
+                            operands[0], operands[1]);
+    }
+}
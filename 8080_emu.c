@@ -6,23 +6,15 @@
         exit(1);                   \
     }
 
-/* Define register pair high-order and low-order registers */
-#define RP_BC_RH (state->b)
-#define RP_BC_RL (state->c)
-#define RP_DE_RH (state->d)
-#define RP_DE_RL (state->e)
-#define RP_HL_RH (state->h)
-#define RP_HL_RL (state->l)
-#define RP_SP_RH (state->sp_h)
-#define RP_SP_RL (state->sp_l)
-
-#define BC ((RP_BC_RH << 8) | RP_BC_RL)
-#define DE ((RP_DE_RH << 8) | RP_DE_RL)
-#define HL ((RP_HL_RH << 8) | RP_HL_RL)
-#define SP ((RP_SP_RH << 8) | RP_SP_RL)
-
-#define LOW_ORDER_DATA (state->mem[state->pc + 1])
-#define HIGH_ORDER_DATA (state->mem[state->pc + 2])
+/* Register pairs, as the 16-bit view of their registers */
+#define BC (state->bc)
+#define DE (state->de)
+#define HL (state->hl)
+#define SP (state->sp)
+
+/* Operands of the instruction at PC, wrapping around the address space */
+#define LOW_ORDER_DATA (state->mem[(uint16_t)(state->pc + 1)])
+#define HIGH_ORDER_DATA (state->mem[(uint16_t)(state->pc + 2)])
 #define DATA (LOW_ORDER_DATA)
 
 #define DATA_ADDR ((HIGH_ORDER_DATA << 8) + LOW_ORDER_DATA)
@@ -30,9 +22,53 @@
 #define PCH ((state->pc >> 8) & 0xff)
 #define PCL (state->pc & 0xff)
 
+/* Extra clock periods of a conditional call or return when it is taken */
+#define EMU_COND_TAKEN_CYCLES (6)
+
 /* The content of the memory location at the specified address. */
 #define MEM(addr) (state->mem[addr])
 
+/* Pages of EMU_CODE_PAGE_SIZE bytes tracked by emu_state_t.code_pages */
+#define EMU_CODE_PAGE_SIZE (0x100)
+#define EMU_CODE_PAGES (0x10000 / EMU_CODE_PAGE_SIZE)
+
+/* Pages of EMU_DIRTY_PAGE_SIZE bytes tracked by emu_state_t.dirty_pages */
+#define EMU_DIRTY_PAGE_SIZE (0x400)
+#define EMU_DIRTY_PAGES (0x10000 / EMU_DIRTY_PAGE_SIZE)
+
+/* Entries of the log of writes to code pages */
+#define EMU_CODE_LOG_SIZE (64)
+
+/* Catches a write to a page holding cached code, with a single test of the
+ * page's flag on the common path. Every write to memory must go through it. */
+#define EMU_CHECK_CODE_WRITE(addr)                                  \
+    do {                                                            \
+        uint16_t written_ = (uint16_t)(addr);                       \
+        if (state->code_pages[written_ / EMU_CODE_PAGE_SIZE]) {     \
+            emu_code_write(state, written_);                        \
+        }                                                           \
+    } while (0)
+
+/* Writes a byte of memory, addresses wrap around at 64K. The memory hash
+ * trades the key of the address times the old byte for the new one, and the
+ * page is flagged as dirty without a branch. */
+#define MEM_WRITE(addr, val)                                      \
+    do {                                                          \
+        uint16_t addr_ = (uint16_t)(addr);                        \
+        uint8_t val_ = (val);                                     \
+        state->mem_hash +=                                        \
+            (uint64_t)(val_ - MEM(addr_)) * emu_hash_keys[addr_]; \
+        MEM(addr_) = val_;                                        \
+        state->dirty_pages[addr_ / EMU_DIRTY_PAGE_SIZE] = 1;      \
+        EMU_CHECK_CODE_WRITE(addr_);                              \
+    } while (0)
+
+/* Fingerprints between full checks of the memory hash, with
+ * -DEMU_HASH_VERIFY=<n> */
+#ifndef EMU_HASH_VERIFY
+#define EMU_HASH_VERIFY (0)
+#endif
+
 typedef struct {
     uint8_t z : 1;    // Zero
     uint8_t s : 1;    // Sign
@@ -42,25 +78,75 @@ typedef struct {
     uint8_t pad : 3;  // Pad remain bits
 } condition_flags_t;
 
-typedef struct {
+/* A register pair, both as a 16-bit value and as its high-order and
+ * low-order registers, laid out in host byte order */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define EMU_PAIR(pair, rh, rl) \
+    union {                    \
+        uint16_t pair;         \
+        struct {               \
+            uint8_t rh;        \
+            uint8_t rl;        \
+        };                     \
+    }
+#else
+#define EMU_PAIR(pair, rh, rl) \
+    union {                    \
+        uint16_t pair;         \
+        struct {               \
+            uint8_t rl;        \
+            uint8_t rh;        \
+        };                     \
+    }
+#endif
+
+typedef struct emu_state_s {
+    /* Registers and counters used by every instruction, in the first cache
+     * line */
+    uint16_t pc;               // Program counter
+    EMU_PAIR(sp, sp_h, sp_l);  // Stack pointer (high & low)
+    EMU_PAIR(bc, b, c);
+    EMU_PAIR(de, d, e);
+    EMU_PAIR(hl, h, l);
     uint8_t a;
-    uint8_t b;
-    uint8_t c;
-    uint8_t d;
-    uint8_t e;
-    uint8_t h;
-    uint8_t l;
-    uint16_t pc;   // Program counter
-    uint8_t sp_h;  // Stack pointer (high & low)
-    uint8_t sp_l;
     condition_flags_t cf;
     uint8_t interrupts_enabled;
     uint8_t halted;
-    void (*write_port)(uint8_t port, uint8_t data);
-    uint8_t (*read_port)(uint8_t port);
+    uint8_t stopped;        // Set by the machine, a halted CPU never resumes
+    uint8_t code_written;   // Set when a write invalidates cached code
+    uint64_t cycles;        // Clock periods executed since reset
+    uint64_t instructions;  // Instructions executed since reset
+    uint64_t mem_hash;      // emu_hash_mem() of mem, kept by MEM_WRITE
     uint8_t *mem;
+    /* Flags of the pages holding code cached by the execution core, whose
+     * writes go to code_write (a byte per page, so the check is a single
+     * compare) */
+    uint8_t code_pages[EMU_CODE_PAGES];
+    /* Flags of the pages written, cleared by their user (8080_fork.c) */
+    uint8_t dirty_pages[EMU_DIRTY_PAGES];
+    /* Callbacks of the machine, and the core's function invalidating the
+     * code at a written address */
+    void (*write_port)(struct emu_state_s *state, uint8_t port, uint8_t data);
+    uint8_t (*read_port)(struct emu_state_s *state, uint8_t port);
+    void (*code_write)(struct emu_state_s *state, uint16_t addr);
 } emu_state_t;
 
+/* A write to a code page */
+typedef struct {
+    uint16_t addr;          // Address written
+    uint16_t pc;            // Address of the writing instruction
+    uint64_t instructions;  // Instruction count at the write
+} emu_code_write_t;
+
+/* Writes to code pages, and a log of the last EMU_CODE_LOG_SIZE ones, of
+ * the machines run by the thread */
+_Thread_local uint64_t emu_code_writes;
+_Thread_local emu_code_write_t emu_code_log[EMU_CODE_LOG_SIZE];
+
+/* Random key of each address in the memory hash, set by emu_hash_init */
+uint64_t emu_hash_keys[0x10000];
+_Thread_local uint64_t emu_fingerprints;
+
 void print_flags(emu_state_t *state) {
     printf("%c%c%c%c%c", state->cf.z ? 'z' : '.', state->cf.s ? 's' : '.',
            state->cf.p ? 'p' : '.', state->cf.cy ? 'c' : '.',
@@ -81,18 +167,45 @@ void dump_state(emu_state_t *state) {
 }
 
 /*
- * set_sp: Sets the SP high and low order bytes
+ * emu_status_word: Packs the condition flags into the processor status word,
+ *                  as pushed by PUSH PSW
  *
  * Arguments:
- *   state  - emulator state to update
- *   sp     - the new value of the SP
+ *   state  - emulator state
+ *
+ * Returns:
+ *   the processor status word.
+ */
+uint8_t emu_status_word(emu_state_t *state) {
+    uint8_t status_word = 0x00;
+    status_word |= state->cf.cy << 0;
+    status_word |= 1U           << 1;
+    status_word |= state->cf.p  << 2;
+    status_word |= 0U           << 3;
+    status_word |= state->cf.ac << 4;
+    status_word |= 0U           << 5;
+    status_word |= state->cf.z  << 6;
+    status_word |= state->cf.s  << 7;
+    return status_word;
+}
+
+/*
+ * emu_set_status_word: Sets the condition flags from a processor status word,
+ *                      as popped by POP PSW
+ *
+ * Arguments:
+ *   state       - emulator state to update
+ *   status_word - processor status word
  *
  * Returns:
  *   None.
  */
-void set_sp(emu_state_t *state, uint16_t sp) {
-    RP_SP_RH = ((sp >> 8) & 0xff);
-    RP_SP_RL = (sp & 0xff);
+void emu_set_status_word(emu_state_t *state, uint8_t status_word) {
+    state->cf.cy = (status_word >> 0) & 1U;
+    state->cf.p  = (status_word >> 2) & 1U;
+    state->cf.ac = (status_word >> 4) & 1U;
+    state->cf.z  = (status_word >> 6) & 1U;
+    state->cf.s  = (status_word >> 7) & 1U;
 }
 
 /*
@@ -136,6 +249,149 @@ int carry(uint8_t op1, uint8_t op2, uint32_t bit_no, uint8_t cy) {
     return ((result ^ op1 ^ op2) & (1 << bit_no)) > 0;
 }
 
+/*
+ * emu_code_write: Handles a write to a page holding cached code: counts and
+ *                 logs it, and has the execution core invalidate the code at
+ *                 the address, if any.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   addr   - address written
+ *
+ * Returns:
+ *   None.
+ */
+void emu_code_write(emu_state_t *state, uint16_t addr) {
+    emu_code_write_t *entry = &emu_code_log[emu_code_writes++ %
+                                            EMU_CODE_LOG_SIZE];
+    entry->addr = addr;
+    entry->pc = state->pc;
+    entry->instructions = state->instructions;
+    if (state->code_write != NULL) state->code_write(state, addr);
+}
+
+/*
+ * emu_print_code_log: Prints the last writes to code pages.
+ *
+ * Arguments:
+ *   out    - stream to print to
+ *
+ * Returns:
+ *   None.
+ */
+void emu_print_code_log(FILE *out) {
+    uint64_t first = (emu_code_writes > EMU_CODE_LOG_SIZE)
+                         ? emu_code_writes - EMU_CODE_LOG_SIZE
+                         : 0;
+    fprintf(out, "%llu writes to code, last ones:\n",
+            (unsigned long long)emu_code_writes);
+    for (uint64_t i = first; i < emu_code_writes; i++) {
+        emu_code_write_t *entry = &emu_code_log[i % EMU_CODE_LOG_SIZE];
+        fprintf(out, "  %04x written by %04x at instruction %llu\n",
+                entry->addr, entry->pc,
+                (unsigned long long)entry->instructions);
+    }
+}
+
+/*
+ * emu_hash_mix: Mixes the bits of a 64-bit value (the splitmix64 finalizer).
+ *
+ * Arguments:
+ *   x      - value to mix
+ *
+ * Returns:
+ *   the mixed value.
+ */
+uint64_t emu_hash_mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/*
+ * emu_hash_init: Sets the keys of the memory hash, once. Must be called
+ *                before machines run on several threads.
+ *
+ * Returns:
+ *   None.
+ */
+void emu_hash_init(void) {
+    if (emu_hash_keys[0] != 0) return;
+    for (uint32_t addr = 0; addr < 0x10000; addr++) {
+        emu_hash_keys[addr] = emu_hash_mix(addr + 0x9e3779b97f4a7c15ull);
+    }
+}
+
+/*
+ * emu_hash_mem: Computes the memory hash from scratch: the sum of each byte
+ *               times the key of its address, modulo 2^64. Being a sum, it is
+ *               updated in O(1) by each write.
+ *
+ * Arguments:
+ *   mem    - 64K of memory
+ *
+ * Returns:
+ *   the hash.
+ */
+uint64_t emu_hash_mem(const uint8_t *mem) {
+    uint64_t hash = 0;
+    for (uint32_t addr = 0; addr < 0x10000; addr++) {
+        hash += mem[addr] * emu_hash_keys[addr];
+    }
+    return hash;
+}
+
+/*
+ * emu_hash_reset: Recomputes the memory hash, after the memory was written
+ *                 without MEM_WRITE (e.g. by loading a program).
+ *
+ * Arguments:
+ *   state  - emulator state
+ *
+ * Returns:
+ *   None.
+ */
+void emu_hash_reset(emu_state_t *state) {
+    emu_hash_init();
+    state->mem_hash = emu_hash_mem(state->mem);
+}
+
+/*
+ * emu_fingerprint: Hashes the machine state, the memory hash combined with
+ *                  the registers and flags, in O(1). The cycle and instruction
+ *                  counts are left out, so equal states reached at different
+ *                  times have the same fingerprint. With EMU_HASH_VERIFY, every
+ *                  EMU_HASH_VERIFY-th call checks the memory hash against a
+ *                  full recompute.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *
+ * Returns:
+ *   the fingerprint.
+ */
+uint64_t emu_fingerprint(emu_state_t *state) {
+    if (EMU_HASH_VERIFY && ++emu_fingerprints % EMU_HASH_VERIFY == 0 &&
+        state->mem_hash != emu_hash_mem(state->mem)) {
+        fprintf(stderr,
+                "error: Memory hash %016llx, %016llx when recomputed, at "
+                "instruction %llu\n",
+                (unsigned long long)state->mem_hash,
+                (unsigned long long)emu_hash_mem(state->mem),
+                (unsigned long long)state->instructions);
+        dump_state(state);
+        exit(1);
+    }
+
+    uint64_t regs = (uint64_t)state->pc | (uint64_t)SP << 16 |
+                    (uint64_t)BC << 32 | (uint64_t)DE << 48;
+    uint64_t more = (uint64_t)HL | (uint64_t)state->a << 16 |
+                    (uint64_t)emu_status_word(state) << 24 |
+                    (uint64_t)state->interrupts_enabled << 32 |
+                    (uint64_t)state->halted << 40;
+    return emu_hash_mix(emu_hash_mix(state->mem_hash ^ regs) ^ more);
+}
+
 /*
  * emu_update_zsp: Updates the Zero, Sign and Parity flags based on the result
  *                 of the operation
@@ -232,17 +488,15 @@ void emu_dcr(emu_state_t *state, uint8_t *reg) {
  *
  * Arguments:
  *   state  - emulator state
- *   rp_rh  - high order register of register pair
- *   rp_rl  - low order register of register pair
+ *   rp     - value of the register pair
  *
  * Returns:
  *   None.
  */
-void emu_dad(emu_state_t *state, uint8_t rp_rh, uint8_t rp_rl) {
-    int rl_cy = carry(RP_HL_RL, rp_rl, 8, 0);
-    RP_HL_RL += rp_rl;
-    state->cf.cy = carry(RP_HL_RH, rp_rh, 8, rl_cy);
-    RP_HL_RH += rp_rh + rl_cy;
+void emu_dad(emu_state_t *state, uint16_t rp) {
+    uint32_t sum = HL + rp;
+    state->cf.cy = sum > 0xffff;
+    HL = sum;
 }
 
 /*
@@ -428,7 +682,8 @@ void emu_jmp(emu_state_t *state, uint8_t condition) {
 }
 
 /*
- * emu_call: Push PC to stack and jump if the specified confition is true
+ * emu_call: Push the address of the next instruction to stack and jump if the
+ *           specified confition is true
  *
  * Arguments:
  *   state     - emulator state
@@ -439,10 +694,13 @@ void emu_jmp(emu_state_t *state, uint8_t condition) {
  */
 void emu_call(emu_state_t *state, uint8_t condition) {
     if (condition) {
-        MEM(SP - 1) = PCH;
-        MEM(SP - 2) = PCL;
-        set_sp(state, SP - 2);
-        emu_jmp(state, 1);
+        uint16_t ret_addr = state->pc + 3;
+        uint16_t target = DATA_ADDR;  // Fetched before the push overwrites it
+        MEM_WRITE(SP - 1, (ret_addr >> 8) & 0xff);
+        MEM_WRITE(SP - 2, ret_addr & 0xff);
+        SP -= 2;
+        state->pc = target;
+        PROFILE_CALL(state->pc, SP);
     }
 }
 
@@ -458,11 +716,9 @@ void emu_call(emu_state_t *state, uint8_t condition) {
  */
 void emu_ret(emu_state_t *state, uint8_t condition) {
     if (condition) {
-        uint8_t pcl = MEM(SP);
-        uint8_t pch = MEM(SP + 1);
-        set_sp(state, SP + 2);
-
-        state->pc = (pch << 8) + pcl;
+        PROFILE_RET(SP);
+        state->pc = MEM(SP) | MEM((uint16_t)(SP + 1)) << 8;
+        SP += 2;
     }
 }
 
@@ -478,11 +734,35 @@ void emu_ret(emu_state_t *state, uint8_t condition) {
  *   None.
  */
 void emu_rst(emu_state_t *state, uint8_t reset_num) {
-    MEM(SP - 1) = PCH;
-    MEM(SP - 2) = PCL;
-    set_sp(state, SP - 2);
-    state->interrupts_enabled = 0;
+    MEM_WRITE(SP - 1, PCH);
+    MEM_WRITE(SP - 2, PCL);
+    SP -= 2;
     state->pc = 8 * reset_num;
+    PROFILE_CALL(state->pc, SP);
+}
+
+/*
+ * emu_interrupt: Acknowledges an interrupt by executing the RST instruction
+ *                supplied by the interrupting device. PC already points to the
+ *                next instruction, which is where the handler returns to.
+ *                Interrupts are disabled until the handler re-enables them.
+ *
+ * Arguments:
+ *   state     - emulator state
+ *   reset_num - reset handler to jump to
+ *
+ * Returns:
+ *   1 if the interrupt was taken, 0 if interrupts are disabled.
+ */
+int emu_interrupt(emu_state_t *state, uint8_t reset_num) {
+    if (!state->interrupts_enabled) return 0;
+
+    state->interrupts_enabled = 0;
+    state->halted = 0;
+    PROFILE_INTERRUPT();
+    emu_rst(state, reset_num);
+    state->cycles += 11;
+    return 1;
 }
 
 EMU_UNIMPLEMENTED(emu_unimplemented)
@@ -495,20 +775,17 @@ int emu_NOP(emu_state_t *state) {
 }
 
 int emu_LXI_B(emu_state_t *state) {
-    RP_BC_RH = HIGH_ORDER_DATA;
-    RP_BC_RL = LOW_ORDER_DATA;
+    BC = DATA_ADDR;
     return 3;
 }
 
 int emu_STAX_B(emu_state_t *state) {
-    MEM(BC) = state->a;
+    MEM_WRITE(BC, state->a);
     return 1;
 }
 
 int emu_INX_B(emu_state_t *state) {
-    uint16_t new_bc = BC + 1;
-    RP_BC_RH = ((new_bc >> 8) & 0xff);
-    RP_BC_RL = (new_bc & 0xff);
+    BC++;
     return 1;
 }
 
@@ -535,7 +812,7 @@ int emu_RLC(emu_state_t *state) {
 // 0x08 --
 
 int emu_DAD_B(emu_state_t *state) {
-    emu_dad(state, RP_BC_RH, RP_BC_RL);
+    emu_dad(state, BC);
     return 1;
 }
 
@@ -545,7 +822,7 @@ int emu_LDAX_B(emu_state_t *state) {
 }
 
 int emu_DCX_B(emu_state_t *state) {
-    MEM(BC) -= 1;
+    BC--;
     return 1;
 }
 
@@ -572,20 +849,17 @@ int emu_RRC(emu_state_t *state) {
 // 0x10 --
 
 int emu_LXI_D(emu_state_t *state) {
-    RP_DE_RH = HIGH_ORDER_DATA;
-    RP_DE_RL = LOW_ORDER_DATA;
+    DE = DATA_ADDR;
     return 3;
 }
 
 int emu_STAX_D(emu_state_t *state) {
-    MEM(DE) = state->a;
+    MEM_WRITE(DE, state->a);
     return 1;
 }
 
 int emu_INX_D(emu_state_t *state) {
-    uint16_t new_de = DE + 1;
-    RP_DE_RH = ((new_de >> 8) & 0xff);
-    RP_DE_RL = (new_de & 0xff);
+    DE++;
     return 1;
 }
 
@@ -612,7 +886,7 @@ int emu_RAL(emu_state_t *state) {
 // 0x18 --
 
 int emu_DAD_D(emu_state_t *state) {
-    emu_dad(state, RP_DE_RH, RP_DE_RL);
+    emu_dad(state, DE);
     return 1;
 }
 
@@ -622,7 +896,7 @@ int emu_LDAX_D(emu_state_t *state) {
 }
 
 int emu_DCX_D(emu_state_t *state) {
-    MEM(DE) -= 1;
+    DE--;
     return 1;
 }
 
@@ -649,21 +923,18 @@ int emu_RAR(emu_state_t *state) {
 EMU_UNIMPLEMENTED(emu_RIM)
 
 int emu_LXI_H(emu_state_t *state) {
-    RP_HL_RH = HIGH_ORDER_DATA;
-    RP_HL_RL = LOW_ORDER_DATA;
+    HL = DATA_ADDR;
     return 3;
 }
 
 int emu_SHLD(emu_state_t *state) {
-    MEM(DATA_ADDR) = state->l;
-    MEM(DATA_ADDR + 1) = state->h;
+    MEM_WRITE(DATA_ADDR, state->l);
+    MEM_WRITE(DATA_ADDR + 1, state->h);
     return 3;
 }
 
 int emu_INX_H(emu_state_t *state) {
-    uint16_t new_hl = HL + 1;
-    RP_HL_RH = ((new_hl >> 8) & 0xff);
-    RP_HL_RL = (new_hl & 0xff);
+    HL++;
     return 1;
 }
 
@@ -702,18 +973,18 @@ int emu_DAA(emu_state_t *state) {
 // 0x28 --
 
 int emu_DAD_H(emu_state_t *state) {
-    emu_dad(state, RP_HL_RH, RP_HL_RL);
+    emu_dad(state, HL);
     return 1;
 }
 
 int emu_LHLD(emu_state_t *state) {
     state->l = MEM(DATA_ADDR);
-    state->h = MEM(DATA_ADDR + 1);
+    state->h = MEM((uint16_t)(DATA_ADDR + 1));
     return 3;
 }
 
 int emu_DCX_H(emu_state_t *state) {
-    MEM(HL) -= 1;
+    HL--;
     return 1;
 }
 
@@ -740,33 +1011,36 @@ int emu_CMA(emu_state_t *state) {
 EMU_UNIMPLEMENTED(emu_SIM)
 
 int emu_LXI_SP(emu_state_t *state) {
-    RP_SP_RH = HIGH_ORDER_DATA;
-    RP_SP_RL = LOW_ORDER_DATA;
+    SP = DATA_ADDR;
     return 3;
 }
 
 int emu_STA(emu_state_t *state) {
-    MEM(DATA_ADDR) = state->a;
+    MEM_WRITE(DATA_ADDR, state->a);
     return 3;
 }
 
 int emu_INX_SP(emu_state_t *state) {
-    set_sp(state, SP + 1);
+    SP++;
     return 1;
 }
 
 int emu_INR_M(emu_state_t *state) {
-    emu_inr(state, &MEM(HL));
+    uint8_t m = MEM(HL);
+    emu_inr(state, &m);
+    MEM_WRITE(HL, m);
     return 1;
 }
 
 int emu_DCR_M(emu_state_t *state) {
-    emu_dcr(state, &MEM(HL));
+    uint8_t m = MEM(HL);
+    emu_dcr(state, &m);
+    MEM_WRITE(HL, m);
     return 1;
 }
 
 int emu_MVI_M(emu_state_t *state) {
-    MEM(HL) = DATA;
+    MEM_WRITE(HL, DATA);
     return 2;
 }
 
@@ -778,7 +1052,7 @@ int emu_STC(emu_state_t *state) {
 // 0x38 --
 
 int emu_DAD_SP(emu_state_t *state) {
-    emu_dad(state, RP_SP_RH, RP_SP_RL);
+    emu_dad(state, SP);
     return 1;
 }
 
@@ -788,7 +1062,7 @@ int emu_LDA(emu_state_t *state) {
 }
 
 int emu_DCX_SP(emu_state_t *state) {
-    MEM(SP) -= 1;
+    SP--;
     return 1;
 }
 
@@ -1053,32 +1327,32 @@ int emu_MOV_L_A(emu_state_t *state) {
 }
 
 int emu_MOV_M_B(emu_state_t *state) {
-    MEM(HL) = state->b;
+    MEM_WRITE(HL, state->b);
     return 1;
 }
 
 int emu_MOV_M_C(emu_state_t *state) {
-    MEM(HL) = state->c;
+    MEM_WRITE(HL, state->c);
     return 1;
 }
 
 int emu_MOV_M_D(emu_state_t *state) {
-    MEM(HL) = state->d;
+    MEM_WRITE(HL, state->d);
     return 1;
 }
 
 int emu_MOV_M_E(emu_state_t *state) {
-    MEM(HL) = state->e;
+    MEM_WRITE(HL, state->e);
     return 1;
 }
 
 int emu_MOV_M_H(emu_state_t *state) {
-    MEM(HL) = state->h;
+    MEM_WRITE(HL, state->h);
     return 1;
 }
 
 int emu_MOV_M_L(emu_state_t *state) {
-    MEM(HL) = state->l;
+    MEM_WRITE(HL, state->l);
     return 1;
 }
 
@@ -1088,7 +1362,7 @@ int emu_HLT(emu_state_t *state) {
 }
 
 int emu_MOV_M_A(emu_state_t *state) {
-    MEM(HL) = state->a;
+    MEM_WRITE(HL, state->a);
     return 1;
 }
 
@@ -1455,13 +1729,13 @@ int emu_CMP_A(emu_state_t *state) {
 int emu_RNZ(emu_state_t *state) {
     int r = !state->cf.z;
     emu_ret(state, r);
-    return (r) ? 3 : 1;
+    if (r) state->cycles += EMU_COND_TAKEN_CYCLES;
+    return (r) ? 0 : 1;
 }
 
 int emu_POP_B(emu_state_t *state) {
-    RP_BC_RL = MEM(SP);
-    RP_BC_RH = MEM(SP + 1);
-    set_sp(state, SP + 2);
+    BC = MEM(SP) | MEM((uint16_t)(SP + 1)) << 8;
+    SP += 2;
     return 1;
 }
 
@@ -1479,13 +1753,14 @@ int emu_JMP(emu_state_t *state) {
 int emu_CNZ(emu_state_t *state) {
     int c = !state->cf.z;
     emu_call(state, c);
+    if (c) state->cycles += EMU_COND_TAKEN_CYCLES;
     return (c) ? 0 : 3;
 }
 
 int emu_PUSH_B(emu_state_t *state) {
-    MEM(SP - 1) = RP_BC_RH;
-    MEM(SP - 2) = RP_BC_RL;
-    set_sp(state, SP - 2);
+    MEM_WRITE(SP - 1, BC >> 8);
+    MEM_WRITE(SP - 2, BC & 0xff);
+    SP -= 2;
     return 1;
 }
 
@@ -1495,6 +1770,7 @@ int emu_ADI(emu_state_t *state) {
 }
 
 int emu_RST_0(emu_state_t *state) {
+    state->pc += 1;
     emu_rst(state, 0);
     return 0;
 }
@@ -1502,12 +1778,13 @@ int emu_RST_0(emu_state_t *state) {
 int emu_RZ(emu_state_t *state) {
     int r = state->cf.z;
     emu_ret(state, r);
-    return (r) ? 3 : 1;
+    if (r) state->cycles += EMU_COND_TAKEN_CYCLES;
+    return (r) ? 0 : 1;
 }
 
 int emu_RET(emu_state_t *state) {
     emu_ret(state, 1);
-    return 3;
+    return 0;
 }
 
 int emu_JZ(emu_state_t *state) {
@@ -1521,6 +1798,7 @@ int emu_JZ(emu_state_t *state) {
 int emu_CZ(emu_state_t *state) {
     int c = state->cf.z;
     emu_call(state, c);
+    if (c) state->cycles += EMU_COND_TAKEN_CYCLES;
     return (c) ? 0 : 3;
 }
 
@@ -1535,6 +1813,7 @@ int emu_ACI(emu_state_t *state) {
 }
 
 int emu_RST_1(emu_state_t *state) {
+    state->pc += 1;
     emu_rst(state, 1);
     return 0;
 }
@@ -1542,13 +1821,13 @@ int emu_RST_1(emu_state_t *state) {
 int emu_RNC(emu_state_t *state) {
     int r = !state->cf.cy;
     emu_ret(state, r);
-    return (r) ? 3 : 1;
+    if (r) state->cycles += EMU_COND_TAKEN_CYCLES;
+    return (r) ? 0 : 1;
 }
 
 int emu_POP_D(emu_state_t *state) {
-    RP_DE_RL = MEM(SP);
-    RP_DE_RH = MEM(SP + 1);
-    set_sp(state, SP + 2);
+    DE = MEM(SP) | MEM((uint16_t)(SP + 1)) << 8;
+    SP += 2;
     return 1;
 }
 
@@ -1560,20 +1839,23 @@ int emu_JNC(emu_state_t *state) {
 
 int emu_OUT(emu_state_t *state) {
     /* Write content of accumulator to specified port */
-    (*state->write_port)(DATA, state->a);
+    PROFILE_SUBSYSTEM(PROF_IO);
+    (*state->write_port)(state, DATA, state->a);
+    PROFILE_SUBSYSTEM(PROF_CPU);
     return 2;
 }
 
 int emu_CNC(emu_state_t *state) {
     int c = !state->cf.cy;
     emu_call(state, c);
+    if (c) state->cycles += EMU_COND_TAKEN_CYCLES;
     return (c) ? 0 : 3;
 }
 
 int emu_PUSH_D(emu_state_t *state) {
-    MEM(SP - 1) = RP_DE_RH;
-    MEM(SP - 2) = RP_DE_RL;
-    set_sp(state, SP - 2);
+    MEM_WRITE(SP - 1, DE >> 8);
+    MEM_WRITE(SP - 2, DE & 0xff);
+    SP -= 2;
     return 1;
 }
 
@@ -1583,6 +1865,7 @@ int emu_SUI(emu_state_t *state) {
 }
 
 int emu_RST_2(emu_state_t *state) {
+    state->pc += 1;
     emu_rst(state, 2);
     return 0;
 }
@@ -1590,7 +1873,8 @@ int emu_RST_2(emu_state_t *state) {
 int emu_RC(emu_state_t *state) {
     int r = state->cf.cy;
     emu_ret(state, r);
-    return (r) ? 3 : 1;
+    if (r) state->cycles += EMU_COND_TAKEN_CYCLES;
+    return (r) ? 0 : 1;
 }
 
 // 0xd9 --
@@ -1603,13 +1887,16 @@ int emu_JC(emu_state_t *state) {
 
 int emu_IN(emu_state_t *state) {
     /* Move the data from specified port to the accumulator */
-    state->a = (*state->read_port)(DATA);
+    PROFILE_SUBSYSTEM(PROF_IO);
+    state->a = (*state->read_port)(state, DATA);
+    PROFILE_SUBSYSTEM(PROF_CPU);
     return 2;
 }
 
 int emu_CC(emu_state_t *state) {
     int c = state->cf.cy;
     emu_call(state, c);
+    if (c) state->cycles += EMU_COND_TAKEN_CYCLES;
     return (c) ? 0 : 3;
 }
 
@@ -1621,6 +1908,7 @@ int emu_SBI(emu_state_t *state) {
 }
 
 int emu_RST_3(emu_state_t *state) {
+    state->pc += 1;
     emu_rst(state, 3);
     return 0;
 }
@@ -1629,13 +1917,13 @@ int emu_RPO(emu_state_t *state) {
     /* Ret if parity odd (P = 0) */
     int r = state->cf.p == 0;
     emu_ret(state, r);
-    return (r) ? 3 : 1;
+    if (r) state->cycles += EMU_COND_TAKEN_CYCLES;
+    return (r) ? 0 : 1;
 }
 
 int emu_POP_H(emu_state_t *state) {
-    RP_HL_RL = MEM(SP);
-    RP_HL_RH = MEM(SP + 1);
-    set_sp(state, SP + 2);
+    HL = MEM(SP) | MEM((uint16_t)(SP + 1)) << 8;
+    SP += 2;
     return 1;
 }
 
@@ -1647,12 +1935,10 @@ int emu_JPO(emu_state_t *state) {
 }
 
 int emu_XTHL(emu_state_t *state) {
-    uint8_t tmp_l = state->l;
-    uint8_t tmp_h = state->h;
-    state->l = MEM(SP);
-    state->h = MEM(SP + 1);
-    MEM(SP) = tmp_l;
-    MEM(SP + 1) = tmp_h;
+    uint16_t tmp = HL;
+    HL = MEM(SP) | MEM((uint16_t)(SP + 1)) << 8;
+    MEM_WRITE(SP, tmp & 0xff);
+    MEM_WRITE(SP + 1, tmp >> 8);
     return 1;
 }
 
@@ -1660,13 +1946,14 @@ int emu_CPO(emu_state_t *state) {
     /* Call if parity odd (P = 0) */
     int c = state->cf.p == 0;
     emu_call(state, c);
+    if (c) state->cycles += EMU_COND_TAKEN_CYCLES;
     return (c) ? 0 : 3;
 }
 
 int emu_PUSH_H(emu_state_t *state) {
-    MEM(SP - 1) = RP_HL_RH;
-    MEM(SP - 2) = RP_HL_RL;
-    set_sp(state, SP - 2);
+    MEM_WRITE(SP - 1, HL >> 8);
+    MEM_WRITE(SP - 2, HL & 0xff);
+    SP -= 2;
     return 1;
 }
 
@@ -1677,6 +1964,7 @@ int emu_ANI(emu_state_t *state) {
 }
 
 int emu_RST_4(emu_state_t *state) {
+    state->pc += 1;
     emu_rst(state, 4);
     return 0;
 }
@@ -1685,11 +1973,12 @@ int emu_RPE(emu_state_t *state) {
     /* Ret if parity even (P = 1) */
     int r = state->cf.p == 1;
     emu_ret(state, r);
-    return (r) ? 3 : 1;
+    if (r) state->cycles += EMU_COND_TAKEN_CYCLES;
+    return (r) ? 0 : 1;
 }
 
 int emu_PCHL(emu_state_t *state) {
-    state->pc = (state->h << 8) + state->l;
+    state->pc = HL;
     return 0;
 }
 
@@ -1701,13 +1990,9 @@ int emu_JPE(emu_state_t *state) {
 }
 
 int emu_XCHG(emu_state_t *state) {
-    uint8_t tmp_h = state->h;
-    uint8_t tmp_l = state->l;
-
-    state->h = state->d;
-    state->l = state->e;
-    state->d = tmp_h;
-    state->e = tmp_l;
+    uint16_t tmp = HL;
+    HL = DE;
+    DE = tmp;
     return 1;
 }
 
@@ -1715,6 +2000,7 @@ int emu_CPE(emu_state_t *state) {
     /* Call if parity even (P = 1) */
     int c = state->cf.p == 1;
     emu_call(state, c);
+    if (c) state->cycles += EMU_COND_TAKEN_CYCLES;
     return (c) ? 0 : 3;
 }
 
@@ -1726,6 +2012,7 @@ int emu_XRI(emu_state_t *state) {
 }
 
 int emu_RST_5(emu_state_t *state) {
+    state->pc += 1;
     emu_rst(state, 5);
     return 0;
 }
@@ -1733,19 +2020,14 @@ int emu_RST_5(emu_state_t *state) {
 int emu_RP(emu_state_t *state) {
     int r = !state->cf.s;
     emu_ret(state, r);
-    return (r) ? 3 : 1;
+    if (r) state->cycles += EMU_COND_TAKEN_CYCLES;
+    return (r) ? 0 : 1;
 }
 
 int emu_POP_PSW(emu_state_t *state) {
-    uint8_t status_word = MEM(SP);
-    state->cf.cy = (status_word >> 0) & 1U;
-    state->cf.p  = (status_word >> 2) & 1U;
-    state->cf.ac = (status_word >> 4) & 1U;
-    state->cf.z  = (status_word >> 6) & 1U;
-    state->cf.s  = (status_word >> 7) & 1U;
-
-    state->a = MEM(SP + 1);
-    set_sp(state, SP + 2);
+    emu_set_status_word(state, MEM(SP));
+    state->a = MEM((uint16_t)(SP + 1));
+    SP += 2;
     return 1;
 }
 
@@ -1763,23 +2045,14 @@ int emu_DI(emu_state_t *state) {
 int emu_CP(emu_state_t *state) {
     int c = !state->cf.s;
     emu_call(state, c);
+    if (c) state->cycles += EMU_COND_TAKEN_CYCLES;
     return (c) ? 0 : 3;
 }
 
 int emu_PUSH_PSW(emu_state_t *state) {
-    uint8_t status_word = 0x00;
-    status_word |= state->cf.cy << 0;
-    status_word |= 1U           << 1;
-    status_word |= state->cf.p  << 2;
-    status_word |= 0U           << 3;
-    status_word |= state->cf.ac << 4;
-    status_word |= 0U           << 5;
-    status_word |= state->cf.z  << 6;
-    status_word |= state->cf.s  << 7;
-
-    MEM(SP - 1) = state->a;
-    MEM(SP - 2) = status_word;
-    set_sp(state, SP - 2);
+    MEM_WRITE(SP - 1, state->a);
+    MEM_WRITE(SP - 2, emu_status_word(state));
+    SP -= 2;
     return 1;
 }
 
@@ -1789,6 +2062,7 @@ int emu_ORI(emu_state_t *state) {
 }
 
 int emu_RST_6(emu_state_t *state) {
+    state->pc += 1;
     emu_rst(state, 6);
     return 0;
 }
@@ -1796,11 +2070,12 @@ int emu_RST_6(emu_state_t *state) {
 int emu_RM(emu_state_t *state) {
     int r = state->cf.s;
     emu_ret(state, r);
-    return (r) ? 3 : 1;
+    if (r) state->cycles += EMU_COND_TAKEN_CYCLES;
+    return (r) ? 0 : 1;
 }
 
 int emu_SPHL(emu_state_t *state) {
-    set_sp(state, HL);
+    SP = HL;
     return 1;
 }
 
@@ -1818,6 +2093,7 @@ int emu_EI(emu_state_t *state) {
 int emu_CM(emu_state_t *state) {
     int c = state->cf.s;
     emu_call(state, c);
+    if (c) state->cycles += EMU_COND_TAKEN_CYCLES;
     return (c) ? 0 : 3;
 }
 
@@ -1829,6 +2105,7 @@ int emu_CPI(emu_state_t *state) {
 }
 
 int emu_RST_7(emu_state_t *state) {
+    state->pc += 1;
     emu_rst(state, 7);
     return 0;
 }
@@ -1842,261 +2119,58 @@ int emu_RST_7(emu_state_t *state) {
  * Returns:
  *   Number of bytes to advance pc.
  */
-int (*emu_handlers[0x100])(emu_state_t *state) = {
-    emu_NOP,            // 0x00
-    emu_LXI_B,          // 0x01
-    emu_STAX_B,         // 0x02
-    emu_INX_B,          // 0x03
-    emu_INR_B,          // 0x04
-    emu_DCR_B,          // 0x05
-    emu_MVI_B,          // 0x06
-    emu_RLC,            // 0x07
-    emu_unimplemented,  // 0x08
-    emu_DAD_B,          // 0x09
-    emu_LDAX_B,         // 0x0a
-    emu_DCX_B,          // 0x0b
-    emu_INR_C,          // 0x0c
-    emu_DCR_C,          // 0x0d
-    emu_MVI_C,          // 0x0e
-    emu_RRC,            // 0x0f
-    emu_unimplemented,  // 0x10
-    emu_LXI_D,          // 0x11
-    emu_STAX_D,         // 0x12
-    emu_INX_D,          // 0x13
-    emu_INR_D,          // 0x14
-    emu_DCR_D,          // 0x15
-    emu_MVI_D,          // 0x16
-    emu_RAL,            // 0x17
-    emu_unimplemented,  // 0x18
-    emu_DAD_D,          // 0x19
-    emu_LDAX_D,         // 0x1a
-    emu_DCX_D,          // 0x1b
-    emu_INR_E,          // 0x1c
-    emu_DCR_E,          // 0x1d
-    emu_MVI_E,          // 0x1e
-    emu_RAR,            // 0x1f
-    emu_RIM,            // 0x20
-    emu_LXI_H,          // 0x21
-    emu_SHLD,           // 0x22
-    emu_INX_H,          // 0x23
-    emu_INR_H,          // 0x24
-    emu_DCR_H,          // 0x25
-    emu_MVI_H,          // 0x26
-    emu_DAA,            // 0x27
-    emu_unimplemented,  // 0x28
-    emu_DAD_H,          // 0x29
-    emu_LHLD,           // 0x2a
-    emu_DCX_H,          // 0x2b
-    emu_INR_L,          // 0x2c
-    emu_DCR_L,          // 0x2d
-    emu_MVI_L,          // 0x2e
-    emu_CMA,            // 0x2f
-    emu_SIM,            // 0x30
-    emu_LXI_SP,         // 0x31
-    emu_STA,            // 0x32
-    emu_INX_SP,         // 0x33
-    emu_INR_M,          // 0x34
-    emu_DCR_M,          // 0x35
-    emu_MVI_M,          // 0x36
-    emu_STC,            // 0x37
-    emu_unimplemented,  // 0x38
-    emu_DAD_SP,         // 0x39
-    emu_LDA,            // 0x3a
-    emu_DCX_SP,         // 0x3b
-    emu_INR_A,          // 0x3c
-    emu_DCR_A,          // 0x3d
-    emu_MVI_A,          // 0x3e
-    emu_CMC,            // 0x3f
-    emu_MOV_B_B,        // 0x40
-    emu_MOV_B_C,        // 0x41
-    emu_MOV_B_D,        // 0x42
-    emu_MOV_B_E,        // 0x43
-    emu_MOV_B_H,        // 0x44
-    emu_MOV_B_L,        // 0x45
-    emu_MOV_B_M,        // 0x46
-    emu_MOV_B_A,        // 0x47
-    emu_MOV_C_B,        // 0x48
-    emu_MOV_C_C,        // 0x49
-    emu_MOV_C_D,        // 0x4a
-    emu_MOV_C_E,        // 0x4b
-    emu_MOV_C_H,        // 0x4c
-    emu_MOV_C_L,        // 0x4d
-    emu_MOV_C_M,        // 0x4e
-    emu_MOV_C_A,        // 0x4f
-    emu_MOV_D_B,        // 0x50
-    emu_MOV_D_C,        // 0x51
-    emu_MOV_D_D,        // 0x52
-    emu_MOV_D_E,        // 0x53
-    emu_MOV_D_H,        // 0x54
-    emu_MOV_D_L,        // 0x55
-    emu_MOV_D_M,        // 0x56
-    emu_MOV_D_A,        // 0x57
-    emu_MOV_E_B,        // 0x58
-    emu_MOV_E_C,        // 0x59
-    emu_MOV_E_D,        // 0x5a
-    emu_MOV_E_E,        // 0x5b
-    emu_MOV_E_H,        // 0x5c
-    emu_MOV_E_L,        // 0x5d
-    emu_MOV_E_M,        // 0x5e
-    emu_MOV_E_A,        // 0x5f
-    emu_MOV_H_B,        // 0x60
-    emu_MOV_H_C,        // 0x61
-    emu_MOV_H_D,        // 0x62
-    emu_MOV_H_E,        // 0x63
-    emu_MOV_H_H,        // 0x64
-    emu_MOV_H_L,        // 0x65
-    emu_MOV_H_M,        // 0x66
-    emu_MOV_H_A,        // 0x67
-    emu_MOV_L_B,        // 0x68
-    emu_MOV_L_C,        // 0x69
-    emu_MOV_L_D,        // 0x6a
-    emu_MOV_L_E,        // 0x6b
-    emu_MOV_L_H,        // 0x6c
-    emu_MOV_L_L,        // 0x6d
-    emu_MOV_L_M,        // 0x6e
-    emu_MOV_L_A,        // 0x6f
-    emu_MOV_M_B,        // 0x70
-    emu_MOV_M_C,        // 0x71
-    emu_MOV_M_D,        // 0x72
-    emu_MOV_M_E,        // 0x73
-    emu_MOV_M_H,        // 0x74
-    emu_MOV_M_L,        // 0x75
-    emu_HLT,            // 0x76
-    emu_MOV_M_A,        // 0x77
-    emu_MOV_A_B,        // 0x78
-    emu_MOV_A_C,        // 0x79
-    emu_MOV_A_D,        // 0x7a
-    emu_MOV_A_E,        // 0x7b
-    emu_MOV_A_H,        // 0x7c
-    emu_MOV_A_L,        // 0x7d
-    emu_MOV_A_M,        // 0x7e
-    emu_MOV_A_A,        // 0x7f
-    emu_ADD_B,          // 0x80
-    emu_ADD_C,          // 0x81
-    emu_ADD_D,          // 0x82
-    emu_ADD_E,          // 0x83
-    emu_ADD_H,          // 0x84
-    emu_ADD_L,          // 0x85
-    emu_ADD_M,          // 0x86
-    emu_ADD_A,          // 0x87
-    emu_ADC_B,          // 0x88
-    emu_ADC_C,          // 0x89
-    emu_ADC_D,          // 0x8a
-    emu_ADC_E,          // 0x8b
-    emu_ADC_H,          // 0x8c
-    emu_ADC_L,          // 0x8d
-    emu_ADC_M,          // 0x8e
-    emu_ADC_A,          // 0x8f
-    emu_SUB_B,          // 0x90
-    emu_SUB_C,          // 0x91
-    emu_SUB_D,          // 0x92
-    emu_SUB_E,          // 0x93
-    emu_SUB_H,          // 0x94
-    emu_SUB_L,          // 0x95
-    emu_SUB_M,          // 0x96
-    emu_SUB_A,          // 0x97
-    emu_SBB_B,          // 0x98
-    emu_SBB_C,          // 0x99
-    emu_SBB_D,          // 0x9a
-    emu_SBB_E,          // 0x9b
-    emu_SBB_H,          // 0x9c
-    emu_SBB_L,          // 0x9d
-    emu_SBB_M,          // 0x9e
-    emu_SBB_A,          // 0x9f
-    emu_ANA_B,          // 0xa0
-    emu_ANA_C,          // 0xa1
-    emu_ANA_D,          // 0xa2
-    emu_ANA_E,          // 0xa3
-    emu_ANA_H,          // 0xa4
-    emu_ANA_L,          // 0xa5
-    emu_ANA_M,          // 0xa6
-    emu_ANA_A,          // 0xa7
-    emu_XRA_B,          // 0xa8
-    emu_XRA_C,          // 0xa9
-    emu_XRA_D,          // 0xaa
-    emu_XRA_E,          // 0xab
-    emu_XRA_H,          // 0xac
-    emu_XRA_L,          // 0xad
-    emu_XRA_M,          // 0xae
-    emu_XRA_A,          // 0xaf
-    emu_ORA_B,          // 0xb0
-    emu_ORA_C,          // 0xb1
-    emu_ORA_D,          // 0xb2
-    emu_ORA_E,          // 0xb3
-    emu_ORA_H,          // 0xb4
-    emu_ORA_L,          // 0xb5
-    emu_ORA_M,          // 0xb6
-    emu_ORA_A,          // 0xb7
-    emu_CMP_B,          // 0xb8
-    emu_CMP_C,          // 0xb9
-    emu_CMP_D,          // 0xba
-    emu_CMP_E,          // 0xbb
-    emu_CMP_H,          // 0xbc
-    emu_CMP_L,          // 0xbd
-    emu_CMP_M,          // 0xbe
-    emu_CMP_A,          // 0xbf
-    emu_RNZ,            // 0xc0
-    emu_POP_B,          // 0xc1
-    emu_JNZ,            // 0xc2
-    emu_JMP,            // 0xc3
-    emu_CNZ,            // 0xc4
-    emu_PUSH_B,         // 0xc5
-    emu_ADI,            // 0xc6
-    emu_RST_0,          // 0xc7
-    emu_RZ,             // 0xc8
-    emu_RET,            // 0xc9
-    emu_JZ,             // 0xca
-    emu_unimplemented,  // 0xcb
-    emu_CZ,             // 0xcc
-    emu_CALL,           // 0xcd
-    emu_ACI,            // 0xce
-    emu_RST_1,          // 0xcf
-    emu_RNC,            // 0xd0
-    emu_POP_D,          // 0xd1
-    emu_JNC,            // 0xd2
-    emu_OUT,            // 0xd3
-    emu_CNC,            // 0xd4
-    emu_PUSH_D,         // 0xd5
-    emu_SUI,            // 0xd6
-    emu_RST_2,          // 0xd7
-    emu_RC,             // 0xd8
-    emu_unimplemented,  // 0xd9
-    emu_JC,             // 0xda
-    emu_IN,             // 0xdb
-    emu_CC,             // 0xdc
-    emu_unimplemented,  // 0xdd
-    emu_SBI,            // 0xde
-    emu_RST_3,          // 0xdf
-    emu_RPO,            // 0xe0
-    emu_POP_H,          // 0xe1
-    emu_JPO,            // 0xe2
-    emu_XTHL,           // 0xe3
-    emu_CPO,            // 0xe4
-    emu_PUSH_H,         // 0xe5
-    emu_ANI,            // 0xe6
-    emu_RST_4,          // 0xe7
-    emu_RPE,            // 0xe8
-    emu_PCHL,           // 0xe9
-    emu_JPE,            // 0xea
-    emu_XCHG,           // 0xeb
-    emu_CPE,            // 0xec
-    emu_unimplemented,  // 0xed
-    emu_XRI,            // 0xee
-    emu_RST_5,          // 0xef
-    emu_RP,             // 0xf0
-    emu_POP_PSW,        // 0xf1
-    emu_JP,             // 0xf2
-    emu_DI,             // 0xf3
-    emu_CP,             // 0xf4
-    emu_PUSH_PSW,       // 0xf5
-    emu_ORI,            // 0xf6
-    emu_RST_6,          // 0xf7
-    emu_RM,             // 0xf8
-    emu_SPHL,           // 0xf9
-    emu_JM,             // 0xfa
-    emu_EI,             // 0xfb
-    emu_CM,             // 0xfc
-    emu_unimplemented,  // 0xfd
-    emu_CPI,            // 0xfe
-    emu_RST_7           // 0xff
-};
+#define EMU_HANDLER(name, ...) emu_##name,
+int (*emu_handlers[0x100])(emu_state_t *state) = {OPCODES(EMU_HANDLER)};
+
+/*
+ * emu_cycles: Clock periods (states) taken by each instruction, indexed by
+ *             opcode. Conditional calls and returns are listed with their
+ *             not-taken duration, the handlers add EMU_COND_TAKEN_CYCLES when
+ *             the branch is taken.
+ */
+#define EMU_CYCLES(name, mn, size, cycles, ...) cycles,
+uint8_t emu_cycles[0x100] = {OPCODES(EMU_CYCLES)};
+
+/*
+ * emu_step: Emulates the instruction at PC and accounts for its duration. A
+ *           halted CPU idles until the next interrupt.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *
+ * Returns:
+ *   None.
+ */
+void emu_step(emu_state_t *state) {
+    if (state->halted) {
+        state->cycles += 4;
+        return;
+    }
+
+    uint16_t pc = state->pc;
+    uint8_t opcode = state->mem[pc];
+    uint64_t start = state->cycles;
+    state->cycles += emu_cycles[opcode];
+    state->instructions++;
+    state->pc += (*emu_handlers[opcode])(state);
+    PROFILE_INSTR(pc, opcode, state->cycles - start);
+}
+
+/*
+ * emu_run: Emulates instructions until the given cycle count is reached, or
+ *          until the CPU halts once the machine stopped it, using table
+ *          dispatch through emu_handlers.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   until  - value of state->cycles at which to stop
+ *
+ * Returns:
+ *   None.
+ */
+void emu_run(emu_state_t *state, uint64_t until) {
+    while (state->cycles < until) {
+        if (state->halted && state->stopped) break;
+        emu_step(state);
+    }
+}
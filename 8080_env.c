@@ -0,0 +1,419 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Batched environment API, to drive many Space Invaders machines from a
+ * learning loop. env_step runs a batch of instances on a pool of threads:
+ * each instance holds its action (the bits of input ports 1 and 2) for a
+ * number of frames, then its last frame is downsampled from the video RAM
+ * and its observation vector read from the RAM of the game, into arrays of
+ * the caller indexed by position in the batch. Nothing is allocated after
+ * env_new.
+ *
+ * Frames are only decoded when asked for: skipped frames never are, and a
+ * step without a frame array decodes none (env_render decodes one later).
+ *
+ * The instances run on the table core: the caches of the other cores are
+ * global to the process.
+ */
+
+#define ENV_MAX_THREADS (64)
+
+/* Upright screen, the video RAM holds it rotated (see 8080_export.c) */
+#define ENV_SCREEN_WIDTH (SCREEN_HEIGHT)
+#define ENV_SCREEN_HEIGHT (SCREEN_WIDTH)
+
+/* Observation vector of an instance */
+#define ENV_OBS_SCORE (0)  // Score of player 1
+#define ENV_OBS_SHIPS (1)  // Ships left to player 1
+#define ENV_OBS_SIZE (2)
+
+typedef struct env_s env_t;
+
+/*
+ * env_t: Instances and the thread pool stepping them.
+ *
+ *   num_instances - number of instances
+ *   scale         - downsampling factor of the frames
+ *   width, height - size of a downsampled frame, a byte per pixel
+ *   bits          - number of bits set in each byte
+ *   levels        - pixel of each number of lit pixels in a square
+ *   machines      - instances
+ *   stamps        - generation of the last env_step stepping each instance
+ *   generation    - generation of the current env_step
+ *   rom           - ROM image, copied by env_reset
+ *   core          - execution core of the instances
+ *   num_threads   - threads stepping a batch, with the calling one
+ *   threads       - the other threads
+ *   lock          - held while the threads are created
+ *   batch, ...    - arguments of the current env_step
+ *   next          - next position of the batch to step
+ */
+struct env_s {
+    int num_instances;
+    int scale;
+    int width;
+    int height;
+    uint8_t bits[256];
+    uint8_t levels[8 * 8 + 1];
+    invaders_t *machines;
+    uint32_t *stamps;
+    uint32_t generation;
+    uint8_t rom[ROM_SIZE];
+    emu_core_t *core;
+
+    int num_threads;
+    pthread_t threads[ENV_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+    int stop;
+
+    const int *batch;
+    int batch_size;
+    const uint8_t *actions;
+    int frames_per_step;
+    uint8_t *frames;
+    int32_t *obs;
+    atomic_int next;
+};
+
+/*
+ * env_frame_size: Size of a downsampled frame.
+ *
+ * Arguments:
+ *   env    - environment
+ *
+ * Returns:
+ *   the size in bytes.
+ */
+size_t env_frame_size(const env_t *env) {
+    return (size_t)env->width * env->height;
+}
+
+/*
+ * ENV_RENDER: Defines env_render_<scale>, the downsampling of a screen for a
+ *             scale known at compile time, so its loops unroll. Each row of
+ *             bytes of the video RAM holds 8 / <scale> rows of pixels from
+ *             the bottom, each byte a column.
+ */
+#define ENV_RENDER(s)                                                        \
+    void env_render_##s(const env_t *env, const uint8_t *vram,               \
+                        uint8_t *out) {                                      \
+        const uint8_t *bits = env->bits, *levels = env->levels;              \
+        for (int byte = 0; byte < ENV_SCREEN_HEIGHT / 8; byte++) {           \
+            uint8_t *bottom =                                                \
+                out + (ENV_SCREEN_HEIGHT / s - 1 - byte * 8 / s) *           \
+                          (ENV_SCREEN_WIDTH / s);                            \
+            const uint8_t *column = vram + byte;                             \
+            for (int x = 0; x < ENV_SCREEN_WIDTH / s; x++) {                 \
+                uint8_t *p = bottom + x;                                     \
+                for (int bit = 0; bit < 8; bit += s) {                       \
+                    int lit = 0;                                             \
+                    for (int c = 0; c < s; c++) {                            \
+                        lit += bits[column[c * (ENV_SCREEN_HEIGHT / 8)] >>   \
+                                        bit &                                \
+                                    ((1 << s) - 1)];                         \
+                    }                                                        \
+                    *p = levels[lit];                                        \
+                    p -= ENV_SCREEN_WIDTH / s;                               \
+                }                                                            \
+                column += s * (ENV_SCREEN_HEIGHT / 8);                       \
+            }                                                                \
+        }                                                                    \
+    }
+
+ENV_RENDER(1)
+ENV_RENDER(2)
+ENV_RENDER(4)
+ENV_RENDER(8)
+
+/*
+ * env_render: Downsamples the screen of an instance: each pixel is the share
+ *             of lit pixels in a square of <scale> x <scale> pixels of the
+ *             screen, from 0 to 255. Since the scale divides 8, the pixels
+ *             of a square are bits of the same video RAM byte in each of
+ *             <scale> columns.
+ *
+ * Arguments:
+ *   env    - environment
+ *   i      - index of the instance
+ *   out    - frame of env_frame_size() bytes, row by row from the top left
+ *
+ * Returns:
+ *   None.
+ */
+void env_render(const env_t *env, int i, uint8_t *out) {
+    const uint8_t *vram = env->machines[i].cpu.mem + VRAM_START;
+    switch (env->scale) {
+        case 1:
+            env_render_1(env, vram, out);
+            break;
+        case 2:
+            env_render_2(env, vram, out);
+            break;
+        case 4:
+            env_render_4(env, vram, out);
+            break;
+        default:
+            env_render_8(env, vram, out);
+    }
+}
+
+/*
+ * env_observe: Reads the observation vector of an instance.
+ *
+ * Arguments:
+ *   env    - environment
+ *   i      - index of the instance
+ *   obs    - ENV_OBS_SIZE values
+ *
+ * Returns:
+ *   None.
+ */
+void env_observe(const env_t *env, int i, int32_t *obs) {
+    obs[ENV_OBS_SCORE] = invaders_score(&env->machines[i]);
+    obs[ENV_OBS_SHIPS] = invaders_ships(&env->machines[i]);
+}
+
+/*
+ * env_reset: Resets an instance to the power on state.
+ *
+ * Arguments:
+ *   env    - environment
+ *   i      - index of the instance
+ *
+ * Returns:
+ *   None.
+ */
+void env_reset(env_t *env, int i) {
+    invaders_reset(&env->machines[i], env->rom);
+}
+
+/*
+ * env_step_one: Steps the instance at a position of the current batch.
+ *
+ * Arguments:
+ *   env    - environment
+ *   k      - position in the batch
+ *
+ * Returns:
+ *   None.
+ */
+void env_step_one(env_t *env, int k) {
+    int i = env->batch[k];
+    invaders_t *m = &env->machines[i];
+    m->port1_inputs = env->actions[2 * k];
+    m->port2_inputs = env->actions[2 * k + 1];
+    for (int f = 0; f < env->frames_per_step; f++) {
+        invaders_run_frame(m, env->core);
+    }
+    if (env->frames != NULL) {
+        env_render(env, i, env->frames + k * env_frame_size(env));
+    }
+    if (env->obs != NULL) env_observe(env, i, env->obs + k * ENV_OBS_SIZE);
+}
+
+/*
+ * env_run_batch: Steps the instances of the current batch, until none is
+ *                left, on each thread of the pool.
+ *
+ * Arguments:
+ *   env    - environment
+ *
+ * Returns:
+ *   None.
+ */
+void env_run_batch(env_t *env) {
+    int k;
+    while ((k = atomic_fetch_add(&env->next, 1)) < env->batch_size) {
+        env_step_one(env, k);
+    }
+}
+
+/*
+ * env_thread_main: Thread of the pool, steps each batch with the calling
+ *                  thread until env->stop is set.
+ *
+ * Arguments:
+ *   arg    - environment
+ *
+ * Returns:
+ *   NULL.
+ */
+void *env_thread_main(void *arg) {
+    env_t *env = arg;
+    pthread_mutex_lock(&env->lock);
+    pthread_mutex_unlock(&env->lock);
+    if (env->stop) return NULL;  // Not all the threads could be started
+    for (;;) {
+        pthread_barrier_wait(&env->start);
+        if (env->stop) return NULL;
+        env_run_batch(env);
+        pthread_barrier_wait(&env->done);
+    }
+}
+
+/*
+ * env_free: Stops the threads of an environment and releases it.
+ *
+ * Arguments:
+ *   env    - environment, or NULL
+ *
+ * Returns:
+ *   None.
+ */
+void env_free(env_t *env) {
+    if (env == NULL) return;
+    if (env->num_threads > 1) {
+        env->stop = 1;
+        pthread_barrier_wait(&env->start);
+        for (int t = 1; t < env->num_threads; t++) {
+            pthread_join(env->threads[t], NULL);
+        }
+        pthread_barrier_destroy(&env->start);
+        pthread_barrier_destroy(&env->done);
+        pthread_mutex_destroy(&env->lock);
+    }
+    for (int i = 0; i < env->num_instances; i++) {
+        invaders_free(&env->machines[i]);
+    }
+    free(env->machines);
+    free(env->stamps);
+    free(env);
+}
+
+/*
+ * env_new: Creates instances at their power on state, and the threads
+ *          stepping them.
+ *
+ * Arguments:
+ *   rom       - ROM image of ROM_SIZE bytes
+ *   instances - number of instances
+ *   threads   - threads stepping a batch, including the calling one
+ *   scale     - downsampling factor of the frames: 1, 2, 4 or 8
+ *
+ * Returns:
+ *   the environment, or NULL if the arguments are invalid or it couldn't be
+ *   allocated.
+ */
+env_t *env_new(const uint8_t *rom, int instances, int threads, int scale) {
+    if (instances < 1 || threads < 1 || threads > ENV_MAX_THREADS ||
+        scale < 1 || scale > 8 || (scale & (scale - 1)) != 0) {
+        return NULL;
+    }
+
+    env_t *env = calloc(1, sizeof(*env));
+    if (env == NULL) return NULL;
+    env->scale = scale;
+    env->width = ENV_SCREEN_WIDTH / scale;
+    env->height = ENV_SCREEN_HEIGHT / scale;
+    for (int b = 0; b < 256; b++) {
+        env->bits[b] = (b & 1) + env->bits[b >> 1];
+    }
+    for (int lit = 0; lit <= scale * scale; lit++) {
+        env->levels[lit] = lit * 255 / (scale * scale);
+    }
+    memcpy(env->rom, rom, ROM_SIZE);
+    env->core = emu_find_core("table");
+
+    env->machines = calloc(instances, sizeof(*env->machines));
+    env->stamps = calloc(instances, sizeof(*env->stamps));
+    if (env->machines == NULL || env->stamps == NULL) {
+        free(env->machines);
+        free(env->stamps);
+        free(env);
+        return NULL;
+    }
+    for (; env->num_instances < instances; env->num_instances++) {
+        if (invaders_init(&env->machines[env->num_instances], rom) < 0) {
+            env_free(env);
+            return NULL;
+        }
+    }
+
+    /* The threads wait for the lock before using the barriers, which are
+     * only set up for the threads that could be started */
+    env->num_threads = 1;
+    if (threads > 1) {
+        pthread_mutex_init(&env->lock, NULL);
+        pthread_mutex_lock(&env->lock);
+        for (; env->num_threads < threads; env->num_threads++) {
+            if (pthread_create(&env->threads[env->num_threads], NULL,
+                               env_thread_main, env) != 0) {
+                env->stop = 1;
+                break;
+            }
+        }
+        pthread_barrier_init(&env->start, NULL, env->num_threads);
+        pthread_barrier_init(&env->done, NULL, env->num_threads);
+        pthread_mutex_unlock(&env->lock);
+    }
+    if (env->stop) {
+        for (int t = 1; t < env->num_threads; t++) {
+            pthread_join(env->threads[t], NULL);
+        }
+        pthread_barrier_destroy(&env->start);
+        pthread_barrier_destroy(&env->done);
+        pthread_mutex_destroy(&env->lock);
+        env->num_threads = 1;
+        env_free(env);
+        return NULL;
+    }
+    return env;
+}
+
+/*
+ * env_step: Steps a batch of instances: each one holds its action for
+ *           <frames_per_step> frames, then its last frame and observation
+ *           are written at its position in the batch.
+ *
+ * Arguments:
+ *   env             - environment
+ *   batch           - indices of the instances to step, all different
+ *   n               - number of instances in the batch
+ *   actions         - 2 bytes per instance: the bits of input ports 1 and 2
+ *   frames_per_step - frames emulated per step
+ *   frames          - n frames of env_frame_size() bytes, or NULL to decode
+ *                     none
+ *   obs             - n observations of ENV_OBS_SIZE values, or NULL
+ *
+ * Returns:
+ *   0 on success, -1 if the arguments are invalid, including an instance
+ *   given twice in the batch.
+ */
+int env_step(env_t *env, const int *batch, int n, const uint8_t *actions,
+             int frames_per_step, uint8_t *frames, int32_t *obs) {
+    if (n < 0 || frames_per_step < 1) return -1;
+
+    /* Two threads stepping the same instance would race, so each instance
+     * is stamped with the generation of the step, which spots duplicates
+     * without clearing anything between steps */
+    if (++env->generation == 0) {
+        memset(env->stamps, 0, env->num_instances * sizeof(*env->stamps));
+        env->generation = 1;
+    }
+    for (int k = 0; k < n; k++) {
+        if (batch[k] < 0 || batch[k] >= env->num_instances ||
+            env->stamps[batch[k]] == env->generation) {
+            return -1;
+        }
+        env->stamps[batch[k]] = env->generation;
+    }
+
+    env->batch = batch;
+    env->batch_size = n;
+    env->actions = actions;
+    env->frames_per_step = frames_per_step;
+    env->frames = frames;
+    env->obs = obs;
+    atomic_store(&env->next, 0);
+
+    if (env->num_threads > 1) pthread_barrier_wait(&env->start);
+    env_run_batch(env);
+    if (env->num_threads > 1) pthread_barrier_wait(&env->done);
+    return 0;
+}
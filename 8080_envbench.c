@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "8080_disasm.c"
+#include "8080_profile.c"
+#include "8080_emu.c"
+#include "8080_cfg.c"
+#include "8080_core.c"
+#include "8080_invaders.c"
+#include "8080_env.c"
+
+/*
+ * Throughput of the batched environment API (8080_env.c), the way a learning
+ * loop drives it: every instance is stepped with a random action each step,
+ * and reset when its game is over. The actions come from a fixed seed and
+ * the resets from the observations, so the checksum of the observations and
+ * of the last frames doesn't depend on the number of threads.
+ */
+
+/* Defaults of the benchmark */
+#define ENVBENCH_DEFAULT_INSTANCES (64)
+#define ENVBENCH_DEFAULT_FRAMES (4)  // Frames per step
+#define ENVBENCH_DEFAULT_SCALE (2)
+#define ENVBENCH_DEFAULT_STEPS (500)
+
+/* Frames of a game at which a coin is inserted and 1 player started */
+#define ENVBENCH_COIN_FRAME (60)
+#define ENVBENCH_START_FRAME (120)
+
+/* Random actions: port 1 bits */
+uint8_t envbench_actions[] = {
+    0x00,  // None
+    0x10,  // Fire
+    0x20,  // Left
+    0x40,  // Right
+    0x30,  // Left and fire
+    0x50,  // Right and fire
+};
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * envbench_hash: Folds bytes into a checksum.
+ *
+ * Arguments:
+ *   h      - checksum so far
+ *   data   - bytes
+ *   size   - number of bytes
+ *
+ * Returns:
+ *   the new checksum.
+ */
+uint64_t envbench_hash(uint64_t h, const void *data, size_t size) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < size; i++) h = (h ^ p[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+void usage(char *prog) {
+    fprintf(stderr,
+            "usage: %s [-R <rom dir>] [-n <instances>] [-t <threads>] "
+            "[-f <frames per step>] [-s <scale>] [-k <steps>] "
+            "[-r <1 to render each step>]\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    char *rom_dir = "ROM";
+    int instances = ENVBENCH_DEFAULT_INSTANCES;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int frames_per_step = ENVBENCH_DEFAULT_FRAMES;
+    int scale = ENVBENCH_DEFAULT_SCALE;
+    int steps = ENVBENCH_DEFAULT_STEPS;
+    int render = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-') usage(argv[0]);
+        char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+            case 'R':
+                rom_dir = arg;
+                break;
+            case 'n':
+                instances = atoi(arg);
+                break;
+            case 't':
+                threads = atoi(arg);
+                break;
+            case 'f':
+                frames_per_step = atoi(arg);
+                break;
+            case 's':
+                scale = atoi(arg);
+                break;
+            case 'k':
+                steps = atoi(arg);
+                break;
+            case 'r':
+                render = atoi(arg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (threads > ENV_MAX_THREADS) threads = ENV_MAX_THREADS;
+    if (instances < 1 || threads < 1 || frames_per_step < 1 || steps < 1) {
+        usage(argv[0]);
+    }
+
+    uint8_t rom[ROM_SIZE];
+    if (invaders_load_rom(rom_dir, rom) < 0) exit(1);
+    env_t *env = env_new(rom, instances, threads, scale);
+    if (env == NULL) {
+        fprintf(stderr, "error: Couldn't create %d instances at scale %d\n",
+                instances, scale);
+        exit(1);
+    }
+
+    /* Every instance is stepped each step, the buffers of a learning loop */
+    int *batch = malloc(instances * sizeof(*batch));
+    int *game_frames = calloc(instances, sizeof(*game_frames));
+    uint8_t *actions = malloc(instances * 2);
+    uint8_t *frames = malloc(instances * env_frame_size(env));
+    int32_t *obs = malloc(instances * ENV_OBS_SIZE * sizeof(*obs));
+    if (batch == NULL || game_frames == NULL || actions == NULL ||
+        frames == NULL || obs == NULL) {
+        exit(1);
+    }
+    for (int k = 0; k < instances; k++) batch[k] = k;
+
+    uint32_t x = 1;
+    uint64_t checksum = 0xcbf29ce484222325ULL;
+    long resets = 0;
+    uint64_t start = now_ns();
+    for (int s = 0; s < steps; s++) {
+        for (int k = 0; k < instances; k++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            int f = game_frames[k], end = f + frames_per_step;
+            uint8_t port1 = envbench_actions[x % sizeof(envbench_actions)];
+            if (f <= ENVBENCH_COIN_FRAME && end > ENVBENCH_COIN_FRAME) {
+                port1 = 0x01;
+            } else if (f <= ENVBENCH_START_FRAME &&
+                       end > ENVBENCH_START_FRAME) {
+                port1 = 0x04;
+            }
+            actions[2 * k] = port1;
+            actions[2 * k + 1] = 0x00;
+            game_frames[k] = end;
+        }
+
+        int last = (s == steps - 1);
+        if (env_step(env, batch, instances, actions, frames_per_step,
+                     (render || last) ? frames : NULL, obs) < 0) {
+            exit(1);
+        }
+        checksum = envbench_hash(checksum, obs,
+                                 instances * ENV_OBS_SIZE * sizeof(*obs));
+
+        /* A game is over once it started and the ships are gone */
+        for (int k = 0; k < instances; k++) {
+            if (game_frames[k] > ENVBENCH_START_FRAME * 2 &&
+                obs[k * ENV_OBS_SIZE + ENV_OBS_SHIPS] == 0) {
+                env_reset(env, k);
+                game_frames[k] = 0;
+                resets++;
+            }
+        }
+    }
+    double secs = (now_ns() - start) / 1e9;
+    checksum = envbench_hash(checksum, frames,
+                             instances * env_frame_size(env));
+
+    long total = (long)steps * instances;
+    printf("%d instances, %d threads, %d frames per step, %dx%d frames%s: "
+           "%ld steps in %.2f s, %.0f steps/s, %.0f emulated frames/s, "
+           "%ld resets, checksum %016llx\n",
+           instances, threads, frames_per_step, env->width, env->height,
+           render ? "" : " (last step only)", total, secs, total / secs,
+           total * frames_per_step / secs, resets,
+           (unsigned long long)checksum);
+
+    env_free(env);
+    free(batch);
+    free(game_frames);
+    free(actions);
+    free(frames);
+    free(obs);
+    return 0;
+}
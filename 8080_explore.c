@@ -0,0 +1,440 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "8080_disasm.c"
+#include "8080_profile.c"
+#include "8080_emu.c"
+#include "8080_cfg.c"
+#include "8080_core.c"
+#include "8080_invaders.c"
+#include "8080_fork.c"
+
+/*
+ * Breadth-first search of Space Invaders inputs from a snapshot of a game.
+ * Each state of a depth branches into every action (port 1 input bits held
+ * for a few frames), and the resulting states make the next depth. The
+ * branches run on a pool of threads, each loading clones (8080_fork.c) into
+ * its own view. Identical resulting states are merged by fingerprint, and
+ * the best ones by score and ships left (the beam) are kept.
+ *
+ * The result doesn't depend on the number of threads: each branch has its
+ * own slot, and merging and ranking sort the states.
+ */
+
+/* Defaults of the search */
+#define EXPLORE_DEFAULT_START (240)  // Frames before the snapshot
+#define EXPLORE_DEFAULT_DEPTH (8)    // Actions in a sequence
+#define EXPLORE_DEFAULT_FRAMES (8)   // Frames an action is held
+#define EXPLORE_DEFAULT_WIDTH (256)  // States kept at each depth
+#define EXPLORE_MAX_THREADS (64)
+
+/* Repetitions of the copy of a whole machine, timed to compare with clones */
+#define EXPLORE_COPY_REPS (1000)
+
+typedef struct {
+    const char *name;
+    uint8_t inputs;  // Port 1 input bits
+} explore_action_t;
+
+explore_action_t explore_actions[] = {
+    {"-", 0x00},  {"L", 0x20},  {"R", 0x40},
+    {"F", 0x10},  {"LF", 0x30}, {"RF", 0x50},
+};
+
+#define EXPLORE_NUM_ACTIONS \
+    (sizeof(explore_actions) / sizeof(explore_actions[0]))
+
+/* Inputs before the snapshot, as (frame, port 1 bits) pairs: insert a coin
+ * and start a 1P game */
+int explore_start_script[][2] = {
+    {60, 0x01},
+    {64, 0x00},
+    {120, 0x04},
+    {124, 0x00},
+};
+
+/*
+ * explore_node_t: A state of the search.
+ *
+ *   fork        - clone of the machine, NULL once branched or dropped
+ *   fingerprint - fingerprint of the machine (explore_fingerprint)
+ *   score       - score of player 1
+ *   ships       - ships left to player 1
+ *   parent      - index of the state it was branched from, at the previous
+ *                 depth
+ *   action      - action branched into
+ */
+typedef struct {
+    fork_t *fork;
+    uint64_t fingerprint;
+    int score;
+    int ships;
+    int parent;
+    int action;
+} explore_node_t;
+
+/* A thread of the pool, and the host time it spent on each step of a
+ * branch */
+typedef struct {
+    fork_view_t view;
+    pthread_t thread;
+    uint64_t branches;
+    uint64_t load_ns;
+    uint64_t run_ns;
+    uint64_t store_ns;
+} explore_worker_t;
+
+/* States being branched, their branches, and the next state to branch */
+explore_node_t *explore_parents;
+explore_node_t *explore_children;
+int explore_num_parents;
+atomic_int explore_next;
+
+int explore_frames = EXPLORE_DEFAULT_FRAMES;
+emu_core_t *explore_core;
+
+/* Workers start a depth together, and the main thread waits for all of them
+ * to finish it */
+pthread_barrier_t explore_start;
+pthread_barrier_t explore_done;
+int explore_stop;
+
+/* Copy of a whole machine, see explore_copy_ns */
+invaders_t explore_copy;
+uint8_t explore_copy_mem[MEM_SIZE];
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * explore_fingerprint: Hashes the state of the machine, the CPU and the
+ *                      devices. The inputs are left out, since every branch
+ *                      sets them.
+ *
+ * Arguments:
+ *   m      - machine
+ *
+ * Returns:
+ *   the fingerprint.
+ */
+uint64_t explore_fingerprint(invaders_t *m) {
+    uint64_t devices = (uint64_t)m->shift_reg |
+                       (uint64_t)m->shift_reg_offset << 16 |
+                       (uint64_t)m->next_rst << 24 |
+                       (m->next_interrupt - m->cpu.cycles) << 32;
+    return emu_hash_mix(emu_fingerprint(&m->cpu) ^ devices);
+}
+
+/*
+ * explore_branch: Runs a state with an action held for explore_frames
+ *                 frames, and makes a state of the result.
+ *
+ * Arguments:
+ *   w      - worker running the branch
+ *   index  - index of the state in explore_parents
+ *   action - index of the action in explore_actions
+ *   child  - resulting state, its fork is NULL if memory ran out
+ *
+ * Returns:
+ *   None.
+ */
+void explore_branch(explore_worker_t *w, int index, int action,
+                    explore_node_t *child) {
+    uint64_t t0 = now_ns();
+    invaders_t *m = fork_load(&w->view, explore_parents[index].fork);
+    uint64_t t1 = now_ns();
+    m->port1_inputs = explore_actions[action].inputs;
+    for (int f = 0; f < explore_frames; f++) {
+        invaders_run_frame(m, explore_core);
+    }
+    uint64_t t2 = now_ns();
+    child->fork = fork_store(&w->view);
+    uint64_t t3 = now_ns();
+
+    child->fingerprint = explore_fingerprint(m);
+    child->score = invaders_score(m);
+    child->ships = invaders_ships(m);
+    child->parent = index;
+    child->action = action;
+
+    w->branches++;
+    w->load_ns += t1 - t0;
+    w->run_ns += t2 - t1;
+    w->store_ns += t3 - t2;
+}
+
+/*
+ * explore_worker_main: Thread of the pool, branches the states of each depth
+ *                      until explore_stop is set.
+ *
+ * Arguments:
+ *   arg    - explore_worker_t of the thread
+ *
+ * Returns:
+ *   NULL.
+ */
+void *explore_worker_main(void *arg) {
+    explore_worker_t *w = arg;
+    for (;;) {
+        pthread_barrier_wait(&explore_start);
+        if (explore_stop) return NULL;
+
+        /* All the actions of a state run in a row, so the view only copies
+         * the pages written by the previous one */
+        int i;
+        while ((i = atomic_fetch_add(&explore_next, 1)) <
+               explore_num_parents) {
+            for (int a = 0; a < (int)EXPLORE_NUM_ACTIONS; a++) {
+                explore_branch(w, i, a,
+                               &explore_children[i * EXPLORE_NUM_ACTIONS + a]);
+            }
+        }
+        pthread_barrier_wait(&explore_done);
+    }
+}
+
+/* Orders states by fingerprint, then by the branch that reached them */
+int cmp_fingerprint(const void *a, const void *b) {
+    const explore_node_t *x = a, *y = b;
+    if (x->fingerprint != y->fingerprint) {
+        return (x->fingerprint > y->fingerprint) ? 1 : -1;
+    }
+    if (x->parent != y->parent) return x->parent - y->parent;
+    return x->action - y->action;
+}
+
+/* Orders states from the best: highest score, most ships left */
+int cmp_rank(const void *a, const void *b) {
+    const explore_node_t *x = a, *y = b;
+    if (x->score != y->score) return y->score - x->score;
+    if (x->ships != y->ships) return y->ships - x->ships;
+    return cmp_fingerprint(a, b);
+}
+
+/*
+ * explore_merge: Merges the states with the same fingerprint, keeping the
+ *                first branch that reached each one, and ranks the others
+ *                from the best.
+ *
+ * Arguments:
+ *   nodes  - states, sorted in place
+ *   n      - number of states
+ *
+ * Returns:
+ *   number of different states, at the start of nodes.
+ */
+int explore_merge(explore_node_t *nodes, int n) {
+    qsort(nodes, n, sizeof(*nodes), cmp_fingerprint);
+    int unique = 0;
+    for (int i = 0; i < n; i++) {
+        if (unique > 0 &&
+            nodes[i].fingerprint == nodes[unique - 1].fingerprint) {
+            fork_free(nodes[i].fork);
+            continue;
+        }
+        nodes[unique++] = nodes[i];
+    }
+    qsort(nodes, unique, sizeof(*nodes), cmp_rank);
+    return unique;
+}
+
+/*
+ * explore_copy_ns: Times the copy of a whole machine, its memory and
+ *                  structure, for comparison with a clone.
+ *
+ * Arguments:
+ *   m      - machine to copy
+ *
+ * Returns:
+ *   host time of a copy, in ns.
+ */
+double explore_copy_ns(invaders_t *m) {
+    uint64_t start = now_ns();
+    for (int i = 0; i < EXPLORE_COPY_REPS; i++) {
+        memcpy(explore_copy_mem, m->cpu.mem, MEM_SIZE);
+        explore_copy = *m;
+        explore_copy.cpu.mem = explore_copy_mem;
+    }
+    return (double)(now_ns() - start) / EXPLORE_COPY_REPS;
+}
+
+/*
+ * explore_print_path: Prints the actions leading to a state.
+ *
+ * Arguments:
+ *   levels - states of each depth
+ *   depth  - depth of the state
+ *   index  - index of the state at its depth
+ *
+ * Returns:
+ *   None.
+ */
+void explore_print_path(explore_node_t **levels, int depth, int index) {
+    if (depth == 0) return;
+    explore_node_t *node = &levels[depth][index];
+    explore_print_path(levels, depth - 1, node->parent);
+    printf(" %s", explore_actions[node->action].name);
+}
+
+void usage(char *prog) {
+    fprintf(stderr,
+            "usage: %s [-R <rom dir>] [-s <start frame>] [-d <depth>] "
+            "[-f <frames per action>] [-w <width>] [-t <threads>]\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    char *rom_dir = "ROM";
+    int start = EXPLORE_DEFAULT_START;
+    int depth = EXPLORE_DEFAULT_DEPTH;
+    int width = EXPLORE_DEFAULT_WIDTH;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-') usage(argv[0]);
+        char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+            case 'R':
+                rom_dir = arg;
+                break;
+            case 's':
+                start = atoi(arg);
+                break;
+            case 'd':
+                depth = atoi(arg);
+                break;
+            case 'f':
+                explore_frames = atoi(arg);
+                break;
+            case 'w':
+                width = atoi(arg);
+                break;
+            case 't':
+                threads = atoi(arg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (threads > EXPLORE_MAX_THREADS) threads = EXPLORE_MAX_THREADS;
+    if (start < 0 || depth < 1 || explore_frames < 1 || width < 1 ||
+        threads < 1) {
+        usage(argv[0]);
+    }
+
+    uint8_t rom[ROM_SIZE];
+    if (invaders_load_rom(rom_dir, rom) < 0) exit(1);
+
+    /* The snapshot, taken after the start of a game on the main thread */
+    invaders_t m;
+    if (invaders_init(&m, rom) < 0) exit(1);
+    explore_core = emu_find_core("table");
+    int n = sizeof(explore_start_script) / sizeof(explore_start_script[0]);
+    for (int f = 0; f < start; f++) {
+        for (int i = 0; i < n; i++) {
+            if (explore_start_script[i][0] == f) {
+                m.port1_inputs = explore_start_script[i][1];
+            }
+        }
+        invaders_run_frame(&m, explore_core);
+    }
+    double copy_ns = explore_copy_ns(&m);
+
+    explore_node_t **levels = calloc(depth + 1, sizeof(*levels));
+    levels[0] = calloc(1, sizeof(explore_node_t));
+    levels[0][0].fork = fork_snapshot(&m, sizeof(m));
+    levels[0][0].score = invaders_score(&m);
+    levels[0][0].ships = invaders_ships(&m);
+    if (levels[0][0].fork == NULL) exit(1);
+    invaders_free(&m);
+
+    explore_worker_t *workers = calloc(threads, sizeof(*workers));
+    pthread_barrier_init(&explore_start, NULL, threads + 1);
+    pthread_barrier_init(&explore_done, NULL, threads + 1);
+    for (int t = 0; t < threads; t++) {
+        if (fork_view_init(&workers[t].view, sizeof(invaders_t)) < 0 ||
+            pthread_create(&workers[t].thread, NULL, explore_worker_main,
+                           &workers[t]) != 0) {
+            fprintf(stderr, "error: Couldn't start worker %d\n", t);
+            exit(1);
+        }
+    }
+
+    printf("start frame %d, score %d, ships %d, %d threads\n", start,
+           levels[0][0].score, levels[0][0].ships, threads);
+    int num_nodes = 1;
+    uint64_t total_start = now_ns();
+    for (int d = 1; d <= depth; d++) {
+        uint64_t t = now_ns();
+        int branches = num_nodes * EXPLORE_NUM_ACTIONS;
+        explore_parents = levels[d - 1];
+        explore_num_parents = num_nodes;
+        explore_children = levels[d] = calloc(branches, sizeof(**levels));
+        atomic_store(&explore_next, 0);
+        pthread_barrier_wait(&explore_start);
+        pthread_barrier_wait(&explore_done);
+
+        for (int i = 0; i < num_nodes; i++) {
+            fork_free(levels[d - 1][i].fork);
+            levels[d - 1][i].fork = NULL;
+        }
+        for (int i = 0; i < branches; i++) {
+            if (levels[d][i].fork == NULL) {
+                fprintf(stderr, "error: Out of memory at depth %d\n", d);
+                exit(1);
+            }
+        }
+
+        int unique = explore_merge(levels[d], branches);
+        num_nodes = (unique < width) ? unique : width;
+        for (int i = num_nodes; i < unique; i++) {
+            fork_free(levels[d][i].fork);
+        }
+        size_t pages = atomic_load(&fork_pages_live);
+        printf("depth %d: %d branches, %d unique, %d kept, best score %d, "
+               "%.1f MB of pages (%.1f MB as copies), %.1f ms\n",
+               d, branches, unique, num_nodes, levels[d][0].score,
+               pages * FORK_PAGE_SIZE / 1e6,
+               (double)num_nodes * MEM_SIZE / 1e6, (now_ns() - t) / 1e6);
+    }
+    double total_ms = (now_ns() - total_start) / 1e6;
+
+    explore_stop = 1;
+    pthread_barrier_wait(&explore_start);
+    uint64_t branches = 0, load_ns = 0, run_ns = 0, store_ns = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        branches += workers[t].branches;
+        load_ns += workers[t].load_ns;
+        run_ns += workers[t].run_ns;
+        store_ns += workers[t].store_ns;
+        fork_view_free(&workers[t].view);
+    }
+
+    printf("best: score %d, ships %d, actions:", levels[depth][0].score,
+           levels[depth][0].ships);
+    explore_print_path(levels, depth, 0);
+    printf("\n%llu branches in %.1f ms, per branch: load %.2f us, run %.1f "
+           "us, store %.2f us (a full copy takes %.2f us)\n",
+           (unsigned long long)branches, total_ms,
+           load_ns / 1e3 / branches, run_ns / 1e3 / branches,
+           store_ns / 1e3 / branches, copy_ns / 1e3);
+    printf("%zu pages allocated, %.1f per branch\n",
+           atomic_load(&fork_pages_allocated),
+           (double)atomic_load(&fork_pages_allocated) / branches);
+
+    for (int i = 0; i < num_nodes; i++) fork_free(levels[depth][i].fork);
+    for (int d = 0; d <= depth; d++) free(levels[d]);
+    free(levels);
+    free(workers);
+    return 0;
+}
@@ -0,0 +1,332 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Export of the screen to a POSIX shared memory segment, for viewers,
+ * recorders and analysis tools running next to the emulator. Each frame is
+ * decoded into one of EXPORT_BUFFERS buffers in turn: a byte per pixel (0 or
+ * 255) of the upright screen, row by row from the top left, optionally
+ * followed by the raw video RAM.
+ *
+ * Consumers map the buffers read-only and never slow the emulator down:
+ * - Each buffer has a sequence count, odd while the buffer is being written
+ *   (a seqlock). A consumer reads the buffer in place, and the read is good
+ *   if the count was even and unchanged across it. A buffer is only
+ *   rewritten EXPORT_BUFFERS - 1 frames after being published, so a reader
+ *   keeping up with the frames never has to retry.
+ * - export_header_t.frame is the last published frame, in buffer
+ *   frame % EXPORT_BUFFERS.
+ * - export_header_t.futex counts the published frames. Consumers count
+ *   themselves in export_header_t.waiters while they wait on it, and the
+ *   emulator only makes the wake syscall after a frame if one is.
+ *
+ * File layout: an export_header_t of header_size bytes, a multiple of the
+ * page size so that consumers can map the header writable and the buffers
+ * read-only, followed by the buffers of buffer_size bytes.
+ */
+
+#define EXPORT_MAGIC "8080FB02"
+
+/* Upright screen, the video RAM holds it rotated: each 32 bytes are a column
+ * from the bottom, least significant bit first */
+#define EXPORT_WIDTH (224)
+#define EXPORT_HEIGHT (256)
+#define EXPORT_VRAM_SIZE (EXPORT_WIDTH * EXPORT_HEIGHT / 8)
+
+#define EXPORT_BUFFERS (2)
+
+typedef struct {
+    _Alignas(64) atomic_uint seq;  // Odd while the buffer is written
+    uint64_t frame;                // Frame held by the buffer
+    uint64_t cycles;               // CPU cycles at the end of the frame
+} export_slot_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t header_size;  // Offset of the first buffer
+    uint32_t buffer_size;  // Pixels, then video RAM
+    uint32_t width;
+    uint32_t height;
+    uint32_t vram_size;  // Raw video RAM in each buffer, 0 if not exported
+    uint32_t buffers;
+    _Alignas(64) atomic_uint futex;  // Frames published, woken on each one
+    _Atomic uint64_t frame;          // Last frame published, 0 if none
+    atomic_uint waiters;             // Consumers waiting on futex
+    export_slot_t slots[EXPORT_BUFFERS];
+} export_header_t;
+
+/*
+ * export_t: A mapped export segment, on either side.
+ *
+ *   name   - name of the segment
+ *   header - mapped segment
+ *   size   - size of the mapping
+ *   owner  - 1 for the emulator, which removes the segment when closing it
+ */
+typedef struct {
+    const char *name;
+    export_header_t *header;
+    size_t size;
+    int owner;
+} export_t;
+
+/*
+ * export_open: Creates the export segment, replacing any segment of the same
+ *              name.
+ *
+ * Arguments:
+ *   e      - export to initialize
+ *   name   - name of the segment, e.g. "/8080_screen"
+ *   vram   - 1 to also export the raw video RAM
+ *
+ * Returns:
+ *   0 on success, -1 on failure.
+ */
+int export_open(export_t *e, const char *name, int vram) {
+    uint32_t page = sysconf(_SC_PAGESIZE);
+    uint32_t header_size = (sizeof(export_header_t) + page - 1) / page * page;
+    uint32_t buffer_size = EXPORT_WIDTH * EXPORT_HEIGHT +
+                           (vram ? EXPORT_VRAM_SIZE : 0);
+
+    memset(e, 0, sizeof(*e));
+    e->name = name;
+    e->owner = 1;
+    e->size = header_size + (size_t)EXPORT_BUFFERS * buffer_size;
+
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, e->size) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    e->header = mmap(NULL, e->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (e->header == MAP_FAILED) {
+        shm_unlink(name);
+        return -1;
+    }
+
+    export_header_t *h = e->header;
+    h->header_size = header_size;
+    h->buffer_size = buffer_size;
+    h->width = EXPORT_WIDTH;
+    h->height = EXPORT_HEIGHT;
+    h->vram_size = vram ? EXPORT_VRAM_SIZE : 0;
+    h->buffers = EXPORT_BUFFERS;
+    /* The magic goes last, consumers attaching before it fail and retry */
+    atomic_thread_fence(memory_order_release);
+    memcpy(h->magic, EXPORT_MAGIC, sizeof(h->magic));
+    return 0;
+}
+
+/*
+ * export_buffer: Finds a buffer of an export segment.
+ *
+ * Arguments:
+ *   h      - mapped segment
+ *   slot   - index of the buffer
+ *
+ * Returns:
+ *   the pixels of the buffer, followed by the raw video RAM if exported.
+ */
+uint8_t *export_buffer(const export_header_t *h, int slot) {
+    return (uint8_t *)h + h->header_size + (size_t)slot * h->buffer_size;
+}
+
+/*
+ * export_frame: Publishes a frame, decoding the video RAM into the next
+ *               buffer, and wakes the consumers waiting for it.
+ *
+ * Arguments:
+ *   e      - export created with export_open
+ *   vram   - EXPORT_VRAM_SIZE bytes of video RAM
+ *   frame  - number of the frame, from 1
+ *   cycles - CPU cycles at the end of the frame
+ *
+ * Returns:
+ *   None.
+ */
+void export_frame(export_t *e, const uint8_t *vram, uint64_t frame,
+                  uint64_t cycles) {
+    export_header_t *h = e->header;
+    export_slot_t *slot = &h->slots[frame % EXPORT_BUFFERS];
+    uint8_t *pixels = export_buffer(h, frame % EXPORT_BUFFERS);
+
+    unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    for (int x = 0; x < EXPORT_WIDTH; x++) {
+        const uint8_t *column = vram + x * (EXPORT_HEIGHT / 8);
+        uint8_t *p = pixels + (EXPORT_HEIGHT - 1) * EXPORT_WIDTH + x;
+        for (int i = 0; i < EXPORT_HEIGHT / 8; i++) {
+            uint8_t bits = column[i];
+            for (int b = 0; b < 8; b++, p -= EXPORT_WIDTH) {
+                *p = (bits >> b & 1) ? 0xff : 0x00;
+            }
+        }
+    }
+    if (h->vram_size) {
+        memcpy(pixels + EXPORT_WIDTH * EXPORT_HEIGHT, vram, h->vram_size);
+    }
+    slot->frame = frame;
+    slot->cycles = cycles;
+
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+    atomic_store_explicit(&h->frame, frame, memory_order_release);
+
+    /* Ordered with export_wait: either a consumer counted itself before the
+     * count is read here, or its wait finds the futex changed */
+    atomic_fetch_add(&h->futex, 1);
+    if (atomic_load(&h->waiters) > 0) {
+        syscall(SYS_futex, &h->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/*
+ * export_close: Unmaps an export segment, and removes it if it was created
+ *               with export_open. Consumers still attached keep their
+ *               mapping.
+ *
+ * Arguments:
+ *   e      - export to close
+ *
+ * Returns:
+ *   None.
+ */
+void export_close(export_t *e) {
+    if (e->header != NULL) munmap(e->header, e->size);
+    if (e->owner) shm_unlink(e->name);
+    e->header = NULL;
+}
+
+/*
+ * export_attach: Maps an export segment for a consumer: the buffers
+ *                read-only, and the header writable for its waiter count.
+ *
+ * Arguments:
+ *   e      - export to initialize
+ *   name   - name of the segment
+ *
+ * Returns:
+ *   0 on success, -1 if the segment doesn't exist, isn't an export or can't
+ *   be opened for writing.
+ */
+int export_attach(export_t *e, const char *name) {
+    memset(e, 0, sizeof(*e));
+    e->name = name;
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(export_header_t)) {
+        close(fd);
+        return -1;
+    }
+    e->size = st.st_size;
+    e->header = mmap(NULL, e->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (e->header == MAP_FAILED) {
+        e->header = NULL;
+        return -1;
+    }
+
+    export_header_t *h = e->header;
+    if (memcmp(h->magic, EXPORT_MAGIC, sizeof(h->magic)) != 0 ||
+        h->buffers == 0 || h->buffers > EXPORT_BUFFERS ||
+        h->header_size < sizeof(*h) ||
+        h->header_size % sysconf(_SC_PAGESIZE) != 0 ||
+        h->header_size + (size_t)h->buffers * h->buffer_size > e->size ||
+        mprotect(h, h->header_size, PROT_READ | PROT_WRITE) < 0) {
+        export_close(e);
+        return -1;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    return 0;
+}
+
+/*
+ * export_wait: Waits for a frame after a given one to be published.
+ *
+ * Arguments:
+ *   e          - attached export
+ *   frame      - last frame seen, 0 for none
+ *   timeout_ms - longest wait
+ *
+ * Returns:
+ *   the last published frame, which is still <frame> on a timeout.
+ */
+uint64_t export_wait(export_t *e, uint64_t frame, int timeout_ms) {
+    export_header_t *h = e->header;
+    struct timespec timeout = {timeout_ms / 1000,
+                               (timeout_ms % 1000) * 1000000L};
+    for (;;) {
+        /* Read the count before the frame, a frame published in between
+         * changes the count and the wait returns at once */
+        unsigned int count =
+            atomic_load_explicit(&h->futex, memory_order_acquire);
+        uint64_t last = atomic_load_explicit(&h->frame, memory_order_acquire);
+        if (last != frame) return last;
+
+        /* Counted before the futex is checked against count, see
+         * export_frame */
+        atomic_fetch_add(&h->waiters, 1);
+        int rc = syscall(SYS_futex, &h->futex, FUTEX_WAIT, count, &timeout,
+                         NULL, 0);
+        int timed_out = rc < 0 && errno == ETIMEDOUT;
+        atomic_fetch_sub(&h->waiters, 1);
+        if (timed_out) {
+            return atomic_load_explicit(&h->frame, memory_order_acquire);
+        }
+    }
+}
+
+/*
+ * export_begin: Starts reading the buffer of a frame in place.
+ *
+ * Arguments:
+ *   e      - attached export
+ *   frame  - published frame, as returned by export_wait
+ *   seq    - set to the sequence count to pass to export_end
+ *
+ * Returns:
+ *   the pixels of the buffer, followed by the raw video RAM if exported.
+ */
+const uint8_t *export_begin(export_t *e, uint64_t frame, unsigned int *seq) {
+    export_header_t *h = e->header;
+    *seq = atomic_load_explicit(&h->slots[frame % h->buffers].seq,
+                                memory_order_acquire);
+    return export_buffer(h, frame % h->buffers);
+}
+
+/*
+ * export_end: Checks that a buffer read since export_begin held the frame
+ *             and wasn't rewritten meanwhile.
+ *
+ * Arguments:
+ *   e      - attached export
+ *   frame  - frame passed to export_begin
+ *   seq    - sequence count set by export_begin
+ *
+ * Returns:
+ *   1 if the read is good, 0 if the frame was overwritten.
+ */
+int export_end(export_t *e, uint64_t frame, unsigned int seq) {
+    export_slot_t *slot = &e->header->slots[frame % e->header->buffers];
+    uint64_t held = slot->frame;
+    atomic_thread_fence(memory_order_acquire);
+    return (seq & 1) == 0 && held == frame &&
+           atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq;
+}
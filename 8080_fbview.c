@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "8080_export.c"
+
+/*
+ * Consumer of the screen exported by 8080_main -S/-V (8080_export.c). It
+ * waits for the frames, reads each one in place, and reports the frames it
+ * saw, missed (published while it was busy) and found overwritten while
+ * reading. With the video RAM exported, the pixels of each frame are checked
+ * against it. The last frame can be written as a PGM image.
+ */
+
+#define FBVIEW_DEFAULT_FRAMES (600)
+#define FBVIEW_ATTACH_MS (5000)  // Time the emulator has to create the segment
+#define FBVIEW_WAIT_MS (1000)    // Time without a frame before giving up
+
+/*
+ * fbview_check: Checks the pixels of a buffer against its video RAM.
+ *
+ * Arguments:
+ *   buf    - buffer holding the pixels and the video RAM
+ *
+ * Returns:
+ *   number of pixels that differ from the video RAM.
+ */
+long fbview_check(const uint8_t *buf) {
+    const uint8_t *vram = buf + EXPORT_WIDTH * EXPORT_HEIGHT;
+    long bad = 0;
+    for (int y = 0; y < EXPORT_HEIGHT; y++) {
+        for (int x = 0; x < EXPORT_WIDTH; x++) {
+            int bit = EXPORT_HEIGHT - 1 - y;
+            int on = vram[x * (EXPORT_HEIGHT / 8) + bit / 8] >> (bit % 8) & 1;
+            bad += buf[y * EXPORT_WIDTH + x] != (on ? 0xff : 0x00);
+        }
+    }
+    return bad;
+}
+
+/*
+ * fbview_save: Writes the pixels of a frame as a binary PGM image.
+ *
+ * Arguments:
+ *   filename - name of the image
+ *   pixels   - EXPORT_WIDTH x EXPORT_HEIGHT pixels
+ *
+ * Returns:
+ *   0 on success, -1 on failure.
+ */
+int fbview_save(const char *filename, const uint8_t *pixels) {
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL) return -1;
+    fprintf(fp, "P5\n%d %d\n255\n", EXPORT_WIDTH, EXPORT_HEIGHT);
+    size_t rc = fwrite(pixels, EXPORT_WIDTH, EXPORT_HEIGHT, fp);
+    return (fclose(fp) == 0 && rc == EXPORT_HEIGHT) ? 0 : -1;
+}
+
+void usage(char *prog) {
+    fprintf(stderr,
+            "usage: %s <name> [-n <frames>] [-d <ms per frame>] "
+            "[-o <image.pgm>]\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    long frames = FBVIEW_DEFAULT_FRAMES;
+    int delay_ms = 0;
+    char *image = NULL;
+
+    if (argc < 2 || argv[1][0] == '-') usage(argv[0]);
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-') usage(argv[0]);
+        char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+            case 'n':
+                frames = atol(arg);
+                break;
+            case 'd':
+                delay_ms = atoi(arg);
+                break;
+            case 'o':
+                image = arg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    export_t e;
+    struct timespec nap = {0, 10000000};
+    for (int ms = 0; export_attach(&e, argv[1]) < 0; ms += 10) {
+        if (ms >= FBVIEW_ATTACH_MS) {
+            fprintf(stderr, "error: Couldn't attach to %s\n", argv[1]);
+            exit(1);
+        }
+        nanosleep(&nap, NULL);
+    }
+
+    static uint8_t copy[EXPORT_WIDTH * EXPORT_HEIGHT];
+    static uint8_t last[EXPORT_WIDTH * EXPORT_HEIGHT];
+    uint64_t frame = 0, first = 0;
+    long seen = 0, missed = 0, torn = 0, bad_pixels = 0;
+    while (seen < frames) {
+        uint64_t next = export_wait(&e, frame, FBVIEW_WAIT_MS);
+        if (next == frame) break;
+        if (frame != 0) missed += next - frame - 1;
+        if (first == 0) first = next;
+        frame = next;
+
+        unsigned int seq;
+        const uint8_t *buf = export_begin(&e, frame, &seq);
+        long bad = e.header->vram_size ? fbview_check(buf) : 0;
+        if (image != NULL) memcpy(copy, buf, sizeof(copy));
+        if (!export_end(&e, frame, seq)) {
+            torn++;
+            continue;
+        }
+        if (image != NULL) memcpy(last, copy, sizeof(last));
+        bad_pixels += bad;
+        seen++;
+
+        if (delay_ms > 0) {
+            struct timespec work = {delay_ms / 1000,
+                                    (delay_ms % 1000) * 1000000L};
+            nanosleep(&work, NULL);
+        }
+    }
+
+    printf("%s: frames %llu to %llu, %ld seen, %ld missed, %ld overwritten "
+           "while read",
+           argv[1], (unsigned long long)first, (unsigned long long)frame,
+           seen, missed, torn);
+    if (e.header->vram_size) printf(", %ld bad pixels", bad_pixels);
+    printf("\n");
+    if (image != NULL && seen > 0 && fbview_save(image, last) < 0) {
+        fprintf(stderr, "error: Couldn't write %s\n", image);
+    }
+    export_close(&e);
+    return (seen > 0 && bad_pixels == 0) ? 0 : 1;
+}
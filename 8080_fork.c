@@ -0,0 +1,342 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Copy-on-write clones of a machine, to branch from one state into many runs.
+ * A clone (fork_t) holds a copy of the machine structure (an emu_state_t
+ * followed by its devices) and its memory, as pages of FORK_PAGE_SIZE bytes
+ * shared with the clone it was made from. Pages are only copied when a run
+ * writes to them, so pages that are never written, like the ROM, are shared
+ * by every clone.
+ *
+ * Clones are immutable, they run in a view (fork_view_t): a private 64K
+ * memory and machine that a clone is loaded into, and new clones are stored
+ * from. Loading only copies the pages the view doesn't already hold.
+ * MEM_WRITE flags the pages it writes in emu_state_t.dirty_pages, so storing
+ * only copies the pages that were written.
+ *
+ * Pages, and the groups of pages clones hold, are reference counted with
+ * atomics, so clones can be shared between threads, each one running its
+ * own view. A view runs on any core, but views running on several threads
+ * at once must use the table core: the caches of the other cores are global.
+ */
+
+#define FORK_PAGE_SIZE (EMU_DIRTY_PAGE_SIZE)
+#define FORK_PAGES (0x10000 / FORK_PAGE_SIZE)
+
+/* Pages are shared in groups, so a clone takes a reference on each group
+ * rather than on each page */
+#define FORK_GROUP_PAGES (8)
+#define FORK_GROUPS (FORK_PAGES / FORK_GROUP_PAGES)
+
+typedef struct {
+    atomic_uint refs;  // Groups holding the page
+    uint8_t data[FORK_PAGE_SIZE];
+} fork_page_t;
+
+typedef struct {
+    atomic_uint refs;  // Clones and views holding the group
+    fork_page_t *pages[FORK_GROUP_PAGES];
+} fork_group_t;
+
+/*
+ * fork_t: A clone of a machine.
+ *
+ *   groups  - memory, shared with other clones
+ *   size    - size of the machine structure
+ *   machine - copy of the machine structure, its memory pointer is NULL
+ */
+typedef struct {
+    fork_group_t *groups[FORK_GROUPS];
+    size_t size;
+    _Alignas(max_align_t) uint8_t machine[];
+} fork_t;
+
+/*
+ * fork_view_t: Machine running a clone.
+ *
+ *   mem     - memory of the machine
+ *   groups  - group last loaded or stored in each part of mem, NULL if
+ *             none; the pages written since are flagged in the dirty_pages
+ *             of the machine
+ *   machine - machine structure, of the size of the clones
+ */
+typedef struct {
+    uint8_t *mem;
+    fork_group_t *groups[FORK_GROUPS];
+    size_t size;
+    void *machine;
+} fork_view_t;
+
+/* Pages allocated so far, and the ones still held */
+atomic_size_t fork_pages_allocated;
+atomic_size_t fork_pages_live;
+
+/*
+ * fork_page_new: Allocates a page holding a copy of some memory.
+ *
+ * Arguments:
+ *   data   - FORK_PAGE_SIZE bytes to copy
+ *
+ * Returns:
+ *   the page with a single reference, or NULL if it couldn't be allocated.
+ */
+fork_page_t *fork_page_new(const uint8_t *data) {
+    fork_page_t *page = malloc(sizeof(*page));
+    if (page == NULL) return NULL;
+    atomic_init(&page->refs, 1);
+    memcpy(page->data, data, FORK_PAGE_SIZE);
+    atomic_fetch_add_explicit(&fork_pages_allocated, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&fork_pages_live, 1, memory_order_relaxed);
+    return page;
+}
+
+void fork_page_unref(fork_page_t *page) {
+    if (page == NULL ||
+        atomic_fetch_sub_explicit(&page->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    atomic_fetch_sub_explicit(&fork_pages_live, 1, memory_order_relaxed);
+    free(page);
+}
+
+fork_group_t *fork_group_ref(fork_group_t *group) {
+    atomic_fetch_add_explicit(&group->refs, 1, memory_order_relaxed);
+    return group;
+}
+
+void fork_group_unref(fork_group_t *group) {
+    if (group == NULL ||
+        atomic_fetch_sub_explicit(&group->refs, 1, memory_order_acq_rel) !=
+            1) {
+        return;
+    }
+    for (int i = 0; i < FORK_GROUP_PAGES; i++) {
+        fork_page_unref(group->pages[i]);
+    }
+    free(group);
+}
+
+/*
+ * fork_group_new: Allocates a group of pages of memory, sharing the pages of
+ *                 another group that weren't written.
+ *
+ * Arguments:
+ *   mem     - memory of the group
+ *   old     - group the memory was loaded from, or NULL
+ *   written - flags of emu_state_t.dirty_pages of the group, set for the
+ *             pages written since it was loaded
+ *
+ * Returns:
+ *   the group with a single reference, or NULL if it couldn't be allocated.
+ */
+fork_group_t *fork_group_new(const uint8_t *mem, const fork_group_t *old,
+                             const uint8_t *written) {
+    fork_group_t *group = calloc(1, sizeof(*group));
+    if (group == NULL) return NULL;
+    atomic_init(&group->refs, 1);
+    for (int i = 0; i < FORK_GROUP_PAGES; i++) {
+        if (old != NULL && !written[i]) {
+            group->pages[i] = old->pages[i];
+            atomic_fetch_add_explicit(&group->pages[i]->refs, 1,
+                                      memory_order_relaxed);
+            continue;
+        }
+        group->pages[i] = fork_page_new(mem + i * FORK_PAGE_SIZE);
+        if (group->pages[i] == NULL) {
+            fork_group_unref(group);
+            return NULL;
+        }
+    }
+    return group;
+}
+
+/*
+ * fork_group_written: Checks if a run wrote to the memory of a group.
+ *
+ * Arguments:
+ *   state  - machine of a view
+ *   g      - index of the group
+ *
+ * Returns:
+ *   1 if a page of the group was written, 0 otherwise.
+ */
+int fork_group_written(const emu_state_t *state, int g) {
+    const uint8_t *flags = &state->dirty_pages[g * FORK_GROUP_PAGES];
+    for (int i = 0; i < FORK_GROUP_PAGES; i++) {
+        if (flags[i]) return 1;
+    }
+    return 0;
+}
+
+/*
+ * fork_free: Releases a clone, and the pages no other clone or view holds.
+ *
+ * Arguments:
+ *   f      - clone to release, or NULL
+ *
+ * Returns:
+ *   None.
+ */
+void fork_free(fork_t *f) {
+    if (f == NULL) return;
+    for (int g = 0; g < FORK_GROUPS; g++) fork_group_unref(f->groups[g]);
+    free(f);
+}
+
+/*
+ * fork_copy_machine: Allocates a clone, without its memory, holding a copy of
+ *                    a machine structure.
+ *
+ * Arguments:
+ *   machine - machine structure, starting with its emu_state_t
+ *   size    - size of the machine structure
+ *
+ * Returns:
+ *   the clone, or NULL if it couldn't be allocated.
+ */
+fork_t *fork_copy_machine(const void *machine, size_t size) {
+    fork_t *f = malloc(sizeof(*f) + size);
+    if (f == NULL) return NULL;
+    memset(f->groups, 0, sizeof(f->groups));
+    f->size = size;
+    memcpy(f->machine, machine, size);
+    ((emu_state_t *)f->machine)->mem = NULL;
+    return f;
+}
+
+/*
+ * fork_snapshot: Makes the first clone of a machine, copying all of its
+ *                memory.
+ *
+ * Arguments:
+ *   machine - machine structure, starting with its emu_state_t
+ *   size    - size of the machine structure
+ *
+ * Returns:
+ *   the clone, or NULL if it couldn't be allocated.
+ */
+fork_t *fork_snapshot(const void *machine, size_t size) {
+    const uint8_t *mem = ((const emu_state_t *)machine)->mem;
+    fork_t *f = fork_copy_machine(machine, size);
+    if (f == NULL) return NULL;
+
+    for (int g = 0; g < FORK_GROUPS; g++) {
+        f->groups[g] = fork_group_new(
+            mem + g * FORK_GROUP_PAGES * FORK_PAGE_SIZE, NULL, NULL);
+        if (f->groups[g] == NULL) {
+            fork_free(f);
+            return NULL;
+        }
+    }
+    return f;
+}
+
+/*
+ * fork_view_init: Allocates the memory and machine of a view.
+ *
+ * Arguments:
+ *   v      - view to initialize
+ *   size   - size of the machine structure of the clones it runs
+ *
+ * Returns:
+ *   0 on success, -1 if memory couldn't be allocated.
+ */
+int fork_view_init(fork_view_t *v, size_t size) {
+    memset(v, 0, sizeof(*v));
+    v->size = size;
+    v->mem = malloc(0x10000);
+    v->machine = calloc(1, size);
+    return (v->mem == NULL || v->machine == NULL) ? -1 : 0;
+}
+
+/*
+ * fork_view_free: Releases the memory of a view and the groups it holds.
+ *
+ * Arguments:
+ *   v      - view to release
+ *
+ * Returns:
+ *   None.
+ */
+void fork_view_free(fork_view_t *v) {
+    for (int g = 0; g < FORK_GROUPS; g++) fork_group_unref(v->groups[g]);
+    free(v->mem);
+    free(v->machine);
+    memset(v, 0, sizeof(*v));
+}
+
+/*
+ * fork_load: Loads a clone into a view, to run it. Only the pages that
+ *            differ from the ones in the view are copied.
+ *
+ * Arguments:
+ *   v      - view
+ *   f      - clone, of the size of the view's machine
+ *
+ * Returns:
+ *   machine structure of the view, holding the clone.
+ */
+void *fork_load(fork_view_t *v, const fork_t *f) {
+    emu_state_t *state = v->machine;
+    for (int g = 0; g < FORK_GROUPS; g++) {
+        fork_group_t *old = v->groups[g], *group = f->groups[g];
+        if (old == group && !fork_group_written(state, g)) continue;
+
+        for (int i = 0; i < FORK_GROUP_PAGES; i++) {
+            int p = g * FORK_GROUP_PAGES + i;
+            if (old != NULL && old->pages[i] == group->pages[i] &&
+                !state->dirty_pages[p]) {
+                continue;
+            }
+            memcpy(v->mem + p * FORK_PAGE_SIZE, group->pages[i]->data,
+                   FORK_PAGE_SIZE);
+        }
+        v->groups[g] = fork_group_ref(group);
+        fork_group_unref(old);
+    }
+
+    memcpy(v->machine, f->machine, v->size);
+    memset(state->dirty_pages, 0, sizeof(state->dirty_pages));
+    state->mem = v->mem;
+    return v->machine;
+}
+
+/*
+ * fork_store: Makes a clone of the machine of a view. It shares the pages
+ *             that weren't written with the clone last loaded or stored,
+ *             and the view keeps running from it.
+ *
+ * Arguments:
+ *   v      - view
+ *
+ * Returns:
+ *   the clone, or NULL if it couldn't be allocated.
+ */
+fork_t *fork_store(fork_view_t *v) {
+    emu_state_t *state = v->machine;
+    fork_t *f = fork_copy_machine(v->machine, v->size);
+    if (f == NULL) return NULL;
+
+    for (int g = 0; g < FORK_GROUPS; g++) {
+        if (v->groups[g] != NULL && !fork_group_written(state, g)) {
+            f->groups[g] = fork_group_ref(v->groups[g]);
+            continue;
+        }
+        f->groups[g] = fork_group_new(
+            v->mem + g * FORK_GROUP_PAGES * FORK_PAGE_SIZE, v->groups[g],
+            &state->dirty_pages[g * FORK_GROUP_PAGES]);
+        if (f->groups[g] == NULL) {
+            fork_free(f);
+            return NULL;
+        }
+        fork_group_unref(v->groups[g]);
+        v->groups[g] = fork_group_ref(f->groups[g]);
+        memset(&state->dirty_pages[g * FORK_GROUP_PAGES], 0,
+               FORK_GROUP_PAGES);
+    }
+    return f;
+}
@@ -0,0 +1,625 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "8080_disasm.c"
+#include "8080_profile.c"
+#include "8080_emu.c"
+#include "8080_cfg.c"
+#include "8080_core.c"
+
+/*
+ * Differential fuzzer of the execution cores. A case is a machine state (the
+ * registers, flags and a memory fill) and a short program; it runs on the
+ * core under test and on the reference interpreter (emu_run), and the whole
+ * machine is compared after each slice of cycles, memory through its hash
+ * (emu_state_t.mem_hash). The memory itself is compared at the end, and the
+ * hashes checked against a recompute.
+ *
+ * A case is a fuzz_header_t followed by the code, loaded at FUZZ_ORG. Any
+ * input is a valid case: missing header bytes are zero and extra code is
+ * ignored, so the same files are libFuzzer inputs, minimized reproducers and
+ * regression cases.
+ *
+ * Built with -DFUZZ_LIBFUZZER this is a libFuzzer target (the core under test
+ * is read from $FUZZ_CORE), otherwise a standalone driver generating random
+ * cases and replaying saved ones.
+ */
+
+#define FUZZ_MEM_SIZE (0x10000)
+#define FUZZ_ORG (0x0000)          // Load address of the code
+#define FUZZ_MAX_CODE (256)        // Code bytes of a case
+#define FUZZ_MAX_CYCLES (1 << 15)  // Length of a run
+#define FUZZ_SLICE_MIN (32)        // Shortest slice of cycles between compares
+
+/* Options of a case */
+#define FUZZ_OPT_INTERRUPTS (1 << 0)  // Start with EI, interrupt every slice
+
+/* Defaults of the standalone driver */
+#define FUZZ_DEFAULT_CORE "tier"
+#define FUZZ_DEFAULT_CASES (10000)
+
+/*
+ * fuzz_header_t: First bytes of a case, only bytes so there's no padding.
+ */
+typedef struct {
+    uint8_t a, psw, b, c, d, e, h, l;
+    uint8_t sp_l, sp_h;
+    uint8_t seed[4];  // Memory fill, zeroed memory if 0
+    uint8_t slice;    // Slice of FUZZ_SLICE_MIN << (slice % 8) cycles
+    uint8_t options;  // FUZZ_OPT_*
+} fuzz_header_t;
+
+#define FUZZ_MAX_CASE (sizeof(fuzz_header_t) + FUZZ_MAX_CODE)
+
+/*
+ * fuzz_machine_t: Bare machine running a case, with deterministic ports.
+ */
+typedef struct {
+    emu_state_t cpu;  // Must be first, port handlers cast back from it
+    uint32_t port_reads;
+    uint32_t port_hash;  // Of the writes, in order
+} fuzz_machine_t;
+
+uint8_t fuzz_mem[2][FUZZ_MEM_SIZE];
+fuzz_machine_t fuzz_machines[2];  // Reference, then core under test
+
+/*
+ * fuzz_write_port: Device handler for writing data to I/O ports, hashes the
+ *                  writes so the cores are compared on them.
+ *
+ * Arguments:
+ *   state  - emulator state of the machine
+ *   port   - addr of port to write data to
+ *   data   - data to write to port
+ */
+void fuzz_write_port(emu_state_t *state, uint8_t port, uint8_t data) {
+    fuzz_machine_t *m = (fuzz_machine_t *)state;
+    m->port_hash = m->port_hash * 31 + (port << 8 | data);
+}
+
+/*
+ * fuzz_read_port: Device handler for reading data from I/O ports, returns a
+ *                 value depending on the port and the number of reads.
+ *
+ * Arguments:
+ *   state  - emulator state of the machine
+ *   port   - addr of port to read data from
+ *
+ * Returns:
+ *   data read.
+ */
+uint8_t fuzz_read_port(emu_state_t *state, uint8_t port) {
+    fuzz_machine_t *m = (fuzz_machine_t *)state;
+    return (port * 0x9d) ^ m->port_reads++;
+}
+
+/*
+ * fuzz_undefined: Handler of the opcodes that aren't 8080 instructions, which
+ *                 stop the emulator. Random code runs into them, so they halt
+ *                 the CPU instead.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *
+ * Returns:
+ *   size of the instruction.
+ */
+int fuzz_undefined(emu_state_t *state) {
+    state->halted = 1;
+    return 1;
+}
+
+/*
+ * fuzz_init: Installs fuzz_undefined, before any core caches handlers.
+ *
+ * Arguments:
+ *   None.
+ *
+ * Returns:
+ *   None.
+ */
+void fuzz_init(void) {
+    for (int op = 0; op < 0x100; op++) {
+        if (opcode_info[op].op_class & OC_UNDEF) {
+            emu_handlers[op] = fuzz_undefined;
+        }
+    }
+}
+
+/*
+ * fuzz_load: Resets a machine to the state of a case.
+ *
+ * Arguments:
+ *   m      - machine
+ *   mem    - memory of the machine
+ *   data   - case
+ *   size   - size of the case
+ *
+ * Returns:
+ *   None.
+ */
+void fuzz_load(fuzz_machine_t *m, uint8_t *mem, const uint8_t *data,
+               size_t size) {
+    fuzz_header_t h = {0};
+    memcpy(&h, data, (size < sizeof(h)) ? size : sizeof(h));
+    size_t code = (size > sizeof(h)) ? size - sizeof(h) : 0;
+    if (code > FUZZ_MAX_CODE) code = FUZZ_MAX_CODE;
+
+    /* xorshift32, the seed is never 0 once filling */
+    uint32_t x = h.seed[0] | h.seed[1] << 8 | h.seed[2] << 16 |
+                 (uint32_t)h.seed[3] << 24;
+    for (uint32_t addr = 0; addr < FUZZ_MEM_SIZE; addr++) {
+        if (x != 0) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+        }
+        mem[addr] = x;
+    }
+    memcpy(mem + FUZZ_ORG, data + sizeof(h), code);
+
+    memset(m, 0, sizeof(*m));
+    emu_state_t *state = &m->cpu;
+    state->mem = mem;
+    state->write_port = fuzz_write_port;
+    state->read_port = fuzz_read_port;
+    state->pc = FUZZ_ORG;
+    state->a = h.a;
+    emu_set_status_word(state, h.psw);
+    BC = h.b << 8 | h.c;
+    DE = h.d << 8 | h.e;
+    HL = h.h << 8 | h.l;
+    SP = h.sp_h << 8 | h.sp_l;
+    state->interrupts_enabled = !!(h.options & FUZZ_OPT_INTERRUPTS);
+    emu_hash_reset(state);
+}
+
+/*
+ * fuzz_compare: Compares the machines, and prints their differences.
+ *
+ * Arguments:
+ *   ref    - reference machine
+ *   m      - machine of the core under test
+ *   full   - also compare the memory, and check the memory hashes against a
+ *            recompute, rather than only compare the hashes
+ *   out    - stream to print the differences to, NULL to only compare
+ *
+ * Returns:
+ *   1 if the machines differ, 0 otherwise.
+ */
+int fuzz_compare(fuzz_machine_t *ref, fuzz_machine_t *m, int full,
+                 FILE *out) {
+    emu_state_t *r = &ref->cpu, *s = &m->cpu;
+    const struct {
+        const char *name;
+        unsigned long long ref, core;
+    } fields[] = {
+        {"pc", r->pc, s->pc},
+        {"sp", r->sp, s->sp},
+        {"a", r->a, s->a},
+        {"bc", r->bc, s->bc},
+        {"de", r->de, s->de},
+        {"hl", r->hl, s->hl},
+        {"psw", emu_status_word(r), emu_status_word(s)},
+        {"interrupts_enabled", r->interrupts_enabled, s->interrupts_enabled},
+        {"halted", r->halted, s->halted},
+        {"cycles", r->cycles, s->cycles},
+        {"instructions", r->instructions, s->instructions},
+        {"port_reads", ref->port_reads, m->port_reads},
+        {"port_hash", ref->port_hash, m->port_hash},
+        {"mem_hash", r->mem_hash, s->mem_hash},
+    };
+
+    int differ = 0;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (fields[i].ref == fields[i].core) continue;
+        differ = 1;
+        if (out) {
+            fprintf(out, "  %s: %llx -> %llx\n", fields[i].name,
+                    fields[i].ref, fields[i].core);
+        }
+    }
+    if (!full) return differ;
+
+    for (int i = 0; i < 2; i++) {
+        emu_state_t *state = i ? s : r;
+        uint64_t hash = emu_hash_mem(state->mem);
+        if (state->mem_hash == hash) continue;
+        differ = 1;
+        if (out) {
+            fprintf(out, "  %s mem_hash: %016llx, recomputed %016llx\n",
+                    i ? "core" : "reference",
+                    (unsigned long long)state->mem_hash,
+                    (unsigned long long)hash);
+        }
+    }
+    if (memcmp(r->mem, s->mem, FUZZ_MEM_SIZE) != 0) {
+        differ = 1;
+        for (uint32_t addr = 0; out && addr < FUZZ_MEM_SIZE; addr++) {
+            if (r->mem[addr] != s->mem[addr]) {
+                fprintf(out, "  mem[%04x]: %02x -> %02x\n", addr,
+                        r->mem[addr], s->mem[addr]);
+            }
+        }
+    }
+    return differ;
+}
+
+/*
+ * fuzz_run: Runs a case on the reference interpreter and on a core, comparing
+ *           the machines after each slice. Each slice runs the core, then the
+ *           reference up to the cycle count the core reached, so the core
+ *           stops on its own boundaries (e.g. after whole blocks).
+ *
+ * Arguments:
+ *   data   - case
+ *   size   - size of the case
+ *   core   - core under test
+ *   out    - stream to print the divergence to, NULL to only detect it
+ *
+ * Returns:
+ *   1 if the core diverged from the reference, 0 otherwise.
+ */
+int fuzz_run(const uint8_t *data, size_t size, emu_core_t *core, FILE *out) {
+    fuzz_machine_t *ref = &fuzz_machines[0], *m = &fuzz_machines[1];
+    fuzz_load(ref, fuzz_mem[0], data, size);
+    *m = *ref;
+    m->cpu.mem = memcpy(fuzz_mem[1], fuzz_mem[0], FUZZ_MEM_SIZE);
+
+    /* The code changed under the cores' caches */
+    block_cache_mem = NULL;
+
+    uint8_t slice = (size > offsetof(fuzz_header_t, slice))
+                        ? data[offsetof(fuzz_header_t, slice)]
+                        : 0;
+    uint64_t slice_cycles = (uint64_t)FUZZ_SLICE_MIN << (slice % 8);
+    uint64_t start = 0;
+    uint16_t pc = FUZZ_ORG;
+    int n = -1, diverged = 0;
+    while (!diverged && m->cpu.cycles < FUZZ_MAX_CYCLES) {
+        n++;
+        start = m->cpu.cycles;
+        pc = m->cpu.pc;
+        (*core->run)(&m->cpu, start + slice_cycles);
+        emu_run(&ref->cpu, m->cpu.cycles);
+        diverged = fuzz_compare(ref, m, 0, NULL);
+
+        /* Nothing happens to a halted CPU but interrupts */
+        if (m->cpu.halted && !m->cpu.interrupts_enabled) break;
+        if (data[offsetof(fuzz_header_t, options)] & FUZZ_OPT_INTERRUPTS) {
+            emu_interrupt(&ref->cpu, n % 8);
+            emu_interrupt(&m->cpu, n % 8);
+        }
+    }
+    if (!diverged) diverged = fuzz_compare(ref, m, 1, NULL);
+
+    if (diverged && out) {
+        fprintf(out, "%s diverged in slice %d, from %04x at cycle %llu:\n",
+                core->name, n, pc, (unsigned long long)start);
+        fuzz_compare(ref, m, 1, out);
+    }
+    return diverged;
+}
+
+#ifdef FUZZ_LIBFUZZER
+emu_core_t *fuzz_core;
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    (void)(argc);
+    (void)(argv);
+    const char *name = getenv("FUZZ_CORE");
+    fuzz_core = emu_find_core(name ? name : FUZZ_DEFAULT_CORE);
+    if (fuzz_core == NULL) {
+        fprintf(stderr, "error: Unknown core %s\n", name);
+        exit(2);
+    }
+    fuzz_init();
+    return 0;
+}
+
+/* A divergence aborts, for libFuzzer to save and minimize the input */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size >= sizeof(fuzz_header_t) && fuzz_run(data, size, fuzz_core,
+                                                  stderr)) {
+        abort();
+    }
+    return 0;
+}
+#else
+/*
+ * fuzz_minimize: Shrinks a diverging case while it still diverges: drops runs
+ *                of code bytes, halving their length, then zeroes single
+ *                bytes (NOPs in the code, zeroed memory for the seed).
+ *
+ * Arguments:
+ *   data   - case, minimized in place
+ *   size   - size of the case, updated
+ *   core   - core under test
+ *
+ * Returns:
+ *   None.
+ */
+void fuzz_minimize(uint8_t *data, size_t *size, emu_core_t *core) {
+    uint8_t saved[FUZZ_MAX_CASE];
+    int shrunk = 1;
+    while (shrunk) {
+        shrunk = 0;
+        size_t code = *size - sizeof(fuzz_header_t);
+        for (size_t len = code / 2 ? code / 2 : 1; len > 0; len /= 2) {
+            size_t pos = sizeof(fuzz_header_t);
+            while (pos + len <= *size && *size - len > sizeof(fuzz_header_t)) {
+                memcpy(saved, data, *size);
+                memmove(data + pos, data + pos + len, *size - pos - len);
+                if (fuzz_run(data, *size - len, core, NULL)) {
+                    *size -= len;
+                    shrunk = 1;
+                } else {
+                    memcpy(data, saved, *size);
+                    pos += len;
+                }
+            }
+        }
+        for (size_t i = 0; i < *size; i++) {
+            uint8_t byte = data[i];
+            if (byte == 0) continue;
+            data[i] = 0;
+            if (fuzz_run(data, *size, core, NULL)) {
+                shrunk = 1;
+            } else {
+                data[i] = byte;
+            }
+        }
+    }
+}
+
+/*
+ * fuzz_print_case: Prints the state of a case and the disassembly of its code.
+ *
+ * Arguments:
+ *   data   - case
+ *   size   - size of the case, at least a header
+ *
+ * Returns:
+ *   None.
+ */
+void fuzz_print_case(const uint8_t *data, size_t size) {
+    const fuzz_header_t *h = (const fuzz_header_t *)data;
+    printf("  a: %02x psw: %02x bc: %02x%02x de: %02x%02x hl: %02x%02x "
+           "sp: %02x%02x\n",
+           h->a, h->psw, h->b, h->c, h->d, h->e, h->h, h->l, h->sp_h,
+           h->sp_l);
+    printf("  seed: %02x%02x%02x%02x slice: %d options: %02x\n", h->seed[3],
+           h->seed[2], h->seed[1], h->seed[0],
+           FUZZ_SLICE_MIN << (h->slice % 8), h->options);
+
+    /* Operands past the end of the code are the memory fill */
+    uint8_t code[FUZZ_MAX_CODE + 2] = {0};
+    size_t len = size - sizeof(*h);
+    memcpy(code, data + sizeof(*h), len);
+    fuzz_load(&fuzz_machines[0], fuzz_mem[0], data, size);
+    memcpy(code + len, fuzz_mem[0] + FUZZ_ORG + len, 2);
+
+    char buf[DISASM_BUF_SIZE];
+    for (size_t pc = 0; pc < len;) {
+        disasm_info_t info;
+        disasm_str(buf, sizeof(buf), &code[pc], FUZZ_ORG + pc, &info);
+        printf("  %04zx: %s\n", FUZZ_ORG + pc, buf);
+        pc += info.size;
+    }
+}
+
+/*
+ * fuzz_save: Writes a case to a file named after its hash.
+ *
+ * Arguments:
+ *   dir    - directory to write the file to
+ *   data   - case
+ *   size   - size of the case
+ *
+ * Returns:
+ *   0 on success, -1 on errors.
+ */
+int fuzz_save(const char *dir, const uint8_t *data, size_t size) {
+    uint32_t hash = 2166136261u;  // FNV-1a
+    for (size_t i = 0; i < size; i++) hash = (hash ^ data[i]) * 16777619u;
+
+    char filename[4096];
+    snprintf(filename, sizeof(filename), "%s/diverge-%08x.bin", dir, hash);
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL || fwrite(data, 1, size, fp) != size) {
+        fprintf(stderr, "error: Couldn't write %s\n", filename);
+        if (fp) fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    printf("saved %s\n", filename);
+    return 0;
+}
+
+/*
+ * fuzz_replay: Replays a saved case, or every case of a directory.
+ *
+ * Arguments:
+ *   path   - case file or directory
+ *   core   - core under test
+ *
+ * Returns:
+ *   number of diverging cases, or -1 on errors.
+ */
+int fuzz_replay(const char *path, emu_core_t *core) {
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path);
+        if (dir == NULL) return -1;
+        int diverged = 0;
+        struct dirent *entry;
+        while (diverged >= 0 && (entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+            char filename[4096];
+            snprintf(filename, sizeof(filename), "%s/%s", path,
+                     entry->d_name);
+            int rc = fuzz_replay(filename, core);
+            diverged = (rc < 0) ? rc : diverged + rc;
+        }
+        closedir(dir);
+        return diverged;
+    }
+
+    uint8_t data[FUZZ_MAX_CASE];
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "error: Couldn't open %s\n", path);
+        return -1;
+    }
+    size_t size = fread(data, 1, sizeof(data), fp);
+    fclose(fp);
+    if (size < sizeof(fuzz_header_t)) {
+        fprintf(stderr, "error: %s is shorter than a header\n", path);
+        return -1;
+    }
+
+    printf("%s: ", path);
+    if (!fuzz_run(data, size, core, stdout)) {
+        printf("ok\n");
+        return 0;
+    }
+    fuzz_print_case(data, size);
+    return 1;
+}
+
+/*
+ * fuzz_regression_t: Case that once diverged, replayed before the random
+ *                    cases.
+ */
+typedef struct {
+    const char *name;
+    size_t size;
+    uint8_t data[FUZZ_MAX_CASE];
+} fuzz_regression_t;
+
+/* Header bytes: a, psw, b, c, d, e, h, l, sp, seed, slice, options */
+const fuzz_regression_t fuzz_regressions[] = {
+    /* MOV M, A of the fused MOV M, A; INX H overwrites the INX H */
+    {"mov_inx_store", 19,
+     {0x3c, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0xf0, 0x00, 0x00,
+      0x00, 0x00, 0x07, 0x00, 0x77, 0x23, 0x76}},
+    /* The same in the middle of LDAX D; MOV M, A; INX H */
+    {"ldax_mov_store", 20,
+     {0x00, 0x02, 0x00, 0x00, 0x10, 0x00, 0x00, 0x02, 0x00, 0xf0, 0x00, 0x00,
+      0x00, 0x00, 0x07, 0x00, 0x1a, 0x77, 0x23, 0x76}},
+    /* The same once the loop is hot, from native code: HL steps by 0x80
+     * and reaches the INX H after 300 iterations */
+    {"mov_inx_store_hot", 30,
+     {0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf0, 0x00, 0x00,
+      0x00, 0x00, 0x07, 0x00, 0x21, 0x09, 0x6a, 0x11, 0x7f, 0x00, 0x3e, 0x3c,
+      0x77, 0x23, 0x19, 0xc3, 0x08, 0x00}},
+};
+
+#define FUZZ_NUM_REGRESSIONS \
+    (sizeof(fuzz_regressions) / sizeof(fuzz_regressions[0]))
+
+/*
+ * fuzz_regress: Replays the regression cases.
+ *
+ * Arguments:
+ *   core   - core under test
+ *
+ * Returns:
+ *   number of diverging cases.
+ */
+int fuzz_regress(emu_core_t *core) {
+    int diverged = 0;
+    for (unsigned int i = 0; i < FUZZ_NUM_REGRESSIONS; i++) {
+        const fuzz_regression_t *r = &fuzz_regressions[i];
+        if (!fuzz_run(r->data, r->size, core, NULL)) continue;
+
+        printf("regression %s: ", r->name);
+        fuzz_run(r->data, r->size, core, stdout);
+        fuzz_print_case(r->data, r->size);
+        diverged++;
+    }
+    return diverged;
+}
+
+void usage(char *prog) {
+    fprintf(stderr,
+            "usage: %s [-c <core>] [-n <cases>] [-s <seed>] [-o <dir>] "
+            "[-r <case or dir>]...\n",
+            prog);
+    exit(2);
+}
+
+/* Exits like diff(1): 0 if the cores match, 1 if they differ, 2 on errors */
+int main(int argc, char **argv) {
+    const char *core_name = FUZZ_DEFAULT_CORE;
+    long cases = FUZZ_DEFAULT_CASES;
+    uint32_t seed = 1;
+    const char *dir = ".";
+    const char *replays[argc];
+    int num_replays = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-') usage(argv[0]);
+        char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+            case 'c':
+                core_name = arg;
+                break;
+            case 'n':
+                cases = atol(arg);
+                break;
+            case 's':
+                seed = strtoul(arg, NULL, 0);
+                break;
+            case 'o':
+                dir = arg;
+                break;
+            case 'r':
+                replays[num_replays++] = arg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    emu_core_t *core = emu_find_core(core_name);
+    if (core == NULL || seed == 0) usage(argv[0]);
+    fuzz_init();
+
+    if (num_replays > 0) {
+        int diverged = 0;
+        for (int i = 0; i < num_replays && diverged >= 0; i++) {
+            int rc = fuzz_replay(replays[i], core);
+            diverged = (rc < 0) ? rc : diverged + rc;
+        }
+        return (diverged < 0) ? 2 : (diverged > 0);
+    }
+
+    if (fuzz_regress(core) > 0) return 1;
+
+    /* Random cases: a random header, and code of random length */
+    uint8_t data[FUZZ_MAX_CASE];
+    uint32_t x = seed;
+    for (long n = 0; n < cases; n++) {
+        for (size_t i = 0; i < sizeof(data); i++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            data[i] = x;
+        }
+        size_t size = sizeof(fuzz_header_t) + 1 + x % FUZZ_MAX_CODE;
+        if (!fuzz_run(data, size, core, NULL)) continue;
+
+        printf("case %ld diverged, minimizing\n", n);
+        fuzz_minimize(data, &size, core);
+        fuzz_run(data, size, core, stdout);
+        fuzz_print_case(data, size);
+        fuzz_save(dir, data, size);
+        return 1;
+    }
+    printf("%ld cases, %s matches the interpreter\n", cases, core->name);
+    return 0;
+}
+#endif
@@ -0,0 +1,285 @@
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+/* Size of the key event ring, must be a power of two */
+#define INPUT_RING_SIZE (256)
+
+/* Terminals only report key presses (and autorepeats), never releases, so a
+ * key is considered held for this many frames after its last event. */
+#define INPUT_HOLD_FRAMES (8)
+
+/* Poll timeout of the input thread, bounds how long input_stop() waits */
+#define INPUT_POLL_MS (50)
+
+/* Encode/decode an input event as the port it affects and its bit mask */
+#define INPUT_EVENT(port, bit) ((uint16_t)(((port) << 8) | (1U << (bit))))
+#define INPUT_EVENT_PORT(ev) ((ev) >> 8)
+#define INPUT_EVENT_MASK(ev) ((ev)&0xff)
+
+/*
+ * Single-producer/single-consumer ring of key events. The input thread only
+ * writes head, the emulator only writes tail, so neither side ever blocks or
+ * makes a syscall.
+ */
+typedef struct {
+    uint16_t events[INPUT_RING_SIZE];
+    _Atomic uint32_t head;  // Next slot to write (producer)
+    _Atomic uint32_t tail;  // Next slot to read (consumer)
+} input_ring_t;
+
+input_ring_t input_ring;
+pthread_t input_thread;
+atomic_int input_running;
+struct termios input_saved_termios;
+int input_raw_mode;
+
+/* Frames left for which each bit of ports 1 and 2 stays set (consumer side) */
+uint8_t input_hold[2][8];
+
+/*
+ * input_push: Appends an event to the ring, dropping it if the ring is full.
+ *
+ * Arguments:
+ *   event  - encoded input event
+ *
+ * Returns:
+ *   None.
+ */
+void input_push(uint16_t event) {
+    uint32_t head = atomic_load_explicit(&input_ring.head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&input_ring.tail, memory_order_acquire);
+
+    if (head - tail == INPUT_RING_SIZE) return;
+
+    input_ring.events[head & (INPUT_RING_SIZE - 1)] = event;
+    atomic_store_explicit(&input_ring.head, head + 1, memory_order_release);
+}
+
+/*
+ * input_key_event: Maps a key to the input port bit it controls
+ *
+ *   c, 5          - CREDIT      (port 1, bit 0)
+ *   2             - 2P start    (port 1, bit 1)
+ *   1             - 1P start    (port 1, bit 2)
+ *   space, w, up  - 1P shot     (port 1, bit 4)
+ *   a, left       - 1P left     (port 1, bit 5)
+ *   d, right      - 1P right    (port 1, bit 6)
+ *   i             - 2P shot     (port 2, bit 4)
+ *   j             - 2P left     (port 2, bit 5)
+ *   l             - 2P right    (port 2, bit 6)
+ *
+ * Arguments:
+ *   key    - key read from the terminal
+ *   arrow  - 1 if the key is the final byte of an arrow key escape sequence
+ *
+ * Returns:
+ *   encoded input event, or 0 if the key is not mapped.
+ */
+uint16_t input_key_event(uint8_t key, int arrow) {
+    if (arrow) {
+        switch (key) {
+            case 'D':
+                return INPUT_EVENT(1, 5);
+            case 'C':
+                return INPUT_EVENT(1, 6);
+            case 'A':
+                return INPUT_EVENT(1, 4);
+            default:
+                return 0;
+        }
+    }
+
+    switch (key) {
+        case 'c':
+        case '5':
+            return INPUT_EVENT(1, 0);
+        case '2':
+            return INPUT_EVENT(1, 1);
+        case '1':
+            return INPUT_EVENT(1, 2);
+        case ' ':
+        case 'w':
+            return INPUT_EVENT(1, 4);
+        case 'a':
+            return INPUT_EVENT(1, 5);
+        case 'd':
+            return INPUT_EVENT(1, 6);
+        case 'i':
+            return INPUT_EVENT(2, 4);
+        case 'j':
+            return INPUT_EVENT(2, 5);
+        case 'l':
+            return INPUT_EVENT(2, 6);
+        default:
+            return 0;
+    }
+}
+
+/*
+ * input_thread_main: Reads key presses from the terminal and pushes the
+ *                    matching events into the ring.
+ *
+ * Arguments:
+ *   arg    - unused
+ *
+ * Returns:
+ *   NULL.
+ */
+void *input_thread_main(void *arg) {
+    (void)(arg);
+    struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+    uint8_t buf[64];
+    int esc = 0;  // Escape sequence state: 0 none, 1 got ESC, 2 got ESC [
+
+    while (atomic_load(&input_running)) {
+        if (poll(&pfd, 1, INPUT_POLL_MS) <= 0) continue;
+
+        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n <= 0) break;
+
+        for (ssize_t i = 0; i < n; i++) {
+            uint16_t event = 0;
+            if (esc == 0 && buf[i] == 0x1b) {
+                esc = 1;
+            } else if (esc == 1) {
+                esc = (buf[i] == '[') ? 2 : 0;
+            } else if (esc == 2) {
+                event = input_key_event(buf[i], 1);
+                esc = 0;
+            } else {
+                event = input_key_event(buf[i], 0);
+            }
+
+            if (event) input_push(event);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * input_restore_terminal: Restores the terminal settings saved by
+ *                         input_start(). Safe to call more than once.
+ *
+ * Returns:
+ *   None.
+ */
+void input_restore_terminal(void) {
+    if (input_raw_mode) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &input_saved_termios);
+        input_raw_mode = 0;
+    }
+}
+
+/*
+ * input_signal_handler: Restores the terminal on a fatal signal, then raises
+ *                       the signal again with its default action so the
+ *                       process still terminates the way it would have.
+ *
+ * Arguments:
+ *   sig    - signal received
+ *
+ * Returns:
+ *   None.
+ */
+void input_signal_handler(int sig) {
+    input_restore_terminal();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/*
+ * input_stop: Stops the input thread and restores the terminal.
+ *
+ * Returns:
+ *   None.
+ */
+void input_stop(void) {
+    if (atomic_exchange(&input_running, 0)) {
+        pthread_join(input_thread, NULL);
+    }
+    input_restore_terminal();
+}
+
+/*
+ * input_start: Puts the terminal into raw mode and starts the input thread.
+ *              The terminal is restored on exit and on fatal signals.
+ *
+ * Returns:
+ *   0 on success, -1 if stdin is not a terminal or the thread failed to start.
+ */
+int input_start(void) {
+    struct termios raw;
+
+    if (!isatty(STDIN_FILENO)) return -1;
+    if (tcgetattr(STDIN_FILENO, &input_saved_termios) < 0) return -1;
+
+    /* No line buffering or echo, but keep ISIG so Ctrl-C still quits */
+    raw = input_saved_termios;
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) < 0) return -1;
+    input_raw_mode = 1;
+
+    atexit(input_stop);
+    signal(SIGINT, input_signal_handler);
+    signal(SIGTERM, input_signal_handler);
+    signal(SIGQUIT, input_signal_handler);
+
+    atomic_store(&input_running, 1);
+    if (pthread_create(&input_thread, NULL, input_thread_main, NULL) != 0) {
+        atomic_store(&input_running, 0);
+        input_restore_terminal();
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * input_drain: Consumes all pending key events and updates the input port
+ *              bits. Called once per frame from the emulator thread, it only
+ *              touches memory (no syscalls, no locks).
+ *
+ * Arguments:
+ *   port1  - input bits of port 1 to update (bits 0-2, 4-6)
+ *   port2  - input bits of port 2 to update (bits 4-6)
+ *
+ * Returns:
+ *   None.
+ */
+void input_drain(uint8_t *port1, uint8_t *port2) {
+    uint32_t tail = atomic_load_explicit(&input_ring.tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&input_ring.head, memory_order_acquire);
+    uint8_t *ports[2] = {port1, port2};
+
+    for (; tail != head; tail++) {
+        uint16_t event = input_ring.events[tail & (INPUT_RING_SIZE - 1)];
+        uint8_t mask = INPUT_EVENT_MASK(event);
+        for (int bit = 0; bit < 8; bit++) {
+            if (mask & (1U << bit)) {
+                input_hold[INPUT_EVENT_PORT(event) - 1][bit] = INPUT_HOLD_FRAMES;
+            }
+        }
+    }
+    atomic_store_explicit(&input_ring.tail, tail, memory_order_release);
+
+    for (int p = 0; p < 2; p++) {
+        uint8_t bits = 0;
+        for (int bit = 0; bit < 8; bit++) {
+            if (input_hold[p][bit] > 0) {
+                bits |= (1U << bit);
+                input_hold[p][bit]--;
+            }
+        }
+        *ports[p] = bits;
+    }
+}
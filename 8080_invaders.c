@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCREEN_WIDTH (256)
+#define SCREEN_HEIGHT (224)
+#define VRAM_START (0x2400)
+
+#define ROM_SIZE (0x2000)
+#define ROM_FILE_SIZE (0x0800)  // Each of the 4 ROM files
+#define MEM_SIZE (0x10000)
+
+/* The CPU runs at 2 MHz and the screen refreshes at 60 Hz. The video hardware
+ * interrupts with RST 1 when the beam reaches the middle of the screen and
+ * with RST 2 at the end of the screen (vertical blank). */
+#define CLOCK_HZ (2000000)
+#define FRAMES_PER_SEC (60)
+#define CYCLES_PER_FRAME (CLOCK_HZ / FRAMES_PER_SEC)
+#define CYCLES_PER_HALF_FRAME ((CYCLES_PER_FRAME + 1) / 2)
+
+/* Player 1 state in the RAM of the game: score (BCD, low byte first) and
+ * ships left */
+#define P1_SCORE_ADDR (0x20f8)
+#define P1_SHIPS_ADDR (0x21ff)
+
+/*
+ * invaders_t: Space Invaders machine, the CPU and the devices wired to it.
+ */
+typedef struct invaders_s {
+    emu_state_t cpu;  // Must be first, port handlers cast back from it
+    uint16_t shift_reg;
+    uint8_t shift_reg_offset;
+    uint8_t port1_inputs;  // Input bits ORed into port 1
+    uint8_t port2_inputs;  // Input bits ORed into port 2
+    uint8_t next_rst;      // Next video interrupt (1 or 2)
+    uint64_t next_interrupt;  // Cycle at which the next video interrupt fires
+    uint64_t frame;           // Frames completed since reset
+    void (*vblank)(struct invaders_s *m);  // Called before end of screen
+} invaders_t;
+
+/*
+ * read_file_to_buf: Reads file into memory buffer at given offset.
+ *
+ * Arguments:
+ *   filename - name of file to load into buffer
+ *   buf      - buffer to load file contents into
+ *   offset   - offset at which to load the file contents
+ *   max_size - most bytes the buffer has room for after <offset>
+ *
+ * Returns:
+ *   number of bytes read into buffer, or -1 if the file couldn't be opened or
+ *   is larger than <max_size>.
+ */
+int read_file_to_buf(char *filename, uint8_t *buf, uint32_t offset,
+                     uint32_t max_size) {
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    // Read file info buffer, anything left over doesn't fit
+    int rc = fread(buf + offset, 1, max_size, fp);
+    if (fgetc(fp) != EOF) rc = -1;
+    fclose(fp);
+
+    return rc;
+}
+
+/*
+ * invaders_load_rom: Loads the invaders.[h,g,f,e] ROM files.
+ *
+ * Arguments:
+ *   dir    - directory containing the ROM files
+ *   rom    - buffer of ROM_SIZE bytes to load the ROM into
+ *
+ * Returns:
+ *   number of bytes loaded, or -1 if a file couldn't be opened or is larger
+ *   than ROM_FILE_SIZE.
+ */
+int invaders_load_rom(const char *dir, uint8_t *rom) {
+    // Memory map information from:
+    // http://www.emutalk.net/threads/38177-Space-Invaders
+    const char *files[4] = {"invaders.h", "invaders.g", "invaders.f",
+                            "invaders.e"};
+    char filename[4096];
+    int psize = 0;
+
+    for (int i = 0; i < 4; i++) {
+        snprintf(filename, sizeof(filename), "%s/%s", dir, files[i]);
+        int rc = read_file_to_buf(filename, rom, ROM_FILE_SIZE * i,
+                                  ROM_FILE_SIZE);
+        if (rc < 0) {
+            fprintf(stderr, "error: Couldn't read %s, or it is over %d bytes\n",
+                    filename, ROM_FILE_SIZE);
+            return -1;
+        }
+        psize += rc;
+    }
+
+    return psize;
+}
+
+/*
+ * write_port: Device handler for writing data to I/O ports.
+ *
+ * Arguments:
+ *   state  - emulator state of the machine
+ *   port   - addr of port to write data to
+ *   data   - data to write to port
+ */
+void write_port(emu_state_t *state, uint8_t port, uint8_t data) {
+    invaders_t *m = (invaders_t *)state;
+    switch (port) {
+        case 2:
+            /* Shift register offset */
+            m->shift_reg_offset = (data & 0b111);
+            break;
+        case 3:
+            /* Sounds */
+            break;
+        case 4:
+            /* Shift register */
+            m->shift_reg = (m->shift_reg >> 8) + (data << 8);
+            break;
+        case 5:
+            /* Sounds */
+            break;
+        case 6:
+            /* Watchdog */
+            break;
+        default:
+            printf("::: Wrote to port %d: 0x%02x\n", port, data);
+    }
+}
+
+/*
+ * read_port: Device handler for reading data from I/O ports.
+ *
+ * Arguments:
+ *   state  - emulator state of the machine
+ *   port   - addr of port to read data from
+ *
+ * Returns:
+ *   data read from port
+ */
+uint8_t read_port(emu_state_t *state, uint8_t port) {
+    invaders_t *m = (invaders_t *)state;
+    uint8_t data = 0x00;
+    switch (port) {
+        case 0:
+            /* Hardware mapped P1 inputs, never used in code */
+            // Fall-through to default case
+            // break;
+        case 1:
+            /* Inputs
+             * bit 0 = CREDIT (1 if deposit)
+             * bit 1 = 2P start (1 if pressed)
+             * bit 2 = 1P start (1 if pressed)
+             * bit 3 = Always 1
+             * bit 4 = 1P shot (1 if pressed)
+             * bit 5 = 1P left (1 if pressed)
+             * bit 6 = 1P right (1 if pressed)
+             * bit 7 = Not connected
+             */
+            data = (0 << 7) | (0 << 6) | (0 << 5) | (0 << 4) | (1 << 3) |
+                   (0 << 2) | (0 << 1) | (0 << 0);
+            data |= m->port1_inputs;
+            break;
+        case 2:
+            /* Inputs
+             * bit 0 = DIP3 00 = 3 ships  10 = 5 ships
+             * bit 1 = DIP5 01 = 4 ships  11 = 6 ships
+             * bit 2 = Tilt
+             * bit 3 = DIP6 0 = extra ship at 1500, 1 = extra ship at 1000
+             * bit 4 = P2 shot (1 if pressed)
+             * bit 5 = P2 left (1 if pressed)
+             * bit 6 = P2 right (1 if pressed)
+             * bit 7 = DIP7 Coin info displayed in demo screen 0=ON
+             */
+            data = (0 << 7) | (0 << 6) | (0 << 5) | (0 << 4) | (1 << 3) |
+                   (0 << 2) | (0 << 1) | (0 << 0);
+            data |= m->port2_inputs;
+            break;
+        case 3:
+            /* Shift register result */
+            data = (m->shift_reg >> (8 - m->shift_reg_offset)) & 0xff;
+            break;
+        default:
+            printf("::: Read from port %d: 0x%02x\n", port, data);
+    }
+
+    return data;
+}
+
+/*
+ * invaders_reset: Resets a machine, keeping its memory, and copies the ROM
+ *                 into it.
+ *
+ * Arguments:
+ *   m      - machine to reset, with MEM_SIZE bytes of memory
+ *   rom    - ROM image of ROM_SIZE bytes
+ *
+ * Returns:
+ *   None.
+ */
+void invaders_reset(invaders_t *m, const uint8_t *rom) {
+    uint8_t *mem = m->cpu.mem;
+    memset(m, 0, sizeof(*m));
+    m->cpu.interrupts_enabled = 1;  // Enable interrupts by default
+    m->cpu.write_port = write_port;
+    m->cpu.read_port = read_port;
+    m->cpu.mem = mem;
+    memset(mem, 0, MEM_SIZE);
+    memcpy(mem, rom, ROM_SIZE);
+    emu_hash_reset(&m->cpu);
+
+    m->next_rst = 1;
+    m->next_interrupt = CYCLES_PER_HALF_FRAME;
+}
+
+/*
+ * invaders_init: Allocates the memory of a machine and resets it.
+ *
+ * Arguments:
+ *   m      - machine to initialize
+ *   rom    - ROM image of ROM_SIZE bytes
+ *
+ * Returns:
+ *   0 on success, -1 if memory couldn't be allocated.
+ */
+int invaders_init(invaders_t *m, const uint8_t *rom) {
+    m->cpu.mem = malloc(MEM_SIZE);
+    if (m->cpu.mem == NULL) return -1;
+    invaders_reset(m, rom);
+    return 0;
+}
+
+/*
+ * invaders_free: Releases the memory of the machine.
+ *
+ * Arguments:
+ *   m      - machine to release
+ *
+ * Returns:
+ *   None.
+ */
+void invaders_free(invaders_t *m) {
+    free(m->cpu.mem);
+    m->cpu.mem = NULL;
+}
+
+/*
+ * invaders_sync: Raises the video interrupts once the CPU reaches their cycle.
+ *
+ * Arguments:
+ *   m      - machine to synchronize
+ *
+ * Returns:
+ *   1 if the end of a frame was reached, 0 otherwise.
+ */
+int invaders_sync(invaders_t *m) {
+    if (m->cpu.cycles < m->next_interrupt) return 0;
+    PROFILE_SUBSYSTEM(PROF_SCHEDULER);
+
+    int end_of_frame = (m->next_rst == 2);
+    if (end_of_frame && m->vblank) (*m->vblank)(m);
+
+    emu_interrupt(&m->cpu, m->next_rst);
+    m->next_rst = end_of_frame ? 1 : 2;
+    m->next_interrupt += CYCLES_PER_HALF_FRAME;
+
+    if (end_of_frame) m->frame++;
+    PROFILE_SUBSYSTEM(PROF_CPU);
+    return end_of_frame;
+}
+
+/*
+ * invaders_run_frame: Emulates the machine up to the end of the current frame.
+ *
+ * Arguments:
+ *   m      - machine to run
+ *   core   - execution core to emulate instructions with
+ *
+ * Returns:
+ *   None.
+ */
+void invaders_run_frame(invaders_t *m, emu_core_t *core) {
+    do {
+        (*core->run)(&m->cpu, m->next_interrupt);
+    } while (!invaders_sync(m));
+}
+
+/*
+ * invaders_score: Reads the score of player 1 from the RAM of the game.
+ *
+ * Arguments:
+ *   m      - machine
+ *
+ * Returns:
+ *   the score.
+ */
+int invaders_score(const invaders_t *m) {
+    int score = 0;
+    for (int i = 1; i >= 0; i--) {
+        uint8_t bcd = m->cpu.mem[P1_SCORE_ADDR + i];
+        score = score * 100 + (bcd >> 4) * 10 + (bcd & 0x0f);
+    }
+    return score;
+}
+
+/*
+ * invaders_ships: Reads the ships left to player 1 from the RAM of the game.
+ *
+ * Arguments:
+ *   m      - machine
+ *
+ * Returns:
+ *   the number of ships.
+ */
+int invaders_ships(const invaders_t *m) {
+    return m->cpu.mem[P1_SHIPS_ADDR];
+}
@@ -0,0 +1,200 @@
+#include <stdint.h>
+
+#include "8080_disasm.c"
+#include "8080_profile.c"
+#include "8080_emu.c"
+#include "8080_cfg.c"
+#include "8080_core.c"
+#include "8080_invaders.c"
+#include "8080_env.c"
+
+/*
+ * Shared library of the environment API (8080_env.c), for Python and other
+ * languages calling C through a foreign function interface such as ctypes.
+ * The lib_* functions only take and return integers and pointers, so no
+ * structure layout is part of the interface, and LIB_ABI_VERSION changes
+ * whenever they do.
+ *
+ * Memory is never copied across the interface: lib_memory returns the
+ * memory of an instance, video RAM included, and lib_step and lib_render
+ * write the frames and observations into arrays of the caller. A step is a
+ * single call whatever the number of frames it runs, and emulates without
+ * calling back, so a foreign function interface can release its locks (the
+ * GIL of Python) around it.
+ *
+ * gcc -O2 -shared -fPIC -pthread 8080_lib.c -o lib8080.so
+ */
+
+#define LIB_ABI_VERSION (1)
+
+/*
+ * lib_abi_version: Version of the lib_* functions, to check against the one
+ *                  a wrapper was written for.
+ *
+ * Returns:
+ *   LIB_ABI_VERSION.
+ */
+int lib_abi_version(void) {
+    return LIB_ABI_VERSION;
+}
+
+/*
+ * lib_load_rom: Loads the invaders.[h,g,f,e] ROM files.
+ *
+ * Arguments:
+ *   dir    - directory containing the ROM files
+ *   rom    - buffer of lib_rom_size() bytes
+ *
+ * Returns:
+ *   number of bytes loaded, or -1 if a file couldn't be opened.
+ */
+int lib_load_rom(const char *dir, uint8_t *rom) {
+    return invaders_load_rom(dir, rom);
+}
+
+/* Sizes and offsets of the buffers, in bytes */
+int lib_rom_size(void) {
+    return ROM_SIZE;
+}
+
+int lib_memory_size(void) {
+    return MEM_SIZE;
+}
+
+int lib_vram_offset(void) {
+    return VRAM_START;
+}
+
+int lib_vram_size(void) {
+    return SCREEN_WIDTH * SCREEN_HEIGHT / 8;
+}
+
+/*
+ * lib_new: Creates instances at their power on state and the threads
+ *          stepping them, see env_new.
+ *
+ * Arguments:
+ *   rom       - ROM image of lib_rom_size() bytes
+ *   instances - number of instances
+ *   threads   - threads stepping a batch, including the calling one
+ *   scale     - downsampling factor of the frames: 1, 2, 4 or 8
+ *
+ * Returns:
+ *   the environment, or NULL on failure.
+ */
+env_t *lib_new(const uint8_t *rom, int instances, int threads, int scale) {
+    return env_new(rom, instances, threads, scale);
+}
+
+void lib_free(env_t *env) {
+    env_free(env);
+}
+
+/* Shape of the environment */
+int lib_instances(const env_t *env) {
+    return env->num_instances;
+}
+
+int lib_frame_width(const env_t *env) {
+    return env->width;
+}
+
+int lib_frame_height(const env_t *env) {
+    return env->height;
+}
+
+int lib_obs_size(void) {
+    return ENV_OBS_SIZE;
+}
+
+/*
+ * lib_memory: Finds the memory of an instance. It stays at the same address
+ *             until lib_free, resets included.
+ *
+ * Arguments:
+ *   env    - environment
+ *   i      - index of the instance
+ *
+ * Returns:
+ *   lib_memory_size() bytes of memory, or NULL if there's no such instance.
+ */
+uint8_t *lib_memory(env_t *env, int i) {
+    if (i < 0 || i >= env->num_instances) return NULL;
+    return env->machines[i].cpu.mem;
+}
+
+/*
+ * lib_cycles: Counts the CPU cycles an instance ran since its last reset.
+ *
+ * Arguments:
+ *   env    - environment
+ *   i      - index of the instance
+ *
+ * Returns:
+ *   the number of cycles, or -1 if there's no such instance.
+ */
+int64_t lib_cycles(const env_t *env, int i) {
+    if (i < 0 || i >= env->num_instances) return -1;
+    return env->machines[i].cpu.cycles;
+}
+
+/*
+ * lib_reset: Resets an instance to the power on state.
+ *
+ * Arguments:
+ *   env    - environment
+ *   i      - index of the instance
+ *
+ * Returns:
+ *   0 on success, -1 if there's no such instance.
+ */
+int lib_reset(env_t *env, int i) {
+    if (i < 0 || i >= env->num_instances) return -1;
+    env_reset(env, i);
+    return 0;
+}
+
+/*
+ * lib_step: Steps a batch of instances, see env_step.
+ *
+ * Returns:
+ *   0 on success, -1 if the arguments are invalid.
+ */
+int lib_step(env_t *env, const int *batch, int n, const uint8_t *actions,
+             int frames_per_step, uint8_t *frames, int32_t *obs) {
+    return env_step(env, batch, n, actions, frames_per_step, frames, obs);
+}
+
+/*
+ * lib_render: Downsamples the current screen of an instance, see env_render.
+ *
+ * Arguments:
+ *   env    - environment
+ *   i      - index of the instance
+ *   out    - frame of lib_frame_width() x lib_frame_height() bytes
+ *
+ * Returns:
+ *   0 on success, -1 if there's no such instance.
+ */
+int lib_render(const env_t *env, int i, uint8_t *out) {
+    if (i < 0 || i >= env->num_instances) return -1;
+    env_render(env, i, out);
+    return 0;
+}
+
+/*
+ * lib_observe: Reads the observation vector of an instance.
+ *
+ * Arguments:
+ *   env    - environment
+ *   i      - index of the instance
+ *   obs    - lib_obs_size() values
+ *
+ * Returns:
+ *   0 on success, -1 if there's no such instance.
+ */
+int lib_observe(const env_t *env, int i, int32_t *obs) {
+    if (i < 0 || i >= env->num_instances) return -1;
+    env_observe(env, i, obs);
+    return 0;
+}
@@ -1,135 +1,20 @@
 #include <locale.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <wchar.h>
 
 #include "8080_disasm.c"
+#include "8080_profile.c"
 #include "8080_emu.c"
-
-#define SCREEN_WIDTH (256)
-#define SCREEN_HEIGHT (224)
-#define VRAM_START (0x2400)
-
-uint16_t shift_reg;
-uint8_t shift_reg_offset;
-
-/*
- * read_file_to_buf: Reads file into memory buffer at given offset.
- *
- * Arguments:
- *   filename - name of file to load into buffer
- *   buf      - buffer to load file contents into
- *   offset   - offset at which to load the file contents
- *
- * Returns:
- *   number of bytes read into buffer.
- */
-int read_file_to_buf(char *filename, uint8_t *buf, uint32_t offset) {
-    int rc, fsize;
-
-    FILE *fp = fopen(filename, "rb");
-    if (fp == NULL) {
-        printf("error: Couldn't open %s\n", filename);
-        exit(1);
-    }
-
-    // Get file size
-    fseek(fp, 0L, SEEK_END);
-    fsize = ftell(fp);
-    fseek(fp, 0L, SEEK_SET);
-
-    // Read file info buffer
-    rc = fread(buf + offset, 1, fsize, fp);
-    fclose(fp);
-
-    return rc;
-}
-
-/*
- * write_port: Device handler for writing data to I/O ports.
- *
- * Arguments:
- *   port   - addr of port to write data to
- *   data   - data to write to port
- */
-void write_port(uint8_t port, uint8_t data) {
-    switch (port) {
-        case 2:
-            /* Shift register offset */
-            shift_reg_offset = (data & 0b111);
-            break;
-        case 3:
-            /* Sounds */
-            break;
-        case 4:
-            /* Shift register */
-            shift_reg = (shift_reg >> 8) + (data << 8);
-            break;
-        case 5:
-            /* Sounds */
-            break;
-        case 6:
-            /* Watchdog */
-            break;
-        default:
-            printf("::: Wrote to port %d: 0x%02x\n", port, data);
-    }
-}
-
-/*
- * read_port: Device handler for reading data from I/O ports.
- *
- * Arguments:
- *   port   - addr of port to read data from
- *
- * Returns:
- *   data read from port
- */
-uint8_t read_port(uint8_t port) {
-    uint8_t data = 0x00;
-    switch (port) {
-        case 0:
-            /* Hardware mapped P1 inputs, never used in code */
-            // Fall-through to default case
-            // break;
-        case 1:
-            /* Inputs
-             * bit 0 = CREDIT (1 if deposit)
-             * bit 1 = 2P start (1 if pressed)
-             * bit 2 = 1P start (1 if pressed)
-             * bit 3 = Always 1
-             * bit 4 = 1P shot (1 if pressed)
-             * bit 5 = 1P left (1 if pressed)
-             * bit 6 = 1P right (1 if pressed)
-             * bit 7 = Not connected
-             */
-            data = (0 << 7) | (0 << 6) | (0 << 5) | (0 << 4) | (1 << 3) |
-                   (0 << 2) | (0 << 1) | (0 << 0);
-            break;
-        case 2:
-            /* Inputs
-             * bit 0 = DIP3 00 = 3 ships  10 = 5 ships
-             * bit 1 = DIP5 01 = 4 ships  11 = 6 ships
-             * bit 2 = Tilt
-             * bit 3 = DIP6 0 = extra ship at 1500, 1 = extra ship at 1000
-             * bit 4 = P2 shot (1 if pressed)
-             * bit 5 = P2 left (1 if pressed)
-             * bit 6 = P2 right (1 if pressed)
-             * bit 7 = DIP7 Coin info displayed in demo screen 0=ON
-             */
-            data = (0 << 7) | (0 << 6) | (0 << 5) | (0 << 4) | (1 << 3) |
-                   (0 << 2) | (0 << 1) | (0 << 0);
-            break;
-        case 3:
-            /* Shift register result */
-            data = (shift_reg >> (8 - shift_reg_offset)) & 0xff;
-            break;
-        default:
-            printf("::: Read from port %d: 0x%02x\n", port, data);
-    }
-
-    return data;
-}
+#include "8080_cfg.c"
+#include "8080_core.c"
+#include "8080_input.c"
+#include "8080_invaders.c"
+#include "8080_cpm.c"
+#include "8080_trace.c"
+#include "8080_export.c"
 
 /*
  * bit0: lower right
@@ -196,65 +81,166 @@ void print_screen(emu_state_t *state) {
     wprintf(L"%lc\n", 0x2518);
 }
 
+/*
+ * latch_inputs: Updates the input ports with the keys pressed since the last
+ *               frame.
+ *
+ * Arguments:
+ *   m      - machine whose input ports to update
+ *
+ * Returns:
+ *   None.
+ */
+void latch_inputs(invaders_t *m) {
+    input_drain(&m->port1_inputs, &m->port2_inputs);
+}
+
+/*
+ * run_cpm: Runs a CP/M program to completion on an execution core, and
+ *          reports its speed. The tier core starts from a translation cache
+ *          of the program, if any, and saves it for the next run.
+ *
+ * Arguments:
+ *   filename  - .COM program
+ *   core_name - name of the execution core
+ *   stop_at   - instructions after which to stop, 0 for no limit
+ *   cache     - translation cache file of the tier core, or NULL
+ *
+ * Returns:
+ *   the exit status of the emulator.
+ */
+int run_cpm(char *filename, const char *core_name, uint64_t stop_at,
+            const char *cache) {
+    emu_core_t *core = emu_find_core(core_name);
+    if (core == NULL) {
+        fprintf(stderr, "error: Unknown core %s\n", core_name);
+        return 1;
+    }
+
+    cpm_t machine;
+    if (cpm_init(&machine, filename, stdout) < 0) return 1;
+    emu_state_t *state = &machine.cpu;
+    profile_start(state->mem, &state->pc);
+
+    /* The program may write to its code, the cache is checked against the
+     * code it starts with */
+    static uint8_t rom[TCACHE_CODE_END];
+    memcpy(rom, state->mem, sizeof(rom));
+    tcache_file = cache;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cpm_run(&machine, core, stop_at);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (cache != NULL && core->run == tier_run) {
+        fprintf(stderr, "\n%s: %llu blocks loaded\n", cache,
+                (unsigned long long)tier_stats.loaded);
+        if (tcache_save(cache, rom) < 0) {
+            fprintf(stderr, "warning: Couldn't write %s\n", cache);
+        }
+    }
+
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr,
+            "\n%s: %llu instructions, %llu cycles, %llu BDOS calls in "
+            "%.2f s (%.1f M instructions/s, %s core)\n",
+            filename, (unsigned long long)state->instructions,
+            (unsigned long long)state->cycles,
+            (unsigned long long)machine.bdos_calls, secs,
+            state->instructions / secs / 1e6, core->name);
+
+    profile_report();
+    cpm_free(&machine);
+    return machine.exited ? 0 : 1;
+}
+
 int main(int argc, char **argv) {
     setlocale(LC_CTYPE, "");
 
+    // CP/M mode: -C <program.com> [<core>] [<stop_at>] [<cache file>]
+    if (argc > 2 && strcmp(argv[1], "-C") == 0) {
+        return run_cpm(argv[2], (argc > 3) ? argv[3] : "tier",
+                       (argc > 4) ? strtoull(argv[4], NULL, 10) : 0,
+                       (argc > 5) ? argv[5] : NULL);
+    }
+
+    // Screen export: -S <name> (pixels) or -V <name> (pixels and video RAM)
+    // to a shared memory segment instead of the terminal, then the usual
+    // arguments
+    export_t export;
+    int exporting = 0;
+    if (argc > 2 &&
+        (strcmp(argv[1], "-S") == 0 || strcmp(argv[1], "-V") == 0)) {
+        if (export_open(&export, argv[2], argv[1][1] == 'V') < 0) {
+            fprintf(stderr, "error: Couldn't create %s\n", argv[2]);
+            exit(1);
+        }
+        exporting = 1;
+        argc -= 2;
+        argv += 2;
+    }
+
     unsigned int verbose = 0;
     unsigned int stop_at = 0;
+    char *trace_file = "trace.bin";
     if (argc > 1) verbose = atoi(argv[1]);
     if (argc > 2) stop_at = atoi(argv[2]);
+    if (argc > 3) trace_file = argv[3];
 
-    shift_reg = 0x0000;
-    int psize = 0;
-    emu_state_t state = {0};
-    state.interrupts_enabled = 1;  // Enable interrupts by default
-    state.write_port = write_port;
-    state.read_port = read_port;
-    state.mem = malloc(0x8000);
+    uint8_t rom[ROM_SIZE] = {0};
+    int psize = invaders_load_rom("ROM", rom);
+    if (psize < 0) exit(1);
 
-    // Memory map information from:
-    // http://www.emutalk.net/threads/38177-Space-Invaders
-    psize += read_file_to_buf("ROM/invaders.h", state.mem, 0x0000);
-    psize += read_file_to_buf("ROM/invaders.g", state.mem, 0x0800);
-    psize += read_file_to_buf("ROM/invaders.f", state.mem, 0x1000);
-    psize += read_file_to_buf("ROM/invaders.e", state.mem, 0x1800);
+    invaders_t machine;
+    if (invaders_init(&machine, rom) < 0) exit(1);
+    emu_state_t *state = &machine.cpu;
 
-    unsigned int opcode;
-    unsigned int instr_cnt = 0;
-    unsigned int last_rst = 0;
-    while (state.pc < psize) {
-        if (state.halted) continue;
+    // Reports of the profilers enabled at compile time
+    profile_start(state->mem, &state->pc);
 
-        opcode = state.mem[state.pc];
+    // Every <verbose>th instruction is traced, see 8080_tracedec
+    trace_t trace;
+    if (verbose && trace_open(&trace, trace_file) < 0) {
+        printf("error: Couldn't create %s\n", trace_file);
+        exit(1);
+    }
+
+    // Keyboard controls, only available when attached to a terminal
+    if (input_start() == 0) machine.vblank = latch_inputs;
 
+    unsigned int instr_cnt = 0;
+    while (state->pc < psize) {
         if (verbose && instr_cnt % verbose == 0) {
-            printf("%012d ", instr_cnt);  // Print instruction count
-            print_flags(&state);
-            printf("%*c", 12, ' ');  // Pad spacing
-            (*disasm_handlers[opcode])(state.mem, state.pc);
+            trace_instr(&trace, state, instr_cnt);
         }
 
         // Emulate instuction
-        state.pc += (*emu_handlers[opcode])(&state);
-
-        // TODO: Use correct screen print interval
-        if (instr_cnt % 400000 == 0) {
-            print_screen(&state);
-        }
-
-        // Vertical sync interrupts
-        // TODO: Use proper timing here too...
-        // FIXME: Check if interrupts are enabled?
-        if (instr_cnt % 100000 == 0) {
-            emu_rst(&state, last_rst + 1);
-            last_rst = !last_rst;
+        emu_step(state);
+
+        // Video interrupts, the screen is printed or exported once per frame
+        if (invaders_sync(&machine)) {
+            PROFILE_SUBSYSTEM(PROF_RENDER);
+            if (exporting) {
+                export_frame(&export, &state->mem[VRAM_START], machine.frame,
+                             state->cycles);
+            } else {
+                print_screen(state);
+            }
+            PROFILE_SUBSYSTEM(PROF_CPU);
         }
 
         instr_cnt++;
         if (stop_at > 0 && instr_cnt > stop_at) break;
     }
 
-    dump_state(&state);
-    free(state.mem);
+    input_stop();
+    if (verbose && trace_close(&trace) < 0) {
+        printf("error: Couldn't write %s\n", trace_file);
+    }
+    if (exporting) export_close(&export);
+    dump_state(state);
+    profile_report();
+    invaders_free(&machine);
     return 0;
 }
@@ -0,0 +1,358 @@
+#include <stdint.h>
+
+/*
+ * Specification of the 8080 instruction set, from which the handler tables of
+ * the disassembler and the emulator and the opcode_info metadata are
+ * generated. Each opcode, in order, is described by
+ *
+ *   X(name, mnemonic, size, cycles, taken, flags_read, flags_written,
+ *     regs_read, regs_written, class)
+ *
+ *   name          - suffix of the disasm_ and emu_ handlers
+ *   mnemonic      - disasm_mn_t, without the DISASM_MN_ prefix
+ *   size          - bytes, including the opcode
+ *   cycles        - clock periods, for conditional branches when not taken
+ *   taken         - clock periods of a conditional branch when taken
+ *   flags_read    - OF_* flags read
+ *   flags_written - OF_* flags written
+ *   regs_read     - OR_* registers read, HL for instructions using M
+ *   regs_written  - OR_* registers written
+ *   class         - OC_* memory, I/O and branch behavior
+ *
+ * The flags are the ones the handlers of 8080_emu.c actually update (e.g. ANA
+ * keeps AC, and DAA reads all the flags since it keeps them when it doesn't
+ * adjust A).
+ */
+
+/* Condition flags */
+#define OF_Z (1 << 0)
+#define OF_S (1 << 1)
+#define OF_P (1 << 2)
+#define OF_CY (1 << 3)
+#define OF_AC (1 << 4)
+#define OF_ZSP (OF_Z | OF_S | OF_P)
+#define OF_ALL (OF_ZSP | OF_CY | OF_AC)
+
+/* Registers, SP counts as one */
+#define OR_A (1 << 0)
+#define OR_B (1 << 1)
+#define OR_C (1 << 2)
+#define OR_D (1 << 3)
+#define OR_E (1 << 4)
+#define OR_H (1 << 5)
+#define OR_L (1 << 6)
+#define OR_SP (1 << 7)
+#define OR_BC (OR_B | OR_C)
+#define OR_DE (OR_D | OR_E)
+#define OR_HL (OR_H | OR_L)
+
+/* Classes */
+#define OC_LOAD (1 << 0)      // Reads memory
+#define OC_STORE (1 << 1)     // Writes memory
+#define OC_IO (1 << 2)        // IN, OUT
+#define OC_JUMP (1 << 3)      // Changes PC
+#define OC_CALL (1 << 4)      // Pushes the return address, including RST
+#define OC_RET (1 << 5)       // Pops the return address
+#define OC_COND (1 << 6)      // Branch depending on a flag
+#define OC_INDIRECT (1 << 7)  // Target not encoded in the instruction
+#define OC_CONTROL (1 << 8)   // Interrupt control and HLT
+#define OC_UNDEF (1 << 9)     // Not an 8080 instruction, stops the emulator
+
+#define OPCODES(X)                                                            \
+    /* 0x00 */                                                                \
+    X(NOP, NOP, 1, 4, 4, 0, 0, 0, 0, 0)                                       \
+    X(LXI_B, LXI, 3, 10, 10, 0, 0, 0, OR_BC, 0)                               \
+    X(STAX_B, STAX, 1, 7, 7, 0, 0, OR_A | OR_BC, 0, OC_STORE)                 \
+    X(INX_B, INX, 1, 5, 5, 0, 0, OR_BC, OR_BC, 0)                             \
+    X(INR_B, INR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_B, OR_B, 0)                  \
+    X(DCR_B, DCR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_B, OR_B, 0)                  \
+    X(MVI_B, MVI, 2, 7, 7, 0, 0, 0, OR_B, 0)                                  \
+    X(RLC, RLC, 1, 4, 4, 0, OF_CY, OR_A, OR_A, 0)                             \
+    X(unimplemented, unimplemented, 1, 4, 4, 0, 0, 0, 0, OC_UNDEF)            \
+    X(DAD_B, DAD, 1, 10, 10, 0, OF_CY, OR_HL | OR_BC, OR_HL, 0)               \
+    X(LDAX_B, LDAX, 1, 7, 7, 0, 0, OR_BC, OR_A, OC_LOAD)                      \
+    X(DCX_B, DCX, 1, 5, 5, 0, 0, OR_BC, OR_BC, 0)                             \
+    X(INR_C, INR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_C, OR_C, 0)                  \
+    X(DCR_C, DCR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_C, OR_C, 0)                  \
+    X(MVI_C, MVI, 2, 7, 7, 0, 0, 0, OR_C, 0)                                  \
+    X(RRC, RRC, 1, 4, 4, 0, OF_CY, OR_A, OR_A, 0)                             \
+    /* 0x10 */                                                                \
+    X(unimplemented, unimplemented, 1, 4, 4, 0, 0, 0, 0, OC_UNDEF)            \
+    X(LXI_D, LXI, 3, 10, 10, 0, 0, 0, OR_DE, 0)                               \
+    X(STAX_D, STAX, 1, 7, 7, 0, 0, OR_A | OR_DE, 0, OC_STORE)                 \
+    X(INX_D, INX, 1, 5, 5, 0, 0, OR_DE, OR_DE, 0)                             \
+    X(INR_D, INR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_D, OR_D, 0)                  \
+    X(DCR_D, DCR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_D, OR_D, 0)                  \
+    X(MVI_D, MVI, 2, 7, 7, 0, 0, 0, OR_D, 0)                                  \
+    X(RAL, RAL, 1, 4, 4, OF_CY, OF_CY, OR_A, OR_A, 0)                         \
+    X(unimplemented, unimplemented, 1, 4, 4, 0, 0, 0, 0, OC_UNDEF)            \
+    X(DAD_D, DAD, 1, 10, 10, 0, OF_CY, OR_HL | OR_DE, OR_HL, 0)               \
+    X(LDAX_D, LDAX, 1, 7, 7, 0, 0, OR_DE, OR_A, OC_LOAD)                      \
+    X(DCX_D, DCX, 1, 5, 5, 0, 0, OR_DE, OR_DE, 0)                             \
+    X(INR_E, INR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_E, OR_E, 0)                  \
+    X(DCR_E, DCR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_E, OR_E, 0)                  \
+    X(MVI_E, MVI, 2, 7, 7, 0, 0, 0, OR_E, 0)                                  \
+    X(RAR, RAR, 1, 4, 4, OF_CY, OF_CY, OR_A, OR_A, 0)                         \
+    /* 0x20 */                                                                \
+    X(RIM, RIM, 1, 4, 4, 0, 0, 0, 0, OC_UNDEF)                                \
+    X(LXI_H, LXI, 3, 10, 10, 0, 0, 0, OR_HL, 0)                               \
+    X(SHLD, SHLD, 3, 16, 16, 0, 0, OR_HL, 0, OC_STORE)                        \
+    X(INX_H, INX, 1, 5, 5, 0, 0, OR_HL, OR_HL, 0)                             \
+    X(INR_H, INR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_H, OR_H, 0)                  \
+    X(DCR_H, DCR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_H, OR_H, 0)                  \
+    X(MVI_H, MVI, 2, 7, 7, 0, 0, 0, OR_H, 0)                                  \
+    X(DAA, DAA, 1, 4, 4, OF_ALL, OF_ALL, OR_A, OR_A, 0)                       \
+    X(unimplemented, unimplemented, 1, 4, 4, 0, 0, 0, 0, OC_UNDEF)            \
+    X(DAD_H, DAD, 1, 10, 10, 0, OF_CY, OR_HL, OR_HL, 0)                       \
+    X(LHLD, LHLD, 3, 16, 16, 0, 0, 0, OR_HL, OC_LOAD)                         \
+    X(DCX_H, DCX, 1, 5, 5, 0, 0, OR_HL, OR_HL, 0)                             \
+    X(INR_L, INR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_L, OR_L, 0)                  \
+    X(DCR_L, DCR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_L, OR_L, 0)                  \
+    X(MVI_L, MVI, 2, 7, 7, 0, 0, 0, OR_L, 0)                                  \
+    X(CMA, CMA, 1, 4, 4, 0, 0, OR_A, OR_A, 0)                                 \
+    /* 0x30 */                                                                \
+    X(SIM, SIM, 1, 4, 4, 0, 0, 0, 0, OC_UNDEF)                                \
+    X(LXI_SP, LXI, 3, 10, 10, 0, 0, 0, OR_SP, 0)                              \
+    X(STA, STA, 3, 13, 13, 0, 0, OR_A, 0, OC_STORE)                           \
+    X(INX_SP, INX, 1, 5, 5, 0, 0, OR_SP, OR_SP, 0)                            \
+    X(INR_M, INR, 1, 10, 10, 0, OF_ZSP | OF_AC, OR_HL, 0, OC_LOAD | OC_STORE) \
+    X(DCR_M, DCR, 1, 10, 10, 0, OF_ZSP | OF_AC, OR_HL, 0, OC_LOAD | OC_STORE) \
+    X(MVI_M, MVI, 2, 10, 10, 0, 0, OR_HL, 0, OC_STORE)                        \
+    X(STC, STC, 1, 4, 4, 0, OF_CY, 0, 0, 0)                                   \
+    X(unimplemented, unimplemented, 1, 4, 4, 0, 0, 0, 0, OC_UNDEF)            \
+    X(DAD_SP, DAD, 1, 10, 10, 0, OF_CY, OR_HL | OR_SP, OR_HL, 0)              \
+    X(LDA, LDA, 3, 13, 13, 0, 0, 0, OR_A, OC_LOAD)                            \
+    X(DCX_SP, DCX, 1, 5, 5, 0, 0, OR_SP, OR_SP, 0)                            \
+    X(INR_A, INR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_A, OR_A, 0)                  \
+    X(DCR_A, DCR, 1, 5, 5, 0, OF_ZSP | OF_AC, OR_A, OR_A, 0)                  \
+    X(MVI_A, MVI, 2, 7, 7, 0, 0, 0, OR_A, 0)                                  \
+    X(CMC, CMC, 1, 4, 4, OF_CY, OF_CY, 0, 0, 0)                               \
+    /* 0x40 */                                                                \
+    X(MOV_B_B, MOV, 1, 5, 5, 0, 0, OR_B, OR_B, 0)                             \
+    X(MOV_B_C, MOV, 1, 5, 5, 0, 0, OR_C, OR_B, 0)                             \
+    X(MOV_B_D, MOV, 1, 5, 5, 0, 0, OR_D, OR_B, 0)                             \
+    X(MOV_B_E, MOV, 1, 5, 5, 0, 0, OR_E, OR_B, 0)                             \
+    X(MOV_B_H, MOV, 1, 5, 5, 0, 0, OR_H, OR_B, 0)                             \
+    X(MOV_B_L, MOV, 1, 5, 5, 0, 0, OR_L, OR_B, 0)                             \
+    X(MOV_B_M, MOV, 1, 7, 7, 0, 0, OR_HL, OR_B, OC_LOAD)                      \
+    X(MOV_B_A, MOV, 1, 5, 5, 0, 0, OR_A, OR_B, 0)                             \
+    X(MOV_C_B, MOV, 1, 5, 5, 0, 0, OR_B, OR_C, 0)                             \
+    X(MOV_C_C, MOV, 1, 5, 5, 0, 0, OR_C, OR_C, 0)                             \
+    X(MOV_C_D, MOV, 1, 5, 5, 0, 0, OR_D, OR_C, 0)                             \
+    X(MOV_C_E, MOV, 1, 5, 5, 0, 0, OR_E, OR_C, 0)                             \
+    X(MOV_C_H, MOV, 1, 5, 5, 0, 0, OR_H, OR_C, 0)                             \
+    X(MOV_C_L, MOV, 1, 5, 5, 0, 0, OR_L, OR_C, 0)                             \
+    X(MOV_C_M, MOV, 1, 7, 7, 0, 0, OR_HL, OR_C, OC_LOAD)                      \
+    X(MOV_C_A, MOV, 1, 5, 5, 0, 0, OR_A, OR_C, 0)                             \
+    /* 0x50 */                                                                \
+    X(MOV_D_B, MOV, 1, 5, 5, 0, 0, OR_B, OR_D, 0)                             \
+    X(MOV_D_C, MOV, 1, 5, 5, 0, 0, OR_C, OR_D, 0)                             \
+    X(MOV_D_D, MOV, 1, 5, 5, 0, 0, OR_D, OR_D, 0)                             \
+    X(MOV_D_E, MOV, 1, 5, 5, 0, 0, OR_E, OR_D, 0)                             \
+    X(MOV_D_H, MOV, 1, 5, 5, 0, 0, OR_H, OR_D, 0)                             \
+    X(MOV_D_L, MOV, 1, 5, 5, 0, 0, OR_L, OR_D, 0)                             \
+    X(MOV_D_M, MOV, 1, 7, 7, 0, 0, OR_HL, OR_D, OC_LOAD)                      \
+    X(MOV_D_A, MOV, 1, 5, 5, 0, 0, OR_A, OR_D, 0)                             \
+    X(MOV_E_B, MOV, 1, 5, 5, 0, 0, OR_B, OR_E, 0)                             \
+    X(MOV_E_C, MOV, 1, 5, 5, 0, 0, OR_C, OR_E, 0)                             \
+    X(MOV_E_D, MOV, 1, 5, 5, 0, 0, OR_D, OR_E, 0)                             \
+    X(MOV_E_E, MOV, 1, 5, 5, 0, 0, OR_E, OR_E, 0)                             \
+    X(MOV_E_H, MOV, 1, 5, 5, 0, 0, OR_H, OR_E, 0)                             \
+    X(MOV_E_L, MOV, 1, 5, 5, 0, 0, OR_L, OR_E, 0)                             \
+    X(MOV_E_M, MOV, 1, 7, 7, 0, 0, OR_HL, OR_E, OC_LOAD)                      \
+    X(MOV_E_A, MOV, 1, 5, 5, 0, 0, OR_A, OR_E, 0)                             \
+    /* 0x60 */                                                                \
+    X(MOV_H_B, MOV, 1, 5, 5, 0, 0, OR_B, OR_H, 0)                             \
+    X(MOV_H_C, MOV, 1, 5, 5, 0, 0, OR_C, OR_H, 0)                             \
+    X(MOV_H_D, MOV, 1, 5, 5, 0, 0, OR_D, OR_H, 0)                             \
+    X(MOV_H_E, MOV, 1, 5, 5, 0, 0, OR_E, OR_H, 0)                             \
+    X(MOV_H_H, MOV, 1, 5, 5, 0, 0, OR_H, OR_H, 0)                             \
+    X(MOV_H_L, MOV, 1, 5, 5, 0, 0, OR_L, OR_H, 0)                             \
+    X(MOV_H_M, MOV, 1, 7, 7, 0, 0, OR_HL, OR_H, OC_LOAD)                      \
+    X(MOV_H_A, MOV, 1, 5, 5, 0, 0, OR_A, OR_H, 0)                             \
+    X(MOV_L_B, MOV, 1, 5, 5, 0, 0, OR_B, OR_L, 0)                             \
+    X(MOV_L_C, MOV, 1, 5, 5, 0, 0, OR_C, OR_L, 0)                             \
+    X(MOV_L_D, MOV, 1, 5, 5, 0, 0, OR_D, OR_L, 0)                             \
+    X(MOV_L_E, MOV, 1, 5, 5, 0, 0, OR_E, OR_L, 0)                             \
+    X(MOV_L_H, MOV, 1, 5, 5, 0, 0, OR_H, OR_L, 0)                             \
+    X(MOV_L_L, MOV, 1, 5, 5, 0, 0, OR_L, OR_L, 0)                             \
+    X(MOV_L_M, MOV, 1, 7, 7, 0, 0, OR_HL, OR_L, OC_LOAD)                      \
+    X(MOV_L_A, MOV, 1, 5, 5, 0, 0, OR_A, OR_L, 0)                             \
+    /* 0x70 */                                                                \
+    X(MOV_M_B, MOV, 1, 7, 7, 0, 0, OR_B | OR_HL, 0, OC_STORE)                 \
+    X(MOV_M_C, MOV, 1, 7, 7, 0, 0, OR_C | OR_HL, 0, OC_STORE)                 \
+    X(MOV_M_D, MOV, 1, 7, 7, 0, 0, OR_D | OR_HL, 0, OC_STORE)                 \
+    X(MOV_M_E, MOV, 1, 7, 7, 0, 0, OR_E | OR_HL, 0, OC_STORE)                 \
+    X(MOV_M_H, MOV, 1, 7, 7, 0, 0, OR_H | OR_HL, 0, OC_STORE)                 \
+    X(MOV_M_L, MOV, 1, 7, 7, 0, 0, OR_L | OR_HL, 0, OC_STORE)                 \
+    X(HLT, HLT, 1, 7, 7, 0, 0, 0, 0, OC_CONTROL)                              \
+    X(MOV_M_A, MOV, 1, 7, 7, 0, 0, OR_A | OR_HL, 0, OC_STORE)                 \
+    X(MOV_A_B, MOV, 1, 5, 5, 0, 0, OR_B, OR_A, 0)                             \
+    X(MOV_A_C, MOV, 1, 5, 5, 0, 0, OR_C, OR_A, 0)                             \
+    X(MOV_A_D, MOV, 1, 5, 5, 0, 0, OR_D, OR_A, 0)                             \
+    X(MOV_A_E, MOV, 1, 5, 5, 0, 0, OR_E, OR_A, 0)                             \
+    X(MOV_A_H, MOV, 1, 5, 5, 0, 0, OR_H, OR_A, 0)                             \
+    X(MOV_A_L, MOV, 1, 5, 5, 0, 0, OR_L, OR_A, 0)                             \
+    X(MOV_A_M, MOV, 1, 7, 7, 0, 0, OR_HL, OR_A, OC_LOAD)                      \
+    X(MOV_A_A, MOV, 1, 5, 5, 0, 0, OR_A, OR_A, 0)                             \
+    /* 0x80 */                                                                \
+    X(ADD_B, ADD, 1, 4, 4, 0, OF_ALL, OR_A | OR_B, OR_A, 0)                   \
+    X(ADD_C, ADD, 1, 4, 4, 0, OF_ALL, OR_A | OR_C, OR_A, 0)                   \
+    X(ADD_D, ADD, 1, 4, 4, 0, OF_ALL, OR_A | OR_D, OR_A, 0)                   \
+    X(ADD_E, ADD, 1, 4, 4, 0, OF_ALL, OR_A | OR_E, OR_A, 0)                   \
+    X(ADD_H, ADD, 1, 4, 4, 0, OF_ALL, OR_A | OR_H, OR_A, 0)                   \
+    X(ADD_L, ADD, 1, 4, 4, 0, OF_ALL, OR_A | OR_L, OR_A, 0)                   \
+    X(ADD_M, ADD, 1, 7, 7, 0, OF_ALL, OR_A | OR_HL, OR_A, OC_LOAD)            \
+    X(ADD_A, ADD, 1, 4, 4, 0, OF_ALL, OR_A, OR_A, 0)                          \
+    X(ADC_B, ADC, 1, 4, 4, OF_CY, OF_ALL, OR_A | OR_B, OR_A, 0)               \
+    X(ADC_C, ADC, 1, 4, 4, OF_CY, OF_ALL, OR_A | OR_C, OR_A, 0)               \
+    X(ADC_D, ADC, 1, 4, 4, OF_CY, OF_ALL, OR_A | OR_D, OR_A, 0)               \
+    X(ADC_E, ADC, 1, 4, 4, OF_CY, OF_ALL, OR_A | OR_E, OR_A, 0)               \
+    X(ADC_H, ADC, 1, 4, 4, OF_CY, OF_ALL, OR_A | OR_H, OR_A, 0)               \
+    X(ADC_L, ADC, 1, 4, 4, OF_CY, OF_ALL, OR_A | OR_L, OR_A, 0)               \
+    X(ADC_M, ADC, 1, 7, 7, OF_CY, OF_ALL, OR_A | OR_HL, OR_A, OC_LOAD)        \
+    X(ADC_A, ADC, 1, 4, 4, OF_CY, OF_ALL, OR_A, OR_A, 0)                      \
+    /* 0x90 */                                                                \
+    X(SUB_B, SUB, 1, 4, 4, 0, OF_ALL, OR_A | OR_B, OR_A, 0)                   \
+    X(SUB_C, SUB, 1, 4, 4, 0, OF_ALL, OR_A | OR_C, OR_A, 0)                   \
+    X(SUB_D, SUB, 1, 4, 4, 0, OF_ALL, OR_A | OR_D, OR_A, 0)                   \
+    X(SUB_E, SUB, 1, 4, 4, 0, OF_ALL, OR_A | OR_E, OR_A, 0)                   \
+    X(SUB_H, SUB, 1, 4, 4, 0, OF_ALL, OR_A | OR_H, OR_A, 0)                   \
+    X(SUB_L, SUB, 1, 4, 4, 0, OF_ALL, OR_A | OR_L, OR_A, 0)                   \
+    X(SUB_M, SUB, 1, 7, 7, 0, OF_ALL, OR_A | OR_HL, OR_A, OC_LOAD)            \
+    X(SUB_A, SUB, 1, 4, 4, 0, OF_ALL, OR_A, OR_A, 0)                          \
+    X(SBB_B, SBB, 1, 4, 4, OF_CY, OF_ALL, OR_A | OR_B, OR_A, 0)               \
+    X(SBB_C, SBB, 1, 4, 4, OF_CY, OF_ALL, OR_A | OR_C, OR_A, 0)               \
+    X(SBB_D, SBB, 1, 4, 4, OF_CY, OF_ALL, OR_A | OR_D, OR_A, 0)               \
+    X(SBB_E, SBB, 1, 4, 4, OF_CY, OF_ALL, OR_A | OR_E, OR_A, 0)               \
+    X(SBB_H, SBB, 1, 4, 4, OF_CY, OF_ALL, OR_A | OR_H, OR_A, 0)               \
+    X(SBB_L, SBB, 1, 4, 4, OF_CY, OF_ALL, OR_A | OR_L, OR_A, 0)               \
+    X(SBB_M, SBB, 1, 7, 7, OF_CY, OF_ALL, OR_A | OR_HL, OR_A, OC_LOAD)        \
+    X(SBB_A, SBB, 1, 4, 4, OF_CY, OF_ALL, OR_A, OR_A, 0)                      \
+    /* 0xa0 */                                                                \
+    X(ANA_B, ANA, 1, 4, 4, 0, OF_ZSP | OF_CY, OR_A | OR_B, OR_A, 0)           \
+    X(ANA_C, ANA, 1, 4, 4, 0, OF_ZSP | OF_CY, OR_A | OR_C, OR_A, 0)           \
+    X(ANA_D, ANA, 1, 4, 4, 0, OF_ZSP | OF_CY, OR_A | OR_D, OR_A, 0)           \
+    X(ANA_E, ANA, 1, 4, 4, 0, OF_ZSP | OF_CY, OR_A | OR_E, OR_A, 0)           \
+    X(ANA_H, ANA, 1, 4, 4, 0, OF_ZSP | OF_CY, OR_A | OR_H, OR_A, 0)           \
+    X(ANA_L, ANA, 1, 4, 4, 0, OF_ZSP | OF_CY, OR_A | OR_L, OR_A, 0)           \
+    X(ANA_M, ANA, 1, 7, 7, 0, OF_ZSP | OF_CY, OR_A | OR_HL, OR_A, OC_LOAD)    \
+    X(ANA_A, ANA, 1, 4, 4, 0, OF_ZSP | OF_CY, OR_A, OR_A, 0)                  \
+    X(XRA_B, XRA, 1, 4, 4, 0, OF_ALL, OR_A | OR_B, OR_A, 0)                   \
+    X(XRA_C, XRA, 1, 4, 4, 0, OF_ALL, OR_A | OR_C, OR_A, 0)                   \
+    X(XRA_D, XRA, 1, 4, 4, 0, OF_ALL, OR_A | OR_D, OR_A, 0)                   \
+    X(XRA_E, XRA, 1, 4, 4, 0, OF_ALL, OR_A | OR_E, OR_A, 0)                   \
+    X(XRA_H, XRA, 1, 4, 4, 0, OF_ALL, OR_A | OR_H, OR_A, 0)                   \
+    X(XRA_L, XRA, 1, 4, 4, 0, OF_ALL, OR_A | OR_L, OR_A, 0)                   \
+    X(XRA_M, XRA, 1, 7, 7, 0, OF_ALL, OR_A | OR_HL, OR_A, OC_LOAD)            \
+    X(XRA_A, XRA, 1, 4, 4, 0, OF_ALL, OR_A, OR_A, 0)                          \
+    /* 0xb0 */                                                                \
+    X(ORA_B, ORA, 1, 4, 4, 0, OF_ALL, OR_A | OR_B, OR_A, 0)                   \
+    X(ORA_C, ORA, 1, 4, 4, 0, OF_ALL, OR_A | OR_C, OR_A, 0)                   \
+    X(ORA_D, ORA, 1, 4, 4, 0, OF_ALL, OR_A | OR_D, OR_A, 0)                   \
+    X(ORA_E, ORA, 1, 4, 4, 0, OF_ALL, OR_A | OR_E, OR_A, 0)                   \
+    X(ORA_H, ORA, 1, 4, 4, 0, OF_ALL, OR_A | OR_H, OR_A, 0)                   \
+    X(ORA_L, ORA, 1, 4, 4, 0, OF_ALL, OR_A | OR_L, OR_A, 0)                   \
+    X(ORA_M, ORA, 1, 7, 7, 0, OF_ALL, OR_A | OR_HL, OR_A, OC_LOAD)            \
+    X(ORA_A, ORA, 1, 4, 4, 0, OF_ALL, OR_A, OR_A, 0)                          \
+    X(CMP_B, CMP, 1, 4, 4, 0, OF_ALL, OR_A | OR_B, 0, 0)                      \
+    X(CMP_C, CMP, 1, 4, 4, 0, OF_ALL, OR_A | OR_C, 0, 0)                      \
+    X(CMP_D, CMP, 1, 4, 4, 0, OF_ALL, OR_A | OR_D, 0, 0)                      \
+    X(CMP_E, CMP, 1, 4, 4, 0, OF_ALL, OR_A | OR_E, 0, 0)                      \
+    X(CMP_H, CMP, 1, 4, 4, 0, OF_ALL, OR_A | OR_H, 0, 0)                      \
+    X(CMP_L, CMP, 1, 4, 4, 0, OF_ALL, OR_A | OR_L, 0, 0)                      \
+    X(CMP_M, CMP, 1, 7, 7, 0, OF_ALL, OR_A | OR_HL, 0, OC_LOAD)               \
+    X(CMP_A, CMP, 1, 4, 4, 0, OF_ALL, OR_A, 0, 0)                             \
+    /* 0xc0 */                                                                \
+    X(RNZ, RNZ, 1, 5, 11, OF_Z, 0, OR_SP, OR_SP, OC_RET | OC_COND | OC_LOAD)  \
+    X(POP_B, POP, 1, 10, 10, 0, 0, OR_SP, OR_BC | OR_SP, OC_LOAD)             \
+    X(JNZ, JNZ, 3, 10, 10, OF_Z, 0, 0, 0, OC_JUMP | OC_COND)                  \
+    X(JMP, JMP, 3, 10, 10, 0, 0, 0, 0, OC_JUMP)                               \
+    X(CNZ, CNZ, 3, 11, 17, OF_Z, 0,                                           \
+      OR_SP, OR_SP, OC_CALL | OC_COND | OC_STORE)                             \
+    X(PUSH_B, PUSH, 1, 11, 11, 0, 0, OR_BC | OR_SP, OR_SP, OC_STORE)          \
+    X(ADI, ADI, 2, 7, 7, 0, OF_ALL, OR_A, OR_A, 0)                            \
+    X(RST_0, RST, 1, 11, 11, 0, 0, OR_SP, OR_SP, OC_CALL | OC_STORE)          \
+    X(RZ, RZ, 1, 5, 11, OF_Z, 0, OR_SP, OR_SP, OC_RET | OC_COND | OC_LOAD)    \
+    X(RET, RET, 1, 10, 10, 0, 0, OR_SP, OR_SP, OC_RET | OC_LOAD)              \
+    X(JZ, JZ, 3, 10, 10, OF_Z, 0, 0, 0, OC_JUMP | OC_COND)                    \
+    X(unimplemented, unimplemented, 1, 10, 10, 0, 0, 0, 0, OC_UNDEF)          \
+    X(CZ, CZ, 3, 11, 17, OF_Z, 0, OR_SP, OR_SP, OC_CALL | OC_COND | OC_STORE) \
+    X(CALL, CALL, 3, 17, 17, 0, 0, OR_SP, OR_SP, OC_CALL | OC_STORE)          \
+    X(ACI, ACI, 2, 7, 7, OF_CY, OF_ALL, OR_A, OR_A, 0)                        \
+    X(RST_1, RST, 1, 11, 11, 0, 0, OR_SP, OR_SP, OC_CALL | OC_STORE)          \
+    /* 0xd0 */                                                                \
+    X(RNC, RNC, 1, 5, 11, OF_CY, 0, OR_SP, OR_SP, OC_RET | OC_COND | OC_LOAD) \
+    X(POP_D, POP, 1, 10, 10, 0, 0, OR_SP, OR_DE | OR_SP, OC_LOAD)             \
+    X(JNC, JNC, 3, 10, 10, OF_CY, 0, 0, 0, OC_JUMP | OC_COND)                 \
+    X(OUT, OUT, 2, 10, 10, 0, 0, OR_A, 0, OC_IO)                              \
+    X(CNC, CNC, 3, 11, 17, OF_CY, 0,                                          \
+      OR_SP, OR_SP, OC_CALL | OC_COND | OC_STORE)                             \
+    X(PUSH_D, PUSH, 1, 11, 11, 0, 0, OR_DE | OR_SP, OR_SP, OC_STORE)          \
+    X(SUI, SUI, 2, 7, 7, 0, OF_ALL, OR_A, OR_A, 0)                            \
+    X(RST_2, RST, 1, 11, 11, 0, 0, OR_SP, OR_SP, OC_CALL | OC_STORE)          \
+    X(RC, RC, 1, 5, 11, OF_CY, 0, OR_SP, OR_SP, OC_RET | OC_COND | OC_LOAD)   \
+    X(unimplemented, unimplemented, 1, 10, 10, 0, 0, 0, 0, OC_UNDEF)          \
+    X(JC, JC, 3, 10, 10, OF_CY, 0, 0, 0, OC_JUMP | OC_COND)                   \
+    X(IN, IN, 2, 10, 10, 0, 0, 0, OR_A, OC_IO)                                \
+    X(CC, CC, 3, 11, 17, OF_CY, 0, OR_SP, OR_SP, OC_CALL | OC_COND | OC_STORE)\
+    X(unimplemented, unimplemented, 1, 17, 17, 0, 0, 0, 0, OC_UNDEF)          \
+    X(SBI, SBI, 2, 7, 7, OF_CY, OF_ALL, OR_A, OR_A, 0)                        \
+    X(RST_3, RST, 1, 11, 11, 0, 0, OR_SP, OR_SP, OC_CALL | OC_STORE)          \
+    /* 0xe0 */                                                                \
+    X(RPO, RPO, 1, 5, 11, OF_P, 0, OR_SP, OR_SP, OC_RET | OC_COND | OC_LOAD)  \
+    X(POP_H, POP, 1, 10, 10, 0, 0, OR_SP, OR_HL | OR_SP, OC_LOAD)             \
+    X(JPO, JPO, 3, 10, 10, OF_P, 0, 0, 0, OC_JUMP | OC_COND)                  \
+    X(XTHL, XTHL, 1, 18, 18, 0, 0, OR_HL | OR_SP, OR_HL, OC_LOAD | OC_STORE)  \
+    X(CPO, CPO, 3, 11, 17, OF_P, 0,                                           \
+      OR_SP, OR_SP, OC_CALL | OC_COND | OC_STORE)                             \
+    X(PUSH_H, PUSH, 1, 11, 11, 0, 0, OR_HL | OR_SP, OR_SP, OC_STORE)          \
+    X(ANI, ANI, 2, 7, 7, 0, OF_ALL, OR_A, OR_A, 0)                            \
+    X(RST_4, RST, 1, 11, 11, 0, 0, OR_SP, OR_SP, OC_CALL | OC_STORE)          \
+    X(RPE, RPE, 1, 5, 11, OF_P, 0, OR_SP, OR_SP, OC_RET | OC_COND | OC_LOAD)  \
+    X(PCHL, PCHL, 1, 5, 5, 0, 0, OR_HL, 0, OC_JUMP | OC_INDIRECT)             \
+    X(JPE, JPE, 3, 10, 10, OF_P, 0, 0, 0, OC_JUMP | OC_COND)                  \
+    X(XCHG, XCHG, 1, 4, 4, 0, 0, OR_DE | OR_HL, OR_DE | OR_HL, 0)             \
+    X(CPE, CPE, 3, 11, 17, OF_P, 0,                                           \
+      OR_SP, OR_SP, OC_CALL | OC_COND | OC_STORE)                             \
+    X(unimplemented, unimplemented, 1, 17, 17, 0, 0, 0, 0, OC_UNDEF)          \
+    X(XRI, XRI, 2, 7, 7, 0, OF_ALL, OR_A, OR_A, 0)                            \
+    X(RST_5, RST, 1, 11, 11, 0, 0, OR_SP, OR_SP, OC_CALL | OC_STORE)          \
+    /* 0xf0 */                                                                \
+    X(RP, RP, 1, 5, 11, OF_S, 0, OR_SP, OR_SP, OC_RET | OC_COND | OC_LOAD)    \
+    X(POP_PSW, POP, 1, 10, 10, 0, OF_ALL, OR_SP, OR_A | OR_SP, OC_LOAD)       \
+    X(JP, JP, 3, 10, 10, OF_S, 0, 0, 0, OC_JUMP | OC_COND)                    \
+    X(DI, DI, 1, 4, 4, 0, 0, 0, 0, OC_CONTROL)                                \
+    X(CP, CP, 3, 11, 17, OF_S, 0, OR_SP, OR_SP, OC_CALL | OC_COND | OC_STORE) \
+    X(PUSH_PSW, PUSH, 1, 11, 11, OF_ALL, 0, OR_A | OR_SP, OR_SP, OC_STORE)    \
+    X(ORI, ORI, 2, 7, 7, 0, OF_ALL, OR_A, OR_A, 0)                            \
+    X(RST_6, RST, 1, 11, 11, 0, 0, OR_SP, OR_SP, OC_CALL | OC_STORE)          \
+    X(RM, RM, 1, 5, 11, OF_S, 0, OR_SP, OR_SP, OC_RET | OC_COND | OC_LOAD)    \
+    X(SPHL, SPHL, 1, 5, 5, 0, 0, OR_HL, OR_SP, 0)                             \
+    X(JM, JM, 3, 10, 10, OF_S, 0, 0, 0, OC_JUMP | OC_COND)                    \
+    X(EI, EI, 1, 4, 4, 0, 0, 0, 0, OC_CONTROL)                                \
+    X(CM, CM, 3, 11, 17, OF_S, 0, OR_SP, OR_SP, OC_CALL | OC_COND | OC_STORE) \
+    X(unimplemented, unimplemented, 1, 17, 17, 0, 0, 0, 0, OC_UNDEF)          \
+    X(CPI, CPI, 2, 7, 7, 0, OF_ALL, OR_A, 0, 0)                               \
+    X(RST_7, RST, 1, 11, 11, 0, 0, OR_SP, OR_SP, OC_CALL | OC_STORE)
+
+/* Metadata of an opcode */
+typedef struct {
+    uint8_t mnemonic;       // disasm_mn_t
+    uint8_t size;           // Bytes, including the opcode
+    uint8_t cycles;         // Clock periods, when not taken
+    uint8_t taken_cycles;   // Clock periods of a taken conditional branch
+    uint8_t flags_read;     // OF_*
+    uint8_t flags_written;  // OF_*
+    uint8_t regs_read;      // OR_*
+    uint8_t regs_written;   // OR_*
+    uint16_t op_class;      // OC_*
+} opcode_info_t;
+
+#define OPCODE_INFO(name, mn, size, cycles, taken, fr, fw, rr, rw, cls) \
+    {DISASM_MN_##mn, size, cycles, taken, fr, fw, rr, rw, cls},
+
+/*
+ * opcode_info: Metadata of each opcode, indexed by opcode.
+ */
+const opcode_info_t opcode_info[0x100] = {OPCODES(OPCODE_INFO)};
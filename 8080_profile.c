@@ -0,0 +1,683 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+/*
+ * Optional profilers, enabled at compile time. When a profiler is compiled out
+ * its hooks expand to nothing, so the emulator pays nothing for them.
+ *
+ *   PROFILE_OPCODES - executions and cycles per opcode
+ *   PROFILE_PC      - executions and cycles per guest address, reported as an
+ *                     annotated listing of the hottest code regions
+ *   PROFILE_CALLS   - inclusive and exclusive cycles per guest subroutine,
+ *                     tracked with a shadow call stack and also written as
+ *                     collapsed stacks for flame graph tools
+ *   PROFILE_SAMPLE  - host time sampling (SIGPROF), attributing host time to
+ *                     the guest PC, opcode and emulator subsystem
+ */
+
+/* Set when a profiler hooks into every instruction, execution cores that run
+ * several instructions at once then fall back to single instructions */
+#if defined(PROFILE_OPCODES) || defined(PROFILE_PC) || defined(PROFILE_CALLS)
+#define PROFILE_PER_INSTR 1
+#else
+#define PROFILE_PER_INSTR 0
+#endif
+
+/* Number of code regions listed by the PC profile */
+#define PROFILE_PC_REGIONS (10)
+
+/* Memory of the profiled machine, used to disassemble the reports */
+uint8_t *prof_mem;
+
+/* Program counter of the profiled machine */
+uint16_t *prof_pc;
+
+#ifdef PROFILE_OPCODES
+uint64_t prof_opcode_count[0x100];
+uint64_t prof_opcode_cycles[0x100];
+
+#define PROFILE_OPCODE(opcode, cycles)         \
+    do {                                       \
+        prof_opcode_count[opcode]++;           \
+        prof_opcode_cycles[opcode] += (cycles); \
+    } while (0)
+#else
+#define PROFILE_OPCODE(opcode, cycles)
+#endif
+
+#ifdef PROFILE_PC
+uint64_t prof_pc_count[0x10000];
+uint64_t prof_pc_cycles[0x10000];
+
+#define PROFILE_PC_HIT(pc, cycles)          \
+    do {                                    \
+        prof_pc_count[pc]++;                \
+        prof_pc_cycles[pc] += (cycles);     \
+    } while (0)
+#else
+#define PROFILE_PC_HIT(pc, cycles)
+#endif
+
+#ifdef PROFILE_CALLS
+#define PROFILE_CALLS_MAX_NODES (1 << 16)
+#define PROFILE_CALLS_MAX_DEPTH (256)
+#define PROFILE_CALLS_FILE "profile_calls.folded"
+
+/*
+ * A node of the call tree, one per distinct call path. Node 0 is the root of
+ * code running from reset, interrupt handlers are roots of their own, chained
+ * as siblings of node 0.
+ */
+typedef struct {
+    uint16_t addr;      // Entry address of the subroutine
+    uint8_t interrupt;  // 1 if this is the root of an interrupt handler
+    int32_t parent;
+    int32_t child;    // First child, -1 if none
+    int32_t sibling;  // Next sibling, -1 if none
+    uint64_t calls;
+    uint64_t self_cycles;  // Cycles spent in the subroutine itself
+    uint64_t total_cycles;  // Including callees, computed for the report
+} prof_node_t;
+
+/* A frame of the shadow call stack */
+typedef struct {
+    int32_t caller;  // Node to return to
+    uint16_t sp;     // Stack address holding the return address
+} prof_frame_t;
+
+prof_node_t prof_nodes[PROFILE_CALLS_MAX_NODES] = {
+    {0x0000, 0, -1, -1, -1, 1, 0, 0}};
+int32_t prof_num_nodes = 1;
+int32_t prof_node = 0;  // Node of the code currently executing
+prof_frame_t prof_stack[PROFILE_CALLS_MAX_DEPTH];
+int prof_depth;
+int prof_interrupt;  // The next call is an interrupt being acknowledged
+
+/*
+ * prof_child: Finds or adds a node in a sibling chain.
+ *
+ * Arguments:
+ *   first     - first node of the sibling chain
+ *   parent    - parent of new nodes
+ *   addr      - entry address of the subroutine
+ *   interrupt - 1 if looking for an interrupt root
+ *
+ * Returns:
+ *   index of the node, or -1 if the call tree is full.
+ */
+int32_t prof_child(int32_t *first, int32_t parent, uint16_t addr,
+                   uint8_t interrupt) {
+    int32_t *link = first;
+    while (*link >= 0) {
+        prof_node_t *n = &prof_nodes[*link];
+        if (n->addr == addr && n->interrupt == interrupt) return *link;
+        link = &n->sibling;
+    }
+    if (prof_num_nodes == PROFILE_CALLS_MAX_NODES) return -1;
+
+    prof_node_t *n = &prof_nodes[prof_num_nodes];
+    n->addr = addr;
+    n->interrupt = interrupt;
+    n->parent = parent;
+    n->child = -1;
+    n->sibling = -1;
+    *link = prof_num_nodes;
+    return prof_num_nodes++;
+}
+
+/*
+ * prof_call: Enters a subroutine after its return address was pushed.
+ *
+ * Arguments:
+ *   addr   - entry address of the subroutine
+ *   sp     - stack address holding the return address
+ *
+ * Returns:
+ *   None.
+ */
+void prof_call(uint16_t addr, uint16_t sp) {
+    int32_t node;
+    if (prof_interrupt) {
+        node = prof_child(&prof_nodes[0].sibling, -1, addr, 1);
+        prof_interrupt = 0;
+    } else {
+        node = prof_child(&prof_nodes[prof_node].child, prof_node, addr, 0);
+    }
+    if (node < 0 || prof_depth == PROFILE_CALLS_MAX_DEPTH) return;
+
+    prof_stack[prof_depth].caller = prof_node;
+    prof_stack[prof_depth].sp = sp;
+    prof_depth++;
+    prof_node = node;
+    prof_nodes[node].calls++;
+}
+
+/*
+ * prof_ret: Leaves the current subroutine. Frames whose return address lies
+ *           below the stack pointer were abandoned by the guest and are
+ *           dropped; a return that matches no frame is ignored.
+ *
+ * Arguments:
+ *   sp     - stack address the return address is popped from
+ *
+ * Returns:
+ *   None.
+ */
+void prof_ret(uint16_t sp) {
+    while (prof_depth > 0 && prof_stack[prof_depth - 1].sp < sp) {
+        prof_node = prof_stack[--prof_depth].caller;
+    }
+    if (prof_depth > 0 && prof_stack[prof_depth - 1].sp == sp) {
+        prof_node = prof_stack[--prof_depth].caller;
+    }
+}
+
+#define PROFILE_CALL(addr, sp) prof_call(addr, sp)
+#define PROFILE_RET(sp) prof_ret(sp)
+#define PROFILE_INTERRUPT() (prof_interrupt = 1)
+#define PROFILE_CALL_CYCLES(cycles) \
+    (prof_nodes[prof_node].self_cycles += (cycles))
+#else
+#define PROFILE_CALL(addr, sp)
+#define PROFILE_RET(sp)
+#define PROFILE_INTERRUPT()
+#define PROFILE_CALL_CYCLES(cycles)
+#endif
+
+/* Emulator subsystems host time is attributed to */
+enum {
+    PROF_CPU,        // Emulating instructions
+    PROF_RENDER,     // Drawing the screen
+    PROF_IO,         // Port handlers
+    PROF_SCHEDULER,  // Interrupts and frame timing
+    PROF_NUM_SUBSYSTEMS
+};
+
+const char *prof_subsystem_names[PROF_NUM_SUBSYSTEMS] = {"cpu", "render", "io",
+                                                         "scheduler"};
+
+#ifdef PROFILE_SAMPLE
+#define PROFILE_SAMPLE_US (1000)
+#define PROFILE_SAMPLE_MAX (1 << 20)
+
+typedef struct {
+    uint16_t pc;
+    uint8_t opcode;
+    uint8_t subsystem;
+} prof_sample_t;
+
+/* Preallocated so the signal handler never allocates */
+prof_sample_t prof_samples[PROFILE_SAMPLE_MAX];
+volatile sig_atomic_t prof_num_samples;
+volatile sig_atomic_t prof_dropped;
+volatile sig_atomic_t prof_subsystem;
+
+/* The profiling timer counts the CPU time of every thread, and its signal
+ * goes to the thread that was running. Ticks of the other threads (input,
+ * trace writer) are only counted, they say nothing of the guest. */
+pthread_t prof_thread;
+volatile sig_atomic_t prof_other_samples;
+
+/*
+ * prof_sigprof: Records the guest PC, opcode and active subsystem on each
+ *               profiling timer tick of the emulator thread.
+ *
+ * Arguments:
+ *   sig    - unused
+ *
+ * Returns:
+ *   None.
+ */
+void prof_sigprof(int sig) {
+    (void)(sig);
+    if (!pthread_equal(pthread_self(), prof_thread)) {
+        prof_other_samples++;
+        return;
+    }
+    if (prof_num_samples == PROFILE_SAMPLE_MAX) {
+        prof_dropped++;
+        return;
+    }
+
+    prof_sample_t *sample = &prof_samples[prof_num_samples];
+    sample->pc = *prof_pc;
+    sample->opcode = prof_mem[sample->pc];
+    sample->subsystem = prof_subsystem;
+    prof_num_samples++;
+}
+
+#define PROFILE_SUBSYSTEM(subsystem) (prof_subsystem = (subsystem))
+#else
+#define PROFILE_SUBSYSTEM(subsystem)
+#endif
+
+/*
+ * PROFILE_INSTR: Hook called by the emulator after each instruction.
+ *
+ *   pc     - address of the instruction
+ *   opcode - opcode of the instruction
+ *   cycles - clock periods it took
+ */
+#define PROFILE_INSTR(pc, opcode, cycles) \
+    do {                                  \
+        (void)(pc);                       \
+        (void)(cycles);                   \
+        PROFILE_OPCODE(opcode, cycles);   \
+        PROFILE_PC_HIT(pc, cycles);       \
+        PROFILE_CALL_CYCLES(cycles);      \
+    } while (0)
+
+#ifdef PROFILE_OPCODES
+int prof_cmp_opcode(const void *a, const void *b) {
+    uint64_t x = prof_opcode_cycles[*(const uint8_t *)a];
+    uint64_t y = prof_opcode_cycles[*(const uint8_t *)b];
+    return (x < y) - (x > y);
+}
+
+/*
+ * profile_report_opcodes: Prints the executed opcodes sorted by the cycles
+ *                         spent in them.
+ *
+ * Returns:
+ *   None.
+ */
+void profile_report_opcodes(void) {
+    uint8_t order[0x100];
+    uint64_t total_count = 0, total_cycles = 0;
+    int executed = 0;
+
+    for (int i = 0; i < 0x100; i++) {
+        order[i] = i;
+        total_count += prof_opcode_count[i];
+        total_cycles += prof_opcode_cycles[i];
+        executed += (prof_opcode_count[i] > 0);
+    }
+    if (total_count == 0) return;
+    qsort(order, 0x100, sizeof(order[0]), prof_cmp_opcode);
+
+    printf(
+        "------------------------- Opcode profile "
+        "-------------------------\n"
+        "opcode           count  count%%           cycles  cycle%%    cum%%  "
+        "instruction\n");
+
+    uint64_t cum_cycles = 0;
+    int hot_90 = 0, hot_99 = 0;
+    char name[DISASM_BUF_SIZE];
+    for (int i = 0; i < executed; i++) {
+        uint8_t op = order[i];
+        cum_cycles += prof_opcode_cycles[op];
+        double cum = 100.0 * cum_cycles / total_cycles;
+        if (hot_90 == 0 && cum >= 90.0) hot_90 = i + 1;
+        if (hot_99 == 0 && cum >= 99.0) hot_99 = i + 1;
+
+        printf("  0x%02x %14llu %6.2f%% %16llu %6.2f%% %6.2f%%  ", op,
+               (unsigned long long)prof_opcode_count[op],
+               100.0 * prof_opcode_count[op] / total_count,
+               (unsigned long long)prof_opcode_cycles[op],
+               100.0 * prof_opcode_cycles[op] / total_cycles, cum);
+        disasm_opcode_name(name, sizeof(name), op);
+        printf("%s\n", name);
+    }
+
+    printf(
+        "%d opcodes executed, %llu instructions, %llu cycles\n"
+        "%d opcodes account for 90%% of cycles, %d for 99%%\n",
+        executed, (unsigned long long)total_count,
+        (unsigned long long)total_cycles, hot_90, hot_99);
+}
+#endif
+
+#ifdef PROFILE_PC
+/*
+ * A code region is a run of executed instructions, each starting at most 3
+ * bytes (the longest instruction) after the previous one.
+ */
+typedef struct {
+    uint32_t start;
+    uint32_t end;  // Address of the last executed instruction
+    uint64_t cycles;
+} prof_region_t;
+
+int prof_cmp_region(const void *a, const void *b) {
+    uint64_t x = ((const prof_region_t *)a)->cycles;
+    uint64_t y = ((const prof_region_t *)b)->cycles;
+    return (x < y) - (x > y);
+}
+
+/*
+ * profile_report_pc: Prints an annotated disassembly of the code regions in
+ *                    which the most cycles were spent.
+ *
+ * Returns:
+ *   None.
+ */
+void profile_report_pc(void) {
+    static prof_region_t regions[0x10000];
+    int num_regions = 0;
+    uint64_t total_cycles = 0;
+    int32_t last = -4;
+
+    for (uint32_t pc = 0; pc < 0x10000; pc++) {
+        if (prof_pc_count[pc] == 0) continue;
+        total_cycles += prof_pc_cycles[pc];
+        if ((int32_t)pc - last > 3) {
+            regions[num_regions].start = pc;
+            regions[num_regions].cycles = 0;
+            num_regions++;
+        }
+        regions[num_regions - 1].end = pc;
+        regions[num_regions - 1].cycles += prof_pc_cycles[pc];
+        last = pc;
+    }
+    if (total_cycles == 0) return;
+    qsort(regions, num_regions, sizeof(regions[0]), prof_cmp_region);
+
+    printf(
+        "--------------------------- PC profile "
+        "---------------------------\n"
+        "%d code regions executed, %llu cycles, hottest regions:\n",
+        num_regions, (unsigned long long)total_cycles);
+
+    for (int r = 0; r < num_regions && r < PROFILE_PC_REGIONS; r++) {
+        printf("\n#%d  %04x-%04x  %6.2f%% of cycles\n", r + 1, regions[r].start,
+               regions[r].end, 100.0 * regions[r].cycles / total_cycles);
+        printf("         count   cycle%%  instruction\n");
+        for (uint32_t pc = regions[r].start; pc <= regions[r].end; pc++) {
+            if (prof_pc_count[pc] == 0) continue;
+            printf("%14llu  %6.2f%%  ", (unsigned long long)prof_pc_count[pc],
+                   100.0 * prof_pc_cycles[pc] / total_cycles);
+            printf("%04x:      %s\n", pc, disasm_line(&prof_mem[pc], pc, NULL));
+        }
+    }
+}
+#endif
+
+#ifdef PROFILE_CALLS
+/*
+ * prof_node_name: Formats the name of a call tree node, as used in the
+ *                 collapsed stacks.
+ *
+ * Arguments:
+ *   n      - node to name
+ *   buf    - buffer of at least 16 bytes
+ *
+ * Returns:
+ *   buf.
+ */
+char *prof_node_name(prof_node_t *n, char *buf) {
+    if (n == &prof_nodes[0]) {
+        sprintf(buf, "reset");
+    } else if (n->interrupt) {
+        sprintf(buf, "rst%d_%04x", n->addr / 8, n->addr);
+    } else {
+        sprintf(buf, "sub_%04x", n->addr);
+    }
+    return buf;
+}
+
+int prof_cmp_func(const void *a, const void *b) {
+    uint64_t x = prof_nodes[*(const int32_t *)a].total_cycles;
+    uint64_t y = prof_nodes[*(const int32_t *)b].total_cycles;
+    return (x < y) - (x > y);
+}
+
+/*
+ * profile_report_calls: Writes the collapsed stacks (one line per call path
+ *                       with its exclusive cycles) and prints the subroutines
+ *                       taking the most inclusive cycles.
+ *
+ * Returns:
+ *   None.
+ */
+void profile_report_calls(void) {
+    /* Children always come after their parents, so accumulating in reverse
+     * order gives the inclusive cycles of every node. */
+    uint64_t total_cycles = 0;
+    for (int32_t i = prof_num_nodes - 1; i >= 0; i--) {
+        prof_node_t *n = &prof_nodes[i];
+        n->total_cycles += n->self_cycles;
+        if (n->parent >= 0) {
+            prof_nodes[n->parent].total_cycles += n->total_cycles;
+        }
+        total_cycles += n->self_cycles;
+    }
+    if (total_cycles == 0) return;
+
+    FILE *fp = fopen(PROFILE_CALLS_FILE, "w");
+    if (fp) {
+        char name[16];
+        int32_t path[PROFILE_CALLS_MAX_DEPTH + 1];
+        for (int32_t i = 0; i < prof_num_nodes; i++) {
+            if (prof_nodes[i].self_cycles == 0) continue;
+            int depth = 0;
+            for (int32_t n = i; n >= 0 && depth <= PROFILE_CALLS_MAX_DEPTH;
+                 n = prof_nodes[n].parent) {
+                path[depth++] = n;
+            }
+            while (depth-- > 0) {
+                prof_node_t *n = &prof_nodes[path[depth]];
+                fprintf(fp, "%s%c", prof_node_name(n, name), depth ? ';' : ' ');
+            }
+            fprintf(fp, "%llu\n",
+                    (unsigned long long)prof_nodes[i].self_cycles);
+        }
+        fclose(fp);
+    }
+
+    /* Sum up the nodes of each subroutine, a recursive call is only counted
+     * once in the inclusive cycles. */
+    static uint64_t func_self[2][0x10000], func_total[2][0x10000];
+    static uint64_t func_calls[2][0x10000];
+    static uint8_t func_seen[2][0x10000];
+    static int32_t funcs[2 * 0x10000];
+    int num_funcs = 0;
+    for (int32_t i = 0; i < prof_num_nodes; i++) {
+        prof_node_t *n = &prof_nodes[i];
+        int32_t a = n->parent;
+        while (a >= 0 && prof_nodes[a].addr != n->addr) {
+            a = prof_nodes[a].parent;
+        }
+        if (!func_seen[n->interrupt][n->addr]) {
+            func_seen[n->interrupt][n->addr] = 1;
+            funcs[num_funcs++] = i;
+        }
+        func_self[n->interrupt][n->addr] += n->self_cycles;
+        func_calls[n->interrupt][n->addr] += n->calls;
+        if (a < 0) func_total[n->interrupt][n->addr] += n->total_cycles;
+    }
+    /* Reuse the representative nodes to sort the subroutines */
+    for (int i = 0; i < num_funcs; i++) {
+        prof_node_t *n = &prof_nodes[funcs[i]];
+        n->total_cycles = func_total[n->interrupt][n->addr];
+    }
+    qsort(funcs, num_funcs, sizeof(funcs[0]), prof_cmp_func);
+
+    printf(
+        "------------------------- Call profile "
+        "--------------------------\n"
+        "Collapsed stacks written to %s\n"
+        "subroutine           calls    incl%%    excl%%      cycles/call\n",
+        PROFILE_CALLS_FILE);
+    for (int i = 0; i < num_funcs && i < PROFILE_PC_REGIONS * 2; i++) {
+        prof_node_t *n = &prof_nodes[funcs[i]];
+        uint64_t calls = func_calls[n->interrupt][n->addr];
+        char name[16];
+        printf("%-14s %11llu  %6.2f%%  %6.2f%%  %15.1f\n",
+               prof_node_name(n, name), (unsigned long long)calls,
+               100.0 * n->total_cycles / total_cycles,
+               100.0 * func_self[n->interrupt][n->addr] / total_cycles,
+               calls ? (double)n->total_cycles / calls : 0.0);
+    }
+}
+#endif
+
+#ifdef PROFILE_SAMPLE
+typedef struct {
+    uint32_t key;
+    uint64_t samples;
+} prof_bucket_t;
+
+int prof_cmp_bucket(const void *a, const void *b) {
+    uint64_t x = ((const prof_bucket_t *)a)->samples;
+    uint64_t y = ((const prof_bucket_t *)b)->samples;
+    return (x < y) - (x > y);
+}
+
+/*
+ * profile_report_samples: Prints the host time per subsystem, and the host
+ *                         time of emulating each opcode and guest address.
+ *                         When the opcode or PC profilers are enabled, host
+ *                         time is shown next to the share of guest cycles, so
+ *                         instructions that are expensive to emulate stand out.
+ *
+ * Returns:
+ *   None.
+ */
+void profile_report_samples(void) {
+    struct itimerval stop = {{0, 0}, {0, 0}};
+    setitimer(ITIMER_PROF, &stop, NULL);
+
+    uint64_t total = prof_num_samples;
+    uint64_t others = prof_other_samples;
+    if (total + others == 0) return;
+
+    static prof_bucket_t opcodes[0x100], pcs[0x10000];
+    uint64_t subsystems[PROF_NUM_SUBSYSTEMS] = {0};
+    uint64_t cpu_samples = 0;
+    for (int i = 0; i < 0x10000; i++) pcs[i].key = i;
+    for (int i = 0; i < 0x100; i++) opcodes[i].key = i;
+    for (uint64_t i = 0; i < total; i++) {
+        prof_sample_t *sample = &prof_samples[i];
+        subsystems[sample->subsystem]++;
+        if (sample->subsystem != PROF_CPU) continue;
+        opcodes[sample->opcode].samples++;
+        pcs[sample->pc].samples++;
+        cpu_samples++;
+    }
+
+    printf(
+        "------------------------ Sampling profile "
+        "------------------------\n"
+        "%llu samples every %d us (%d dropped)\n"
+        "subsystem        samples   host%%\n",
+        (unsigned long long)(total + others), PROFILE_SAMPLE_US,
+        (int)prof_dropped);
+    for (int i = 0; i < PROF_NUM_SUBSYSTEMS; i++) {
+        printf("%-10s %13llu %6.2f%%\n", prof_subsystem_names[i],
+               (unsigned long long)subsystems[i],
+               100.0 * subsystems[i] / (total + others));
+    }
+    printf("%-10s %13llu %6.2f%%\n", "threads", (unsigned long long)others,
+           100.0 * others / (total + others));
+    if (cpu_samples == 0) return;
+
+#ifdef PROFILE_OPCODES
+    uint64_t guest_cycles = 0;
+    for (int i = 0; i < 0x100; i++) guest_cycles += prof_opcode_cycles[i];
+#endif
+    qsort(opcodes, 0x100, sizeof(opcodes[0]), prof_cmp_bucket);
+    printf("\nopcode       samples  cpu%%   guest%%  instruction\n");
+    char name[DISASM_BUF_SIZE];
+    for (int i = 0; i < 0x100 && opcodes[i].samples; i++) {
+        uint8_t op = opcodes[i].key;
+        double guest = -1;
+#ifdef PROFILE_OPCODES
+        if (guest_cycles) {
+            guest = 100.0 * prof_opcode_cycles[op] / guest_cycles;
+        }
+#endif
+        printf("  0x%02x %12llu %6.2f%% ", op,
+               (unsigned long long)opcodes[i].samples,
+               100.0 * opcodes[i].samples / cpu_samples);
+        if (guest >= 0) {
+            printf("%6.2f%%  ", guest);
+        } else {
+            printf("     -   ");
+        }
+        disasm_opcode_name(name, sizeof(name), op);
+        printf("%s\n", name);
+    }
+
+#ifdef PROFILE_PC
+    uint64_t pc_cycles = 0;
+    for (int i = 0; i < 0x10000; i++) pc_cycles += prof_pc_cycles[i];
+#endif
+    qsort(pcs, 0x10000, sizeof(pcs[0]), prof_cmp_bucket);
+    printf("\n     samples  cpu%%   guest%%  instruction\n");
+    for (int i = 0; i < PROFILE_PC_REGIONS * 3 && pcs[i].samples; i++) {
+        uint16_t pc = pcs[i].key;
+        double guest = -1;
+#ifdef PROFILE_PC
+        if (pc_cycles) guest = 100.0 * prof_pc_cycles[pc] / pc_cycles;
+#endif
+        printf("%12llu %6.2f%% ", (unsigned long long)pcs[i].samples,
+               100.0 * pcs[i].samples / cpu_samples);
+        if (guest >= 0) {
+            printf("%6.2f%%  ", guest);
+        } else {
+            printf("     -   ");
+        }
+        printf("%04x:      %s\n", pc, disasm_line(&prof_mem[pc], pc, NULL));
+    }
+}
+#endif
+
+/*
+ * profile_report: Prints the reports of the enabled profilers, only the first
+ *                 call has an effect.
+ *
+ * Returns:
+ *   None.
+ */
+void profile_report(void) {
+    static int reported = 0;
+    if (reported) return;
+    reported = 1;
+
+#ifdef PROFILE_OPCODES
+    profile_report_opcodes();
+#endif
+#ifdef PROFILE_PC
+    profile_report_pc();
+#endif
+#ifdef PROFILE_CALLS
+    profile_report_calls();
+#endif
+#ifdef PROFILE_SAMPLE
+    profile_report_samples();
+#endif
+}
+
+/*
+ * profile_start: Prepares the enabled profilers, their reports are printed
+ *                when the program exits unless profile_report() was called
+ *                before. Called from the thread running the machine, the one
+ *                host time samples are attributed to.
+ *
+ * Arguments:
+ *   mem    - memory of the profiled machine
+ *   pc     - program counter of the profiled machine
+ *
+ * Returns:
+ *   None.
+ */
+void profile_start(uint8_t *mem, uint16_t *pc) {
+    prof_mem = mem;
+    prof_pc = pc;
+    atexit(profile_report);
+
+#ifdef PROFILE_SAMPLE
+    prof_thread = pthread_self();
+    struct itimerval timer = {{0, PROFILE_SAMPLE_US}, {0, PROFILE_SAMPLE_US}};
+    struct sigaction sa = {0};
+    sa.sa_handler = prof_sigprof;
+    sa.sa_flags = SA_RESTART;  // Don't interrupt syscalls of other threads
+    sigaction(SIGPROF, &sa, NULL);
+    setitimer(ITIMER_PROF, &timer, NULL);
+#endif
+}
@@ -0,0 +1,529 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "8080_disasm.c"
+#include "8080_profile.c"
+#include "8080_emu.c"
+#include "8080_cfg.c"
+#include "8080_core.c"
+#include "8080_invaders.c"
+#include "8080_aot.c"
+
+/*
+ * Ahead-of-time recompiler: turns the basic blocks found by the static
+ * analysis of a ROM into C functions for 8080_aot.c. Build the emulator with
+ * -DAOT and the generated 8080_aot_rom.c to get the "aot" execution core.
+ */
+
+/* Operands encoded in the opcode, M only as a source since memory is written
+ * with MEM_WRITE */
+const char *recomp_regs[8] = {"b", "c", "d", "e",
+                              "h", "l", "mem[(h << 8) | l]", "a"};
+const char *recomp_pair_hi[4] = {"b", "d", "h", "(sp >> 8)"};
+const char *recomp_pair_lo[4] = {"c", "e", "l", "(sp & 0xff)"};
+const char *recomp_pairs[4] = {"((b << 8) | c)", "((d << 8) | e)",
+                               "((h << 8) | l)", "sp"};
+
+/* Condition of Jcc, Ccc and Rcc */
+const char *recomp_conds[8] = {"!fz", "fz", "!fcy", "fcy",
+                               "!fp", "fp", "!fs",  "fs"};
+
+/*
+ * recomp_interpreted: Checks if an instruction is left to its interpreter
+ *                     handler: I/O, interrupt control, and instructions
+ *                     that are rare in practice.
+ *
+ * Arguments:
+ *   op     - opcode
+ *
+ * Returns:
+ *   1 if the instruction is interpreted, 0 if it is recompiled.
+ */
+int recomp_interpreted(uint8_t op) {
+    switch (op) {
+        case 0x20:  // RIM
+        case 0x27:  // DAA
+        case 0x30:  // SIM
+        case 0x76:  // HLT
+        case 0xd3:  // OUT
+        case 0xdb:  // IN
+        case 0xe3:  // XTHL
+        case 0xf1:  // POP PSW
+        case 0xf3:  // DI
+        case 0xf5:  // PUSH PSW
+        case 0xfb:  // EI
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * recomp_flags: Returns the flags an instruction reads and writes.
+ *
+ * Arguments:
+ *   op     - opcode
+ *   reads  - set to the OF_* flags read
+ *   writes - set to the OF_* flags written
+ *
+ * Returns:
+ *   None.
+ */
+void recomp_flags(uint8_t op, int *reads, int *writes) {
+    if (recomp_interpreted(op)) {
+        *reads = *writes = OF_ALL;
+    } else {
+        *reads = opcode_info[op].flags_read;
+        *writes = opcode_info[op].flags_written;
+    }
+}
+
+/*
+ * recomp_chain: Emits the end of a block continuing at a known address.
+ *
+ * Arguments:
+ *   out    - file to write to
+ *   cfg    - analysis of the ROM
+ *   indent - indentation
+ *   addr   - address to continue at
+ *
+ * Returns:
+ *   None.
+ */
+void recomp_chain(FILE *out, cfg_t *cfg, const char *indent, uint16_t addr) {
+    cfg_block_t *b = cfg_find_block(cfg->blocks, cfg->num_blocks, addr);
+    if (b) {
+        fprintf(out, "%sAOT_CHAIN(0x%04x, aot_%04x, aot_prefix_%04x);\n",
+                indent, addr, addr, addr);
+    } else {
+        fprintf(out, "%sAOT_EXIT(0x%04x);\n", indent, addr);
+    }
+}
+
+/*
+ * recomp_prefix: Returns the cycles of a block without its last instruction.
+ *
+ * Arguments:
+ *   cfg    - analysis of the ROM
+ *   b      - block
+ *
+ * Returns:
+ *   the cycles.
+ */
+int recomp_prefix(cfg_t *cfg, cfg_block_t *b) {
+    int cycles = 0, last = 0;
+    for (uint32_t addr = b->start; addr < b->end;) {
+        disasm_info_t info;
+        cfg_decode(cfg, addr, &info);
+        last = emu_cycles[cfg->mem[addr]];
+        cycles += last;
+        addr += info.size;
+    }
+    return cycles - last;
+}
+
+/*
+ * recomp_instr: Emits an instruction that doesn't end its block.
+ *
+ * Arguments:
+ *   out    - file to write to
+ *   code   - instruction bytes
+ *   need   - OF_* flags written by the instruction that are read later
+ *
+ * Returns:
+ *   None.
+ */
+void recomp_instr(FILE *out, const uint8_t *code, int need) {
+    static const char *alu_ops[8] = {
+        "AOT_ADD(%s, 0, %d)",       "AOT_ADD(%s, fcy, %d)",
+        "AOT_SUB(%s, 0, %d)",       "AOT_SUB(%s, fcy, %d)",
+        "AOT_LOGIC(a & %s, 0, %d)", "AOT_LOGIC(a ^ %s, 1, %d)",
+        "AOT_LOGIC(a | %s, 1, %d)", "AOT_CMP(%s, %d)"};
+    uint8_t op = code[0];
+    uint16_t data16 = code[1] | code[2] << 8;
+    int dst = (op >> 3) & 7, src = op & 7, pair = (op >> 4) & 3;
+    char imm[8];
+    snprintf(imm, sizeof(imm), "0x%02x", code[1]);
+
+    if (op >= 0x40 && op < 0x80) {  // MOV, HLT is interpreted
+        if (dst == 6) {
+            fprintf(out, "    MEM_WRITE((h << 8) | l, %s);\n",
+                    recomp_regs[src]);
+        } else {
+            fprintf(out, "    %s = %s;\n", recomp_regs[dst], recomp_regs[src]);
+        }
+    } else if (op >= 0x80 && op < 0xc0) {
+        fprintf(out, "    ");
+        fprintf(out, alu_ops[dst], recomp_regs[src], need);
+        fprintf(out, ";\n");
+    } else if ((op & 0xc7) == 0xc6) {
+        fprintf(out, "    ");
+        if (op == 0xe6) {  // ANI also clears AC
+            fprintf(out, "AOT_LOGIC(a & %s, 1, %d)", imm, need);
+        } else {
+            fprintf(out, alu_ops[dst], imm, need);
+        }
+        fprintf(out, ";\n");
+    } else if ((op & 0xc7) == 0x06) {
+        if (dst == 6) {
+            fprintf(out, "    MEM_WRITE((h << 8) | l, %s);\n", imm);
+        } else {
+            fprintf(out, "    %s = %s;\n", recomp_regs[dst], imm);
+        }
+    } else if ((op & 0xc6) == 0x04) {
+        const char *inr = (op & 1) ? "AOT_DCR" : "AOT_INR";
+        if (dst == 6) {
+            fprintf(out,
+                    "    { uint8_t m_ = mem[(h << 8) | l]; %s(m_, %d); "
+                    "MEM_WRITE((h << 8) | l, m_); }\n",
+                    inr, need);
+        } else {
+            fprintf(out, "    %s(%s, %d);\n", inr, recomp_regs[dst], need);
+        }
+    } else if ((op & 0xcf) == 0x01) {
+        if (pair == 3) {
+            fprintf(out, "    sp = 0x%04x;\n", data16);
+        } else {
+            fprintf(out, "    %s = 0x%02x;\n    %s = 0x%02x;\n",
+                    recomp_pair_hi[pair], code[2], recomp_pair_lo[pair],
+                    code[1]);
+        }
+    } else if ((op & 0xcf) == 0x03) {
+        if (pair == 3) {
+            fprintf(out, "    sp++;\n");
+        } else {
+            fprintf(out, "    if (++%s == 0) %s++;\n", recomp_pair_lo[pair],
+                    recomp_pair_hi[pair]);
+        }
+    } else if ((op & 0xcf) == 0x0b) {
+        if (pair == 3) {
+            fprintf(out, "    sp--;\n");
+        } else {
+            fprintf(out, "    if (%s-- == 0) %s--;\n", recomp_pair_lo[pair],
+                    recomp_pair_hi[pair]);
+        }
+    } else if ((op & 0xcf) == 0x09) {
+        fprintf(out, "    AOT_DAD(%s, %d);\n", recomp_pairs[pair], need);
+    } else if ((op & 0xcf) == 0xc5) {
+        fprintf(out, "    AOT_PUSH(%s, %s);\n", recomp_pair_hi[pair],
+                recomp_pair_lo[pair]);
+    } else if ((op & 0xcf) == 0xc1) {
+        fprintf(out, "    AOT_POP(%s, %s);\n", recomp_pair_hi[pair],
+                recomp_pair_lo[pair]);
+    } else {
+        switch (op) {
+            case 0x00:
+                break;
+            case 0x02:
+                fprintf(out, "    MEM_WRITE((b << 8) | c, a);\n");
+                break;
+            case 0x12:
+                fprintf(out, "    MEM_WRITE((d << 8) | e, a);\n");
+                break;
+            case 0x0a:
+                fprintf(out, "    a = mem[(b << 8) | c];\n");
+                break;
+            case 0x1a:
+                fprintf(out, "    a = mem[(d << 8) | e];\n");
+                break;
+            case 0x22:
+                fprintf(out, "    MEM_WRITE(0x%04x, l);\n", data16);
+                fprintf(out, "    MEM_WRITE(0x%04x, h);\n",
+                        (data16 + 1) & 0xffff);
+                break;
+            case 0x2a:
+                fprintf(out, "    l = mem[0x%04x];\n    h = mem[0x%04x];\n",
+                        data16, (data16 + 1) & 0xffff);
+                break;
+            case 0x32:
+                fprintf(out, "    MEM_WRITE(0x%04x, a);\n", data16);
+                break;
+            case 0x3a:
+                fprintf(out, "    a = mem[0x%04x];\n", data16);
+                break;
+            case 0x07:
+                fprintf(out, "    fcy = a >> 7;\n    a = (a << 1) | fcy;\n");
+                break;
+            case 0x0f:
+                fprintf(out,
+                        "    fcy = a & 1;\n    a = (a >> 1) | (fcy << 7);\n");
+                break;
+            case 0x17:
+                fprintf(out,
+                        "    { uint8_t cy_ = fcy; fcy = a >> 7; "
+                        "a = (a << 1) | cy_; }\n");
+                break;
+            case 0x1f:
+                fprintf(out,
+                        "    { uint8_t cy_ = fcy; fcy = a & 1; "
+                        "a = (a >> 1) | (cy_ << 7); }\n");
+                break;
+            case 0x2f:
+                fprintf(out, "    a = ~a;\n");
+                break;
+            case 0x37:
+                fprintf(out, "    fcy = 1;\n");
+                break;
+            case 0x3f:
+                fprintf(out, "    fcy = !fcy;\n");
+                break;
+            case 0xeb:
+                fprintf(out,
+                        "    { uint8_t t_ = h; h = d; d = t_; "
+                        "t_ = l; l = e; e = t_; }\n");
+                break;
+            case 0xf9:
+                fprintf(out, "    sp = (h << 8) | l;\n");
+                break;
+            default:
+                fprintf(stderr, "error: Can't recompile opcode %02x\n", op);
+                exit(1);
+        }
+    }
+}
+
+/*
+ * recomp_block: Emits the function of a basic block.
+ *
+ * Arguments:
+ *   out    - file to write to
+ *   cfg    - analysis of the ROM
+ *   b      - block
+ *
+ * Returns:
+ *   None.
+ */
+void recomp_block(FILE *out, cfg_t *cfg, cfg_block_t *b) {
+    static uint16_t addrs[0x10000];
+    static int need[0x10000];
+    int n = 0;
+
+    for (uint32_t addr = b->start; addr < b->end; n++) {
+        disasm_info_t info;
+        cfg_decode(cfg, addr, &info);
+        addrs[n] = addr;
+        addr += info.size;
+    }
+
+    /* Flags written by each instruction that are read before being written
+     * again. All flags are live at the end of the block, and after memory
+     * writes, which leave the block if they hit recompiled code. */
+    int live = OF_ALL;
+    for (int i = n - 1; i >= 0; i--) {
+        int reads, writes;
+        recomp_flags(cfg->mem[addrs[i]], &reads, &writes);
+        if (opcode_info[cfg->mem[addrs[i]]].op_class & OC_STORE) live = OF_ALL;
+        need[i] = writes & live;
+        live = (live & ~writes) | reads;
+    }
+
+    fprintf(out, "aot_next_t aot_%04x(emu_state_t *state, uint64_t until) {\n",
+            b->start);
+    fprintf(out, "    AOT_LOCALS;\n    AOT_LOAD();\n");
+
+    /* Cycles and instructions not yet added to the counters */
+    int pending_cycles = 0, pending_instructions = 0;
+    for (int i = 0; i < n; i++) {
+        uint16_t addr = addrs[i];
+        const uint8_t *code = &cfg->mem[addr];
+        uint8_t op = code[0];
+        uint16_t next = (i + 1 < n) ? addrs[i + 1] : b->end;
+        int last = (i == n - 1);
+        char line[DISASM_BUF_SIZE];
+        disasm_str(line, sizeof(line), code, addr, NULL);
+
+        fprintf(out, "    /* %04x: %s */\n", addr, line);
+        pending_cycles += emu_cycles[op];
+        pending_instructions++;
+        if (recomp_interpreted(op)) {
+            fprintf(out, "    cycles += %d;\n    instructions += %d;\n",
+                    pending_cycles, pending_instructions);
+            fprintf(out, "    AOT_INTERPRET(0x%04x);\n", addr);
+            pending_cycles = pending_instructions = 0;
+            if (last) {
+                fprintf(out, "    return AOT_DISPATCH;\n");
+            } else if (opcode_info[op].op_class & OC_STORE) {
+                fprintf(out, "    AOT_CHECK_CODE(0x%04x, 0, 0);\n", next);
+            }
+            continue;
+        }
+
+        if (!last || b->kind == CFG_END_FALL) {
+            recomp_instr(out, code, need[i]);
+            if (!last) {
+                /* The last instruction is checked by AOT_CHAIN */
+                if (opcode_info[op].op_class & OC_STORE) {
+                    fprintf(out, "    AOT_CHECK_CODE(0x%04x, %d, %d);\n",
+                            next, pending_cycles, pending_instructions);
+                }
+                continue;
+            }
+        }
+
+        /* End of the block */
+        fprintf(out, "    cycles += %d;\n    instructions += %d;\n",
+                pending_cycles, pending_instructions);
+        const char *cond = recomp_conds[(op >> 3) & 7];
+        uint16_t target = code[1] | code[2] << 8;
+        switch (b->kind) {
+            case CFG_END_FALL:
+                fprintf(out, "    AOT_STORE();\n");
+                recomp_chain(out, cfg, "    ", next);
+                break;
+            case CFG_END_JUMP:
+                fprintf(out, "    AOT_STORE();\n");
+                recomp_chain(out, cfg, "    ", target);
+                break;
+            case CFG_END_BRANCH:
+                fprintf(out, "    AOT_STORE();\n    if (%s) {\n", cond);
+                recomp_chain(out, cfg, "        ", target);
+                fprintf(out, "    }\n");
+                recomp_chain(out, cfg, "    ", next);
+                break;
+            case CFG_END_CALL:
+                if ((op & 0xc7) == 0xc7) target = op & 0x38;  // RST
+                if (op == 0xcd || (op & 0xc7) == 0xc7) {
+                    fprintf(out, "    AOT_PUSH(0x%02x, 0x%02x);\n", next >> 8,
+                            next & 0xff);
+                    fprintf(out, "    AOT_STORE();\n");
+                    recomp_chain(out, cfg, "    ", target);
+                    break;
+                }
+                fprintf(out, "    if (%s) {\n        cycles += %d;\n", cond,
+                        EMU_COND_TAKEN_CYCLES);
+                fprintf(out, "        AOT_PUSH(0x%02x, 0x%02x);\n", next >> 8,
+                        next & 0xff);
+                fprintf(out, "        AOT_STORE();\n");
+                recomp_chain(out, cfg, "        ", target);
+                fprintf(out, "    }\n    AOT_STORE();\n");
+                recomp_chain(out, cfg, "    ", next);
+                break;
+            case CFG_END_RET:
+            case CFG_END_COND_RET:
+                if (b->kind == CFG_END_COND_RET) {
+                    fprintf(out, "    if (%s) {\n        cycles += %d;\n",
+                            cond, EMU_COND_TAKEN_CYCLES);
+                }
+                fprintf(out,
+                        "    {\n        uint8_t pch_, pcl_;\n"
+                        "        AOT_POP(pch_, pcl_);\n"
+                        "        AOT_STORE();\n"
+                        "        AOT_EXIT((pch_ << 8) | pcl_);\n    }\n");
+                if (b->kind == CFG_END_COND_RET) {
+                    fprintf(out, "    }\n    AOT_STORE();\n");
+                    recomp_chain(out, cfg, "    ", next);
+                }
+                break;
+            case CFG_END_PCHL:
+                fprintf(out, "    AOT_STORE();\n    AOT_EXIT((h << 8) | l);\n");
+                break;
+            default:
+                fprintf(stderr, "error: Unexpected end of block %04x\n",
+                        b->start);
+                exit(1);
+        }
+    }
+    fprintf(out, "}\n\n");
+}
+
+/*
+ * recomp_write: Writes the recompiled blocks of a ROM and their dispatch
+ *               table.
+ *
+ * Arguments:
+ *   out    - file to write to
+ *   cfg    - analysis of the ROM
+ *
+ * Returns:
+ *   None.
+ */
+void recomp_write(FILE *out, cfg_t *cfg) {
+    fprintf(out,
+            "/* Generated by 8080_recomp, do not edit */\n\n"
+            "#define AOT_ROM_SIZE (0x%04x)\n"
+            "#define AOT_ROM_HASH (0x%08xu)\n\n",
+            cfg->size, cfg_hash(cfg->mem, cfg->size));
+
+    for (int i = 0; i < cfg->num_blocks; i++) {
+        cfg_block_t *b = &cfg->blocks[i];
+        fprintf(out, "#define aot_prefix_%04x (%d)\n", b->start,
+                recomp_prefix(cfg, b));
+        fprintf(out,
+                "aot_next_t aot_%04x(emu_state_t *state, uint64_t until);\n",
+                b->start);
+    }
+    fprintf(out, "\n");
+
+    for (int i = 0; i < cfg->num_blocks; i++) {
+        recomp_block(out, cfg, &cfg->blocks[i]);
+    }
+
+    fprintf(out, "aot_entry_t aot_entries[AOT_ROM_SIZE] = {\n");
+    for (int i = 0; i < cfg->num_blocks; i++) {
+        fprintf(out, "    [0x%04x] = {aot_%04x, aot_prefix_%04x, 0x%04x},\n",
+                cfg->blocks[i].start, cfg->blocks[i].start,
+                cfg->blocks[i].start, cfg->blocks[i].end);
+    }
+    fprintf(out, "};\n");
+}
+
+void usage(char *prog) {
+    fprintf(stderr, "usage: %s [-R <rom dir>] [-f <binary>] [-o <file>]\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    char *rom_dir = "ROM";
+    char *binary = NULL;
+    char *out_file = "8080_aot_rom.c";
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-') usage(argv[0]);
+        char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+            case 'R':
+                rom_dir = arg;
+                break;
+            case 'f':
+                binary = arg;
+                break;
+            case 'o':
+                out_file = arg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    static uint8_t mem[MEM_SIZE];
+    int size = binary ? read_file_to_buf(binary, mem, 0, MEM_SIZE)
+                      : invaders_load_rom(rom_dir, mem);
+    if (size <= 0) {
+        if (binary) {
+            fprintf(stderr, "error: Couldn't read %s, or it is over %d bytes\n",
+                    binary, MEM_SIZE);
+        }
+        exit(1);
+    }
+
+    static cfg_t cfg;
+    if (cfg_analyze(&cfg, mem, size) < 0) {
+        fprintf(stderr, "error: Out of memory\n");
+        exit(1);
+    }
+
+    FILE *out = fopen(out_file, "w");
+    if (out == NULL) {
+        fprintf(stderr, "error: Couldn't write %s\n", out_file);
+        exit(1);
+    }
+    recomp_write(out, &cfg);
+    fclose(out);
+
+    fprintf(stderr, "%d blocks recompiled into %s\n", cfg.num_blocks,
+            out_file);
+    cfg_free(&cfg);
+    return 0;
+}
@@ -0,0 +1,507 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Persistent translation cache of the tiered core. The decoded blocks, the
+ * execution counts of their entry addresses and the native code are saved to
+ * a file, and mapped by later runs of the same build on the same ROM, so they
+ * start with the hot code already translated.
+ *
+ * A file is only used by a build with the same translator: the header holds
+ * the id of the build (tcache_build_id), and a hash of the configuration the handler ids and the native code depend on (opcode table,
+ * handler tables, state layout). Everything after the header is covered by
+ * a checksum, and each native code offset must point to the translation of
+ * its block.
+ *
+ * File layout:
+ *   tcache_header_t
+ *   the bytes of the ROM (TCACHE_CODE_END), compared with memory on load
+ *   tcache_block_t records
+ *   tcache_reloc_t records, one per handler address in the native code
+ *   native code
+ *
+ * Handlers are stored as ids (indexes in tcache_handler_tables), and the
+ * handler addresses in the native code are relocated on load, so the cache
+ * doesn't depend on where the emulator is loaded.
+ *
+ * Only the blocks of the ROM are saved, code in RAM depends on the run. The
+ * ROM bytes saved are the ones a later run starts from, and the blocks whose
+ * code was changed by the run since are left out.
+ */
+
+#define TCACHE_MAGIC "8080TC2"
+
+/* End of the ROM, whose blocks are saved */
+#define TCACHE_CODE_END (0x2000)
+
+/* Hash of the sources of the decoder and the translator (8080_opcodes.c,
+ * 8080_block.c, 8080_tier.c and this file), optionally passed by the build,
+ * e.g. -DTCACHE_SOURCE_HASH=$(cat <files> | cksum | cut -d' ' -f1)u, so that
+ * rebuilds of the same sources share their caches */
+
+typedef struct {
+    char magic[8];         // TCACHE_MAGIC
+    uint32_t build_id;     // tcache_build_id() of the build that saved it
+    uint32_t config_hash;  // tcache_config_hash() of that build
+    uint32_t checksum;     // tcache_hash() of the rest of the file
+    uint32_t rom_hash;     // cfg_hash() of the cached code
+    uint32_t code_end;  // TCACHE_CODE_END
+    uint32_t patterns;  // block_patterns
+    uint32_t dead_flags;  // block_dead_flags
+    uint32_t num_blocks;
+    uint32_t num_relocs;
+    uint32_t code_size;  // Bytes of native code
+} tcache_header_t;
+
+/* A block_t with its handlers as ids, and its tier */
+typedef struct {
+    uint16_t start;
+    uint16_t end;
+    uint16_t num_ops;
+    uint16_t num_fast;
+    uint16_t cycles;
+    uint16_t prefix;
+    uint32_t count;  // tier_counts of the entry address
+    int32_t native;  // Offset of the native code, -1 if none
+    uint32_t native_size;  // Bytes of native code
+    uint16_t addrs[BLOCK_MAX_OPS];
+    uint16_t handlers[BLOCK_MAX_OPS];
+    uint16_t fast[BLOCK_MAX_OPS];
+    uint8_t fast_ops[BLOCK_MAX_OPS];
+    uint8_t op_cycles[BLOCK_MAX_OPS];
+    uint8_t dead_flags[BLOCK_MAX_OPS];
+} tcache_block_t;
+
+typedef struct {
+    uint32_t offset;   // In the native code
+    uint32_t handler;  // Handler id
+} tcache_reloc_t;
+
+/* Superinstructions not listed in a table indexed by register */
+block_handler_t block_ldax_mov[2] = {block_LDAX_D_MOV_M_A_INX_H,
+                                     block_LDAX_D_MOV_M_A_INX_D};
+
+/* Tables of the handlers a block can use, a handler id is its index in the
+ * concatenation of these tables */
+struct {
+    block_handler_t *table;
+    uint32_t size;
+} tcache_handler_tables[] = {
+    {emu_handlers, 0x100},        {block_nf_handlers, 0x100},
+    {block_zsc_handlers, 0x100},  {block_dcr_jnz, 8},
+    {block_mov_from_m_inx, 8},    {block_mov_to_m_inx, 8},
+    {block_ldax_mov, 2},
+};
+
+#define TCACHE_NUM_TABLES \
+    (sizeof(tcache_handler_tables) / sizeof(tcache_handler_tables[0]))
+
+/* File loaded by the tiered core when it starts on a machine, NULL for none */
+const char *tcache_file;
+
+/*
+ * tcache_handler_id: Finds the id of a handler.
+ *
+ * Arguments:
+ *   handler    - handler
+ *
+ * Returns:
+ *   the id, or -1 if the handler isn't in any table.
+ */
+int32_t tcache_handler_id(block_handler_t handler) {
+    int32_t id = 0;
+    if (handler == NULL) return -1;
+    for (unsigned int t = 0; t < TCACHE_NUM_TABLES; t++) {
+        for (uint32_t i = 0; i < tcache_handler_tables[t].size; i++) {
+            if (tcache_handler_tables[t].table[i] == handler) return id + i;
+        }
+        id += tcache_handler_tables[t].size;
+    }
+    return -1;
+}
+
+/*
+ * tcache_handler: Finds the handler of an id.
+ *
+ * Arguments:
+ *   id     - handler id
+ *
+ * Returns:
+ *   the handler, or NULL if the id is invalid.
+ */
+block_handler_t tcache_handler(uint32_t id) {
+    for (unsigned int t = 0; t < TCACHE_NUM_TABLES; t++) {
+        if (id < tcache_handler_tables[t].size) {
+            return tcache_handler_tables[t].table[id];
+        }
+        id -= tcache_handler_tables[t].size;
+    }
+    return NULL;
+}
+
+/*
+ * tcache_hash: Continues a 32 bit FNV-1a hash (see cfg_hash) over more
+ *              bytes.
+ *
+ * Arguments:
+ *   hash   - hash of the previous bytes, 2166136261 for none
+ *   data   - bytes to hash
+ *   size   - number of bytes
+ *
+ * Returns:
+ *   the hash.
+ */
+uint32_t tcache_hash(uint32_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * tcache_build_id: Identifies the translator of this build: the hash of its
+ *                  sources if the build passed TCACHE_SOURCE_HASH, otherwise
+ *                  the time it was compiled at, so a cache is only used by
+ *                  the build that saved it.
+ *
+ * Returns:
+ *   the id.
+ */
+uint32_t tcache_build_id(void) {
+#ifdef TCACHE_SOURCE_HASH
+    return TCACHE_SOURCE_HASH;
+#else
+    static const char built[] = __DATE__ " " __TIME__;
+    return tcache_hash(2166136261u, built, sizeof(built));
+#endif
+}
+
+/*
+ * tcache_config_hash: Hashes what the meaning of a saved block depends on
+ *                     besides the sources: the opcode table, the sizes of
+ *                     the handler tables, the layout of the state the native
+ *                     code accesses, and the block and record sizes.
+ *
+ * Returns:
+ *   the hash.
+ */
+uint32_t tcache_config_hash(void) {
+    const uint32_t layout[] = {
+        sizeof(emu_state_t),
+        offsetof(emu_state_t, pc),
+        offsetof(emu_state_t, a),
+        offsetof(emu_state_t, bc),
+        offsetof(emu_state_t, de),
+        offsetof(emu_state_t, hl),
+        offsetof(emu_state_t, sp),
+        offsetof(emu_state_t, code_written),
+        BLOCK_MAX_OPS,
+        TIER_NATIVE,
+        sizeof(tcache_block_t),
+    };
+    uint32_t hash = tcache_hash(2166136261u, layout, sizeof(layout));
+    hash = tcache_hash(hash, opcode_info, sizeof(opcode_info));
+    for (unsigned int t = 0; t < TCACHE_NUM_TABLES; t++) {
+        uint32_t size = tcache_handler_tables[t].size;
+        hash = tcache_hash(hash, &size, sizeof(size));
+    }
+    return hash;
+}
+
+/*
+ * tcache_init_header: Fills in the header for the current build, ROM and
+ *                     block options.
+ *
+ * Arguments:
+ *   header - header to fill in
+ *   mem    - memory holding the ROM
+ *
+ * Returns:
+ *   None.
+ */
+void tcache_init_header(tcache_header_t *header, const uint8_t *mem) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, TCACHE_MAGIC, sizeof(header->magic));
+    header->build_id = tcache_build_id();
+    header->config_hash = tcache_config_hash();
+    header->rom_hash = cfg_hash(mem, TCACHE_CODE_END);
+    header->code_end = TCACHE_CODE_END;
+    header->patterns = block_patterns;
+    header->dead_flags = block_dead_flags;
+}
+
+/*
+ * tcache_write: Writes bytes of a cache file, adding them to its checksum.
+ *
+ * Arguments:
+ *   fp     - cache file
+ *   data   - bytes to write
+ *   size   - number of bytes
+ *   hash   - checksum, updated
+ *
+ * Returns:
+ *   1 on success, 0 on error.
+ */
+int tcache_write(FILE *fp, const void *data, size_t size, uint32_t *hash) {
+    *hash = tcache_hash(*hash, data, size);
+    return fwrite(data, 1, size, fp) == size;
+}
+
+/*
+ * tcache_saved: Checks if a block is saved: it must be in the ROM, and its
+ *               code must not have changed since the start of the run.
+ *
+ * Arguments:
+ *   b      - block, or NULL
+ *   rom    - ROM at the start of the run
+ *
+ * Returns:
+ *   1 if the block is saved, 0 otherwise.
+ */
+int tcache_saved(const block_t *b, const uint8_t *rom) {
+    return b != NULL && b->end <= TCACHE_CODE_END &&
+           memcmp(rom + b->start, block_cache_mem + b->start,
+                  b->end - b->start) == 0;
+}
+
+/*
+ * tcache_save: Saves the blocks of the tiered core to a cache file. The file
+ *              is written under a temporary name, then renamed, so readers
+ *              never see a partial file. The header is written again at the
+ *              end, with the checksum.
+ *
+ * Arguments:
+ *   filename   - name of the cache file
+ *   mem        - ROM at the start of the run, TCACHE_CODE_END bytes: the
+ *                memory of the machine, or a copy if the run wrote to it
+ *
+ * Returns:
+ *   0 on success, -1 on error.
+ */
+int tcache_save(const char *filename, const uint8_t *mem) {
+    tcache_header_t header;
+    tcache_init_header(&header, mem);
+    header.code_size = TIER_NATIVE ? tier_code_used : 0;
+    header.num_relocs = TIER_NATIVE ? tier_num_relocs : 0;
+
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL) return -1;
+
+    for (uint32_t addr = 0; addr < TCACHE_CODE_END; addr++) {
+        const block_t *b = block_cache[addr];
+        header.num_blocks += tcache_saved(b, mem);
+    }
+    uint32_t hash = 2166136261u;
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             tcache_write(fp, mem, TCACHE_CODE_END, &hash);
+
+    for (uint32_t addr = 0; ok && addr < TCACHE_CODE_END; addr++) {
+        const block_t *b = block_cache[addr];
+        if (!tcache_saved(b, mem)) continue;
+
+        tcache_block_t r;
+        memset(&r, 0, sizeof(r));
+        r.start = b->start;
+        r.end = b->end;
+        r.num_ops = b->num_ops;
+        r.num_fast = b->num_fast;
+        r.cycles = b->cycles;
+        r.prefix = b->prefix;
+        r.count = tier_counts[addr];
+        r.native = -1;
+        if (TIER_NATIVE && tier_native[addr] != NULL) {
+            r.native = (uint8_t *)(void *)tier_native[addr] - tier_code;
+            r.native_size = tier_native_size[addr];
+        }
+        for (int i = 0; i < b->num_ops; i++) {
+            r.addrs[i] = b->addrs[i];
+            r.handlers[i] = tcache_handler_id(b->handlers[i]);
+            r.op_cycles[i] = b->op_cycles[i];
+            r.dead_flags[i] = b->dead_flags[i];
+        }
+        for (int i = 0; i < b->num_fast; i++) {
+            r.fast[i] = tcache_handler_id(b->fast[i]);
+            r.fast_ops[i] = b->fast_ops[i];
+        }
+        ok = tcache_write(fp, &r, sizeof(r), &hash);
+    }
+
+    for (uint32_t i = 0; ok && i < header.num_relocs; i++) {
+        block_handler_t handler;
+        memcpy(&handler, tier_code + tier_relocs[i], sizeof(handler));
+        tcache_reloc_t reloc = {tier_relocs[i], tcache_handler_id(handler)};
+        ok = tcache_write(fp, &reloc, sizeof(reloc), &hash);
+    }
+    if (ok && header.code_size > 0) {
+        ok = tcache_write(fp, tier_code, header.code_size, &hash);
+    }
+    header.checksum = hash;
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, fp) == 1;
+
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok || rename(tmp, filename) < 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * tcache_load_blocks: Rebuilds the blocks and native code of a mapped cache
+ *                     file that was validated.
+ *
+ * Arguments:
+ *   header - header of the mapped file
+ *   state  - emulator state
+ *
+ * Returns:
+ *   the number of blocks loaded, or -1 if a record is invalid, in which case
+ *   the loaded blocks must be flushed.
+ */
+int tcache_load_blocks(const tcache_header_t *header, emu_state_t *state) {
+    const uint8_t *p = (const uint8_t *)(header + 1) + TCACHE_CODE_END;
+    const tcache_block_t *records = (const tcache_block_t *)p;
+    const tcache_reloc_t *relocs =
+        (const tcache_reloc_t *)(records + header->num_blocks);
+    const uint8_t *code = (const uint8_t *)(relocs + header->num_relocs);
+
+    /* Native code, with the handler addresses of this run */
+    int native = 0;
+#if TIER_NATIVE
+    native = header->code_size > 0 && header->code_size <= TIER_CODE_SIZE &&
+             header->num_relocs <= TIER_MAX_RELOCS && tier_map_code() == 0;
+    if (native) {
+        memcpy(tier_code, code, header->code_size);
+        for (uint32_t i = 0; i < header->num_relocs; i++) {
+            block_handler_t handler = tcache_handler(relocs[i].handler);
+            if (handler == NULL ||
+                relocs[i].offset + sizeof(handler) > header->code_size) {
+                return -1;
+            }
+            memcpy(tier_code + relocs[i].offset, &handler, sizeof(handler));
+            tier_relocs[i] = relocs[i].offset;
+        }
+        tier_code_used = header->code_size;
+        tier_num_relocs = header->num_relocs;
+    }
+#else
+    (void)code;
+#endif
+
+    for (uint32_t n = 0; n < header->num_blocks; n++) {
+        const tcache_block_t *r = &records[n];
+        if (r->end > TCACHE_CODE_END || r->start >= r->end ||
+            r->num_ops == 0 || r->num_ops > BLOCK_MAX_OPS ||
+            r->num_fast > r->num_ops || block_cache[r->start] != NULL) {
+            return -1;
+        }
+
+        block_t *b = malloc(sizeof(block_t));
+        if (b == NULL) return -1;
+        block_cache[r->start] = b;
+        b->start = r->start;
+        b->end = r->end;
+        b->num_ops = r->num_ops;
+        b->num_fast = r->num_fast;
+        b->cycles = r->cycles;
+        b->prefix = r->prefix;
+        for (int i = 0; i < b->num_ops; i++) {
+            b->addrs[i] = r->addrs[i];
+            b->handlers[i] = tcache_handler(r->handlers[i]);
+            b->op_cycles[i] = r->op_cycles[i];
+            b->dead_flags[i] = r->dead_flags[i];
+            if (b->handlers[i] == NULL) return -1;
+        }
+        int ops = 0;
+        for (int i = 0; i < b->num_fast; i++) {
+            b->fast[i] = tcache_handler(r->fast[i]);
+            b->fast_ops[i] = r->fast_ops[i];
+            ops += r->fast_ops[i];
+            if (b->fast[i] == NULL) return -1;
+        }
+        if (ops != b->num_ops) return -1;
+        block_finish(b);
+        block_track(state, b, 1);
+
+        tier_counts[r->start] = r->count;
+#if TIER_NATIVE
+        if (native && r->native >= 0) {
+            /* The offset must hold the translation of this block */
+            if ((uint64_t)r->native + r->native_size > header->code_size ||
+                !tier_is_block_code(tier_code + r->native, r->native_size,
+                                    b->num_fast)) {
+                return -1;
+            }
+            tier_native[r->start] = (tier_native_t)(void *)(tier_code +
+                                                            r->native);
+            tier_native_size[r->start] = r->native_size;
+        }
+#endif
+    }
+    tier_stats.loaded += header->num_blocks;
+    return header->num_blocks;
+}
+
+/*
+ * tcache_load: Loads a cache file into the tiered core, if it was saved by
+ *              the same translator for the same code and isn't corrupt. The
+ *              tiered core must have been flushed.
+ *
+ * Arguments:
+ *   filename   - name of the cache file
+ *   state      - emulator state
+ *
+ * Returns:
+ *   the number of blocks loaded, or -1 if the file can't be read or doesn't
+ *   match.
+ */
+int tcache_load(const char *filename, emu_state_t *state) {
+    const uint8_t *mem = state->mem;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(tcache_header_t)) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    /* Any mismatch discards the whole file */
+    const tcache_header_t *header = map;
+    tcache_header_t expected;
+    tcache_init_header(&expected, mem);
+    uint64_t size = sizeof(tcache_header_t) + (uint64_t)TCACHE_CODE_END +
+                    (uint64_t)header->num_blocks * sizeof(tcache_block_t) +
+                    (uint64_t)header->num_relocs * sizeof(tcache_reloc_t) +
+                    header->code_size;
+    int loaded = -1;
+    if (memcmp(header->magic, expected.magic, sizeof(expected.magic)) == 0 &&
+        header->build_id == expected.build_id &&
+        header->config_hash == expected.config_hash &&
+        header->rom_hash == expected.rom_hash &&
+        header->code_end == expected.code_end &&
+        header->patterns == expected.patterns &&
+        header->dead_flags == expected.dead_flags &&
+        size == (uint64_t)st.st_size &&
+        tcache_hash(2166136261u, header + 1, size - sizeof(*header)) ==
+            header->checksum &&
+        memcmp(header + 1, mem, TCACHE_CODE_END) == 0) {
+        loaded = tcache_load_blocks(header, state);
+        if (loaded < 0) tier_flush(state);
+    }
+    munmap(map, st.st_size);
+    return loaded;
+}
@@ -0,0 +1,575 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define TIER_NATIVE (1)
+#else
+#define TIER_NATIVE (0)
+#endif
+
+/*
+ * Tiered execution core. Code starts in the interpreter, and each block entry
+ * address counts its executions: past TIER_BLOCK_THRESHOLD the block is
+ * decoded into the block cache (8080_block.c), and past TIER_NATIVE_THRESHOLD
+ * it is translated to native code. Boot code that runs once never pays for a
+ * translation, while the hot loops end up native.
+ *
+ * The native code is call-threaded x86-64: moves, immediate loads and
+ * register pair increments are inlined, and the other instructions call the
+ * handler (superinstruction or flag-free variant) of the decoded block.
+ * Native code only runs when the whole block fits in the cycle budget, the
+ * decoded block handles the end of the budget.
+ *
+ * With tcache_file set, the translations are loaded from a cache file saved
+ * by a previous run (8080_tcache.c). With a block map loaded, the ROM's
+ * blocks are decoded and translated up front (tier_preload).
+ */
+
+/* Executions of an entry address before promotion to each tier */
+#define TIER_BLOCK_THRESHOLD (16)
+#define TIER_NATIVE_THRESHOLD (256)
+
+/* Size of the native code buffer. When a block doesn't fit, all the
+ * translated code is flushed and the block translated again. */
+#define TIER_CODE_SIZE (4 << 20)
+
+/* Largest native code of one instruction, and of the block prologue and
+ * epilogue */
+#define TIER_MAX_OP_CODE (48)
+#define TIER_MAX_BLOCK_CODE (BLOCK_MAX_OPS * TIER_MAX_OP_CODE + 32)
+
+/* Handler calls in the native code buffer, each takes more than 16 bytes */
+#define TIER_MAX_RELOCS (TIER_CODE_SIZE / 16)
+
+typedef enum { TIER_INTERP, TIER_BLOCK, TIER_NATIVE_CODE, TIER_COUNT } tier_t;
+
+const char *tier_names[TIER_COUNT] = {"interp", "block", "native"};
+
+/* Native code of a block, returns the number of fast handlers run, fewer than
+ * the block's if code was written */
+typedef int (*tier_native_t)(emu_state_t *state);
+
+/*
+ * tier_stats_t: Statistics of the tiered core.
+ *
+ *   promotions     - entry addresses promoted to each tier
+ *   instructions   - instructions run in each tier
+ *   switches       - switches into each tier
+ *   invalidations  - calls to tier_invalidate dropping translated code
+ *   loaded         - blocks loaded from the translation cache
+ *   mapped         - blocks of the block map translated up front
+ *   flushes        - flushes of the full native code buffer
+ *   failures       - blocks that couldn't be translated, left to the block
+ *                    tier
+ */
+typedef struct {
+    uint64_t promotions[TIER_COUNT];
+    uint64_t instructions[TIER_COUNT];
+    uint64_t switches[TIER_COUNT];
+    uint64_t invalidations;
+    uint64_t loaded;
+    uint64_t mapped;
+    uint64_t flushes;
+    uint64_t failures;
+} tier_stats_t;
+
+tier_stats_t tier_stats;
+
+/* Executions and native code of each entry address, and whether its
+ * translation failed, so it isn't attempted again until the code changes */
+uint32_t tier_counts[BLOCK_CODE_END];
+tier_native_t tier_native[BLOCK_CODE_END];
+uint8_t tier_failed[BLOCK_CODE_END];
+
+/* Bytes of the last native code translated for each entry address */
+uint16_t tier_native_size[BLOCK_CODE_END];
+
+/* Native code buffer and its used size, NULL if it couldn't be mapped */
+uint8_t *tier_code;
+size_t tier_code_used;
+
+/* Offsets of the handler addresses in the native code, to relocate it */
+uint32_t tier_relocs[TIER_MAX_RELOCS];
+size_t tier_num_relocs;
+
+/* Current tier, and the instruction count at which it was entered */
+tier_t tier_current;
+uint64_t tier_since_instructions;
+
+/*
+ * tier_account: Accounts the instructions run in the current tier since it
+ *               was entered or last accounted.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *
+ * Returns:
+ *   None.
+ */
+void tier_account(emu_state_t *state) {
+    tier_stats.instructions[tier_current] +=
+        state->instructions - tier_since_instructions;
+    tier_since_instructions = state->instructions;
+}
+
+/*
+ * tier_switch: Accounts the instructions of the current tier, and makes
+ *              another tier current. Switches happen about once per block,
+ *              so they are only counted, without reading the clock.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   tier   - new tier
+ *
+ * Returns:
+ *   None.
+ */
+void tier_switch(emu_state_t *state, tier_t tier) {
+    tier_account(state);
+    tier_stats.switches[tier]++;
+    tier_current = tier;
+}
+
+/*
+ * tier_invalidate: Drops the blocks and native code holding a byte of an
+ *                  address range, and sends their entry addresses back to the
+ *                  interpreter. Every tier goes through this function when
+ *                  code is written.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   start  - first address of the range
+ *   end    - address past the last one
+ *
+ * Returns:
+ *   None.
+ */
+void tier_invalidate(emu_state_t *state, uint32_t start, uint32_t end) {
+    if (!block_holds_code(start, end)) return;
+
+    uint32_t first = (start > BLOCK_MAX_BYTES) ? start - BLOCK_MAX_BYTES : 0;
+    for (uint32_t addr = first; addr < end; addr++) {
+        block_t *b = block_cache[addr];
+        if (b != NULL && b->end > start) {
+            tier_counts[addr] = 0;
+            tier_native[addr] = NULL;
+            tier_failed[addr] = 0;
+            tier_stats.invalidations++;
+        }
+    }
+    /* Native code isn't reclaimed, the buffer is flushed once full */
+    block_invalidate(state, start, end);
+}
+
+/*
+ * tier_code_write: Invalidates the code holding a written byte, the
+ *                  emu_state_t.code_write function of the tiered core.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   addr   - address written
+ *
+ * Returns:
+ *   None.
+ */
+void tier_code_write(emu_state_t *state, uint16_t addr) {
+    if (state->mem == block_cache_mem) tier_invalidate(state, addr, addr + 1);
+}
+
+/*
+ * tier_flush: Drops all the translated code and execution counts.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *
+ * Returns:
+ *   None.
+ */
+void tier_flush(emu_state_t *state) {
+    block_flush(state);
+    memset(tier_counts, 0, sizeof(tier_counts));
+    memset(tier_native, 0, sizeof(tier_native));
+    memset(tier_failed, 0, sizeof(tier_failed));
+    tier_code_used = 0;
+    tier_num_relocs = 0;
+}
+
+#if TIER_NATIVE
+/* push rbx; mov rbx, rdi */
+const uint8_t tier_prologue[] = {0x53, 0x48, 0x89, 0xfb};
+
+/* mov eax, num_fast; pop rbx; ret */
+#define TIER_EPILOGUE(num_fast) {0xb8, (num_fast), 0, 0, 0, 0x5b, 0xc3}
+
+/*
+ * tier_emit: Appends bytes to the native code.
+ *
+ * Arguments:
+ *   p      - pointer to the write position, advanced
+ *   bytes  - bytes to append
+ *   n      - number of bytes
+ *
+ * Returns:
+ *   None.
+ */
+void tier_emit(uint8_t **p, const void *bytes, size_t n) {
+    memcpy(*p, bytes, n);
+    *p += n;
+}
+
+/*
+ * tier_emit_pc: Emits the addition of pending instruction sizes to PC.
+ *
+ * Arguments:
+ *   p      - pointer to the write position, advanced
+ *   delta  - bytes to add to PC, nothing is emitted if 0
+ *
+ * Returns:
+ *   None.
+ */
+void tier_emit_pc(uint8_t **p, uint16_t delta) {
+    if (delta == 0) return;
+    /* add word [rbx + pc], imm16 */
+    uint8_t code[] = {0x66, 0x81, 0x43, offsetof(emu_state_t, pc),
+                      delta & 0xff, delta >> 8};
+    tier_emit(p, code, sizeof(code));
+}
+
+/* Offsets of the registers in emu_state_t, in register field order, -1 for
+ * M */
+const int tier_reg_offsets[8] = {
+    offsetof(emu_state_t, b), offsetof(emu_state_t, c),
+    offsetof(emu_state_t, d), offsetof(emu_state_t, e),
+    offsetof(emu_state_t, h), offsetof(emu_state_t, l),
+    -1,                       offsetof(emu_state_t, a)};
+
+/* Offsets of the 16-bit register pairs */
+const int tier_pair_offsets[4] = {
+    offsetof(emu_state_t, bc), offsetof(emu_state_t, de),
+    offsetof(emu_state_t, hl), offsetof(emu_state_t, sp)};
+
+/*
+ * tier_emit_inline: Emits an instruction that is simple enough to be
+ *                   translated without calling its handler: NOP, MOV r, r,
+ *                   MVI r, LXI and INX.
+ *
+ * Arguments:
+ *   p      - pointer to the write position, advanced
+ *   code   - bytes of the instruction
+ *
+ * Returns:
+ *   1 if the instruction was emitted, 0 if it must call its handler.
+ */
+int tier_emit_inline(uint8_t **p, const uint8_t *code) {
+    uint8_t op = code[0];
+    if (op == 0x00) return 1;
+    if ((op & 0xc0) == 0x40) {
+        int dst = tier_reg_offsets[(op >> 3) & 7];
+        int src = tier_reg_offsets[op & 7];
+        if (dst < 0 || src < 0) return 0;
+        /* mov al, [rbx + src]; mov [rbx + dst], al */
+        uint8_t bytes[] = {0x8a, 0x43, src, 0x88, 0x43, dst};
+        tier_emit(p, bytes, sizeof(bytes));
+        return 1;
+    }
+    if ((op & 0xc7) == 0x06) {
+        int dst = tier_reg_offsets[(op >> 3) & 7];
+        if (dst < 0) return 0;
+        /* mov byte [rbx + dst], imm8 */
+        uint8_t bytes[] = {0xc6, 0x43, dst, code[1]};
+        tier_emit(p, bytes, sizeof(bytes));
+        return 1;
+    }
+    if ((op & 0xcf) == 0x01 || (op & 0xcf) == 0x03) {
+        int pair = tier_pair_offsets[(op >> 4) & 3];
+        if (op & 0x02) {
+            /* inc word [rbx + pair] */
+            uint8_t bytes[] = {0x66, 0xff, 0x43, pair};
+            tier_emit(p, bytes, sizeof(bytes));
+        } else {
+            /* mov word [rbx + pair], imm16 */
+            uint8_t bytes[] = {0x66, 0xc7, 0x43, pair, code[1], code[2]};
+            tier_emit(p, bytes, sizeof(bytes));
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * tier_map_code: Maps the native code buffer if it isn't yet.
+ *
+ * Returns:
+ *   0 on success, -1 if it couldn't be mapped.
+ */
+int tier_map_code(void) {
+    if (tier_code == NULL) {
+        void *code = mmap(NULL, TIER_CODE_SIZE,
+                          PROT_READ | PROT_WRITE | PROT_EXEC,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED) return -1;
+        tier_code = code;
+    }
+    return 0;
+}
+
+/*
+ * tier_translate: Translates a decoded block into native code.
+ *
+ * Arguments:
+ *   mem    - memory holding the code
+ *   b      - block
+ *
+ * Returns:
+ *   the native code, or NULL if there is no room left for it or the buffer
+ *   couldn't be mapped.
+ */
+tier_native_t tier_translate(const uint8_t *mem, const block_t *b) {
+    if (tier_map_code() < 0) return NULL;
+    if (tier_code_used + TIER_MAX_BLOCK_CODE > TIER_CODE_SIZE) return NULL;
+
+    uint8_t *start = tier_code + tier_code_used;
+    uint8_t *p = start;
+
+    tier_emit(&p, tier_prologue, sizeof(tier_prologue));
+
+    uint16_t pending_pc = 0;
+    for (int i = 0, op = 0; i < b->num_fast; op += b->fast_ops[i++]) {
+        const uint8_t *code = &mem[b->addrs[op]];
+        if (b->fast_ops[i] == 1 && tier_emit_inline(&p, code)) {
+            pending_pc += opcode_info[code[0]].size;
+            continue;
+        }
+        tier_emit_pc(&p, pending_pc);
+        pending_pc = 0;
+
+        /* mov rdi, rbx; mov rax, handler; call rax; add [rbx + pc], ax */
+        const uint8_t call[] = {0x48, 0x89, 0xdf, 0x48, 0xb8};
+        uint64_t handler = (uint64_t)(uintptr_t)b->fast[i];
+        const uint8_t add[] = {0xff, 0xd0, 0x66, 0x01, 0x43,
+                               offsetof(emu_state_t, pc)};
+        tier_emit(&p, call, sizeof(call));
+        tier_relocs[tier_num_relocs++] = p - tier_code;
+        tier_emit(&p, &handler, sizeof(handler));
+        tier_emit(&p, add, sizeof(add));
+
+        /* Only writes to memory can hit the code */
+        int stores = 0;
+        for (int j = op; j < op + b->fast_ops[i]; j++) {
+            stores |= opcode_info[mem[b->addrs[j]]].op_class & OC_STORE;
+        }
+        if (!stores) continue;
+
+        /* cmp byte [rbx + code_written], 0; je +7;
+         * mov eax, i + 1; pop rbx; ret */
+        const uint8_t check[] = {
+            0x80, 0x7b, offsetof(emu_state_t, code_written), 0x00,
+            0x74, 0x07, 0xb8
+        };
+        uint32_t done = i + 1;
+        const uint8_t ret[] = {0x5b, 0xc3};
+        tier_emit(&p, check, sizeof(check));
+        tier_emit(&p, &done, sizeof(done));
+        tier_emit(&p, ret, sizeof(ret));
+    }
+    tier_emit_pc(&p, pending_pc);
+
+    const uint8_t epilogue[] = TIER_EPILOGUE(b->num_fast);
+    tier_emit(&p, epilogue, sizeof(epilogue));
+
+    tier_code_used += p - start;
+    tier_native_size[b->start] = p - start;
+    return (tier_native_t)(void *)start;
+}
+
+/*
+ * tier_is_block_code: Checks that native code starts and ends like the
+ *                     translation of a block.
+ *
+ * Arguments:
+ *   code       - native code
+ *   size       - bytes of native code
+ *   num_fast   - number of fast handlers of the block
+ *
+ * Returns:
+ *   1 if the code has the prologue and the epilogue of the block, 0
+ *   otherwise.
+ */
+int tier_is_block_code(const uint8_t *code, size_t size, int num_fast) {
+    const uint8_t epilogue[] = TIER_EPILOGUE(num_fast);
+    return size >= sizeof(tier_prologue) + sizeof(epilogue) &&
+           memcmp(code, tier_prologue, sizeof(tier_prologue)) == 0 &&
+           memcmp(code + size - sizeof(epilogue), epilogue,
+                  sizeof(epilogue)) == 0;
+}
+#endif
+
+#include "8080_tcache.c"
+
+/*
+ * tier_interpret: Interprets instructions up to the end of a block, or until
+ *                 the given cycle count is reached.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   until  - value of state->cycles at which to stop
+ *
+ * Returns:
+ *   None.
+ */
+void tier_interpret(emu_state_t *state, uint64_t until) {
+    uint8_t op;
+    do {
+        op = state->mem[state->pc];
+        emu_step(state);
+    } while (!(opcode_info[op].op_class & BLOCK_END_CLASSES) &&
+             state->cycles < until);
+}
+
+/*
+ * tier_promote: Translates the block at an entry address into native code.
+ *               When the buffer is full, all the translated code is flushed
+ *               and the block decoded and translated again. A block that
+ *               still can't be translated stays in the block tier.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   pc     - entry address
+ *
+ * Returns:
+ *   the native code, or NULL if the block couldn't be translated. The
+ *   block is in block_cache[pc], NULL if decoding it again failed.
+ */
+tier_native_t tier_promote(emu_state_t *state, uint16_t pc) {
+    tier_native_t native = NULL;
+#if TIER_NATIVE
+    native = tier_translate(state->mem, block_cache[pc]);
+    if (native == NULL && tier_code_used > 0) {
+        uint32_t count = tier_counts[pc];
+        tier_flush(state);
+        tier_stats.flushes++;
+        tier_counts[pc] = count;
+
+        block_t *b = block_cache[pc] = block_build(state->mem, pc);
+        if (b == NULL) return NULL;
+        block_track(state, b, 1);
+        native = tier_translate(state->mem, b);
+    }
+    if (native == NULL) {
+        tier_failed[pc] = 1;
+        tier_stats.failures++;
+        return NULL;
+    }
+    tier_native[pc] = native;
+    tier_stats.promotions[TIER_NATIVE_CODE]++;
+#endif
+    return native;
+}
+
+/*
+ * tier_preload: Decodes the blocks of the block map, and translates those
+ *               that have no native code yet, as if they were already hot.
+ *               Translation stops when the native code buffer is full, the
+ *               rest is left to the execution counts.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *
+ * Returns:
+ *   None.
+ */
+void tier_preload(emu_state_t *state) {
+    block_preload(state);
+#if TIER_NATIVE
+    if (!block_map_matches(state)) return;
+    for (int i = 0; i < block_map_blocks; i++) {
+        uint16_t start = block_map[i].start;
+        block_t *b = block_cache[start];
+        if (b == NULL || tier_native[start] != NULL) continue;
+
+        tier_native_t native = tier_translate(state->mem, b);
+        if (native == NULL) break;
+        tier_native[start] = native;
+        tier_counts[start] = TIER_NATIVE_THRESHOLD;
+        tier_stats.mapped++;
+    }
+#endif
+}
+
+/*
+ * tier_run: Emulates instructions until the given cycle count is reached,
+ *           running each block in the tier its execution count earned.
+ *
+ * Arguments:
+ *   state  - emulator state
+ *   until  - value of state->cycles at which to stop
+ *
+ * Returns:
+ *   None.
+ */
+void tier_run(emu_state_t *state, uint64_t until) {
+    /* The profilers hook into the interpreter */
+    if (PROFILE_PER_INSTR) {
+        emu_run(state, until);
+        return;
+    }
+    if (block_check_cache(state)) {
+        tier_flush(state);
+        if (tcache_file != NULL) tcache_load(tcache_file, state);
+        if (block_map != NULL) tier_preload(state);
+    }
+    block_reclaim();
+    state->code_write = tier_code_write;
+
+    tier_since_instructions = state->instructions;
+    while (state->cycles < until) {
+        uint16_t pc = state->pc;
+        if (state->halted) {
+            if (state->stopped) break;
+            if (tier_current != TIER_INTERP) tier_switch(state, TIER_INTERP);
+            emu_step(state);
+            continue;
+        }
+
+        uint32_t count = ++tier_counts[pc];
+        block_t *b = block_cache[pc];
+        if (b == NULL && count >= TIER_BLOCK_THRESHOLD) {
+            b = block_cache[pc] = block_build(state->mem, pc);
+            if (b != NULL) {
+                block_track(state, b, 1);
+                tier_stats.promotions[TIER_BLOCK]++;
+            }
+        }
+        if (b == NULL) {
+            if (tier_current != TIER_INTERP) tier_switch(state, TIER_INTERP);
+            tier_interpret(state, until);
+            continue;
+        }
+
+        tier_native_t native = tier_native[pc];
+        if (TIER_NATIVE && native == NULL && count >= TIER_NATIVE_THRESHOLD &&
+            !tier_failed[pc]) {
+            native = tier_promote(state, pc);
+            b = block_cache[pc];
+            if (b == NULL) continue;
+        }
+        if (native != NULL && state->cycles + b->prefix < until) {
+            if (tier_current != TIER_NATIVE_CODE) {
+                tier_switch(state, TIER_NATIVE_CODE);
+            }
+            state->cycles += b->cycles;
+            state->instructions += b->num_ops;
+            state->code_written = 0;
+            int done = (*native)(state);
+            if (done < b->num_fast) block_stop(state, b, done - 1);
+        } else {
+            if (tier_current != TIER_BLOCK) tier_switch(state, TIER_BLOCK);
+            block_exec(state, b, until);
+        }
+        if (state->code_written) block_reclaim();
+    }
+    tier_account(state);
+    block_cache_cycles = state->cycles;
+}
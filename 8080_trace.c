@@ -0,0 +1,343 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Binary instruction traces. Each traced instruction is stored as a fixed size
+ * record holding the machine state before it executes. Records are appended
+ * to a ring buffer owned by the emulating thread, and a writer thread drains
+ * it to disk with large sequential writes. 8080_tracedec turns a trace back
+ * into text.
+ *
+ * File layout: a trace_header_t followed by trace_record_t records.
+ */
+
+#define TRACE_MAGIC "8080TRC1"
+
+/* Ring size and the amount the writer waits for before writing, in records */
+#define TRACE_RING_RECORDS (1 << 16)
+#define TRACE_CHUNK_RECORDS (1 << 12)
+
+/* Memory needed to rebuild the state of a record, the disassembler may read
+ * the operands of an instruction at 0xffff past the end of the address space */
+#define TRACE_MEM_SIZE (0x10000 + 2)
+
+/* How long the writer sleeps when there isn't a full chunk to write */
+#define TRACE_WRITER_SLEEP_NS (1000000)
+
+typedef struct {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+} trace_header_t;
+
+typedef struct {
+    uint64_t index;   // Instruction count
+    uint64_t cycles;  // Clock periods executed before the instruction
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t opcode;
+    uint8_t data[2];  // The bytes following the opcode (operands)
+    uint8_t a;
+    uint8_t b;
+    uint8_t c;
+    uint8_t d;
+    uint8_t e;
+    uint8_t h;
+    uint8_t l;
+    uint8_t psw;  // Processor status word, as pushed by PUSH PSW
+    uint8_t pad;
+} trace_record_t;
+
+typedef struct {
+    trace_record_t *ring;
+    _Atomic uint64_t head;  // Next record to fill (emulating thread)
+    _Atomic uint64_t tail;  // Next record to write (writer thread)
+    atomic_int stop;
+    int fd;
+    int error;  // errno of the first failed write, 0 if none
+    pthread_t writer;
+} trace_t;
+
+/*
+ * trace_write_all: Writes a buffer to a file, retrying on partial writes.
+ *
+ * Arguments:
+ *   fd     - file to write to
+ *   buf    - data to write
+ *   len    - number of bytes to write
+ *
+ * Returns:
+ *   0 on success, errno on failure.
+ */
+int trace_write_all(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t rc = write(fd, p, len);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        p += rc;
+        len -= rc;
+    }
+    return 0;
+}
+
+/*
+ * trace_writer_main: Drains the ring to disk, in chunks of at least
+ *                    TRACE_CHUNK_RECORDS records until asked to stop.
+ *
+ * Arguments:
+ *   arg    - trace to drain
+ *
+ * Returns:
+ *   NULL.
+ */
+void *trace_writer_main(void *arg) {
+    trace_t *t = arg;
+    struct timespec nap = {0, TRACE_WRITER_SLEEP_NS};
+
+    for (;;) {
+        /* Read stop before head, so that once stop is seen head is final */
+        int stop = atomic_load_explicit(&t->stop, memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&t->head, memory_order_acquire);
+        uint64_t tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+        uint64_t avail = head - tail;
+
+        if (avail == 0 && stop) break;
+        if (avail < TRACE_CHUNK_RECORDS && !stop) {
+            nanosleep(&nap, NULL);
+            continue;
+        }
+
+        /* Write up to the end of the ring, the rest on the next iteration */
+        uint64_t start = tail % TRACE_RING_RECORDS;
+        uint64_t n = TRACE_RING_RECORDS - start;
+        if (n > avail) n = avail;
+        if (t->error == 0) {
+            t->error = trace_write_all(t->fd, &t->ring[start],
+                                       n * sizeof(trace_record_t));
+        }
+        atomic_store_explicit(&t->tail, tail + n, memory_order_release);
+    }
+
+    return NULL;
+}
+
+/*
+ * trace_open: Creates a trace file and starts its writer thread.
+ *
+ * Arguments:
+ *   t          - trace to initialize
+ *   filename   - name of the trace file
+ *
+ * Returns:
+ *   0 on success, -1 on failure.
+ */
+int trace_open(trace_t *t, const char *filename) {
+    trace_header_t header = {TRACE_MAGIC, sizeof(trace_record_t), 0};
+
+    memset(t, 0, sizeof(*t));
+    t->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (t->fd < 0) return -1;
+
+    t->ring = malloc(TRACE_RING_RECORDS * sizeof(trace_record_t));
+    if (t->ring == NULL ||
+        trace_write_all(t->fd, &header, sizeof(header)) != 0 ||
+        pthread_create(&t->writer, NULL, trace_writer_main, t) != 0) {
+        free(t->ring);
+        close(t->fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * trace_instr: Appends the state of the machine before executing the
+ *              instruction at PC. Only waits if the writer fell a full ring
+ *              behind.
+ *
+ * Arguments:
+ *   t      - trace to append to
+ *   state  - emulator state
+ *   index  - instruction count
+ *
+ * Returns:
+ *   None.
+ */
+void trace_instr(trace_t *t, emu_state_t *state, uint64_t index) {
+    uint64_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&t->tail, memory_order_acquire) ==
+           TRACE_RING_RECORDS) {
+        sched_yield();
+    }
+
+    trace_record_t *r = &t->ring[head % TRACE_RING_RECORDS];
+    r->index = index;
+    r->cycles = state->cycles;
+    r->pc = state->pc;
+    r->sp = SP;
+    r->opcode = MEM(state->pc);
+    r->data[0] = MEM((uint16_t)(state->pc + 1));
+    r->data[1] = MEM((uint16_t)(state->pc + 2));
+    r->a = state->a;
+    r->b = state->b;
+    r->c = state->c;
+    r->d = state->d;
+    r->e = state->e;
+    r->h = state->h;
+    r->l = state->l;
+    r->psw = emu_status_word(state);
+    r->pad = 0;
+
+    atomic_store_explicit(&t->head, head + 1, memory_order_release);
+}
+
+/*
+ * trace_close: Flushes the remaining records and closes the trace file.
+ *
+ * Arguments:
+ *   t      - trace to close
+ *
+ * Returns:
+ *   0 on success, -1 if writing the trace failed.
+ */
+int trace_close(trace_t *t) {
+    atomic_store_explicit(&t->stop, 1, memory_order_release);
+    pthread_join(t->writer, NULL);
+    free(t->ring);
+    if (close(t->fd) < 0 && t->error == 0) t->error = errno;
+    return t->error ? -1 : 0;
+}
+
+/*
+ * trace_check_header: Checks that a header belongs to a trace file written
+ *                     with the current record layout.
+ *
+ * Arguments:
+ *   header - trace file header
+ *
+ * Returns:
+ *   0 if the header is valid, -1 otherwise.
+ */
+int trace_check_header(const trace_header_t *header) {
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->record_size != sizeof(trace_record_t)) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * trace_map: Maps the records of a trace file into memory, read-only.
+ *            A trailing partial record is ignored.
+ *
+ * Arguments:
+ *   filename   - name of the trace file
+ *   count      - set to the number of records
+ *
+ * Returns:
+ *   the records, or NULL on failure. Release with trace_unmap().
+ */
+const trace_record_t *trace_map(const char *filename, size_t *count) {
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(trace_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    if (trace_check_header(map) < 0) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    *count = (st.st_size - sizeof(trace_header_t)) / sizeof(trace_record_t);
+    return (const trace_record_t *)((uint8_t *)map + sizeof(trace_header_t));
+}
+
+/*
+ * trace_unmap: Unmaps records mapped by trace_map().
+ *
+ * Arguments:
+ *   records    - mapped records
+ *   count      - number of records
+ *
+ * Returns:
+ *   None.
+ */
+void trace_unmap(const trace_record_t *records, size_t count) {
+    if (records == NULL) return;
+    munmap((uint8_t *)records - sizeof(trace_header_t),
+           sizeof(trace_header_t) + count * sizeof(trace_record_t));
+}
+
+/*
+ * trace_record_state: Rebuilds the emulator state held by a trace record.
+ *                     The memory holds the instruction bytes at PC.
+ *
+ * Arguments:
+ *   r      - trace record
+ *   state  - emulator state to fill
+ *   mem    - TRACE_MEM_SIZE bytes of memory for the state
+ *
+ * Returns:
+ *   None.
+ */
+void trace_record_state(const trace_record_t *r, emu_state_t *state,
+                        uint8_t *mem) {
+    memset(state, 0, sizeof(*state));
+    state->mem = mem;
+    state->pc = r->pc;
+    state->cycles = r->cycles;
+    state->instructions = r->index;
+    state->a = r->a;
+    state->b = r->b;
+    state->c = r->c;
+    state->d = r->d;
+    state->e = r->e;
+    state->h = r->h;
+    state->l = r->l;
+    state->sp = r->sp;
+    emu_set_status_word(state, r->psw);
+    mem[r->pc] = r->opcode;
+    mem[r->pc + 1] = r->data[0];
+    mem[r->pc + 2] = r->data[1];
+}
+
+/*
+ * trace_print: Prints a trace record in the text format of the verbose mode:
+ *              instruction count, flags and disassembly.
+ *
+ * Arguments:
+ *   r      - trace record
+ *   mem    - TRACE_MEM_SIZE bytes of scratch memory
+ *
+ * Returns:
+ *   None.
+ */
+void trace_print(const trace_record_t *r, uint8_t *mem) {
+    emu_state_t state;
+    trace_record_state(r, &state, mem);
+
+    printf("%012llu ", (unsigned long long)r->index);
+    print_flags(&state);
+    printf("%*c", 12, ' ');  // Pad spacing
+    printf("%04x:      %s\n", r->pc, disasm_line(&mem[r->pc], r->pc, NULL));
+}
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "8080_disasm.c"
+#include "8080_profile.c"
+#include "8080_emu.c"
+#include "8080_trace.c"
+
+/* Records read from the trace at once */
+#define DECODE_BATCH (4096)
+
+/*
+ * trace_read_header: Opens a trace file and checks its header.
+ *
+ * Arguments:
+ *   filename   - name of the trace file
+ *
+ * Returns:
+ *   the file positioned at the first record, or NULL on failure.
+ */
+FILE *trace_read_header(const char *filename) {
+    trace_header_t header;
+
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        printf("error: Couldn't open %s\n", filename);
+        return NULL;
+    }
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        trace_check_header(&header) < 0) {
+        printf("error: %s is not a trace file\n", filename);
+        fclose(fp);
+        return NULL;
+    }
+
+    return fp;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: %s <trace> [<first record>] [<count>]\n", argv[0]);
+        return 1;
+    }
+    long first = (argc > 2) ? atol(argv[2]) : 0;
+    long count = (argc > 3) ? atol(argv[3]) : -1;
+
+    FILE *fp = trace_read_header(argv[1]);
+    if (fp == NULL) return 1;
+    if (first > 0) fseek(fp, first * sizeof(trace_record_t), SEEK_CUR);
+
+    static trace_record_t records[DECODE_BATCH];
+    static uint8_t mem[TRACE_MEM_SIZE];
+    size_t n;
+    while (count != 0 &&
+           (n = fread(records, sizeof(records[0]), DECODE_BATCH, fp)) > 0) {
+        for (size_t i = 0; i < n && count != 0; i++, count--) {
+            trace_print(&records[i], mem);
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
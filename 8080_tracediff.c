@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "8080_disasm.c"
+#include "8080_profile.c"
+#include "8080_emu.c"
+#include "8080_trace.c"
+
+/* Records compared at once while looking for the first differing block, large
+ * enough that memcmp runs its vectorized loop for most of the time */
+#define DIFF_BLOCK (1 << 15)
+
+/* Default number of records printed before and after the divergence */
+#define DIFF_CONTEXT (5)
+
+/*
+ * diff_first_block: Finds the first block of DIFF_BLOCK records that differs
+ *                   between two traces.
+ *
+ * Arguments:
+ *   a, b   - records of the traces
+ *   n      - number of records to compare
+ *
+ * Returns:
+ *   index of the first record of the block, or n if the records are equal.
+ */
+size_t diff_first_block(const trace_record_t *a, const trace_record_t *b,
+                        size_t n) {
+    for (size_t i = 0; i < n; i += DIFF_BLOCK) {
+        size_t len = (n - i < DIFF_BLOCK) ? n - i : DIFF_BLOCK;
+        if (memcmp(&a[i], &b[i], len * sizeof(trace_record_t)) != 0) {
+            return i;
+        }
+    }
+    return n;
+}
+
+/*
+ * diff_first_record: Binary searches a block for its first differing record.
+ *                    Prefix equality is monotonic, so the search looks for the
+ *                    longest equal prefix of the block.
+ *
+ * Arguments:
+ *   a, b   - records of the block
+ *   n      - number of records in the block, at least one of them differing
+ *
+ * Returns:
+ *   index of the first differing record.
+ */
+size_t diff_first_record(const trace_record_t *a, const trace_record_t *b,
+                         size_t n) {
+    size_t lo = 0, hi = n - 1;  // The answer is within [lo, hi]
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (memcmp(&a[lo], &b[lo], (mid - lo + 1) * sizeof(trace_record_t))) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/*
+ * diff_print_deltas: Prints the fields that differ between two records, as
+ *                    "field: a -> b".
+ *
+ * Arguments:
+ *   a, b   - records to compare
+ *
+ * Returns:
+ *   None.
+ */
+void diff_print_deltas(const trace_record_t *a, const trace_record_t *b) {
+    static const char *flag_names[8] = {"cy", NULL, "p", NULL,
+                                        "ac", NULL, "z", "s"};
+    const struct {
+        const char *name;
+        unsigned int a, b;
+    } regs[] = {
+        {"pc", a->pc, b->pc},
+        {"sp", a->sp, b->sp},
+        {"opcode", a->opcode, b->opcode},
+        {"a", a->a, b->a},
+        {"b", a->b, b->b},
+        {"c", a->c, b->c},
+        {"d", a->d, b->d},
+        {"e", a->e, b->e},
+        {"h", a->h, b->h},
+        {"l", a->l, b->l},
+    };
+
+    printf("  deltas:");
+    if (a->index != b->index) {
+        printf(" index: %llu -> %llu", (unsigned long long)a->index,
+               (unsigned long long)b->index);
+    }
+    if (a->cycles != b->cycles) {
+        printf(" cycles: %llu -> %llu", (unsigned long long)a->cycles,
+               (unsigned long long)b->cycles);
+    }
+    for (size_t i = 0; i < sizeof(regs) / sizeof(regs[0]); i++) {
+        if (regs[i].a != regs[i].b) {
+            printf(" %s: %02x -> %02x", regs[i].name, regs[i].a, regs[i].b);
+        }
+    }
+    if (a->pc == b->pc && a->opcode == b->opcode &&
+        memcmp(a->data, b->data, sizeof(a->data)) != 0) {
+        printf(" operands: %02x%02x -> %02x%02x", a->data[1], a->data[0],
+               b->data[1], b->data[0]);
+    }
+    for (int bit = 0; bit < 8; bit++) {
+        if (flag_names[bit] && ((a->psw ^ b->psw) >> bit) & 1) {
+            printf(" %s: %d -> %d", flag_names[bit], (a->psw >> bit) & 1,
+                   (b->psw >> bit) & 1);
+        }
+    }
+    printf("\n");
+}
+
+/* Exits like diff(1): 0 if the traces match, 1 if they differ, 2 on errors */
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("usage: %s <trace a> <trace b> [<context>]\n", argv[0]);
+        return 2;
+    }
+    size_t context = (argc > 3) ? (size_t)atol(argv[3]) : DIFF_CONTEXT;
+
+    size_t count_a, count_b;
+    const trace_record_t *a = trace_map(argv[1], &count_a);
+    if (a == NULL) {
+        printf("error: Couldn't map trace %s\n", argv[1]);
+        return 2;
+    }
+    const trace_record_t *b = trace_map(argv[2], &count_b);
+    if (b == NULL) {
+        printf("error: Couldn't map trace %s\n", argv[2]);
+        trace_unmap(a, count_a);
+        return 2;
+    }
+
+    size_t n = (count_a < count_b) ? count_a : count_b;
+    size_t first = diff_first_block(a, b, n);
+    if (first < n) {
+        size_t len = (n - first < DIFF_BLOCK) ? n - first : DIFF_BLOCK;
+        first += diff_first_record(&a[first], &b[first], len);
+    }
+
+    if (first == n && count_a == count_b) {
+        printf("traces match (%zu records)\n", n);
+        trace_unmap(a, count_a);
+        trace_unmap(b, count_b);
+        return 0;
+    }
+
+    static uint8_t mem[TRACE_MEM_SIZE];
+    if (first == n) {
+        printf("traces match for %zu records, %s has %zu more\n", n,
+               (count_a > count_b) ? argv[1] : argv[2],
+               (count_a > count_b) ? count_a - n : count_b - n);
+    } else {
+        printf("first divergence at record %zu\n", first);
+    }
+
+    /* Shared history, then both sides from the divergence on */
+    for (size_t i = (first > context) ? first - context : 0; i < first; i++) {
+        printf("  ");
+        trace_print(&a[i], mem);
+    }
+    for (size_t i = first; i < first + context + 1; i++) {
+        if (i < count_a) {
+            printf("< ");
+            trace_print(&a[i], mem);
+        }
+        if (i < count_b) {
+            printf("> ");
+            trace_print(&b[i], mem);
+        }
+        if (i < count_a && i < count_b &&
+            memcmp(&a[i], &b[i], sizeof(trace_record_t)) != 0) {
+            diff_print_deltas(&a[i], &b[i]);
+        }
+    }
+
+    trace_unmap(a, count_a);
+    trace_unmap(b, count_b);
+    return 1;
+}
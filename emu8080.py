@@ -0,0 +1,228 @@
+"""Python bindings of the batched environment API (8080_lib.c).
+
+The library is loaded with ctypes, which releases the GIL around each call,
+so other Python threads run while instances are emulated. A step is a
+single call whatever the number of frames it runs.
+
+Nothing is copied between Python and the emulator: the memory of each
+instance is a NumPy view (video RAM included), and steps write the frames
+and observations into arrays allocated once by Env.
+
+    gcc -O2 -shared -fPIC -pthread 8080_lib.c -o lib8080.so
+
+    env = emu8080.Env("ROM", instances=64, scale=2)
+    actions = numpy.zeros((64, 2), numpy.uint8)  # Port 1 and 2 bits
+    frames, obs = env.step(actions, frames_per_step=4)
+"""
+
+import ctypes
+import os
+
+import numpy
+
+ABI_VERSION = 1
+
+# Columns of the observations
+OBS_SCORE = 0  # Score of player 1
+OBS_SHIPS = 1  # Ships left to player 1
+
+# Bits of input port 1
+COIN = 0x01
+START_1P = 0x04
+FIRE = 0x10
+LEFT = 0x20
+RIGHT = 0x40
+
+_u8_p = ctypes.POINTER(ctypes.c_uint8)
+_i32_p = ctypes.POINTER(ctypes.c_int32)
+_int_p = ctypes.POINTER(ctypes.c_int)
+
+# Argument and result types of the lib_* functions
+_PROTOTYPES = {
+    "lib_abi_version": (ctypes.c_int, []),
+    "lib_load_rom": (ctypes.c_int, [ctypes.c_char_p, _u8_p]),
+    "lib_rom_size": (ctypes.c_int, []),
+    "lib_memory_size": (ctypes.c_int, []),
+    "lib_vram_offset": (ctypes.c_int, []),
+    "lib_vram_size": (ctypes.c_int, []),
+    "lib_new": (ctypes.c_void_p,
+                [_u8_p, ctypes.c_int, ctypes.c_int, ctypes.c_int]),
+    "lib_free": (None, [ctypes.c_void_p]),
+    "lib_instances": (ctypes.c_int, [ctypes.c_void_p]),
+    "lib_frame_width": (ctypes.c_int, [ctypes.c_void_p]),
+    "lib_frame_height": (ctypes.c_int, [ctypes.c_void_p]),
+    "lib_obs_size": (ctypes.c_int, []),
+    "lib_memory": (_u8_p, [ctypes.c_void_p, ctypes.c_int]),
+    "lib_cycles": (ctypes.c_int64, [ctypes.c_void_p, ctypes.c_int]),
+    "lib_reset": (ctypes.c_int, [ctypes.c_void_p, ctypes.c_int]),
+    "lib_step": (ctypes.c_int,
+                 [ctypes.c_void_p, _int_p, ctypes.c_int, _u8_p,
+                  ctypes.c_int, _u8_p, _i32_p]),
+    "lib_render": (ctypes.c_int, [ctypes.c_void_p, ctypes.c_int, _u8_p]),
+    "lib_observe": (ctypes.c_int, [ctypes.c_void_p, ctypes.c_int, _i32_p]),
+}
+
+
+def load_library(path=None):
+    """Loads the library, from $LIB8080 or next to this file by default."""
+    if path is None:
+        path = os.environ.get("LIB8080") or os.path.join(
+            os.path.dirname(os.path.abspath(__file__)), "lib8080.so")
+    lib = ctypes.CDLL(path)
+    for name, (restype, argtypes) in _PROTOTYPES.items():
+        function = getattr(lib, name)
+        function.restype = restype
+        function.argtypes = argtypes
+    if lib.lib_abi_version() != ABI_VERSION:
+        raise OSError("%s: ABI version %d, expected %d" %
+                      (path, lib.lib_abi_version(), ABI_VERSION))
+    return lib
+
+
+def _pointer(array, pointer_type):
+    """Pointer to the data of an array, None for no array."""
+    if array is None:
+        return None
+    return array.ctypes.data_as(pointer_type)
+
+
+class Env:
+    """Space Invaders instances stepped in batches on a pool of threads.
+
+    Attributes:
+        frames: frames of the last step, (instances, height, width) uint8,
+                each pixel the share of lit pixels in its square from 0 to
+                255. Row k holds the frame of the k-th instance of the batch.
+        obs:    observations of the last step, (instances, 2) int32, see
+                OBS_SCORE and OBS_SHIPS. Row k as for frames.
+    """
+
+    def __init__(self, rom="ROM", instances=1, threads=None, scale=2,
+                 lib=None):
+        """Creates instances at their power on state.
+
+        Args:
+            rom:       directory of the invaders.[h,g,f,e] ROM files, or
+                       the ROM image as bytes
+            instances: number of instances
+            threads:   threads stepping a batch, the CPUs by default
+            scale:     downsampling factor of the frames: 1, 2, 4 or 8
+            lib:       library returned by load_library
+        """
+        self._env = None
+        self.lib = lib or load_library()
+        image = numpy.zeros(self.lib.lib_rom_size(), numpy.uint8)
+        if isinstance(rom, (bytes, bytearray)):
+            image[:len(rom)] = numpy.frombuffer(rom, numpy.uint8)
+        elif self.lib.lib_load_rom(os.fsencode(rom),
+                                   _pointer(image, _u8_p)) < 0:
+            raise OSError("Couldn't load the ROM from %s" % rom)
+
+        if threads is None:
+            threads = min(os.cpu_count() or 1, instances, 64)
+        self._env = self.lib.lib_new(_pointer(image, _u8_p), instances,
+                                     threads, scale)
+        if not self._env:
+            raise ValueError("Couldn't create %d instances at scale %d" %
+                             (instances, scale))
+
+        self.instances = instances
+        self.width = self.lib.lib_frame_width(self._env)
+        self.height = self.lib.lib_frame_height(self._env)
+        self.frames = numpy.zeros((instances, self.height, self.width),
+                                  numpy.uint8)
+        self.obs = numpy.zeros((instances, self.lib.lib_obs_size()),
+                               numpy.int32)
+        self._all = numpy.arange(instances, dtype=numpy.intc)
+        self._frames_p = _pointer(self.frames, _u8_p)
+        self._obs_p = _pointer(self.obs, _i32_p)
+        self._all_p = _pointer(self._all, _int_p)
+
+        # Views of the memory of each instance, which never moves
+        size = self.lib.lib_memory_size()
+        vram = self.lib.lib_vram_offset()
+        self.memory = [
+            numpy.ctypeslib.as_array(self.lib.lib_memory(self._env, i),
+                                     (size,))
+            for i in range(instances)
+        ]
+        self.vram = [
+            m[vram:vram + self.lib.lib_vram_size()] for m in self.memory
+        ]
+
+    def close(self):
+        """Stops the threads and releases the instances. The views of their
+        memory must not be used afterwards."""
+        if self._env:
+            self.lib.lib_free(self._env)
+            self._env = None
+            self.memory = self.vram = []
+
+    def __del__(self):
+        self.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def step(self, actions, frames_per_step=1, render=True, batch=None):
+        """Steps a batch of instances: each one holds its action for
+        frames_per_step frames.
+
+        Args:
+            actions:         (n, 2) uint8, the bits of input ports 1 and 2
+                             of each instance of the batch
+            frames_per_step: frames emulated per step
+            render:          False to leave the frames out, see render
+            batch:           indices of the instances to step, all
+                             different, all of them by default
+
+        Returns:
+            frames, obs: views of the first n rows of self.frames (None if
+            not rendered) and self.obs, overwritten by the next step.
+        """
+        if batch is None:
+            n, batch_p = self.instances, self._all_p
+        else:
+            batch = numpy.ascontiguousarray(batch, numpy.intc)
+            n, batch_p = len(batch), _pointer(batch, _int_p)
+        actions = numpy.ascontiguousarray(actions, numpy.uint8)
+        if actions.size != 2 * n or n > self.instances:
+            raise ValueError("Expected %d actions of 2 ports" % n)
+        if self.lib.lib_step(self._env, batch_p, n,
+                             _pointer(actions, _u8_p), frames_per_step,
+                             self._frames_p if render else None,
+                             self._obs_p) < 0:
+            raise ValueError("Invalid batch or frames per step")
+        return (self.frames[:n] if render else None), self.obs[:n]
+
+    def render(self, i, out=None):
+        """Downsamples the current screen of instance i into out, a
+        (height, width) uint8 array, by default self.frames[i]."""
+        if out is None:
+            out = self.frames[i]
+        elif (out.shape != (self.height, self.width) or
+              out.dtype != numpy.uint8 or not out.flags.c_contiguous):
+            raise ValueError("Expected a (%d, %d) uint8 C array" %
+                             (self.height, self.width))
+        if self.lib.lib_render(self._env, i, _pointer(out, _u8_p)) < 0:
+            raise IndexError(i)
+        return out
+
+    def observe(self, i):
+        """Observation vector of instance i."""
+        obs = numpy.zeros(self.lib.lib_obs_size(), numpy.int32)
+        if self.lib.lib_observe(self._env, i, _pointer(obs, _i32_p)) < 0:
+            raise IndexError(i)
+        return obs
+
+    def reset(self, i):
+        """Resets instance i to the power on state."""
+        if self.lib.lib_reset(self._env, i) < 0:
+            raise IndexError(i)
+
+    def cycles(self, i):
+        """CPU cycles instance i ran since its last reset."""
+        return self.lib.lib_cycles(self._env, i)